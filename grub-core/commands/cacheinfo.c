@@ -30,19 +30,21 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
     int argc __attribute__ ((unused)),
     char *argv[] __attribute__ ((unused)))
 {
-  unsigned long hits, misses;
+  unsigned long hits, misses, evictions;
 
-  grub_disk_cache_get_performance (&hits, &misses);
+  grub_disk_cache_get_performance (&hits, &misses, &evictions);
   if (hits + misses)
     {
       unsigned long ratio = hits * 10000 / (hits + misses);
       grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu, evictions = %lu\n"), hits,
+		    ratio / 100, ratio % 100, misses, evictions);
     }
   else
     grub_printf ("%s\n", _("No disk cache statistics available\n"));    
+  grub_printf_ (N_("Disk cache size: %u sets of %u entries\n"),
+		grub_disk_cache_sets, GRUB_DISK_CACHE_WAYS);
 
  return 0;
 }
@@ -0,0 +1,185 @@
+/* cryptobench.c - measure the speed of decrypting disks */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/cryptodisk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define DEFAULT_SIZE	1024
+#define BENCH_MS	1000
+
+static const struct grub_arg_option options[] =
+  {
+    {"size", 's', 0, N_("Decrypt SIZE KiB at a time (default 1024)."),
+     N_("SIZE"), ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static const struct
+{
+  const char *name;
+  grub_cryptodisk_mode_t mode;
+  grub_size_t keysize;
+} configs[] =
+  {
+    {"aes-xts-plain64, 256-bit key", GRUB_CRYPTODISK_MODE_XTS, 32},
+    {"aes-xts-plain64, 512-bit key", GRUB_CRYPTODISK_MODE_XTS, 64},
+    {"aes-cbc-plain64, 256-bit key", GRUB_CRYPTODISK_MODE_CBC, 32}
+  };
+
+/* Decrypt BUF over and over for a while and return the speed in KiB/s.  */
+static grub_uint64_t
+bench (grub_cryptodisk_t dev, grub_uint8_t *buf, grub_size_t size)
+{
+  grub_uint64_t start, now, total = 0;
+
+  start = grub_get_time_ms ();
+  do
+    {
+      grub_cryptodisk_decrypt (dev, buf, size, total >> GRUB_DISK_SECTOR_BITS);
+      total += size;
+      now = grub_get_time_ms ();
+    }
+  while (now - start < BENCH_MS);
+
+  return grub_divmod64 (total * 1000 / 1024, now - start, 0);
+}
+
+static void
+print_speed (const char *what, grub_uint64_t kib)
+{
+  grub_printf ("  %-10s %" PRIuGRUB_UINT64_T ".%02u MiB/s\n", what,
+	       kib / 1024, (unsigned) ((kib % 1024) * 100 / 1024));
+}
+
+static grub_err_t
+grub_cmd_cryptobench (grub_extcmd_context_t ctxt,
+		      int argc __attribute__ ((unused)),
+		      char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  const gcry_cipher_spec_t *aes;
+  grub_uint8_t key[64];
+  grub_uint8_t *buf, *expected;
+  grub_size_t size = DEFAULT_SIZE;
+  unsigned i, j;
+
+  if (state[0].set)
+    size = grub_strtoul (state[0].arg, 0, 0);
+  if (grub_errno)
+    return grub_errno;
+  if (size == 0 || size > (1 << 20))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid size"));
+  size *= 1024;
+
+  aes = grub_crypto_lookup_cipher_by_name ("aes");
+  if (!aes)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "cipher aes isn't available");
+
+  buf = grub_malloc (size);
+  expected = grub_malloc (size);
+  if (!buf || !expected)
+    goto fail;
+
+  for (j = 0; j < sizeof (key); j++)
+    key[j] = j * 7 + 1;
+
+  for (i = 0; i < ARRAY_SIZE (configs); i++)
+    {
+      grub_cryptodisk_t dev;
+      gcry_err_code_t gcry_err = GPG_ERR_NO_ERROR;
+      int aes_hw;
+
+      dev = grub_zalloc (sizeof (*dev));
+      if (!dev)
+	goto fail;
+      dev->cipher = grub_crypto_cipher_open (aes);
+      if (configs[i].mode == GRUB_CRYPTODISK_MODE_XTS)
+	dev->secondary_cipher = grub_crypto_cipher_open (aes);
+      dev->mode = configs[i].mode;
+      dev->mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN64;
+      dev->log_sector_size = GRUB_DISK_SECTOR_BITS;
+      if (!dev->cipher
+	  || (dev->mode == GRUB_CRYPTODISK_MODE_XTS && !dev->secondary_cipher))
+	gcry_err = GPG_ERR_OUT_OF_MEMORY;
+      if (!gcry_err)
+	gcry_err = grub_cryptodisk_setkey (dev, key, configs[i].keysize);
+      if (gcry_err)
+	{
+	  grub_crypto_cipher_close (dev->cipher);
+	  grub_crypto_cipher_close (dev->secondary_cipher);
+	  grub_free (dev);
+	  grub_crypto_gcry_error (gcry_err);
+	  goto fail;
+	}
+
+      grub_printf ("%s:\n", configs[i].name);
+
+      for (j = 0; j < size; j++)
+	buf[j] = j * 13 + (j >> 8);
+      aes_hw = dev->aes_hw;
+      dev->aes_hw = 0;
+      grub_cryptodisk_decrypt (dev, buf, size, 0);
+      grub_memcpy (expected, buf, size);
+      print_speed ("software", bench (dev, buf, size));
+
+      if (aes_hw)
+	{
+	  dev->aes_hw = 1;
+	  for (j = 0; j < size; j++)
+	    buf[j] = j * 13 + (j >> 8);
+	  grub_cryptodisk_decrypt (dev, buf, size, 0);
+	  if (grub_memcmp (buf, expected, size) != 0)
+	    grub_printf ("  the CPU and software results differ\n");
+	  print_speed ("CPU", bench (dev, buf, size));
+	}
+      else
+	grub_printf ("  %-10s not available\n", "CPU");
+
+      grub_crypto_cipher_close (dev->cipher);
+      grub_crypto_cipher_close (dev->secondary_cipher);
+      grub_free (dev);
+    }
+
+ fail:
+  grub_free (buf);
+  grub_free (expected);
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(cryptobench)
+{
+  cmd = grub_register_extcmd ("cryptobench", grub_cmd_cryptobench, 0,
+			      N_("[-s SIZE]"),
+			      N_("Measure the speed of decrypting disks."),
+			      options);
+}
+
+GRUB_MOD_FINI(cryptobench)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -0,0 +1,139 @@
+/* lsmemstats.c - list heap usage per allocation site  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"count", 'n', 0, N_("Show the N sites with the highest peak usage [default=20]."),
+     N_("N"), ARG_TYPE_INT},
+    {"live", 'l', 0, N_("Sort by live instead of peak usage."), 0, 0},
+    {"csv", 'c', 0, N_("Print all fields as comma separated values."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+struct lsmemstats_ctx
+{
+  const struct grub_mm_site **top;
+  unsigned count;
+  unsigned used;
+  int by_live;
+};
+
+/* Helper for grub_cmd_lsmemstats.  Keep the COUNT biggest sites sorted.  */
+static int
+lsmemstats_hook (const struct grub_mm_site *site, void *data)
+{
+  struct lsmemstats_ctx *ctx = data;
+  grub_size_t key = ctx->by_live ? site->live : site->peak;
+  unsigned i;
+
+  i = ctx->used < ctx->count ? ctx->used++ : ctx->count;
+  for (; i > 0; i--)
+    {
+      const struct grub_mm_site *prev = ctx->top[i - 1];
+
+      if ((ctx->by_live ? prev->live : prev->peak) >= key)
+	break;
+      if (i < ctx->count)
+	ctx->top[i] = prev;
+    }
+  if (i < ctx->count)
+    ctx->top[i] = site;
+
+  return 0;
+}
+
+static grub_err_t
+grub_cmd_lsmemstats (grub_extcmd_context_t ctxt,
+		     int argc __attribute__ ((unused)),
+		     char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct lsmemstats_ctx ctx = {
+    .count = 20,
+    .used = 0,
+    .by_live = state[1].set
+  };
+  unsigned i;
+
+  if (state[0].set)
+    {
+      ctx.count = grub_strtoul (state[0].arg, 0, 0);
+      if (grub_errno)
+	return grub_errno;
+    }
+  if (! ctx.count)
+    return GRUB_ERR_NONE;
+
+  ctx.top = grub_malloc (ctx.count * sizeof (ctx.top[0]));
+  if (! ctx.top)
+    return grub_errno;
+
+  grub_mm_site_iterate (lsmemstats_hook, &ctx);
+
+  if (state[2].set)
+    grub_printf ("file,line,live,peak,allocs,frees\n");
+  else
+    grub_printf ("%-32s %10s %10s %9s %9s\n", "site", "live", "peak",
+		 "allocs", "frees");
+
+  for (i = 0; i < ctx.used; i++)
+    {
+      const struct grub_mm_site *site = ctx.top[i];
+
+      if (state[2].set)
+	grub_printf ("%s,%d,%" PRIuGRUB_SIZE ",%" PRIuGRUB_SIZE ",%lu,%lu\n",
+		     site->file, site->line, site->live, site->peak,
+		     site->allocs, site->frees);
+      else
+	{
+	  char name[sizeof (site->file) + 12];
+
+	  grub_snprintf (name, sizeof (name), "%s:%d", site->file, site->line);
+	  grub_printf ("%-32s %10" PRIuGRUB_SIZE " %10" PRIuGRUB_SIZE
+		       " %9lu %9lu\n", name, site->live, site->peak,
+		       site->allocs, site->frees);
+	}
+    }
+
+  grub_free (ctx.top);
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(lsmemstats)
+{
+  cmd = grub_register_extcmd ("lsmemstats", grub_cmd_lsmemstats, 0,
+			      N_("[-n N] [-l] [-c]"),
+			      N_("List heap usage per allocation site."),
+			      options);
+}
+
+GRUB_MOD_FINI(lsmemstats)
+{
+  grub_unregister_extcmd (cmd);
+}
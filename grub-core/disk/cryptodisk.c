@@ -57,18 +57,16 @@ static grub_uint8_t last_cryptodisk_id = 0;
 static void
 gf_mul_x (grub_uint8_t *g)
 {
-  int over = 0, over2 = 0;
-  unsigned j;
+  grub_uint64_t lo = grub_le_to_cpu64 (grub_get_unaligned64 (g));
+  grub_uint64_t hi = grub_le_to_cpu64 (grub_get_unaligned64 (g + 8));
+  grub_uint64_t over = hi >> 63;
 
-  for (j = 0; j < GRUB_CRYPTODISK_GF_BYTES; j++)
-    {
-      over2 = !!(g[j] & 0x80);
-      g[j] <<= 1;
-      g[j] |= over;
-      over = over2;
-    }
-  if (over)
-    g[0] ^= GF_POLYNOM;
+  COMPILE_TIME_ASSERT (GRUB_CRYPTODISK_GF_BYTES == 16);
+
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (over * GF_POLYNOM);
+  grub_set_unaligned64 (g, grub_cpu_to_le64 (lo));
+  grub_set_unaligned64 (g + 8, grub_cpu_to_le64 (hi));
 }
 
 
@@ -309,6 +307,13 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
       switch (dev->mode)
 	{
 	case GRUB_CRYPTODISK_MODE_CBC:
+	  if (dev->aes_hw)
+	    {
+	      grub_cryptodisk_aes_cbc (&dev->aes, data + i,
+				       (1U << dev->log_sector_size),
+				       (grub_uint8_t *) iv, do_encrypt);
+	      break;
+	    }
 	  if (do_encrypt)
 	    err = grub_crypto_cbc_encrypt (dev->cipher, data + i, data + i,
 					   (1U << dev->log_sector_size), iv);
@@ -330,32 +335,49 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    return err;
 	  break;
 	case GRUB_CRYPTODISK_MODE_XTS:
+	  if (dev->aes_hw)
+	    {
+	      grub_cryptodisk_aes_xts (&dev->aes, data + i,
+				       (1U << dev->log_sector_size),
+				       (grub_uint8_t *) iv, do_encrypt);
+	      break;
+	    }
 	  {
 	    unsigned j;
+	    grub_uint32_t tweak[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
+
 	    err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
 					   dev->cipher->cipher->blocksize);
 	    if (err)
 	      return err;
-	    
+
+	    /* XOR the tweaks in before and after doing the whole sector,
+	       rather than calling the cipher for each block.  */
+	    grub_memcpy (tweak, iv, dev->cipher->cipher->blocksize);
 	    for (j = 0; j < (1U << dev->log_sector_size);
 		 j += dev->cipher->cipher->blocksize)
 	      {
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
-		if (do_encrypt)
-		  err = grub_crypto_ecb_encrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
-		else
-		  err = grub_crypto_ecb_decrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
-		if (err)
-		  return err;
 		grub_crypto_xor (data + i + j, data + i + j, iv,
 				 dev->cipher->cipher->blocksize);
 		gf_mul_x ((grub_uint8_t *) iv);
 	      }
+	    if (do_encrypt)
+	      err = grub_crypto_ecb_encrypt (dev->cipher, data + i,
+					     data + i,
+					     (1U << dev->log_sector_size));
+	    else
+	      err = grub_crypto_ecb_decrypt (dev->cipher, data + i,
+					     data + i,
+					     (1U << dev->log_sector_size));
+	    if (err)
+	      return err;
+	    for (j = 0; j < (1U << dev->log_sector_size);
+		 j += dev->cipher->cipher->blocksize)
+	      {
+		grub_crypto_xor (data + i + j, data + i + j, tweak,
+				 dev->cipher->cipher->blocksize);
+		gf_mul_x ((grub_uint8_t *) tweak);
+	      }
 	  }
 	  break;
 	case GRUB_CRYPTODISK_MODE_LRW:
@@ -446,6 +468,16 @@ grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t ke
 	return err;
     }
 
+  /* Let the CPU do AES in the modes it has a fast path for, if it can.  */
+  dev->aes_hw = 0;
+  if (grub_strncmp (dev->cipher->cipher->name, "AES", 3) == 0
+      && dev->cipher->cipher->blocksize == 16
+      && (dev->mode == GRUB_CRYPTODISK_MODE_XTS
+	  || dev->mode == GRUB_CRYPTODISK_MODE_CBC))
+    dev->aes_hw = grub_cryptodisk_aes_setkey (&dev->aes, key, real_keysize,
+					      dev->mode == GRUB_CRYPTODISK_MODE_XTS
+					      ? key + real_keysize : NULL);
+
   if (dev->mode == GRUB_CRYPTODISK_MODE_LRW)
     {
       unsigned i;
@@ -0,0 +1,579 @@
+/* cryptodisk_aes.c - AES with the instructions of the CPU */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/cryptodisk.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+
+/* Whole sectors are done this many blocks at a time, to keep the AES
+   units of the CPU busy.  */
+#define AES_WIDTH	8
+#define AES_BLOCK	16
+
+/* The vector registers are left alone by the compiler when it is told
+   not to use them, and must not be named as clobbered then.  */
+#if defined (__x86_64__)
+#define AES_HW	1
+#ifdef __SSE__
+#define AES_CLOBBERS "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",	\
+    "xmm6", "xmm7", "xmm8", "xmm9",
+#else
+#define AES_CLOBBERS
+#endif
+#elif defined (__aarch64__) && !defined (GRUB_MACHINE_EMU) \
+  && !defined (GRUB_UTIL)
+#define AES_HW	1
+#ifdef __ARM_NEON
+#define AES_CLOBBERS "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",	\
+    "v16", "v17", "v18", "v19",
+#else
+#define AES_CLOBBERS
+#endif
+#endif
+
+#ifdef AES_HW
+
+static const grub_uint8_t sbox[256] =
+  {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+    0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+    0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+    0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+    0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+    0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+    0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+    0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+    0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+    0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+    0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+    0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+  };
+
+static const grub_uint8_t zero[AES_WIDTH * AES_BLOCK];
+
+static grub_uint8_t
+gf_mul (grub_uint8_t a, grub_uint8_t b)
+{
+  grub_uint8_t r = 0;
+
+  for (; b; b >>= 1)
+    {
+      if (b & 1)
+	r ^= a;
+      a = (a << 1) ^ ((a & 0x80) ? 0x1b : 0);
+    }
+  return r;
+}
+
+/* The key schedule of FIPS-197, with the round keys in the byte order
+   the AES instructions take them.  */
+static void
+expand_key (grub_uint8_t (*w)[AES_BLOCK], const grub_uint8_t *key,
+	    unsigned nk, unsigned rounds)
+{
+  grub_uint8_t *b = w[0];
+  grub_uint8_t rcon = 1;
+  unsigned i;
+
+  grub_memcpy (b, key, 4 * nk);
+  for (i = nk; i < 4 * (rounds + 1); i++)
+    {
+      grub_uint8_t t[4];
+
+      grub_memcpy (t, b + 4 * (i - 1), 4);
+      if (i % nk == 0)
+	{
+	  grub_uint8_t t0 = t[0];
+
+	  t[0] = sbox[t[1]] ^ rcon;
+	  t[1] = sbox[t[2]];
+	  t[2] = sbox[t[3]];
+	  t[3] = sbox[t0];
+	  rcon = gf_mul (rcon, 2);
+	}
+      else if (nk > 6 && i % nk == 4)
+	{
+	  t[0] = sbox[t[0]];
+	  t[1] = sbox[t[1]];
+	  t[2] = sbox[t[2]];
+	  t[3] = sbox[t[3]];
+	}
+      b[4 * i] = b[4 * (i - nk)] ^ t[0];
+      b[4 * i + 1] = b[4 * (i - nk) + 1] ^ t[1];
+      b[4 * i + 2] = b[4 * (i - nk) + 2] ^ t[2];
+      b[4 * i + 3] = b[4 * (i - nk) + 3] ^ t[3];
+    }
+}
+
+/* The round keys of the equivalent inverse cipher, which both aesdec on
+   x86 and aesd/aesimc on ARM use.  */
+static void
+invert_key (grub_uint8_t (*dec)[AES_BLOCK],
+	    grub_uint8_t (*enc)[AES_BLOCK], unsigned rounds)
+{
+  unsigned r, c;
+
+  grub_memcpy (dec[0], enc[rounds], AES_BLOCK);
+  grub_memcpy (dec[rounds], enc[0], AES_BLOCK);
+  for (r = 1; r < rounds; r++)
+    for (c = 0; c < AES_BLOCK; c += 4)
+      {
+	const grub_uint8_t *s = enc[rounds - r] + c;
+	grub_uint8_t *d = dec[r] + c;
+
+	d[0] = gf_mul (s[0], 14) ^ gf_mul (s[1], 11)
+	  ^ gf_mul (s[2], 13) ^ gf_mul (s[3], 9);
+	d[1] = gf_mul (s[0], 9) ^ gf_mul (s[1], 14)
+	  ^ gf_mul (s[2], 11) ^ gf_mul (s[3], 13);
+	d[2] = gf_mul (s[0], 13) ^ gf_mul (s[1], 9)
+	  ^ gf_mul (s[2], 14) ^ gf_mul (s[3], 11);
+	d[3] = gf_mul (s[0], 11) ^ gf_mul (s[1], 13)
+	  ^ gf_mul (s[2], 9) ^ gf_mul (s[3], 14);
+      }
+}
+
+#if defined (__x86_64__)
+
+static int
+aes_hw_available (void)
+{
+  grub_uint32_t a, b, c, d;
+
+  /* Unlike grub_cpuid this keeps all of %rbx.  */
+  asm volatile ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (1));
+  return !!(c & (1 << 25));
+}
+
+#define AES_ROUND8(op)				\
+  op " %%xmm8, %%xmm0\n\t"			\
+  op " %%xmm8, %%xmm1\n\t"			\
+  op " %%xmm8, %%xmm2\n\t"			\
+  op " %%xmm8, %%xmm3\n\t"			\
+  op " %%xmm8, %%xmm4\n\t"			\
+  op " %%xmm8, %%xmm5\n\t"			\
+  op " %%xmm8, %%xmm6\n\t"			\
+  op " %%xmm8, %%xmm7\n\t"
+
+#define AES_XOR8(ptr)				\
+  "movdqu 0(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm0\n\t"			\
+  "movdqu 16(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm1\n\t"			\
+  "movdqu 32(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm2\n\t"			\
+  "movdqu 48(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm3\n\t"			\
+  "movdqu 64(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm4\n\t"			\
+  "movdqu 80(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm5\n\t"			\
+  "movdqu 96(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm6\n\t"			\
+  "movdqu 112(%[" ptr "]), %%xmm9\n\t"		\
+  "pxor %%xmm9, %%xmm7\n\t"
+
+/* OUT = cipher (IN ^ PRE) ^ POST for AES_WIDTH blocks.  */
+#define AES_CRYPT8(round, last)						\
+  asm volatile ("movdqu 0(%[in]), %%xmm0\n\t"				\
+		"movdqu 16(%[in]), %%xmm1\n\t"				\
+		"movdqu 32(%[in]), %%xmm2\n\t"				\
+		"movdqu 48(%[in]), %%xmm3\n\t"				\
+		"movdqu 64(%[in]), %%xmm4\n\t"				\
+		"movdqu 80(%[in]), %%xmm5\n\t"				\
+		"movdqu 96(%[in]), %%xmm6\n\t"				\
+		"movdqu 112(%[in]), %%xmm7\n\t"				\
+		AES_XOR8 ("pre")					\
+		"movdqu (%[k]), %%xmm8\n\t"				\
+		AES_ROUND8 ("pxor")					\
+		"1:\n\t"						\
+		"addq $16, %[k]\n\t"					\
+		"movdqu (%[k]), %%xmm8\n\t"				\
+		AES_ROUND8 (round)					\
+		"decl %[n]\n\t"						\
+		"jnz 1b\n\t"						\
+		"movdqu 16(%[k]), %%xmm8\n\t"				\
+		AES_ROUND8 (last)					\
+		AES_XOR8 ("post")					\
+		"movdqu %%xmm0, 0(%[out])\n\t"				\
+		"movdqu %%xmm1, 16(%[out])\n\t"				\
+		"movdqu %%xmm2, 32(%[out])\n\t"				\
+		"movdqu %%xmm3, 48(%[out])\n\t"				\
+		"movdqu %%xmm4, 64(%[out])\n\t"				\
+		"movdqu %%xmm5, 80(%[out])\n\t"				\
+		"movdqu %%xmm6, 96(%[out])\n\t"				\
+		"movdqu %%xmm7, 112(%[out])"				\
+		: [k] "+r" (k), [n] "+r" (n)				\
+		: [in] "r" (in), [out] "r" (out), [pre] "r" (pre),	\
+		  [post] "r" (post)					\
+		: AES_CLOBBERS "memory", "cc")
+
+#define AES_CRYPT1(round, last)						\
+  asm volatile ("movdqu (%[in]), %%xmm0\n\t"				\
+		"movdqu (%[pre]), %%xmm9\n\t"				\
+		"pxor %%xmm9, %%xmm0\n\t"				\
+		"movdqu (%[k]), %%xmm8\n\t"				\
+		"pxor %%xmm8, %%xmm0\n\t"				\
+		"1:\n\t"						\
+		"addq $16, %[k]\n\t"					\
+		"movdqu (%[k]), %%xmm8\n\t"				\
+		round " %%xmm8, %%xmm0\n\t"				\
+		"decl %[n]\n\t"						\
+		"jnz 1b\n\t"						\
+		"movdqu 16(%[k]), %%xmm8\n\t"				\
+		last " %%xmm8, %%xmm0\n\t"				\
+		"movdqu (%[post]), %%xmm9\n\t"				\
+		"pxor %%xmm9, %%xmm0\n\t"				\
+		"movdqu %%xmm0, (%[out])"				\
+		: [k] "+r" (k), [n] "+r" (n)				\
+		: [in] "r" (in), [out] "r" (out), [pre] "r" (pre),	\
+		  [post] "r" (post)					\
+		: AES_CLOBBERS "memory", "cc")
+
+static void
+aes_crypt8 (const grub_uint8_t (*k)[AES_BLOCK], unsigned rounds,
+	    int do_encrypt, grub_uint8_t *out, const grub_uint8_t *in,
+	    const grub_uint8_t *pre, const grub_uint8_t *post)
+{
+  unsigned n = rounds - 1;
+
+  if (do_encrypt)
+    AES_CRYPT8 ("aesenc", "aesenclast");
+  else
+    AES_CRYPT8 ("aesdec", "aesdeclast");
+}
+
+static void
+aes_crypt1 (const grub_uint8_t (*k)[AES_BLOCK], unsigned rounds,
+	    int do_encrypt, grub_uint8_t *out, const grub_uint8_t *in,
+	    const grub_uint8_t *pre, const grub_uint8_t *post)
+{
+  unsigned n = rounds - 1;
+
+  if (do_encrypt)
+    AES_CRYPT1 ("aesenc", "aesenclast");
+  else
+    AES_CRYPT1 ("aesdec", "aesdeclast");
+}
+
+#else
+
+static int
+aes_hw_available (void)
+{
+  grub_uint64_t isar0;
+
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  return ((isar0 >> 4) & 0xf) >= 1;
+}
+
+#define AES_ROUND8(op, mix)			\
+  op " v0.16b, v16.16b\n\t"			\
+  mix " v0.16b, v0.16b\n\t"			\
+  op " v1.16b, v16.16b\n\t"			\
+  mix " v1.16b, v1.16b\n\t"			\
+  op " v2.16b, v16.16b\n\t"			\
+  mix " v2.16b, v2.16b\n\t"			\
+  op " v3.16b, v16.16b\n\t"			\
+  mix " v3.16b, v3.16b\n\t"			\
+  op " v4.16b, v16.16b\n\t"			\
+  mix " v4.16b, v4.16b\n\t"			\
+  op " v5.16b, v16.16b\n\t"			\
+  mix " v5.16b, v5.16b\n\t"			\
+  op " v6.16b, v16.16b\n\t"			\
+  mix " v6.16b, v6.16b\n\t"			\
+  op " v7.16b, v16.16b\n\t"			\
+  mix " v7.16b, v7.16b\n\t"
+
+#define AES_LAST8(op)				\
+  op " v0.16b, v16.16b\n\t"			\
+  op " v1.16b, v16.16b\n\t"			\
+  op " v2.16b, v16.16b\n\t"			\
+  op " v3.16b, v16.16b\n\t"			\
+  op " v4.16b, v16.16b\n\t"			\
+  op " v5.16b, v16.16b\n\t"			\
+  op " v6.16b, v16.16b\n\t"			\
+  op " v7.16b, v16.16b\n\t"
+
+#define AES_EOR8(reg)				\
+  "eor v0.16b, v0.16b, " reg "\n\t"		\
+  "eor v1.16b, v1.16b, " reg "\n\t"		\
+  "eor v2.16b, v2.16b, " reg "\n\t"		\
+  "eor v3.16b, v3.16b, " reg "\n\t"		\
+  "eor v4.16b, v4.16b, " reg "\n\t"		\
+  "eor v5.16b, v5.16b, " reg "\n\t"		\
+  "eor v6.16b, v6.16b, " reg "\n\t"		\
+  "eor v7.16b, v7.16b, " reg "\n\t"
+
+#define AES_XOR8(ptr)						\
+  "ld1 {v16.16b, v17.16b, v18.16b, v19.16b}, [%[" ptr "]]\n\t"	\
+  "eor v0.16b, v0.16b, v16.16b\n\t"				\
+  "eor v1.16b, v1.16b, v17.16b\n\t"				\
+  "eor v2.16b, v2.16b, v18.16b\n\t"				\
+  "eor v3.16b, v3.16b, v19.16b\n\t"				\
+  "add %[tmp], %[" ptr "], #64\n\t"				\
+  "ld1 {v16.16b, v17.16b, v18.16b, v19.16b}, [%[tmp]]\n\t"	\
+  "eor v4.16b, v4.16b, v16.16b\n\t"				\
+  "eor v5.16b, v5.16b, v17.16b\n\t"				\
+  "eor v6.16b, v6.16b, v18.16b\n\t"				\
+  "eor v7.16b, v7.16b, v19.16b\n\t"
+
+/* OUT = cipher (IN ^ PRE) ^ POST for AES_WIDTH blocks.  The first
+   ROUNDS - 1 rounds take the key before mixing, the last one is followed
+   by the last round key.  */
+#define AES_CRYPT8(round, mix)						\
+  asm volatile (".arch armv8-a+crypto\n\t"				\
+		"ld1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[in]]\n\t"	\
+		"add %[tmp], %[in], #64\n\t"				\
+		"ld1 {v4.16b, v5.16b, v6.16b, v7.16b}, [%[tmp]]\n\t"	\
+		AES_XOR8 ("pre")					\
+		"1:\n\t"						\
+		"ld1 {v16.16b}, [%[k]], #16\n\t"			\
+		AES_ROUND8 (round, mix)					\
+		"subs %w[n], %w[n], #1\n\t"				\
+		"b.ne 1b\n\t"						\
+		"ld1 {v16.16b}, [%[k]], #16\n\t"			\
+		AES_LAST8 (round)					\
+		"ld1 {v16.16b}, [%[k]]\n\t"				\
+		AES_EOR8 ("v16.16b")					\
+		AES_XOR8 ("post")					\
+		"st1 {v0.16b, v1.16b, v2.16b, v3.16b}, [%[out]]\n\t"	\
+		"add %[tmp], %[out], #64\n\t"				\
+		"st1 {v4.16b, v5.16b, v6.16b, v7.16b}, [%[tmp]]"	\
+		: [k] "+r" (k), [n] "+r" (n), [tmp] "=&r" (tmp)		\
+		: [in] "r" (in), [out] "r" (out), [pre] "r" (pre),	\
+		  [post] "r" (post)					\
+		: AES_CLOBBERS "memory", "cc")
+
+#define AES_CRYPT1(round, mix)						\
+  asm volatile (".arch armv8-a+crypto\n\t"				\
+		"ld1 {v0.16b}, [%[in]]\n\t"				\
+		"ld1 {v17.16b}, [%[pre]]\n\t"				\
+		"eor v0.16b, v0.16b, v17.16b\n\t"			\
+		"1:\n\t"						\
+		"ld1 {v16.16b}, [%[k]], #16\n\t"			\
+		round " v0.16b, v16.16b\n\t"				\
+		mix " v0.16b, v0.16b\n\t"				\
+		"subs %w[n], %w[n], #1\n\t"				\
+		"b.ne 1b\n\t"						\
+		"ld1 {v16.16b}, [%[k]], #16\n\t"			\
+		round " v0.16b, v16.16b\n\t"				\
+		"ld1 {v16.16b}, [%[k]]\n\t"				\
+		"eor v0.16b, v0.16b, v16.16b\n\t"			\
+		"ld1 {v17.16b}, [%[post]]\n\t"				\
+		"eor v0.16b, v0.16b, v17.16b\n\t"			\
+		"st1 {v0.16b}, [%[out]]"				\
+		: [k] "+r" (k), [n] "+r" (n), [tmp] "=&r" (tmp)		\
+		: [in] "r" (in), [out] "r" (out), [pre] "r" (pre),	\
+		  [post] "r" (post)					\
+		: AES_CLOBBERS "memory", "cc")
+
+static void
+aes_crypt8 (const grub_uint8_t (*k)[AES_BLOCK], unsigned rounds,
+	    int do_encrypt, grub_uint8_t *out, const grub_uint8_t *in,
+	    const grub_uint8_t *pre, const grub_uint8_t *post)
+{
+  unsigned n = rounds - 1;
+  grub_uint8_t *tmp;
+
+  if (do_encrypt)
+    AES_CRYPT8 ("aese", "aesmc");
+  else
+    AES_CRYPT8 ("aesd", "aesimc");
+}
+
+static void
+aes_crypt1 (const grub_uint8_t (*k)[AES_BLOCK], unsigned rounds,
+	    int do_encrypt, grub_uint8_t *out, const grub_uint8_t *in,
+	    const grub_uint8_t *pre, const grub_uint8_t *post)
+{
+  unsigned n = rounds - 1;
+  grub_uint8_t *tmp;
+
+  if (do_encrypt)
+    AES_CRYPT1 ("aese", "aesmc");
+  else
+    AES_CRYPT1 ("aesd", "aesimc");
+}
+
+#endif
+
+int
+grub_cryptodisk_aes_setkey (struct grub_cryptodisk_aes *aes,
+			    const grub_uint8_t *key, grub_size_t keysize,
+			    const grub_uint8_t *tweak_key)
+{
+  static int available = -1;
+
+  if (available < 0)
+    available = aes_hw_available ();
+  if (!available
+      || (keysize != 16 && keysize != 24 && keysize != 32))
+    return 0;
+
+  aes->rounds = keysize / 4 + 6;
+  expand_key (aes->enc, key, keysize / 4, aes->rounds);
+  invert_key (aes->dec, aes->enc, aes->rounds);
+  if (tweak_key)
+    expand_key (aes->tweak, tweak_key, keysize / 4, aes->rounds);
+  return 1;
+}
+
+static inline void
+xts_mul_x (grub_uint64_t *t)
+{
+  grub_uint64_t carry = t[1] >> 63;
+
+  t[1] = (t[1] << 1) | (t[0] >> 63);
+  t[0] = (t[0] << 1) ^ (carry * 0x87);
+}
+
+void
+grub_cryptodisk_aes_xts (const struct grub_cryptodisk_aes *aes,
+			 grub_uint8_t *data, grub_size_t len,
+			 const grub_uint8_t *iv, int do_encrypt)
+{
+  const grub_uint8_t (*k)[AES_BLOCK] = do_encrypt ? aes->enc : aes->dec;
+  grub_uint8_t tweaks[AES_WIDTH][AES_BLOCK];
+  grub_uint64_t t[2];
+  grub_size_t i;
+  unsigned j;
+
+  aes_crypt1 (aes->tweak, aes->rounds, 1, tweaks[0], iv, zero, zero);
+  t[0] = grub_le_to_cpu64 (grub_get_unaligned64 (tweaks[0]));
+  t[1] = grub_le_to_cpu64 (grub_get_unaligned64 (tweaks[0] + 8));
+
+  for (i = 0; i + AES_WIDTH * AES_BLOCK <= len; i += AES_WIDTH * AES_BLOCK)
+    {
+      for (j = 0; j < AES_WIDTH; j++)
+	{
+	  grub_set_unaligned64 (tweaks[j], grub_cpu_to_le64 (t[0]));
+	  grub_set_unaligned64 (tweaks[j] + 8, grub_cpu_to_le64 (t[1]));
+	  xts_mul_x (t);
+	}
+      aes_crypt8 (k, aes->rounds, do_encrypt, data + i, data + i,
+		  tweaks[0], tweaks[0]);
+    }
+
+  for (; i + AES_BLOCK <= len; i += AES_BLOCK)
+    {
+      grub_set_unaligned64 (tweaks[0], grub_cpu_to_le64 (t[0]));
+      grub_set_unaligned64 (tweaks[0] + 8, grub_cpu_to_le64 (t[1]));
+      xts_mul_x (t);
+      aes_crypt1 (k, aes->rounds, do_encrypt, data + i, data + i,
+		  tweaks[0], tweaks[0]);
+    }
+}
+
+void
+grub_cryptodisk_aes_cbc (const struct grub_cryptodisk_aes *aes,
+			 grub_uint8_t *data, grub_size_t len,
+			 const grub_uint8_t *iv, int do_encrypt)
+{
+  grub_uint8_t prev[AES_WIDTH * AES_BLOCK];
+  grub_size_t i;
+
+  grub_memcpy (prev, iv, AES_BLOCK);
+
+  /* Each block depends on the previous one.  */
+  if (do_encrypt)
+    {
+      for (i = 0; i + AES_BLOCK <= len; i += AES_BLOCK)
+	aes_crypt1 (aes->enc, aes->rounds, 1, data + i, data + i,
+		    i ? data + i - AES_BLOCK : prev, zero);
+      return;
+    }
+
+  /* Decrypting in place overwrites the ciphertext each block is XORed
+     with, so keep a copy of it shifted by one block.  */
+  for (i = 0; i + AES_WIDTH * AES_BLOCK <= len; i += AES_WIDTH * AES_BLOCK)
+    {
+      grub_uint8_t c[AES_BLOCK];
+
+      grub_memcpy (prev + AES_BLOCK, data + i,
+		   (AES_WIDTH - 1) * AES_BLOCK);
+      grub_memcpy (c, data + i + (AES_WIDTH - 1) * AES_BLOCK, AES_BLOCK);
+      aes_crypt8 (aes->dec, aes->rounds, 0, data + i, data + i,
+		  zero, prev);
+      grub_memcpy (prev, c, AES_BLOCK);
+    }
+  for (; i + AES_BLOCK <= len; i += AES_BLOCK)
+    {
+      grub_uint8_t c[AES_BLOCK];
+
+      grub_memcpy (c, data + i, AES_BLOCK);
+      aes_crypt1 (aes->dec, aes->rounds, 0, data + i, data + i,
+		  zero, prev);
+      grub_memcpy (prev, c, AES_BLOCK);
+    }
+}
+
+#else
+
+int
+grub_cryptodisk_aes_setkey (struct grub_cryptodisk_aes *aes
+			    __attribute__ ((unused)),
+			    const grub_uint8_t *key __attribute__ ((unused)),
+			    grub_size_t keysize __attribute__ ((unused)),
+			    const grub_uint8_t *tweak_key
+			    __attribute__ ((unused)))
+{
+  return 0;
+}
+
+void
+grub_cryptodisk_aes_xts (const struct grub_cryptodisk_aes *aes
+			 __attribute__ ((unused)),
+			 grub_uint8_t *data __attribute__ ((unused)),
+			 grub_size_t len __attribute__ ((unused)),
+			 const grub_uint8_t *iv __attribute__ ((unused)),
+			 int do_encrypt __attribute__ ((unused)))
+{
+}
+
+void
+grub_cryptodisk_aes_cbc (const struct grub_cryptodisk_aes *aes
+			 __attribute__ ((unused)),
+			 grub_uint8_t *data __attribute__ ((unused)),
+			 grub_size_t len __attribute__ ((unused)),
+			 const grub_uint8_t *iv __attribute__ ((unused)),
+			 int do_encrypt __attribute__ ((unused)))
+{
+}
+
+#endif
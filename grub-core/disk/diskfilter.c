@@ -24,6 +24,7 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/partition.h>
+#include <grub/time.h>
 #ifdef GRUB_UTIL
 #include <grub/i18n.h>
 #include <grub/util/misc.h>
@@ -575,6 +576,21 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* Read statistics of the member holding node K of SEG, where K wraps
+   around past the last node.  */
+static const struct grub_mirror_stats *
+node_stats (struct grub_diskfilter_segment *seg, grub_uint64_t k)
+{
+  static const struct grub_mirror_stats missing = GRUB_MIRROR_STATS_MISSING;
+
+  grub_divmod64 (k, seg->node_count, &k);
+  if (!seg->nodes[k].pv)
+    return NULL;
+  if (!seg->nodes[k].pv->disk)
+    return &missing;
+  return &seg->nodes[k].pv->stats;
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -626,29 +642,48 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	while (1)
 	  {
 	    grub_size_t read_size;
+	    unsigned int first = 0;
 
 	    read_size = seg->stripe_size - b;
 	    if (read_size > size)
 	      read_size = size;
 
+	    /* Start with the copy on the fastest member.  */
+	    for (i = 1; i < near; i++)
+	      if (grub_mirror_prefer (node_stats (seg, disknr + i),
+				      node_stats (seg, disknr + first)))
+		first = i;
+
 	    err = 0;
 	    for (i = 0; i < near; i++)
 	      {
 		unsigned int k;
+		grub_disk_addr_t copy_sector = read_sector;
 
-		k = disknr;
+		k = disknr + (first + i) % (unsigned int) near;
+		while (k >= seg->node_count)
+		  {
+		    k -= seg->node_count;
+		    copy_sector += ofs;
+		  }
 		err = 0;
 		for (j = 0; j < far; j++)
 		  {
+		    struct grub_diskfilter_pv *pv = seg->nodes[k].pv;
+		    grub_uint64_t start = grub_get_time_ms ();
+
 		    if (grub_errno == GRUB_ERR_READ_ERROR
 			|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
 		      grub_errno = GRUB_ERR_NONE;
 
 		    err = grub_diskfilter_read_node (&seg->nodes[k],
-						     read_sector
+						     copy_sector
 						     + j * far_ofs + b,
 						     read_size,
 						     buf);
+		    if (pv)
+		      grub_mirror_account (&pv->stats, read_size,
+					   grub_get_time_ms () - start, err);
 		    if (! err)
 		      break;
 		    else if (err != GRUB_ERR_READ_ERROR
@@ -661,13 +696,6 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 
 		if (! err)
 		  break;
-
-		disknr++;
-		if (disknr == seg->node_count)
-		  {
-		    disknr = 0;
-		    read_sector += ofs;
-		  }
 	      }
 
 	    if (err)
@@ -679,7 +707,7 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      return GRUB_ERR_NONE;
 	    
 	    b = 0;
-	    disknr += (near - i);
+	    disknr += near;
 	    while (disknr >= seg->node_count)
 	      {
 		disknr -= seg->node_count;
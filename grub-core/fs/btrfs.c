@@ -23,12 +23,16 @@
 #include <grub/misc.h>
 #include <grub/disk.h>
 #include <grub/dl.h>
+#include <grub/partition.h>
+#include <grub/time.h>
 #include <grub/types.h>
 #include <grub/lib/crc.h>
 #include <grub/deflate.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
+#include <grub/mirror.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -66,7 +70,10 @@ struct grub_btrfs_superblock
   grub_uint64_t chunk_tree;
   grub_uint8_t dummy2[0x20];
   grub_uint64_t root_dir_objectid;
-  grub_uint8_t dummy3[0x41];
+  grub_uint64_t num_devices;
+  grub_uint32_t sectorsize;
+  grub_uint32_t nodesize;
+  grub_uint8_t dummy3[0x31];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -212,6 +219,7 @@ struct grub_btrfs_extent_data
 #define GRUB_BTRFS_COMPRESSION_NONE 0
 #define GRUB_BTRFS_COMPRESSION_ZLIB 1
 #define GRUB_BTRFS_COMPRESSION_LZO  2
+#define GRUB_BTRFS_COMPRESSION_ZSTD 3
 
 #define GRUB_BTRFS_OBJECT_ID_CHUNK 0x100
 
@@ -278,6 +286,307 @@ key_cmp (const struct grub_btrfs_key *a, const struct grub_btrfs_key *b)
   return 0;
 }
 
+/* The chunks looked up in the chunk tree and the internal tree nodes read
+   last are kept for the filesystem read last, so that opening many files
+   doesn't walk the same nodes again.  Like the disk cache they are
+   dropped when unused for this many seconds, as the medium might have
+   been changed.  */
+#define GRUB_BTRFS_CACHE_TIMEOUT 2
+#define GRUB_BTRFS_NODE_CACHE_ENTRIES 64
+
+struct grub_btrfs_cached_chunk
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
+struct grub_btrfs_cached_node
+{
+  grub_disk_addr_t addr;
+  /* Contents of the node, NULL for an unused entry.  */
+  grub_uint8_t *buf;
+  grub_uint64_t last_use;
+};
+
+/* Filesystem the cache belongs to.  */
+static unsigned long btrfs_cache_dev_id;
+static unsigned long btrfs_cache_disk_id;
+static grub_disk_addr_t btrfs_cache_part_start;
+static grub_btrfs_uuid_t btrfs_cache_uuid;
+static grub_uint64_t btrfs_cache_generation;
+static grub_uint32_t btrfs_cache_nodesize;
+
+/* Chunks sorted by their start.  */
+static struct grub_btrfs_cached_chunk *btrfs_cache_chunks;
+static unsigned btrfs_cache_nchunks;
+static unsigned btrfs_cache_chunks_allocated;
+
+static struct grub_btrfs_cached_node
+  btrfs_cache_nodes[GRUB_BTRFS_NODE_CACHE_ENTRIES];
+static grub_uint64_t btrfs_cache_clock;
+static grub_uint64_t btrfs_cache_time;
+static unsigned long btrfs_cache_hits;
+static unsigned long btrfs_cache_misses;
+
+/* Read statistics of the member devices of the filesystems read lately,
+   by filesystem UUID and device id.  Unlike the cache above they are
+   kept across mounts and changes of generation, as they are about the
+   devices and not about what is on them.  */
+#define GRUB_BTRFS_DEVICE_STATS_ENTRIES 16
+
+struct grub_btrfs_device_stats
+{
+  grub_btrfs_uuid_t uuid;
+  grub_uint64_t id;
+  /* Zero for an unused entry.  */
+  grub_uint64_t last_use;
+  struct grub_mirror_stats stats;
+};
+
+static struct grub_btrfs_device_stats
+  btrfs_device_stats[GRUB_BTRFS_DEVICE_STATS_ENTRIES];
+static grub_uint64_t btrfs_device_stats_clock;
+
+static void
+btrfs_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < btrfs_cache_nchunks; i++)
+    grub_free (btrfs_cache_chunks[i].chunk);
+  grub_free (btrfs_cache_chunks);
+  btrfs_cache_chunks = NULL;
+  btrfs_cache_nchunks = 0;
+  btrfs_cache_chunks_allocated = 0;
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_ENTRIES; i++)
+    {
+      grub_free (btrfs_cache_nodes[i].buf);
+      btrfs_cache_nodes[i].buf = NULL;
+    }
+}
+
+/* Make the cache that of the filesystem of DATA, dropping it if it
+   belongs to another one or has timed out.  */
+static void
+btrfs_cache_select (struct grub_btrfs_data *data)
+{
+  grub_disk_t disk = data->devices_attached[0].dev->disk;
+  grub_disk_addr_t part_start = 0;
+  grub_uint64_t now;
+
+  if (disk->partition)
+    part_start = grub_partition_get_start (disk->partition);
+
+  now = grub_get_time_ms ();
+  if (now > btrfs_cache_time + GRUB_BTRFS_CACHE_TIMEOUT * 1000
+      || btrfs_cache_dev_id != disk->dev->id
+      || btrfs_cache_disk_id != disk->id
+      || btrfs_cache_part_start != part_start
+      || btrfs_cache_generation != data->sblock.generation
+      || grub_memcmp (btrfs_cache_uuid, data->sblock.uuid,
+		      sizeof (btrfs_cache_uuid)) != 0)
+    {
+      grub_uint32_t nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+
+      btrfs_cache_flush ();
+      btrfs_cache_dev_id = disk->dev->id;
+      btrfs_cache_disk_id = disk->id;
+      btrfs_cache_part_start = part_start;
+      btrfs_cache_generation = data->sblock.generation;
+      grub_memcpy (btrfs_cache_uuid, data->sblock.uuid,
+		   sizeof (btrfs_cache_uuid));
+      /* Nodes are only cached if their size makes sense.  */
+      if (nodesize < 4096 || nodesize > 65536 || (nodesize & (nodesize - 1)))
+	nodesize = 0;
+      btrfs_cache_nodesize = nodesize;
+    }
+  btrfs_cache_time = now;
+}
+
+/* Return the cached chunk holding ADDR and set START to its start, or
+   return NULL.  */
+static struct grub_btrfs_chunk_item *
+btrfs_cache_find_chunk (struct grub_btrfs_data *data, grub_uint64_t addr,
+			grub_uint64_t *start)
+{
+  unsigned lo = 0, hi = btrfs_cache_nchunks;
+
+  btrfs_cache_select (data);
+
+  /* Find the last chunk starting at or before ADDR.  */
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (btrfs_cache_chunks[mid].start <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo == 0 || addr - btrfs_cache_chunks[lo - 1].start
+      >= btrfs_cache_chunks[lo - 1].size)
+    return NULL;
+
+  *start = btrfs_cache_chunks[lo - 1].start;
+  return btrfs_cache_chunks[lo - 1].chunk;
+}
+
+/* Add CHUNK, starting at START, to the cache.  Return 1 if the cache
+   took it over and 0 if the caller still owns it.  */
+static int
+btrfs_cache_add_chunk (grub_uint64_t start, struct grub_btrfs_chunk_item *chunk)
+{
+  unsigned lo = 0, hi = btrfs_cache_nchunks;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (btrfs_cache_chunks[mid].start < start)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  if (lo < btrfs_cache_nchunks && btrfs_cache_chunks[lo].start == start)
+    return 0;
+
+  if (btrfs_cache_nchunks == btrfs_cache_chunks_allocated)
+    {
+      struct grub_btrfs_cached_chunk *chunks;
+      unsigned allocated = btrfs_cache_chunks_allocated * 2 ? : 16;
+
+      chunks = grub_realloc (btrfs_cache_chunks,
+			     allocated * sizeof (chunks[0]));
+      if (!chunks)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      btrfs_cache_chunks = chunks;
+      btrfs_cache_chunks_allocated = allocated;
+    }
+
+  grub_memmove (&btrfs_cache_chunks[lo + 1], &btrfs_cache_chunks[lo],
+		(btrfs_cache_nchunks - lo) * sizeof (btrfs_cache_chunks[0]));
+  btrfs_cache_chunks[lo].start = start;
+  btrfs_cache_chunks[lo].size = grub_le_to_cpu64 (chunk->size);
+  btrfs_cache_chunks[lo].chunk = chunk;
+  btrfs_cache_nchunks++;
+  return 1;
+}
+
+/* Return the cached node at ADDR, or NULL.  */
+static const grub_uint8_t *
+btrfs_cache_find_node (struct grub_btrfs_data *data, grub_disk_addr_t addr)
+{
+  unsigned i;
+
+  btrfs_cache_select (data);
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_ENTRIES; i++)
+    if (btrfs_cache_nodes[i].buf && btrfs_cache_nodes[i].addr == addr)
+      {
+	btrfs_cache_hits++;
+	btrfs_cache_nodes[i].last_use = ++btrfs_cache_clock;
+	return btrfs_cache_nodes[i].buf;
+      }
+  return NULL;
+}
+
+/* Read the node at ADDR into the cache, dropping the least recently used
+   one.  Return NULL if nodes aren't cached or on error.  */
+static const grub_uint8_t *
+btrfs_cache_read_node (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		       int recursion_depth)
+{
+  struct grub_btrfs_cached_node *victim = &btrfs_cache_nodes[0];
+  grub_uint32_t nodesize;
+  grub_uint8_t *buf;
+  unsigned i;
+
+  btrfs_cache_select (data);
+  nodesize = btrfs_cache_nodesize;
+  if (!nodesize)
+    return NULL;
+
+  btrfs_cache_misses++;
+  buf = grub_malloc (nodesize);
+  if (!buf)
+    return NULL;
+  if (grub_btrfs_read_logical (data, addr, buf, nodesize, recursion_depth))
+    {
+      grub_free (buf);
+      return NULL;
+    }
+
+  /* Reading may have dropped the cache or made it another filesystem's.  */
+  if (nodesize != btrfs_cache_nodesize)
+    {
+      grub_free (buf);
+      return NULL;
+    }
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_ENTRIES; i++)
+    {
+      if (!btrfs_cache_nodes[i].buf)
+	{
+	  victim = &btrfs_cache_nodes[i];
+	  break;
+	}
+      if (btrfs_cache_nodes[i].last_use < victim->last_use)
+	victim = &btrfs_cache_nodes[i];
+    }
+
+  grub_free (victim->buf);
+  victim->addr = addr;
+  victim->buf = buf;
+  victim->last_use = ++btrfs_cache_clock;
+  return buf;
+}
+
+static grub_err_t
+read_node_header (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		  struct btrfs_header *head, int recursion_depth)
+{
+  const grub_uint8_t *node;
+
+  node = btrfs_cache_find_node (data, addr);
+  if (node)
+    {
+      grub_memcpy (head, node, sizeof (*head));
+      return GRUB_ERR_NONE;
+    }
+  return grub_btrfs_read_logical (data, addr, head, sizeof (*head),
+				  recursion_depth);
+}
+
+/* Read SIZE bytes at OFF in the internal node at ADDR, caching the
+   node.  */
+static grub_err_t
+read_internal_node (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		    grub_size_t off, void *buf, grub_size_t size,
+		    int recursion_depth)
+{
+  const grub_uint8_t *node;
+
+  node = btrfs_cache_find_node (data, addr);
+  if (!node)
+    node = btrfs_cache_read_node (data, addr, recursion_depth);
+  if (!node)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return grub_btrfs_read_logical (data, addr + off, buf, size,
+				      recursion_depth);
+    }
+
+  if (off + size > btrfs_cache_nodesize)
+    return grub_error (GRUB_ERR_BAD_FS, "btrfs node item out of bounds");
+  grub_memcpy (buf, node + off, size);
+  return GRUB_ERR_NONE;
+}
+
 static void
 free_iterator (struct grub_btrfs_leaf_descriptor *desc)
 {
@@ -329,16 +638,15 @@ next (struct grub_btrfs_data *data,
       struct grub_btrfs_internal_node node;
       struct btrfs_header head;
 
-      err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				     * sizeof (node)
-				     + sizeof (struct btrfs_header)
-				     + desc->data[desc->depth - 1].addr,
-				     &node, sizeof (node), 0);
+      err = read_internal_node (data, desc->data[desc->depth - 1].addr,
+				desc->data[desc->depth - 1].iter
+				* sizeof (node)
+				+ sizeof (struct btrfs_header),
+				&node, sizeof (node), 0);
       if (err)
 	return -err;
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
+      err = read_node_header (data, grub_le_to_cpu64 (node.addr), &head, 0);
       if (err)
 	return -err;
 
@@ -397,9 +705,7 @@ lower_bound (struct grub_btrfs_data *data,
 
     reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
+      err = read_node_header (data, addr, &head, recursion_depth + 1);
       if (err)
 	return err;
       addr += sizeof (head);
@@ -411,9 +717,10 @@ lower_bound (struct grub_btrfs_data *data,
 	  grub_memset (&node_last, 0, sizeof (node_last));
 	  for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
 	    {
-	      err = grub_btrfs_read_logical (data, addr + i * sizeof (node),
-					     &node, sizeof (node),
-					     recursion_depth + 1);
+	      err = read_internal_node (data, addr - sizeof (head),
+					sizeof (head) + i * sizeof (node),
+					&node, sizeof (node),
+					recursion_depth + 1);
 	      if (err)
 		return err;
 
@@ -606,6 +913,43 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
   return ctx.dev_found;
 }
 
+/* Read statistics of the device ID.  Devices not attached yet count as
+   failed, so that other copies are read before looking for them.  */
+static struct grub_mirror_stats *
+device_stats (struct grub_btrfs_data *data, grub_uint64_t id)
+{
+  static struct grub_mirror_stats missing = GRUB_MIRROR_STATS_MISSING;
+  struct grub_btrfs_device_stats *victim = &btrfs_device_stats[0];
+  unsigned i;
+
+  for (i = 0; i < data->n_devices_attached; i++)
+    if (id == data->devices_attached[i].id)
+      break;
+  if (i == data->n_devices_attached)
+    return &missing;
+
+  for (i = 0; i < GRUB_BTRFS_DEVICE_STATS_ENTRIES; i++)
+    {
+      if (btrfs_device_stats[i].last_use
+	  && btrfs_device_stats[i].id == id
+	  && grub_memcmp (btrfs_device_stats[i].uuid, data->sblock.uuid,
+			  sizeof (data->sblock.uuid)) == 0)
+	{
+	  btrfs_device_stats[i].last_use = ++btrfs_device_stats_clock;
+	  return &btrfs_device_stats[i].stats;
+	}
+      if (btrfs_device_stats[i].last_use < victim->last_use)
+	victim = &btrfs_device_stats[i];
+    }
+
+  /* Forget the device read least recently.  */
+  grub_memcpy (victim->uuid, data->sblock.uuid, sizeof (victim->uuid));
+  victim->id = id;
+  victim->last_use = ++btrfs_device_stats_clock;
+  grub_memset (&victim->stats, 0, sizeof (victim->stats));
+  return &victim->stats;
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
@@ -648,6 +992,18 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	    * grub_le_to_cpu16 (chunk->nstripes);
 	}
 
+      {
+	grub_uint64_t start;
+
+	chunk = btrfs_cache_find_chunk (data, addr, &start);
+	if (chunk)
+	  {
+	    key_out.offset = grub_cpu_to_le64 (start);
+	    key = &key_out;
+	    goto chunk_found;
+	  }
+      }
+
       key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
       key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
       key_in.offset = grub_cpu_to_le64 (addr);
@@ -674,6 +1030,11 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  grub_free (chunk);
 	  return err;
 	}
+      if (chsize >= sizeof (*chunk)
+	  && chsize >= sizeof (*chunk) + grub_le_to_cpu16 (chunk->nstripes)
+	  * sizeof (struct grub_btrfs_chunk_stripe)
+	  && btrfs_cache_add_chunk (grub_le_to_cpu64 (key->offset), chunk))
+	challoc = 0;
 
     chunk_found:
       {
@@ -683,7 +1044,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	grub_uint64_t chunk_stripe_length;
 	grub_uint16_t nstripes;
 	unsigned redundancy = 1;
-	unsigned i, j;
+	unsigned i, j, first = 0;
 
 	if (grub_le_to_cpu64 (chunk->size) <= off)
 	  {
@@ -778,17 +1139,30 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	if (csize > (grub_uint64_t) size)
 	  csize = size;
 
+	/* Start with the copy on the fastest device.  */
+	for (i = 1; i < redundancy; i++)
+	  {
+	    struct grub_btrfs_chunk_stripe *stripes;
+
+	    stripes = (struct grub_btrfs_chunk_stripe *) (chunk + 1) + stripen;
+	    if (grub_mirror_prefer (device_stats (data, stripes[i].device_id),
+				    device_stats (data,
+						  stripes[first].device_id)))
+	      first = i;
+	  }
+
 	for (j = 0; j < 2; j++)
 	  {
 	    for (i = 0; i < redundancy; i++)
 	      {
 		struct grub_btrfs_chunk_stripe *stripe;
 		grub_disk_addr_t paddr;
+		grub_uint64_t start;
 
 		stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
 		/* Right now the redundancy handling is easy.
 		   With RAID5-like it will be more difficult.  */
-		stripe += stripen + i;
+		stripe += stripen + (first + i) % redundancy;
 
 		paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
 
@@ -815,9 +1189,13 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		    continue;
 		  }
 
+		start = grub_get_time_ms ();
 		err = grub_disk_read (dev->disk, paddr >> GRUB_DISK_SECTOR_BITS,
 				      paddr & (GRUB_DISK_SECTOR_SIZE - 1),
 				      csize, buf);
+		grub_mirror_account (device_stats (data, stripe->device_id),
+				     csize >> GRUB_DISK_SECTOR_BITS,
+				     grub_get_time_ms () - start, err);
 		if (!err)
 		  break;
 		grub_errno = GRUB_ERR_NONE;
@@ -879,6 +1257,10 @@ static void
 grub_btrfs_unmount (struct grub_btrfs_data *data)
 {
   unsigned i;
+
+  grub_dprintf ("btrfs", "node cache: %lu hits, %lu misses, %u chunks\n",
+		btrfs_cache_hits, btrfs_cache_misses, btrfs_cache_nchunks);
+
   /* The device 0 is closed one layer upper.  */
   for (i = 1; i < data->n_devices_attached; i++)
     grub_device_close (data->devices_attached[i].dev);
@@ -1087,7 +1469,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
       if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
 	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZLIB
-	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO)
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZSTD)
 	{
 	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		      "compression type 0x%x not supported",
@@ -1127,6 +1510,20 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  != (grub_ssize_t) csize)
 		return -1;
 	    }
+	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+	    {
+	      if (grub_zstd_decompress (data->extent->inl, data->extsize -
+					((grub_uint8_t *) data->extent->inl
+					 - (grub_uint8_t *) data->extent),
+					extoff, buf, csize)
+		  != (grub_ssize_t) csize)
+		{
+		  if (!grub_errno)
+		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				"premature end of compressed");
+		  return -1;
+		}
+	    }
 	  else
 	    grub_memcpy (buf, data->extent->inl + extoff, csize);
 	  break;
@@ -1164,6 +1561,11 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
 				    + grub_le_to_cpu64 (data->extent->offset),
 				    buf, csize);
+	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+		/* The extent is padded to a sector, the frame ends before.  */
+		ret = grub_zstd_decompress (tmp, zsize, extoff
+				    + grub_le_to_cpu64 (data->extent->offset),
+				    buf, csize);
 	      else
 		ret = -1;
 
@@ -1772,4 +2174,5 @@ GRUB_MOD_INIT (btrfs)
 GRUB_MOD_FINI (btrfs)
 {
   grub_fs_unregister (&grub_btrfs_fs);
+  btrfs_cache_flush ();
 }
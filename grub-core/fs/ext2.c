@@ -141,8 +141,23 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
 #define EXT4_ENCRYPT_FLAG              0x800
+#define EXT2_INDEX_FLAG			0x1000
 #define EXT4_EXTENTS_FLAG		0x80000
 
+/* Superblock flags.  */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Hash versions of directory indexes.  The unsigned variants aren't
+   stored in the index, they are selected by EXT2_FLAGS_UNSIGNED_HASH.  */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_UNSIGNED		3
+
+/* Without the largedir feature an index has at most one level of
+   nodes below the root.  */
+#define EXT2_DX_MAX_LEVELS		2
+
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
 {
@@ -196,6 +211,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_hi;
+  grub_uint32_t reserved_blocks_hi;
+  grub_uint32_t free_blocks_hi;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -262,6 +283,31 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* Header of a directory index, in the first block of the directory
+   after the "." and ".." entries.  */
+struct grub_ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* Index entries, the hash of the first one holds the number of them
+   instead.  */
+struct grub_ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -319,6 +365,15 @@ struct grub_ext4_extent_idx
   grub_uint16_t unused;
 };
 
+/* A run of logically and physically contiguous blocks of an extent mapped
+   file.  START is 0 for unwritten extents, which read as zeros.  */
+struct grub_ext2_run
+{
+  grub_uint32_t fileblock;
+  grub_uint32_t len;
+  grub_disk_addr_t start;
+};
+
 struct grub_fshelp_node
 {
   struct grub_ext2_data *data;
@@ -335,6 +390,11 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+  /* Extents of the inode RUNS_INO, sorted by file block.  They are
+     collected on the first read of that inode.  */
+  struct grub_ext2_run *runs;
+  grub_size_t nruns;
+  int runs_ino;
 };
 
 static grub_dl_t my_mod;
@@ -406,56 +466,168 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
 			 sizeof (struct grub_ext2_block_group), blkgrp);
 }
 
-static struct grub_ext4_extent_header *
-grub_ext4_find_leaf (struct grub_ext2_data *data,
-                     struct grub_ext4_extent_header *ext_block,
-                     grub_uint32_t fileblock)
+/* Number of block pointers read at once from the last indirect block.  */
+#define EXT2_INDIRECT_BATCH	64
+
+/* The deepest extent tree the kernel creates.  */
+#define EXT4_EXT_MAX_DEPTH	5
+/* Extents longer than this are unwritten.  */
+#define EXT4_EXT_INIT_MAX_LEN	32768
+
+/* Append the extents of the tree EXT_BLOCK, of at most DEPTH levels, to
+   the run map of DATA.  */
+static grub_err_t
+grub_ext4_collect_runs (struct grub_ext2_data *data,
+			struct grub_ext4_extent_header *ext_block,
+			unsigned int maxentries, int depth, grub_size_t *alloc)
 {
-  struct grub_ext4_extent_idx *index;
-  void *buf = NULL;
+  unsigned int entries, i;
 
-  while (1)
+  if (ext_block->magic != grub_cpu_to_le16_compile_time (EXT4_EXT_MAGIC)
+      || grub_le_to_cpu16 (ext_block->depth) > depth
+      || grub_le_to_cpu16 (ext_block->entries) > maxentries)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  entries = grub_le_to_cpu16 (ext_block->entries);
+
+  if (ext_block->depth == 0)
     {
-      int i;
-      grub_disk_addr_t block;
+      struct grub_ext4_extent *ext = (struct grub_ext4_extent *) (ext_block + 1);
 
-      index = (struct grub_ext4_extent_idx *) (ext_block + 1);
+      for (i = 0; i < entries; i++)
+	{
+	  struct grub_ext2_run *last = data->nruns ? &data->runs[data->nruns - 1] : 0;
+	  grub_uint32_t fileblock = grub_le_to_cpu32 (ext[i].block);
+	  grub_uint32_t len = grub_le_to_cpu16 (ext[i].len);
+	  grub_disk_addr_t start = 0;
 
-      if (ext_block->magic != grub_cpu_to_le16_compile_time (EXT4_EXT_MAGIC))
-	goto fail;
+	  if (len > EXT4_EXT_INIT_MAX_LEN)
+	    len -= EXT4_EXT_INIT_MAX_LEN;
+	  else
+	    {
+	      start = grub_le_to_cpu16 (ext[i].start_hi);
+	      start = (start << 32) | grub_le_to_cpu32 (ext[i].start);
+	    }
+	  if (len == 0)
+	    continue;
 
-      if (ext_block->depth == 0)
-        return ext_block;
+	  if (last && fileblock < last->fileblock + last->len)
+	    return grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
 
-      for (i = 0; i < grub_le_to_cpu16 (ext_block->entries); i++)
-        {
-          if (fileblock < grub_le_to_cpu32(index[i].block))
-            break;
-        }
+	  /* Large files are made of many extents following each other.  */
+	  if (last && fileblock == last->fileblock + last->len
+	      && ((start == 0 && last->start == 0)
+		  || (start != 0 && last->start != 0
+		      && start == last->start + last->len)))
+	    {
+	      last->len += len;
+	      continue;
+	    }
 
-      if (--i < 0)
-	goto fail;
+	  if (data->nruns == *alloc)
+	    {
+	      struct grub_ext2_run *runs;
 
-      block = grub_le_to_cpu16 (index[i].leaf_hi);
-      block = (block << 32) | grub_le_to_cpu32 (index[i].leaf);
-      if (!buf)
-	buf = grub_malloc (EXT2_BLOCK_SIZE(data));
-      if (!buf)
-	goto fail;
-      if (grub_disk_read (data->disk,
-                          block << LOG2_EXT2_BLOCK_SIZE (data),
-                          0, EXT2_BLOCK_SIZE(data), buf))
-	goto fail;
+	      *alloc = *alloc ? 2 * *alloc : 16;
+	      runs = grub_realloc (data->runs, *alloc * sizeof (runs[0]));
+	      if (! runs)
+		return grub_errno;
+	      data->runs = runs;
+	    }
+	  data->runs[data->nruns].fileblock = fileblock;
+	  data->runs[data->nruns].len = len;
+	  data->runs[data->nruns].start = start;
+	  data->nruns++;
+	}
+      return GRUB_ERR_NONE;
+    }
+  else
+    {
+      struct grub_ext4_extent_idx *index
+	= (struct grub_ext4_extent_idx *) (ext_block + 1);
+      unsigned int blksz = EXT2_BLOCK_SIZE (data);
+      grub_err_t err = GRUB_ERR_NONE;
+      char *buf;
+
+      buf = grub_malloc (blksz);
+      if (! buf)
+	return grub_errno;
 
-      ext_block = buf;
+      for (i = 0; i < entries && !err; i++)
+	{
+	  grub_disk_addr_t block;
+
+	  block = grub_le_to_cpu16 (index[i].leaf_hi);
+	  block = (block << 32) | grub_le_to_cpu32 (index[i].leaf);
+	  err = grub_disk_read (data->disk,
+				block << LOG2_EXT2_BLOCK_SIZE (data),
+				0, blksz, buf);
+	  if (!err)
+	    err = grub_ext4_collect_runs (data,
+					  (struct grub_ext4_extent_header *) buf,
+					  (blksz - sizeof (*ext_block))
+					  / sizeof (struct grub_ext4_extent),
+					  grub_le_to_cpu16 (ext_block->depth) - 1,
+					  alloc);
+	}
+      grub_free (buf);
+      return err;
     }
- fail:
-  grub_free (buf);
-  return 0;
 }
 
+/* Find the first run of the extent mapped NODE which ends after FILEBLOCK,
+   collecting the runs of NODE first if needed.  Returns the number of runs
+   if there is none and -1 on error.  */
+static grub_ssize_t
+grub_ext4_find_run (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_ext2_data *data = node->data;
+  grub_size_t lo, hi;
+
+  if (data->runs_ino != node->ino)
+    {
+      grub_size_t alloc = 0;
+
+      grub_free (data->runs);
+      data->runs = 0;
+      data->nruns = 0;
+      data->runs_ino = 0;
+      if (grub_ext4_collect_runs (data, (struct grub_ext4_extent_header *)
+				  node->inode.blocks.dir_blocks,
+				  (sizeof (node->inode.blocks)
+				   - sizeof (struct grub_ext4_extent_header))
+				  / sizeof (struct grub_ext4_extent),
+				  EXT4_EXT_MAX_DEPTH, &alloc))
+	{
+	  grub_free (data->runs);
+	  data->runs = 0;
+	  data->nruns = 0;
+	  return -1;
+	}
+      data->runs_ino = node->ino;
+    }
+
+  /* Runs don't overlap, so their ends are sorted too.  */
+  lo = 0;
+  hi = data->nruns;
+  while (lo < hi)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+      if ((grub_disk_addr_t) data->runs[mid].fileblock + data->runs[mid].len
+	  <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Map FILEBLOCK of NODE to a disk block and set COUNT to the number of
+   blocks from there on which are contiguous.  That is a whole extent for
+   extent mapped files but just the one block otherwise.  */
 static grub_disk_addr_t
-grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *count)
 {
   struct grub_ext2_data *data = node->data;
   struct grub_ext2_inode *inode = &node->inode;
@@ -468,55 +640,41 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
   if (inode->flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
     {
-      struct grub_ext4_extent_header *leaf;
-      struct grub_ext4_extent *ext;
-      int i;
-      grub_disk_addr_t ret;
-
-      leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
-      if (! leaf)
-        {
-          grub_error (GRUB_ERR_BAD_FS, "invalid extent");
-          return -1;
-        }
-
-      ext = (struct grub_ext4_extent *) (leaf + 1);
-      for (i = 0; i < grub_le_to_cpu16 (leaf->entries); i++)
-        {
-          if (fileblock < grub_le_to_cpu32 (ext[i].block))
-            break;
-        }
-
-      if (--i >= 0)
-        {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
-	    ret = 0;
-          else
-            {
-              grub_disk_addr_t start;
-
-              start = grub_le_to_cpu16 (ext[i].start_hi);
-              start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
-
-              ret = fileblock + start;
-            }
-        }
-      else
-        {
-          grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
-	  ret = -1;
-        }
-
-      if (leaf != (struct grub_ext4_extent_header *) inode->blocks.dir_blocks)
-	grub_free (leaf);
-
-      return ret;
+      struct grub_ext2_run *run;
+      grub_ssize_t idx;
+
+      idx = grub_ext4_find_run (node, fileblock);
+      if (idx < 0)
+	return -1;
+      /* A hole up to the end of the file.  */
+      if ((grub_size_t) idx == node->data->nruns)
+	{
+	  *count = ~(grub_disk_addr_t) 0;
+	  return 0;
+	}
+      run = &node->data->runs[idx];
+      if (fileblock < run->fileblock)
+	{
+	  *count = run->fileblock - fileblock;
+	  return 0;
+	}
+      *count = run->fileblock + run->len - fileblock;
+      if (run->start == 0)
+	return 0;
+      return run->start + (fileblock - run->fileblock);
     }
 
   /* Direct blocks.  */
   if (fileblock < INDIRECT_BLOCKS)
-    return grub_le_to_cpu32 (inode->blocks.dir_blocks[fileblock]);
+    {
+      grub_uint32_t blk = grub_le_to_cpu32 (inode->blocks.dir_blocks[fileblock]);
+
+      for (*count = 1; fileblock + *count < INDIRECT_BLOCKS; ++*count)
+	if (grub_le_to_cpu32 (inode->blocks.dir_blocks[fileblock + *count])
+	    != (blk ? blk + *count : 0))
+	  break;
+      return blk;
+    }
   fileblock -= INDIRECT_BLOCKS;
   /* Indirect.  */
   if (fileblock < blksz_quarter)
@@ -546,19 +704,39 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   return -1;
 
 indirect:
+  *count = 1;
   do {
+    grub_uint32_t entries[EXT2_INDIRECT_BATCH];
+    unsigned int idx, n = 1;
+
     /* If the indirect block is zero, all child blocks are absent
        (i.e. filled with zeros.) */
     if (indir == 0)
-      return 0;
+      {
+	grub_disk_addr_t span = 1ULL << (log_perblock * (shift + 1));
+
+	*count = span - (fileblock & (span - 1));
+	return 0;
+      }
+    idx = (fileblock >> (log_perblock * shift)) & ((1 << log_perblock) - 1);
+    /* Get the following data blocks as well to see which are contiguous.  */
+    if (shift == 0)
+      {
+	n = (1 << log_perblock) - idx;
+	if (n > ARRAY_SIZE (entries))
+	  n = ARRAY_SIZE (entries);
+      }
     if (grub_disk_read (data->disk,
 			((grub_disk_addr_t) grub_le_to_cpu32 (indir))
 			<< log2_blksz,
-			((fileblock >> (log_perblock * shift))
-			 & ((1 << log_perblock) - 1))
-			* sizeof (indir),
-			sizeof (indir), &indir))
+			idx * sizeof (indir), n * sizeof (indir), entries))
       return -1;
+    indir = entries[0];
+    if (shift == 0)
+      for (; *count < n; ++*count)
+	if (grub_le_to_cpu32 (entries[*count])
+	    != (indir ? grub_le_to_cpu32 (indir) + *count : 0))
+	  break;
   } while (shift--);
 
   return grub_le_to_cpu32 (indir);
@@ -571,12 +749,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extent (node->data->disk, node,
+				       read_hook, read_hook_data,
+				       pos, len, buf, grub_ext2_read_block,
+				       grub_cpu_to_le32 (node->inode.size)
+				       | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+				       LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -681,6 +859,9 @@ grub_ext2_mount (grub_disk_t disk)
   data->diropen.data = data;
   data->diropen.ino = 2;
   data->diropen.inode_read = 1;
+  data->runs = 0;
+  data->nruns = 0;
+  data->runs_ino = 0;
 
   data->inode = &data->diropen.inode;
 
@@ -698,6 +879,14 @@ grub_ext2_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_ext2_free_data (struct grub_ext2_data *data)
+{
+  if (data)
+    grub_free (data->runs);
+  grub_free (data);
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -744,6 +933,64 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Make a node for the entry DIRENT of the directory DIRO and tell its
+   type in TYPE.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data,
+			    grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -781,59 +1028,19 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
 	  if (! fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
-
 	  filename[dirent.namelen] = '\0';
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-	  else
-	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-
 	  if (hook (filename, type, fdiro, hook_data))
 	    return 1;
 	}
@@ -844,6 +1051,471 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* The hashes of directory indexes, as computed by Linux.  */
+
+#define EXT2_ROL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define EXT2_MD4_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_MD4_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_MD4_H(x, y, z)	((x) ^ (y) ^ (z))
+
+#define EXT2_MD4_ROUND(f, a, b, c, d, x, s)	\
+  (a += f (b, c, d) + (x), a = EXT2_ROL32 (a, s))
+
+#define EXT2_MD4_K2	013240474631U
+#define EXT2_MD4_K3	015666365641U
+
+static void
+grub_ext2_half_md4 (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  EXT2_MD4_ROUND (EXT2_MD4_F, a, b, c, d, in[0], 3);
+  EXT2_MD4_ROUND (EXT2_MD4_F, d, a, b, c, in[1], 7);
+  EXT2_MD4_ROUND (EXT2_MD4_F, c, d, a, b, in[2], 11);
+  EXT2_MD4_ROUND (EXT2_MD4_F, b, c, d, a, in[3], 19);
+  EXT2_MD4_ROUND (EXT2_MD4_F, a, b, c, d, in[4], 3);
+  EXT2_MD4_ROUND (EXT2_MD4_F, d, a, b, c, in[5], 7);
+  EXT2_MD4_ROUND (EXT2_MD4_F, c, d, a, b, in[6], 11);
+  EXT2_MD4_ROUND (EXT2_MD4_F, b, c, d, a, in[7], 19);
+
+  EXT2_MD4_ROUND (EXT2_MD4_G, a, b, c, d, in[1] + EXT2_MD4_K2, 3);
+  EXT2_MD4_ROUND (EXT2_MD4_G, d, a, b, c, in[3] + EXT2_MD4_K2, 5);
+  EXT2_MD4_ROUND (EXT2_MD4_G, c, d, a, b, in[5] + EXT2_MD4_K2, 9);
+  EXT2_MD4_ROUND (EXT2_MD4_G, b, c, d, a, in[7] + EXT2_MD4_K2, 13);
+  EXT2_MD4_ROUND (EXT2_MD4_G, a, b, c, d, in[0] + EXT2_MD4_K2, 3);
+  EXT2_MD4_ROUND (EXT2_MD4_G, d, a, b, c, in[2] + EXT2_MD4_K2, 5);
+  EXT2_MD4_ROUND (EXT2_MD4_G, c, d, a, b, in[4] + EXT2_MD4_K2, 9);
+  EXT2_MD4_ROUND (EXT2_MD4_G, b, c, d, a, in[6] + EXT2_MD4_K2, 13);
+
+  EXT2_MD4_ROUND (EXT2_MD4_H, a, b, c, d, in[3] + EXT2_MD4_K3, 3);
+  EXT2_MD4_ROUND (EXT2_MD4_H, d, a, b, c, in[7] + EXT2_MD4_K3, 9);
+  EXT2_MD4_ROUND (EXT2_MD4_H, c, d, a, b, in[2] + EXT2_MD4_K3, 11);
+  EXT2_MD4_ROUND (EXT2_MD4_H, b, c, d, a, in[6] + EXT2_MD4_K3, 15);
+  EXT2_MD4_ROUND (EXT2_MD4_H, a, b, c, d, in[1] + EXT2_MD4_K3, 3);
+  EXT2_MD4_ROUND (EXT2_MD4_H, d, a, b, c, in[5] + EXT2_MD4_K3, 9);
+  EXT2_MD4_ROUND (EXT2_MD4_H, c, d, a, b, in[0] + EXT2_MD4_K3, 11);
+  EXT2_MD4_ROUND (EXT2_MD4_H, b, c, d, a, in[4] + EXT2_MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_tea (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Characters are signed or unsigned, depending on the platform the
+   index was written on.  */
+static inline int
+grub_ext2_hash_char (const char *p, int unsigned_char)
+{
+  return unsigned_char ? (int) *(const grub_uint8_t *) p
+    : (int) *(const grub_int8_t *) p;
+}
+
+static void
+grub_ext2_str2hashbuf (const char *msg, int len, grub_uint32_t *buf, int num,
+		       int unsigned_char)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      val = grub_ext2_hash_char (msg + i, unsigned_char) + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static grub_uint32_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len)
+{
+  grub_uint32_t buf[4], in[8], hash = 0;
+  int unsigned_char = 0;
+  int i;
+
+  if (version >= EXT2_DX_HASH_UNSIGNED)
+    {
+      version -= EXT2_DX_HASH_UNSIGNED;
+      unsigned_char = 1;
+    }
+
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  switch (version)
+    {
+    case EXT2_DX_HASH_LEGACY:
+      {
+	grub_uint32_t hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+	for (i = 0; i < len; i++)
+	  {
+	    hash = hash1 + (hash0 ^ (grub_ext2_hash_char (name + i,
+							  unsigned_char)
+				     * 7152373));
+	    if (hash & 0x80000000)
+	      hash -= 0x7fffffff;
+	    hash1 = hash0;
+	    hash0 = hash;
+	  }
+	hash = hash0 << 1;
+	break;
+      }
+    case EXT2_DX_HASH_HALF_MD4:
+      for (; len > 0; len -= 32, name += 32)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 8, unsigned_char);
+	  grub_ext2_half_md4 (buf, in);
+	}
+      hash = buf[1];
+      break;
+    case EXT2_DX_HASH_TEA:
+      for (; len > 0; len -= 16, name += 16)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 4, unsigned_char);
+	  grub_ext2_tea (buf, in);
+	}
+      hash = buf[0];
+      break;
+    }
+
+  hash &= ~1;
+  /* Reserved for the end of the directory.  */
+  if (hash == 0xfffffffe)
+    hash = 0xfffffffc;
+  return hash;
+}
+
+/* Look for NAME in the directory block LEAF of DIRO.  Returns 1 if it was
+   found, 0 if not and -1 if the block is corrupted.  */
+static int
+grub_ext2_dx_leaf_find (struct grub_fshelp_node *diro, const char *leaf,
+			const char *name, grub_size_t namelen,
+			grub_fshelp_node_t *foundnode,
+			enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (diro->data);
+  grub_uint32_t pos;
+
+  for (pos = 0; pos + sizeof (struct ext2_dirent) <= blksz; )
+    {
+      const struct ext2_dirent *dirent
+	= (const struct ext2_dirent *) (leaf + pos);
+      grub_uint16_t len = grub_le_to_cpu16 (dirent->direntlen);
+
+      if (len < sizeof (struct ext2_dirent) || pos + len > blksz
+	  || sizeof (struct ext2_dirent) + dirent->namelen > len)
+	return -1;
+
+      if (dirent->inode != 0 && dirent->namelen == namelen
+	  && grub_memcmp (dirent + 1, name, namelen) == 0)
+	{
+	  *foundnode = grub_ext2_dirent_node (diro, dirent, foundtype);
+	  if (! *foundnode)
+	    return 0;
+	  /* fshelp doesn't return entries of other types either.  */
+	  if (*foundtype == GRUB_FSHELP_UNKNOWN)
+	    {
+	      grub_free (*foundnode);
+	      *foundnode = 0;
+	      return 0;
+	    }
+	  return 1;
+	}
+      pos += len;
+    }
+  return 0;
+}
+
+/* One level of the path from the root of a hash tree index to a leaf.  */
+struct grub_ext2_dx_frame
+{
+  struct grub_ext2_dx_entry *entries;
+  unsigned count;
+  unsigned at;
+};
+
+/* Set up FRAME for the index node in BUF, whose entries start at OFF.  */
+static int
+grub_ext2_dx_frame_init (struct grub_ext2_dx_frame *frame, char *buf,
+			 unsigned off, grub_uint32_t blksz)
+{
+  struct grub_ext2_dx_countlimit *cl
+    = (struct grub_ext2_dx_countlimit *) (buf + off);
+  unsigned limit = grub_le_to_cpu16 (cl->limit);
+
+  frame->entries = (struct grub_ext2_dx_entry *) (buf + off);
+  frame->count = grub_le_to_cpu16 (cl->count);
+  frame->at = 0;
+  return frame->count != 0 && frame->count <= limit
+    && off + limit * sizeof (struct grub_ext2_dx_entry) <= blksz;
+}
+
+/* Read the index node of DIRO the current entry of FRAME points to into
+   BUF and set up NEXT for it.  */
+static int
+grub_ext2_dx_read_node (struct grub_fshelp_node *diro,
+			struct grub_ext2_dx_frame *frame,
+			struct grub_ext2_dx_frame *next, char *buf,
+			grub_uint32_t nblocks)
+{
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (diro->data);
+  grub_uint32_t block;
+
+  block = grub_le_to_cpu32 (frame->entries[frame->at].block) & 0x0fffffff;
+  if (block == 0 || block >= nblocks)
+    return 0;
+  if (grub_ext2_read_file (diro, 0, 0, (grub_off_t) block * blksz, blksz,
+			   buf) != (grub_ssize_t) blksz)
+    return 0;
+  /* Index nodes look like a block with one empty entry.  */
+  if (*(grub_uint32_t *) buf != 0)
+    return 0;
+  return grub_ext2_dx_frame_init (next, buf, sizeof (struct ext2_dirent),
+				  blksz);
+}
+
+/* Look NAME up through the hash tree index of the directory DIRO.
+   Returns 1 if it was found, 0 if it isn't there or on error and -1 if
+   the directory has no usable index.  */
+static int
+grub_ext2_dx_find (struct grub_fshelp_node *diro, const char *name,
+		   grub_fshelp_node_t *foundnode,
+		   enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = diro->data;
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (data);
+  grub_size_t namelen = grub_strlen (name);
+  struct grub_ext2_dx_frame frames[EXT2_DX_MAX_LEVELS];
+  struct grub_ext2_dx_frame *frame;
+  struct grub_ext2_dx_root_info *info;
+  grub_uint32_t nblocks, hash, block;
+  int version, levels, level, ret = -1;
+  char *buf, *leaf;
+
+  if (!(data->sblock.feature_compatibility
+	& grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      || !(diro->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FLAG))
+      || namelen == 0 || namelen > MAX_NAMELEN
+      || grub_strcmp (name, ".") == 0 || grub_strcmp (name, "..") == 0)
+    return -1;
+
+  nblocks = grub_le_to_cpu32 (diro->inode.size) >> LOG2_BLOCK_SIZE (data);
+  /* One block for each level of the index and one for the leaf.  */
+  buf = grub_malloc ((EXT2_DX_MAX_LEVELS + 1) * blksz);
+  if (! buf)
+    return 0;
+  leaf = buf + EXT2_DX_MAX_LEVELS * blksz;
+
+  if (grub_ext2_read_file (diro, 0, 0, 0, blksz, buf) != (grub_ssize_t) blksz)
+    goto fail;
+
+  /* The root follows the "." and ".." entries of 12 bytes each.  */
+  info = (struct grub_ext2_dx_root_info *) (buf + 24);
+  if (info->reserved_zero != 0
+      || info->info_length != sizeof (*info)
+      || info->hash_version > EXT2_DX_HASH_TEA
+      || info->indirect_levels >= EXT2_DX_MAX_LEVELS)
+    goto fail;
+
+  version = info->hash_version;
+  if (data->sblock.flags
+      & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH))
+    version += EXT2_DX_HASH_UNSIGNED;
+  hash = grub_ext2_dx_hash (data, version, name, namelen);
+  levels = info->indirect_levels;
+
+  if (! grub_ext2_dx_frame_init (&frames[0], buf, 24 + sizeof (*info), blksz))
+    goto fail;
+
+  for (level = 0; ; level++)
+    {
+      unsigned lo = 1, hi;
+
+      frame = &frames[level];
+      /* Find the last entry with a hash not above ours.  The first one
+	 covers all hashes below the second one.  */
+      hi = frame->count;
+      while (lo < hi)
+	{
+	  unsigned mid = (lo + hi) / 2;
+	  if (grub_le_to_cpu32 (frame->entries[mid].hash) > hash)
+	    hi = mid;
+	  else
+	    lo = mid + 1;
+	}
+      frame->at = lo - 1;
+
+      if (level == levels)
+	break;
+      if (! grub_ext2_dx_read_node (diro, frame, &frames[level + 1],
+				    buf + (level + 1) * blksz, nblocks))
+	goto fail;
+    }
+
+  while (1)
+    {
+      grub_uint32_t next;
+
+      frame = &frames[levels];
+      block = grub_le_to_cpu32 (frame->entries[frame->at].block) & 0x0fffffff;
+      if (block == 0 || block >= nblocks
+	  || grub_ext2_read_file (diro, 0, 0, (grub_off_t) block * blksz, blksz,
+				  leaf) != (grub_ssize_t) blksz)
+	{
+	  ret = -1;
+	  break;
+	}
+      ret = grub_ext2_dx_leaf_find (diro, leaf, name, namelen,
+				    foundnode, foundtype);
+      if (ret != 0)
+	break;
+
+      /* Names with the same hash may continue in the next leaf, whose
+	 entry then has the lowest bit of its hash set.  That leaf may be
+	 under the next index node.  */
+      for (level = levels; frames[level].at + 1 == frames[level].count; level--)
+	if (level == 0)
+	  goto fail;
+      frame = &frames[level];
+      frame->at++;
+      next = grub_le_to_cpu32 (frame->entries[frame->at].hash);
+      if (!(next & 1) || (next & ~1) != hash)
+	break;
+      for (; level < levels; level++)
+	if (! grub_ext2_dx_read_node (diro, &frames[level], &frames[level + 1],
+				      buf + (level + 1) * blksz, nblocks))
+	  {
+	    ret = -1;
+	    goto fail;
+	  }
+    }
+
+ fail:
+  if (ret < 0 && grub_errno == GRUB_ERR_NONE)
+    grub_dprintf ("ext2", "not using the index of directory inode %d\n",
+		  diro->ino);
+  grub_free (buf);
+  if (grub_errno)
+    return 0;
+  return ret;
+}
+
+struct grub_ext2_find_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file.  */
+static int
+grub_ext2_find_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		     grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_find_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN || grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in the directory DIR, through its index if it has one.  */
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_find_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (! dir->inode_read)
+    {
+      grub_ext2_read_inode (dir->data, dir->ino, &dir->inode);
+      if (grub_errno)
+	return grub_errno;
+      dir->inode_read = 1;
+    }
+
+  if (dir->inode.flags & grub_cpu_to_le32_compile_time (EXT4_ENCRYPT_FLAG))
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "directory is encrypted");
+
+  if (grub_ext2_dx_find (dir, name, foundnode, foundtype) >= 0)
+    return grub_errno;
+
+  grub_ext2_iterate_dir (dir, grub_ext2_find_iter, &ctx);
+  return grub_errno;
+}
+
+static grub_size_t
+grub_ext2_node_size (grub_fshelp_node_t node)
+{
+  return sizeof (*node);
+}
+
+static void
+grub_ext2_node_attach (grub_fshelp_node_t node, void *mount)
+{
+  node->data = mount;
+}
+
+static const struct grub_fshelp_node_desc grub_ext2_node_desc =
+  {
+    .name = "ext2",
+    .node_size = grub_ext2_node_size,
+    .attach = grub_ext2_node_attach
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -861,9 +1533,11 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      NULL, grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      file->device->disk, &grub_ext2_node_desc,
+				      data);
   if (err)
     goto fail;
 
@@ -881,6 +1555,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
     }
 
   grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
+  data->diropen.ino = fdiro->ino;
   grub_free (fdiro);
 
   file->size = grub_le_to_cpu32 (data->inode->size);
@@ -893,7 +1568,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -903,7 +1578,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_ext2_free_data (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -973,9 +1648,10 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				NULL, grub_ext2_lookup_file,
+				grub_ext2_read_symlink, GRUB_FSHELP_DIR,
+				device->disk, &grub_ext2_node_desc, ctx.data);
   if (grub_errno)
     goto fail;
 
@@ -984,7 +1660,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_free_data (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -161,6 +161,18 @@ typedef struct grub_fat_dir_entry grub_fat_dir_node_t;
 
 #endif
 
+/* Clusters which follow each other on disk, starting with the cluster
+   CLUSTER at the logical cluster LOGICAL of the file.  It goes on up to
+   the next run.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+};
+
+/* Bytes of the FAT read at once while following a cluster chain.  */
+#define GRUB_FAT_WINDOW_SIZE	4096
+
 struct grub_fat_data
 {
   int logical_sector_bits;
@@ -182,6 +194,20 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+  /* Cluster chain of the file starting with RUNS_CLUSTER, decoded up to
+     the logical cluster RUNS_END.  */
+  struct grub_fat_run *runs;
+  grub_uint32_t nruns;
+  grub_uint32_t runs_alloc;
+  grub_uint32_t runs_cluster;
+  grub_uint32_t runs_end;
+  int runs_eof;
+
+  /* Part of the FAT read last, starting FAT_WINDOW_OFFSET bytes into it.  */
+  grub_uint8_t *fat_window;
+  grub_uint32_t fat_window_offset;
+  grub_uint32_t fat_window_size;
 };
 
 struct grub_fshelp_node {
@@ -195,8 +221,6 @@ struct grub_fshelp_node {
   grub_uint64_t file_size;
 #endif
   grub_uint32_t file_cluster;
-  grub_uint32_t cur_cluster_num;
-  grub_uint32_t cur_cluster;
 
 #ifdef MODE_EXFAT
   int is_contiguous;
@@ -234,7 +258,7 @@ grub_fat_mount (grub_disk_t disk)
   if (! disk)
     goto fail;
 
-  data = (struct grub_fat_data *) grub_malloc (sizeof (*data));
+  data = (struct grub_fat_data *) grub_zalloc (sizeof (*data));
   if (! data)
     goto fail;
 
@@ -448,13 +472,168 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_fat_unmount (struct grub_fat_data *data)
+{
+  if (data)
+    {
+      grub_free (data->runs);
+      grub_free (data->fat_window);
+    }
+  grub_free (data);
+}
+
+/* Read the FAT entry of CLUSTER into NEXT.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t fat_offset, fat_bytes;
+  grub_uint32_t next_cluster = 0;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+
+  /* Read the FAT, a window of it at a time.  */
+  if (! data->fat_window)
+    {
+      data->fat_window = grub_malloc (GRUB_FAT_WINDOW_SIZE);
+      if (! data->fat_window)
+	return grub_errno;
+    }
+  if (fat_offset < data->fat_window_offset
+      || (fat_offset + ((data->fat_size + 7) >> 3)
+	  > data->fat_window_offset + data->fat_window_size))
+    {
+      fat_bytes = data->sectors_per_fat << GRUB_DISK_SECTOR_BITS;
+      if (fat_offset + ((data->fat_size + 7) >> 3) > fat_bytes)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", cluster);
+      data->fat_window_offset = fat_offset & ~(GRUB_DISK_SECTOR_SIZE - 1);
+      data->fat_window_size = fat_bytes - data->fat_window_offset;
+      if (data->fat_window_size > GRUB_FAT_WINDOW_SIZE)
+	data->fat_window_size = GRUB_FAT_WINDOW_SIZE;
+      if (grub_disk_read (disk, data->fat_sector, data->fat_window_offset,
+			  data->fat_window_size, data->fat_window))
+	{
+	  data->fat_window_size = 0;
+	  return grub_errno;
+	}
+    }
+  grub_memcpy (&next_cluster,
+	       data->fat_window + (fat_offset - data->fat_window_offset),
+	       (data->fat_size + 7) >> 3);
+
+  next_cluster = grub_le_to_cpu32 (next_cluster);
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, next_cluster);
+
+  *next = next_cluster;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the cluster chain of NODE into runs up to the logical cluster
+   LAST, or up to its end if that comes first.  */
+static grub_err_t
+grub_fat_decode_chain (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_uint32_t last)
+{
+  struct grub_fat_data *data = node->data;
+
+  if (data->runs_cluster != node->file_cluster || data->nruns == 0)
+    {
+      if (! data->runs)
+	{
+	  data->runs_alloc = 16;
+	  data->runs = grub_malloc (data->runs_alloc * sizeof (data->runs[0]));
+	  if (! data->runs)
+	    return grub_errno;
+	}
+      data->runs[0].logical = 0;
+      data->runs[0].cluster = node->file_cluster;
+      data->nruns = 1;
+      data->runs_end = 1;
+      data->runs_eof = 0;
+      data->runs_cluster = node->file_cluster;
+    }
+
+  while (data->runs_end <= last && ! data->runs_eof)
+    {
+      struct grub_fat_run *run = &data->runs[data->nruns - 1];
+      grub_uint32_t cluster = run->cluster + (data->runs_end - 1 - run->logical);
+      grub_uint32_t next_cluster = 0;
+
+      if (grub_fat_next_cluster (disk, data, cluster, &next_cluster))
+	return grub_errno;
+
+      /* Check the end.  */
+      if (next_cluster >= data->cluster_eof_mark)
+	{
+	  data->runs_eof = 1;
+	  break;
+	}
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	{
+	  /* Don't keep a chain we couldn't follow.  */
+	  data->nruns = 0;
+	  return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			     next_cluster);
+	}
+
+      if (next_cluster != cluster + 1)
+	{
+	  if (data->nruns == data->runs_alloc)
+	    {
+	      struct grub_fat_run *runs;
+
+	      runs = grub_realloc (data->runs, 2 * data->runs_alloc
+				   * sizeof (data->runs[0]));
+	      if (! runs)
+		return grub_errno;
+	      data->runs = runs;
+	      data->runs_alloc *= 2;
+	    }
+	  data->runs[data->nruns].logical = data->runs_end;
+	  data->runs[data->nruns].cluster = next_cluster;
+	  data->nruns++;
+	}
+      data->runs_end++;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t offset, grub_size_t len, char *buf)
 {
   grub_size_t size;
-  grub_uint32_t logical_cluster;
+  grub_uint32_t logical_cluster, lo, hi, i;
   unsigned logical_cluster_bits;
   grub_ssize_t ret = 0;
   unsigned long sector;
@@ -501,77 +680,40 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
-  if (logical_cluster < node->cur_cluster_num)
+  if (len == 0)
+    return 0;
+
+  if (grub_fat_decode_chain (disk, node,
+			     logical_cluster
+			     + ((offset + len - 1) >> logical_cluster_bits)))
+    return -1;
+
+  /* Find the last run starting at or before LOGICAL_CLUSTER.  */
+  lo = 0;
+  hi = node->data->nruns;
+  while (lo < hi)
     {
-      node->cur_cluster_num = 0;
-      node->cur_cluster = node->file_cluster;
+      grub_uint32_t mid = (lo + hi) / 2;
+      if (node->data->runs[mid].logical > logical_cluster)
+	hi = mid;
+      else
+	lo = mid + 1;
     }
+  i = lo - 1;
 
-  while (len)
+  while (len && logical_cluster < node->data->runs_end)
     {
-      while (logical_cluster > node->cur_cluster_num)
-	{
-	  /* Find next cluster.  */
-	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
-
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
-	    return -1;
-
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
+      struct grub_fat_run *run = &node->data->runs[i];
+      grub_uint32_t run_end = (i + 1 < node->data->nruns
+			       ? node->data->runs[i + 1].logical
+			       : node->data->runs_end);
 
-	  /* Check the end.  */
-	  if (next_cluster >= node->data->cluster_eof_mark)
-	    return ret;
-
-	  if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
-
-	  node->cur_cluster = next_cluster;
-	  node->cur_cluster_num++;
-	}
-
-      /* Read the data here.  */
+      /* Read the data here, up to the end of the run.  */
       sector = (node->data->cluster_sector
-		+ ((node->cur_cluster - 2)
+		+ ((run->cluster + (logical_cluster - run->logical) - 2)
 		   << node->data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
+      size = ((grub_size_t) (run_end - logical_cluster)
+	      << logical_cluster_bits) - offset;
       if (size > len)
 	size = len;
 
@@ -585,8 +727,9 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
+      logical_cluster = run_end;
       offset = 0;
+      i++;
     }
 
   return ret;
@@ -899,7 +1042,6 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	  if (!(*foundnode)->file_cluster)
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
-	  (*foundnode)->cur_cluster_num = ~0U;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -918,6 +1060,31 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 
 }
 
+static grub_size_t
+grub_fat_node_size (grub_fshelp_node_t node)
+{
+  return sizeof (*node);
+}
+
+/* ROOT is the root directory of the current mount.  */
+static void
+grub_fat_node_attach (grub_fshelp_node_t node, void *root)
+{
+  node->disk = ((grub_fshelp_node_t) root)->disk;
+  node->data = ((grub_fshelp_node_t) root)->data;
+}
+
+static const struct grub_fshelp_node_desc grub_fat_node_desc =
+  {
+#ifdef MODE_EXFAT
+    .name = "exfat",
+#else
+    .name = "fat",
+#endif
+    .node_size = grub_fat_node_size,
+    .attach = grub_fat_node_attach
+  };
+
 static grub_err_t
 grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 	      void *hook_data)
@@ -940,14 +1107,14 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (path, &root, &found, lookup_file, NULL, GRUB_FSHELP_DIR);
+  err = grub_fshelp_find_file_cached (path, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_DIR, disk,
+				      &grub_fat_node_desc, &root);
   if (err)
     goto fail;
 
@@ -981,7 +1148,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1008,14 +1175,14 @@ grub_fat_open (grub_file_t file, const char *name)
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (name, &root, &found, lookup_file, NULL, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_REG, disk,
+				      &grub_fat_node_desc, &root);
   if (err)
     goto fail;
 
@@ -1029,7 +1196,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1049,7 +1216,7 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
-  grub_free (node->data);
+  grub_fat_unmount (node->data);
   grub_free (node);
 
   grub_dl_unref (my_mod);
@@ -1068,8 +1235,6 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
     .is_contiguous = 0,
   };
 
@@ -1105,7 +1270,7 @@ grub_fat_label (grub_device_t device, char **label)
 				* GRUB_MAX_UTF8_PER_UTF16 + 1);
 	  if (!*label)
 	    {
-	      grub_free (root.data);
+	      grub_fat_unmount (root.data);
 	      return grub_errno;
 	    }
 	  chc = dir.type_specific.volume_label.character_count;
@@ -1117,7 +1282,7 @@ grub_fat_label (grub_device_t device, char **label)
 	}
     }
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
   return grub_errno;
 }
 
@@ -1133,8 +1298,6 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
   };
 
   *label = 0;
@@ -1164,7 +1327,7 @@ grub_fat_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (root.data);
+  grub_fat_unmount (root.data);
 
   return grub_errno;
 }
@@ -24,9 +24,37 @@
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Number of slots in the lookup cache and the largest node kept in it.  */
+#define GRUB_FSHELP_CACHE_SLOTS		509
+#define GRUB_FSHELP_CACHE_MAX_NODE	4096
+
+/* Like the disk cache, the lookup cache is dropped when it hasn't been
+   used for this many seconds, as the medium might have been changed.  */
+#define GRUB_FSHELP_CACHE_TIMEOUT	2
+
+/* The result of looking up a name in a directory, identified by the
+   device, the filesystem and the path of the entry from the root.  */
+struct grub_fshelp_cache_entry
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* Filesystem name followed by the path, NULL for an unused slot.  */
+  char *key;
+  /* Copy of the node, NULL if the name doesn't exist.  */
+  grub_fshelp_node_t node;
+  grub_size_t node_size;
+  enum grub_fshelp_filetype type;
+};
+
+static struct grub_fshelp_cache_entry *lookup_cache;
+static grub_uint64_t lookup_cache_last_use;
+
 typedef int (*iterate_dir_func) (grub_fshelp_node_t dir,
 				 grub_fshelp_iterate_dir_hook_t hook,
 				 void *data);
@@ -40,6 +68,8 @@ struct stack_element {
   struct stack_element *parent;
   grub_fshelp_node_t node;
   enum grub_fshelp_filetype type;
+  /* Path from the root, only kept when lookups are cached.  */
+  char *path;
 };
 
 /* Context for grub_fshelp_find_file.  */
@@ -54,6 +84,11 @@ struct grub_fshelp_find_file_ctx
 
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
+
+  /* Lookup cache, DESC is NULL if it isn't used.  */
+  grub_disk_t disk;
+  const struct grub_fshelp_node_desc *desc;
+  void *mount;
 };
 
 /* Helper for find_file_iter.  */
@@ -71,6 +106,7 @@ pop_element (struct grub_fshelp_find_file_ctx *ctx)
   el = ctx->currnode;
   ctx->currnode = el->parent;
   free_node (el->node, ctx);
+  grub_free (el->path);
   grub_free (el);
 }
 
@@ -89,15 +125,21 @@ go_up_a_level (struct grub_fshelp_find_file_ctx *ctx)
   pop_element (ctx);
 }
 
+/* Push NODE, PATH is taken over.  */
 static grub_err_t
-push_node (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node, enum grub_fshelp_filetype filetype)
+push_node (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node,
+	   enum grub_fshelp_filetype filetype, char *path)
 {
   struct stack_element *nst;
   nst = grub_malloc (sizeof (*nst));
   if (!nst)
-    return grub_errno;
+    {
+      grub_free (path);
+      return grub_errno;
+    }
   nst->node = node;
   nst->type = filetype & ~GRUB_FSHELP_CASE_INSENSITIVE;
+  nst->path = path;
   nst->parent = ctx->currnode;
   ctx->currnode = nst;
   return GRUB_ERR_NONE;
@@ -106,8 +148,13 @@ push_node (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node, enum
 static grub_err_t
 go_to_root (struct grub_fshelp_find_file_ctx *ctx)
 {
+  char *path = NULL;
+
   free_stack (ctx);
-  return push_node (ctx, ctx->rootnode, GRUB_FSHELP_DIR);
+  if (ctx->desc)
+    path = grub_strdup ("");
+  grub_errno = GRUB_ERR_NONE;
+  return push_node (ctx, ctx->rootnode, GRUB_FSHELP_DIR, path);
 }
 
 struct grub_fshelp_find_file_iter_ctx
@@ -158,6 +205,131 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+static void
+lookup_cache_flush (void)
+{
+  unsigned i;
+
+  if (!lookup_cache)
+    return;
+  for (i = 0; i < GRUB_FSHELP_CACHE_SLOTS; i++)
+    {
+      grub_free (lookup_cache[i].key);
+      grub_free (lookup_cache[i].node);
+    }
+  grub_free (lookup_cache);
+  lookup_cache = NULL;
+}
+
+static struct grub_fshelp_cache_entry *
+lookup_cache_slot (grub_disk_t disk, grub_disk_addr_t part_start,
+		   const char *key)
+{
+  grub_uint32_t hash;
+  const char *ptr;
+
+  hash = (disk->dev->id * 524287UL + disk->id * 2606459UL
+	  + (grub_uint32_t) part_start);
+  for (ptr = key; *ptr; ptr++)
+    hash = hash * 31 + (grub_uint8_t) *ptr;
+  return &lookup_cache[hash % GRUB_FSHELP_CACHE_SLOTS];
+}
+
+/* Look NAME up in the current directory, through the cache if the
+   filesystem supports it.  The path of the entry is returned in PATH
+   for the stack.  */
+static grub_err_t
+lookup_name (struct grub_fshelp_find_file_ctx *ctx, const char *name,
+	     grub_fshelp_node_t *foundnode,
+	     enum grub_fshelp_filetype *foundtype, char **path,
+	     iterate_dir_func iterate_dir, lookup_file_func lookup_file)
+{
+  struct grub_fshelp_cache_entry *entry = NULL;
+  grub_disk_addr_t part_start = 0;
+  char *key = NULL;
+  grub_uint64_t now;
+  grub_err_t err;
+
+  *path = NULL;
+  if (ctx->desc && ctx->currnode->path)
+    {
+      now = grub_get_time_ms ();
+      if (now > lookup_cache_last_use + GRUB_FSHELP_CACHE_TIMEOUT * 1000)
+	lookup_cache_flush ();
+      lookup_cache_last_use = now;
+
+      if (!lookup_cache)
+	lookup_cache = grub_zalloc (GRUB_FSHELP_CACHE_SLOTS
+				    * sizeof (lookup_cache[0]));
+      *path = grub_xasprintf ("%s/%s", ctx->currnode->path, name);
+      if (*path)
+	key = grub_xasprintf ("%s%s", ctx->desc->name, *path);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (key && lookup_cache)
+    {
+      if (ctx->disk->partition)
+	part_start = grub_partition_get_start (ctx->disk->partition);
+      entry = lookup_cache_slot (ctx->disk, part_start, key);
+      if (entry->key && entry->dev_id == ctx->disk->dev->id
+	  && entry->disk_id == ctx->disk->id
+	  && entry->part_start == part_start
+	  && grub_strcmp (entry->key, key) == 0)
+	{
+	  grub_free (key);
+	  *foundtype = entry->type;
+	  if (!entry->node)
+	    return GRUB_ERR_NONE;
+	  *foundnode = grub_malloc (entry->node_size);
+	  if (!*foundnode)
+	    return grub_errno;
+	  grub_memcpy (*foundnode, entry->node, entry->node_size);
+	  ctx->desc->attach (*foundnode, ctx->mount);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (lookup_file)
+    err = lookup_file (ctx->currnode->node, name, foundnode, foundtype);
+  else
+    err = directory_find_file (ctx->currnode->node, name, foundnode, foundtype, iterate_dir);
+  if (err || !entry)
+    {
+      grub_free (key);
+      return err;
+    }
+
+  /* Remember the result, negative ones included.  */
+  grub_free (entry->key);
+  grub_free (entry->node);
+  entry->key = NULL;
+  entry->node = NULL;
+  if (*foundnode)
+    {
+      entry->node_size = ctx->desc->node_size (*foundnode);
+      if (entry->node_size > GRUB_FSHELP_CACHE_MAX_NODE)
+	{
+	  grub_free (key);
+	  return GRUB_ERR_NONE;
+	}
+      entry->node = grub_malloc (entry->node_size);
+      if (!entry->node)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_free (key);
+	  return GRUB_ERR_NONE;
+	}
+      grub_memcpy (entry->node, *foundnode, entry->node_size);
+    }
+  entry->key = key;
+  entry->dev_id = ctx->disk->dev->id;
+  entry->disk_id = ctx->disk->id;
+  entry->part_start = part_start;
+  entry->type = *foundtype;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -171,6 +343,7 @@ find_file (char *currpath,
       char c;
       grub_fshelp_node_t foundnode = NULL;
       enum grub_fshelp_filetype foundtype = 0;
+      char *path;
 
       /* Remove all leading slashes.  */
       while (*name == '/')
@@ -202,19 +375,23 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
-      else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+      err = lookup_name (ctx, name, &foundnode, &foundtype, &path,
+			 iterate_dir, lookup_file);
       *next = c;
 
       if (err)
-	return err;
+	{
+	  grub_free (path);
+	  return err;
+	}
 
       if (!foundnode)
-	break;
+	{
+	  grub_free (path);
+	  break;
+	}
 
-      push_node (ctx, foundnode, foundtype);
+      push_node (ctx, foundnode, foundtype, path);
  
       /* Read in the symlink and follow it.  */
       if (ctx->currnode->type == GRUB_FSHELP_SYMLINK)
@@ -264,13 +441,19 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_node_desc *desc,
+			    void *mount)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
-    .currnode = 0
+    .currnode = 0,
+    .disk = disk,
+    .desc = disk ? desc : NULL,
+    .mount = mount
   };
   grub_err_t err;
   enum grub_fshelp_filetype foundtype;
@@ -327,7 +510,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL, NULL);
 
 }
 
@@ -340,27 +523,71 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL, NULL);
 
 }
 
-/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
-   beginning with the block POS.  READ_HOOK should be set before
-   reading a block from the file.  READ_HOOK_DATA is passed through as
-   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
-grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+/* Like grub_fshelp_find_file or, if ITERATE_DIR is NULL,
+   grub_fshelp_find_file_lookup, but the result of looking up each path
+   component is kept across mounts of the filesystem on DISK.  DESC
+   describes its nodes and MOUNT is passed to DESC->attach for nodes
+   taken from the cache.  */
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      lookup_file_func lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_node_desc *desc,
+			      void *mount)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, iterate_dir ? NULL : lookup_file,
+				     read_symlink, expecttype, disk, desc,
+				     mount);
+}
+
+/* Map the block BLOCK of NODE through GET_EXTENT, or GET_BLOCK if that is
+   NULL, and set COUNT to the length of the run it starts.  */
+static grub_disk_addr_t
+map_blocks (grub_fshelp_node_t node, grub_disk_addr_t block,
+	    grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					   grub_disk_addr_t block),
+	    grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+					    grub_disk_addr_t block,
+					    grub_disk_addr_t *count),
+	    grub_disk_addr_t *count)
 {
-  grub_disk_addr_t i, blockcnt;
+  grub_disk_addr_t blknr;
+
+  *count = 1;
+  if (! get_extent)
+    return get_block (node, block);
+
+  blknr = get_extent (node, block, count);
+  if (*count == 0)
+    *count = 1;
+  return blknr;
+}
+
+static grub_ssize_t
+read_file (grub_disk_t disk, grub_fshelp_node_t node,
+	   grub_disk_read_hook_t read_hook, void *read_hook_data,
+	   grub_off_t pos, grub_size_t len, char *buf,
+	   grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					  grub_disk_addr_t block),
+	   grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+					   grub_disk_addr_t block,
+					   grub_disk_addr_t *count),
+	   grub_off_t filesize, int log2blocksize,
+	   grub_disk_addr_t blocks_start)
+{
+  grub_disk_addr_t i, first, blockcnt, count, blknr;
+  grub_disk_addr_t next = 0, nextcount = 0;
   int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  int have_next = 0;
 
   if (pos > filesize)
     {
@@ -374,36 +601,57 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
     len = filesize - pos;
 
   blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  first = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
 
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
+  for (i = first; i < blockcnt; i += count)
     {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
+      grub_size_t skipfirst = 0;
+      grub_size_t size;
 
-      int skipfirst = 0;
+      if (have_next)
+	{
+	  blknr = next;
+	  count = nextcount;
+	}
+      else
+	{
+	  blknr = map_blocks (node, i, get_block, get_extent, &count);
+	  if (grub_errno)
+	    return -1;
+	}
+      have_next = 0;
+      if (count > blockcnt - i)
+	count = blockcnt - i;
 
-      blknr = get_block (node, i);
-      if (grub_errno)
-	return -1;
+      /* Read the blocks which follow each other on disk in one go, and
+	 likewise clear consecutive holes at once.  */
+      while (i + count < blockcnt)
+	{
+	  next = map_blocks (node, i + count, get_block, get_extent,
+			     &nextcount);
+	  if (grub_errno)
+	    return -1;
+	  if (next != (blknr ? blknr + count : 0))
+	    {
+	      have_next = 1;
+	      break;
+	    }
+	  count += nextcount;
+	  if (count > blockcnt - i)
+	    count = blockcnt - i;
+	}
 
-      blknr = blknr << log2blocksize;
+      size = count << (log2blocksize + GRUB_DISK_SECTOR_BITS);
 
       /* Last block.  */
-      if (i == blockcnt - 1)
-	{
-	  blockend = (len + pos) & (blocksize - 1);
-
-	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
-	}
+      if (i + count == blockcnt && ((len + pos) & (blocksize - 1)))
+	size -= blocksize - ((len + pos) & (blocksize - 1));
 
       /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
+      if (i == first)
 	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
+	  skipfirst = pos & (blocksize - 1);
+	  size -= skipfirst;
 	}
 
       /* If the block number is 0 this block is not stored on disk but
@@ -413,17 +661,56 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 	  disk->read_hook = read_hook;
 	  disk->read_hook_data = read_hook_data;
 
-	  grub_disk_read (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf);
+	  grub_disk_read (disk, (blknr << log2blocksize) + blocks_start,
+			  skipfirst, size, buf);
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
 	}
       else
-	grub_memset (buf, 0, blockend);
+	grub_memset (buf, 0, size);
 
-      buf += blocksize - skipfirst;
+      buf += size;
     }
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the block POS.  READ_HOOK should be set before
+   reading a block from the file.  READ_HOOK_DATA is passed through as
+   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
+   file blocks to disk blocks.  The file is FILESIZE bytes big and the
+   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return read_file (disk, node, read_hook, read_hook_data, pos, len, buf,
+		    get_block, NULL, filesize, log2blocksize, blocks_start);
+}
+
+grub_ssize_t
+grub_fshelp_read_file_extent (grub_disk_t disk, grub_fshelp_node_t node,
+			      grub_disk_read_hook_t read_hook,
+			      void *read_hook_data,
+			      grub_off_t pos, grub_size_t len, char *buf,
+			      grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+							      grub_disk_addr_t block,
+							      grub_disk_addr_t *count),
+			      grub_off_t filesize, int log2blocksize,
+			      grub_disk_addr_t blocks_start)
+{
+  return read_file (disk, node, read_hook, read_hook_data, pos, len, buf,
+		    NULL, get_extent, filesize, log2blocksize, blocks_start);
+}
+
+GRUB_MOD_FINI (fshelp)
+{
+  lookup_cache_flush ();
+}
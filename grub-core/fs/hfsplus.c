@@ -113,12 +113,12 @@ grub_ssize_t (*grub_hfsplus_read_compressed) (struct grub_hfsplus_file *node,
 					      grub_size_t len,
 					      char *buf);
 
-/* Find the extent that points to FILEBLOCK.  If it is not in one of
-   the 8 extents described by EXTENT, return -1.  In that case set
-   FILEBLOCK to the next block.  */
+/* Find the extent that points to FILEBLOCK and set COUNT to the number
+   of blocks left in it.  If it is not in one of the 8 extents described
+   by EXTENT, return -1.  In that case set FILEBLOCK to the next block.  */
 static grub_disk_addr_t
 grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
-			 grub_disk_addr_t *fileblock)
+			 grub_disk_addr_t *fileblock, grub_disk_addr_t *count)
 {
   int i;
   grub_disk_addr_t blksleft = *fileblock;
@@ -127,7 +127,10 @@ grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
   for (i = 0; i < 8; i++)
     {
       if (blksleft < grub_be_to_cpu32 (extent[i].count))
-	return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	{
+	  *count = grub_be_to_cpu32 (extent[i].count) - blksleft;
+	  return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	}
       blksleft -= grub_be_to_cpu32 (extent[i].count);
     }
 
@@ -139,9 +142,11 @@ static int grub_hfsplus_cmp_extkey (struct grub_hfsplus_key *keya,
 				    struct grub_hfsplus_key_internal *keyb);
 
 /* Search for the block FILEBLOCK inside the file NODE.  Return the
-   blocknumber of this block on disk.  */
+   blocknumber of this block on disk and set COUNT to the number of blocks
+   left in its extent.  */
 static grub_disk_addr_t
-grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+			 grub_disk_addr_t *count)
 {
   struct grub_hfsplus_btnode *nnode = 0;
   grub_disk_addr_t blksleft = fileblock;
@@ -156,7 +161,7 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       grub_off_t ptr;
 
       /* Try to find this block in the current set of extents.  */
-      blk = grub_hfsplus_find_block (extents, &blksleft);
+      blk = grub_hfsplus_find_block (extents, &blksleft, count);
 
       /* The previous iteration of this loop allocated memory.  The
 	 code above used this memory, it can be freed now.  */
@@ -215,12 +220,12 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 			grub_disk_read_hook_t read_hook, void *read_hook_data,
 			grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_hfsplus_read_block,
-				node->size,
-				node->data->log2blksize - GRUB_DISK_SECTOR_BITS,
-				node->data->embedded_offset);
+  return grub_fshelp_read_file_extent (node->data->disk, node,
+				       read_hook, read_hook_data,
+				       pos, len, buf, grub_hfsplus_read_block,
+				       node->size,
+				       node->data->log2blksize - GRUB_DISK_SECTOR_BITS,
+				       node->data->embedded_offset);
 }
 
 static struct grub_hfsplus_data *
@@ -825,6 +830,28 @@ grub_hfsplus_iterate_dir (grub_fshelp_node_t dir,
   return ctx.ret;
 }
 
+static grub_size_t
+grub_hfsplus_node_size (grub_fshelp_node_t node)
+{
+  return sizeof (*node);
+}
+
+static void
+grub_hfsplus_node_attach (grub_fshelp_node_t node, void *mount)
+{
+  node->data = mount;
+  node->cbuf = 0;
+  node->file = 0;
+  node->compress_index = 0;
+}
+
+static const struct grub_fshelp_node_desc grub_hfsplus_node_desc =
+  {
+    .name = "hfsplus",
+    .node_size = grub_hfsplus_node_size,
+    .attach = grub_hfsplus_node_attach
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_hfsplus_open (struct grub_file *file, const char *name)
@@ -838,9 +865,11 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->dirroot, &fdiro,
+				grub_hfsplus_iterate_dir, NULL,
+				grub_hfsplus_read_symlink, GRUB_FSHELP_REG,
+				file->device->disk, &grub_hfsplus_node_desc,
+				data);
   if (grub_errno)
     goto fail;
 
@@ -948,9 +977,10 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
     goto fail;
 
   /* Find the directory that should be opened.  */
-  grub_fshelp_find_file (path, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->dirroot, &fdiro,
+				grub_hfsplus_iterate_dir, NULL,
+				grub_hfsplus_read_symlink, GRUB_FSHELP_DIR,
+				device->disk, &grub_hfsplus_node_desc, data);
   if (grub_errno)
     goto fail;
 
@@ -862,6 +862,39 @@ grub_iso9660_dir_iter (const char *filename,
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+static grub_size_t
+grub_iso9660_node_size (grub_fshelp_node_t node)
+{
+  grub_size_t size;
+
+  size = sizeof (*node) + ((node->alloc_dirents - ARRAY_SIZE (node->dirents))
+			   * sizeof (node->dirents[0]));
+  if (node->have_symlink)
+    {
+      const char *symlink = node->symlink
+	+ node->have_dirents * sizeof (node->dirents[0])
+	- sizeof (node->dirents);
+      grub_size_t end = symlink - (char *) node + grub_strlen (symlink) + 1;
+
+      if (end > size)
+	size = end;
+    }
+  return size;
+}
+
+static void
+grub_iso9660_node_attach (grub_fshelp_node_t node, void *mount)
+{
+  node->data = mount;
+}
+
+static const struct grub_fshelp_node_desc grub_iso9660_node_desc =
+  {
+    .name = "iso9660",
+    .node_size = grub_iso9660_node_size,
+    .attach = grub_iso9660_node_attach
+  };
+
 static grub_err_t
 grub_iso9660_dir (grub_device_t device, const char *path,
 		  grub_fs_dir_hook_t hook, void *hook_data)
@@ -884,11 +917,12 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir, NULL,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR, device->disk,
+				    &grub_iso9660_node_desc, data))
     goto fail;
 
   /* List the files in the directory.  */
@@ -927,11 +961,12 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir, NULL,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG, file->device->disk,
+				    &grub_iso9660_node_desc, data))
     goto fail;
 
   data->node = foundnode;
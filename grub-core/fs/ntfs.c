@@ -27,6 +27,8 @@
 #include <grub/fshelp.h>
 #include <grub/ntfs.h>
 #include <grub/charset.h>
+#include <grub/partition.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -490,14 +492,169 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   return ret;
 }
 
+/* The upcase table and the MFT records read last are kept for the
+   filesystem read last, so that resolving many paths doesn't read them
+   again.  Like the disk cache they are dropped when unused for this many
+   seconds, as the medium might have been changed.  */
+#define GRUB_NTFS_CACHE_TIMEOUT 2
+#define GRUB_NTFS_MFT_CACHE_ENTRIES 64
+
+struct grub_ntfs_cached_mft
+{
+  grub_uint64_t mftno;
+  /* The record after fixup, NULL for an unused entry.  */
+  grub_uint8_t *buf;
+  grub_uint64_t last_use;
+};
+
+/* The upcase table in CPU order.  The cache holds a reference and so does
+   every lookup using it, as reading during the lookup may drop the cache.  */
+struct grub_ntfs_upcase
+{
+  unsigned refs;
+  grub_uint16_t table[65536];
+};
+
+/* Filesystem the cache belongs to.  */
+static unsigned long ntfs_cache_dev_id;
+static unsigned long ntfs_cache_disk_id;
+static grub_disk_addr_t ntfs_cache_part_start;
+static grub_uint64_t ntfs_cache_serial;
+static grub_uint64_t ntfs_cache_mft_size;
+
+/* NULL if not read yet.  */
+static struct grub_ntfs_upcase *ntfs_cache_upcase;
+static struct grub_ntfs_cached_mft ntfs_cache_mft[GRUB_NTFS_MFT_CACHE_ENTRIES];
+static grub_uint64_t ntfs_cache_clock;
+static grub_uint64_t ntfs_cache_time;
+static unsigned long ntfs_cache_hits;
+static unsigned long ntfs_cache_misses;
+
+static void
+ntfs_upcase_put (struct grub_ntfs_upcase *upcase)
+{
+  if (upcase && --upcase->refs == 0)
+    grub_free (upcase);
+}
+
+static void
+ntfs_cache_flush (void)
+{
+  unsigned i;
+
+  ntfs_upcase_put (ntfs_cache_upcase);
+  ntfs_cache_upcase = NULL;
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_ENTRIES; i++)
+    {
+      grub_free (ntfs_cache_mft[i].buf);
+      ntfs_cache_mft[i].buf = NULL;
+    }
+}
+
+/* Make the cache that of the filesystem of DATA, dropping it if it
+   belongs to another one or has timed out.  */
+static void
+ntfs_cache_select (struct grub_ntfs_data *data)
+{
+  grub_disk_addr_t part_start = 0;
+  grub_uint64_t now;
+
+  if (data->disk->partition)
+    part_start = grub_partition_get_start (data->disk->partition);
+  now = grub_get_time_ms ();
+
+  if (now > ntfs_cache_time + GRUB_NTFS_CACHE_TIMEOUT * 1000
+      || ntfs_cache_dev_id != data->disk->dev->id
+      || ntfs_cache_disk_id != data->disk->id
+      || ntfs_cache_part_start != part_start
+      || ntfs_cache_serial != data->uuid
+      || ntfs_cache_mft_size != data->mft_size)
+    {
+      ntfs_cache_flush ();
+      ntfs_cache_dev_id = data->disk->dev->id;
+      ntfs_cache_disk_id = data->disk->id;
+      ntfs_cache_part_start = part_start;
+      ntfs_cache_serial = data->uuid;
+      ntfs_cache_mft_size = data->mft_size;
+    }
+  ntfs_cache_time = now;
+}
+
+/* Copy the cached MFT record MFTNO to BUF.  Return 0 if it isn't
+   cached.  */
+static int
+ntfs_cache_find_mft (struct grub_ntfs_data *data, grub_uint64_t mftno,
+		     grub_uint8_t *buf)
+{
+  unsigned i;
+
+  ntfs_cache_select (data);
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_ENTRIES; i++)
+    if (ntfs_cache_mft[i].buf && ntfs_cache_mft[i].mftno == mftno)
+      {
+	ntfs_cache_hits++;
+	ntfs_cache_mft[i].last_use = ++ntfs_cache_clock;
+	grub_memcpy (buf, ntfs_cache_mft[i].buf,
+		     data->mft_size << GRUB_NTFS_BLK_SHR);
+	return 1;
+      }
+  ntfs_cache_misses++;
+  return 0;
+}
+
+/* Keep a copy of the MFT record MFTNO in BUF, dropping the least recently
+   used one.  */
+static void
+ntfs_cache_add_mft (struct grub_ntfs_data *data, grub_uint64_t mftno,
+		    const grub_uint8_t *buf)
+{
+  struct grub_ntfs_cached_mft *victim = &ntfs_cache_mft[0];
+  grub_uint8_t *copy;
+  unsigned i;
+
+  ntfs_cache_select (data);
+
+  copy = grub_malloc (data->mft_size << GRUB_NTFS_BLK_SHR);
+  if (!copy)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (copy, buf, data->mft_size << GRUB_NTFS_BLK_SHR);
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_ENTRIES; i++)
+    {
+      if (!ntfs_cache_mft[i].buf)
+	{
+	  victim = &ntfs_cache_mft[i];
+	  break;
+	}
+      if (ntfs_cache_mft[i].last_use < victim->last_use)
+	victim = &ntfs_cache_mft[i];
+    }
+
+  grub_free (victim->buf);
+  victim->mftno = mftno;
+  victim->buf = copy;
+  victim->last_use = ++ntfs_cache_clock;
+}
+
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint64_t mftno)
 {
+  if (ntfs_cache_find_mft (data, mftno, buf))
+    return GRUB_ERR_NONE;
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%llx fails", (unsigned long long) mftno);
-  return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
+  if (fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    return grub_errno;
+
+  ntfs_cache_add_mft (data, mftno, buf);
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -549,6 +706,52 @@ free_file (struct grub_ntfs_file *mft)
   grub_free (mft->buf);
 }
 
+#define GRUB_NTFS_UPCASE_SIZE (65536 * sizeof (grub_uint16_t))
+
+/* Return a reference to the upcase table of the filesystem of DATA, NULL
+   if it can't be read.  Release it with ntfs_upcase_put ().  */
+static struct grub_ntfs_upcase *
+ntfs_cache_get_upcase (struct grub_ntfs_data *data)
+{
+  struct grub_ntfs_file file;
+  struct grub_ntfs_upcase *upcase;
+  unsigned i;
+
+  ntfs_cache_select (data);
+  if (ntfs_cache_upcase)
+    {
+      ntfs_cache_upcase->refs++;
+      return ntfs_cache_upcase;
+    }
+
+  grub_memset (&file, 0, sizeof (file));
+  file.data = data;
+  upcase = grub_malloc (sizeof (*upcase));
+  if (!upcase
+      || init_file (&file, GRUB_NTFS_FILE_UPCASE)
+      || file.size != GRUB_NTFS_UPCASE_SIZE
+      || read_attr (&file.attr, (grub_uint8_t *) upcase->table, 0,
+		    GRUB_NTFS_UPCASE_SIZE, 1, 0, 0))
+    {
+      grub_dprintf ("ntfs", "can't read the upcase table\n");
+      grub_errno = GRUB_ERR_NONE;
+      free_file (&file);
+      grub_free (upcase);
+      return NULL;
+    }
+  free_file (&file);
+
+  for (i = 0; i < 65536; i++)
+    upcase->table[i] = grub_le_to_cpu16 (upcase->table[i]);
+
+  /* Reading may have dropped the cache or made it another filesystem's.  */
+  ntfs_cache_select (data);
+  ntfs_upcase_put (ntfs_cache_upcase);
+  ntfs_cache_upcase = upcase;
+  upcase->refs = 2;
+  return upcase;
+}
+
 static char *
 get_utf8 (grub_uint8_t *in, grub_size_t len)
 {
@@ -571,6 +774,34 @@ get_utf8 (grub_uint8_t *in, grub_size_t len)
   return (char *) buf;
 }
 
+/* Make the node of the file named by the index entry at POS.  */
+static struct grub_ntfs_file *
+entry_node (struct grub_ntfs_file *diro, grub_uint8_t *pos,
+	    enum grub_fshelp_filetype *type)
+{
+  struct grub_ntfs_file *fdiro;
+  grub_uint32_t attr;
+
+  attr = u32at (pos, 0x48);
+  if (attr & GRUB_NTFS_ATTR_REPARSE)
+    *type = GRUB_FSHELP_SYMLINK;
+  else if (attr & GRUB_NTFS_ATTR_DIRECTORY)
+    *type = GRUB_FSHELP_DIR;
+  else
+    *type = GRUB_FSHELP_REG;
+  if (pos[0x51])
+    *type |= GRUB_FSHELP_CASE_INSENSITIVE;
+
+  fdiro = grub_zalloc (sizeof (struct grub_ntfs_file));
+  if (!fdiro)
+    return NULL;
+
+  fdiro->data = diro->data;
+  fdiro->ino = u64at (pos, 0) & 0xffffffffffffULL;
+  fdiro->mtime = u64at (pos, 0x20);
+  return fdiro;
+}
+
 static int
 list_file (struct grub_ntfs_file *diro, grub_uint8_t *pos,
 	   grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -598,32 +829,17 @@ list_file (struct grub_ntfs_file *diro, grub_uint8_t *pos,
 	{
 	  enum grub_fshelp_filetype type;
 	  struct grub_ntfs_file *fdiro;
-	  grub_uint32_t attr;
-
-	  attr = u32at (pos, 0x48);
-	  if (attr & GRUB_NTFS_ATTR_REPARSE)
-	    type = GRUB_FSHELP_SYMLINK;
-	  else if (attr & GRUB_NTFS_ATTR_DIRECTORY)
-	    type = GRUB_FSHELP_DIR;
-	  else
-	    type = GRUB_FSHELP_REG;
 
-	  fdiro = grub_zalloc (sizeof (struct grub_ntfs_file));
+	  fdiro = entry_node (diro, pos, &type);
 	  if (!fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = u64at (pos, 0) & 0xffffffffffffULL;
-	  fdiro->mtime = u64at (pos, 0x20);
-
 	  ustr = get_utf8 (np, ns);
 	  if (ustr == NULL)
 	    {
 	      grub_free (fdiro);
 	      return 0;
 	    }
-          if (namespace)
-            type |= GRUB_FSHELP_CASE_INSENSITIVE;
 
 	  if (hook (ustr, type, fdiro, hook_data))
 	    {
@@ -883,6 +1099,291 @@ done:
   return ret;
 }
 
+/* Compare the UTF-16 name A of ALEN characters with the on-disk name B
+   of BLEN characters in the order of filename indexes, ignoring case.  */
+static int
+collate_names (const grub_uint16_t *upcase, const grub_uint16_t *a,
+	       grub_size_t alen, grub_uint8_t *b, grub_size_t blen)
+{
+  grub_size_t i;
+
+  for (i = 0; i < alen && i < blen; i++)
+    {
+      grub_uint16_t ca = upcase[a[i]], cb = upcase[u16at (b, 2 * i)];
+
+      if (ca != cb)
+	return ca < cb ? -1 : 1;
+    }
+  if (alen != blen)
+    return alen < blen ? -1 : 1;
+  return 0;
+}
+
+/* Find the $I30 index root of MFT and the SIZE of its value.  */
+static grub_uint8_t *
+find_index_root (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft,
+		 grub_uint32_t *size)
+{
+  grub_uint8_t *cur_pos;
+
+  init_attr (at, mft);
+  while (1)
+    {
+      cur_pos = find_attr (at, GRUB_NTFS_AT_INDEX_ROOT);
+      if (cur_pos == NULL)
+	return NULL;
+
+      /* Resident, Namelen=4, Offset=0x18, Flags=0x00, Name="$I30" */
+      if ((u32at (cur_pos, 8) != 0x180400) ||
+	  (u32at (cur_pos, 0x18) != 0x490024) ||
+	  (u32at (cur_pos, 0x1C) != 0x300033))
+	continue;
+      *size = u32at (cur_pos, 0x10);
+      if (*size < 0x20
+	  || u16at (cur_pos, 0x14) + (grub_uint64_t) *size > u32at (cur_pos, 4))
+	return NULL;
+      cur_pos += u16at (cur_pos, 0x14);
+      if (*cur_pos != 0x30 || u32at (cur_pos, 4) != 1) /* Not filename index */
+	continue;
+      return cur_pos;
+    }
+}
+
+/* Maximum depth of the index of a directory.  */
+#define GRUB_NTFS_MAX_INDEX_DEPTH 16
+
+/* Find NAME in the directory DIR by descending its index.  Return 1 if
+   it was found, 0 if it isn't there and -1 if the index can't tell, for
+   instance because NAME matched a DOS name or one differing in case on a
+   case-sensitive entry.  */
+static int
+index_find (struct grub_ntfs_file *dir, const char *name,
+	    grub_fshelp_node_t *foundnode,
+	    enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ntfs_data *data = dir->data;
+  struct grub_ntfs_upcase *upcase;
+  struct grub_ntfs_file tmp, *mft = dir;
+  struct grub_ntfs_attr root, alloc;
+  grub_uint8_t *cur_pos, *end, *indx = NULL;
+  grub_size_t idx_bytes = data->idx_size << GRUB_NTFS_BLK_SHR;
+  grub_uint16_t *name16;
+  grub_uint32_t root_size;
+  grub_size_t len;
+  int vcn_shift, depth, have_alloc = 0, ret = -1;
+
+  len = grub_strlen (name);
+  name16 = grub_malloc (len * sizeof (name16[0]));
+  if (!name16)
+    return 0;
+  len = grub_utf8_to_utf16 (name16, len, (const grub_uint8_t *) name,
+			    len, NULL);
+  if (len == 0 || len > 255)
+    {
+      grub_free (name16);
+      return len ? 0 : -1;
+    }
+
+  upcase = ntfs_cache_get_upcase (data);
+  if (!upcase)
+    {
+      grub_free (name16);
+      return -1;
+    }
+
+  grub_memset (&root, 0, sizeof (root));
+  grub_memset (&alloc, 0, sizeof (alloc));
+
+  /* Don't keep the record of DIR, nodes are freed with grub_free.  */
+  if (!dir->inode_read)
+    {
+      grub_memset (&tmp, 0, sizeof (tmp));
+      tmp.data = data;
+      mft = &tmp;
+      if (init_file (mft, dir->ino))
+	goto done;
+    }
+
+  cur_pos = find_index_root (&root, mft, &root_size);
+  if (!cur_pos || 0x10 + (grub_uint64_t) u32at (cur_pos, 0x14) > root_size)
+    goto done;
+  cur_pos += 0x10;		/* Skip index root */
+  end = cur_pos + u32at (cur_pos, 4);
+  cur_pos += u32at (cur_pos, 0);
+
+  /* Index blocks are numbered in clusters, or in sectors if smaller than
+     a cluster.  */
+  if (data->idx_size >= (1ULL << data->log_spc))
+    vcn_shift = data->log_spc + GRUB_NTFS_BLK_SHR;
+  else
+    vcn_shift = GRUB_NTFS_BLK_SHR;
+
+  for (depth = 0; depth < GRUB_NTFS_MAX_INDEX_DEPTH; depth++)
+    {
+      grub_uint16_t elen = 0;
+      grub_uint64_t vcn;
+
+      while (1)
+	{
+	  grub_uint8_t ns;
+	  int cmp;
+
+	  if (cur_pos + 0x10 > end)
+	    goto done;
+	  elen = u16at (cur_pos, 8);
+	  if (elen < 0x10 || cur_pos + elen > end)
+	    goto done;
+	  if (cur_pos[0xC] & 2)		/* end signature */
+	    break;
+
+	  ns = cur_pos[0x50];
+	  if (elen < 0x52 || 0x52 + 2 * ns > elen)
+	    goto done;
+	  cmp = collate_names (upcase->table, name16, len, cur_pos + 0x52, ns);
+	  if (cmp < 0)
+	    break;
+	  if (cmp == 0)
+	    {
+	      grub_size_t i;
+
+	      /* DOS names aren't listed, and names in the POSIX namespace
+		 must match exactly.  Leave those to the listing.  */
+	      if (cur_pos[0x51] == 2)
+		goto done;
+	      for (i = 0; i < len; i++)
+		if (name16[i] != u16at (cur_pos, 0x52 + 2 * i))
+		  break;
+	      if (i < len && cur_pos[0x51] == 0)
+		goto done;
+
+	      *foundnode = entry_node (dir, cur_pos, foundtype);
+	      ret = *foundnode ? 1 : 0;
+	      goto done;
+	    }
+	  cur_pos += elen;
+	}
+
+      /* The entries of the subnode sort before this one.  */
+      if (!(cur_pos[0xC] & 1))
+	{
+	  ret = 0;
+	  goto done;
+	}
+      if (elen < 0x18)
+	goto done;
+      vcn = u64at (cur_pos, elen - 8);
+
+      if (!have_alloc)
+	{
+	  cur_pos = locate_attr (&alloc, mft, GRUB_NTFS_AT_INDEX_ALLOCATION);
+	  while (cur_pos != NULL)
+	    {
+	      /* Non-resident, Namelen=4, Offset=0x40, Flags=0, Name="$I30" */
+	      if ((u32at (cur_pos, 8) == 0x400401) &&
+		  (u32at (cur_pos, 0x40) == 0x490024) &&
+		  (u32at (cur_pos, 0x44) == 0x300033))
+		break;
+	      cur_pos = find_attr (&alloc, GRUB_NTFS_AT_INDEX_ALLOCATION);
+	    }
+	  if (!cur_pos)
+	    goto done;
+	  indx = grub_malloc (idx_bytes);
+	  if (!indx)
+	    goto done;
+	  have_alloc = 1;
+	}
+
+      if (read_attr (&alloc, indx, vcn << vcn_shift, idx_bytes, 0, 0, 0)
+	  || fixup (indx, data->idx_size, (const grub_uint8_t *) "INDX"))
+	goto done;
+      if (0x18 + (grub_uint64_t) u32at (indx, 0x1C) > idx_bytes)
+	goto done;
+      end = indx + 0x18 + u32at (indx, 0x1C);
+      cur_pos = indx + 0x18 + u32at (indx, 0x18);
+    }
+
+ done:
+  if (ret < 0 && grub_errno == GRUB_ERR_NONE)
+    grub_dprintf ("ntfs", "not using the index of MFT 0x%llx\n",
+		  (unsigned long long) dir->ino);
+  free_attr (&root);
+  free_attr (&alloc);
+  if (mft == &tmp)
+    free_file (&tmp);
+  grub_free (indx);
+  grub_free (name16);
+  ntfs_upcase_put (upcase);
+  if (grub_errno)
+    return 0;
+  return ret;
+}
+
+/* Context for grub_ntfs_lookup_file.  */
+struct grub_ntfs_find_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ntfs_lookup_file.  */
+static int
+grub_ntfs_find_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		     grub_fshelp_node_t node, void *data)
+{
+  struct grub_ntfs_find_ctx *ctx = data;
+
+  if ((filetype & GRUB_FSHELP_CASE_INSENSITIVE)
+      ? grub_strcasecmp (ctx->name, filename)
+      : grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in the directory DIR, through its index if possible.  */
+static grub_err_t
+grub_ntfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ntfs_find_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (index_find (dir, name, foundnode, foundtype) >= 0)
+    return grub_errno;
+
+  grub_ntfs_iterate_dir (dir, grub_ntfs_find_iter, &ctx);
+  return grub_errno;
+}
+
+static grub_size_t
+grub_ntfs_node_size (grub_fshelp_node_t node __attribute__ ((unused)))
+{
+  return sizeof (struct grub_ntfs_file);
+}
+
+static void
+grub_ntfs_node_attach (grub_fshelp_node_t node, void *mount)
+{
+  node->data = mount;
+}
+
+static const struct grub_fshelp_node_desc grub_ntfs_node_desc =
+  {
+    .name = "ntfs",
+    .node_size = grub_ntfs_node_size,
+    .attach = grub_ntfs_node_attach
+  };
+
 static struct grub_ntfs_data *
 grub_ntfs_mount (grub_disk_t disk)
 {
@@ -1013,8 +1514,10 @@ grub_ntfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->cmft, &fdiro, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->cmft, &fdiro,
+				NULL, grub_ntfs_lookup_file,
+				grub_ntfs_read_symlink, GRUB_FSHELP_DIR,
+				device->disk, &grub_ntfs_node_desc, data);
 
   if (grub_errno)
     goto fail;
@@ -1051,8 +1554,10 @@ grub_ntfs_open (grub_file_t file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 grub_ntfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->cmft, &mft,
+				NULL, grub_ntfs_lookup_file,
+				grub_ntfs_read_symlink, GRUB_FSHELP_REG,
+				file->device->disk, &grub_ntfs_node_desc, data);
 
   if (grub_errno)
     goto fail;
@@ -1109,6 +1614,9 @@ grub_ntfs_close (grub_file_t file)
 
   data = file->data;
 
+  grub_dprintf ("ntfs", "MFT record cache: %lu hits, %lu misses\n",
+		ntfs_cache_hits, ntfs_cache_misses);
+
   if (data)
     {
       free_file (&data->mmft);
@@ -1136,8 +1644,10 @@ grub_ntfs_label (grub_device_t device, char **label)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file ("/$Volume", &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 0, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached ("/$Volume", &data->cmft, &mft,
+				NULL, grub_ntfs_lookup_file,
+				0, GRUB_FSHELP_REG,
+				device->disk, &grub_ntfs_node_desc, data);
 
   if (grub_errno)
     goto fail;
@@ -1234,4 +1744,5 @@ GRUB_MOD_INIT (ntfs)
 GRUB_MOD_FINI (ntfs)
 {
   grub_fs_unregister (&grub_ntfs_fs);
+  ntfs_cache_flush ();
 }
@@ -26,6 +26,10 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/zstd.h>
+#include <grub/lz4.h>
+#include <grub/time.h>
+#include <grub/partition.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -183,6 +187,8 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
@@ -216,6 +222,163 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompressed blocks are kept across mounts in a small LRU cache, as
+   reading a fragment or part of a block otherwise means decompressing all
+   of it again.  */
+#define SQUASH_CACHE_ENTRIES	32
+#define SQUASH_CACHE_SIZE	(4 << 20)
+/* Like the disk cache, the block cache is dropped when it hasn't been
+   used for this many seconds, as the medium might have been changed.  */
+#define SQUASH_CACHE_TIMEOUT	2
+
+struct squash_cache_entry
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* Offset of the compressed block in the filesystem.  */
+  grub_uint64_t offset;
+  /* Decompressed contents, NULL for an unused entry.  */
+  char *buf;
+  grub_size_t size;
+  grub_uint64_t last_use;
+};
+
+static struct squash_cache_entry squash_cache[SQUASH_CACHE_ENTRIES];
+static grub_size_t squash_cache_bytes;
+static grub_uint64_t squash_cache_clock;
+static grub_uint64_t squash_cache_time;
+static unsigned long squash_cache_hits;
+static unsigned long squash_cache_misses;
+
+static void
+squash_cache_evict (struct squash_cache_entry *entry)
+{
+  squash_cache_bytes -= entry->size;
+  grub_free (entry->buf);
+  entry->buf = NULL;
+  entry->size = 0;
+}
+
+static void
+squash_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < SQUASH_CACHE_ENTRIES; i++)
+    if (squash_cache[i].buf)
+      squash_cache_evict (&squash_cache[i]);
+}
+
+/* Dropped along with the disk cache when memory runs out.  */
+static struct grub_disk_cache_hook squash_cache_hook =
+  {
+    .release = squash_cache_flush
+  };
+
+/* Get the decompressed contents of the CSIZE bytes long block at OFFSET,
+   which are at most USIZE bytes long, and their length in SIZE.  The
+   returned buffer belongs to the cache and is only valid until the next
+   call.  */
+static const char *
+squash_get_block (struct grub_squash_data *data, grub_uint64_t offset,
+		  grub_size_t csize, grub_size_t usize, grub_size_t *size)
+{
+  struct squash_cache_entry *entry, *victim = NULL;
+  grub_disk_addr_t part_start = 0;
+  grub_ssize_t n;
+  grub_uint64_t now;
+  char *tmp, *buf;
+  unsigned i;
+
+  now = grub_get_time_ms ();
+  if (now > squash_cache_time + SQUASH_CACHE_TIMEOUT * 1000)
+    squash_cache_flush ();
+  squash_cache_time = now;
+
+  if (data->disk->partition)
+    part_start = grub_partition_get_start (data->disk->partition);
+
+  for (i = 0; i < SQUASH_CACHE_ENTRIES; i++)
+    {
+      entry = &squash_cache[i];
+      if (entry->buf && entry->offset == offset
+	  && entry->dev_id == data->disk->dev->id
+	  && entry->disk_id == data->disk->id
+	  && entry->part_start == part_start)
+	{
+	  squash_cache_hits++;
+	  entry->last_use = ++squash_cache_clock;
+	  *size = entry->size;
+	  return entry->buf;
+	}
+    }
+  squash_cache_misses++;
+
+  tmp = grub_malloc (csize);
+  if (!tmp)
+    return NULL;
+  if (grub_disk_read (data->disk, offset >> GRUB_DISK_SECTOR_BITS,
+		      offset & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp))
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+  buf = grub_malloc (usize);
+  if (!buf)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+  n = data->decompress (tmp, csize, 0, buf, usize, data);
+  grub_free (tmp);
+  if (n < 0)
+    {
+      grub_free (buf);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return NULL;
+    }
+
+  /* Make room, dropping the least recently used blocks.  */
+  while (1)
+    {
+      victim = NULL;
+      for (i = 0; i < SQUASH_CACHE_ENTRIES; i++)
+	{
+	  entry = &squash_cache[i];
+	  if (!entry->buf)
+	    {
+	      if (squash_cache_bytes + n <= SQUASH_CACHE_SIZE)
+		break;
+	      continue;
+	    }
+	  if (!victim || entry->last_use < victim->last_use)
+	    victim = entry;
+	}
+      if (i < SQUASH_CACHE_ENTRIES || !victim)
+	break;
+      squash_cache_evict (victim);
+    }
+  if (i == SQUASH_CACHE_ENTRIES)
+    {
+      /* Too big for the cache altogether.  Keep it in the first entry
+	 until the next call.  */
+      entry = &squash_cache[0];
+    }
+
+  entry->dev_id = data->disk->dev->id;
+  entry->disk_id = data->disk->id;
+  entry->part_start = part_start;
+  entry->offset = offset;
+  entry->buf = buf;
+  entry->size = n;
+  entry->last_use = ++squash_cache_clock;
+  squash_cache_bytes += n;
+  *size = n;
+  return buf;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +417,17 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  const char *block;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
+	  grub_size_t usize;
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  block = squash_get_block (data, chunk_start + 2, bsize,
+				    SQUASH_CHUNK_SIZE, &usize);
+	  if (!block)
+	    return grub_errno;
+	  if (offset + csize > usize)
+	    return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_memcpy (buf, block + offset, csize);
 	}
       len -= csize;
       offset += csize;
@@ -314,11 +465,58 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
       grub_free (udata);
       return -1;
     }
+  /* Don't hand out more than was decompressed.  */
+  if (off > usize)
+    off = usize;
+  if (len > usize - off)
+    len = usize - off;
+  grub_memcpy (outbuf, udata + off, len);
+  grub_free (udata);
+  return len;
+}
+
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  grub_ssize_t ret;
+  char *udata;
+
+  if (usize < 8192)
+    usize = 8192;
+
+  /* Decompress in place when the whole block is sure to fit.  */
+  if (off == 0 && len >= usize)
+    return grub_lz4_decompress (inbuf, insize, outbuf, len, 0);
+
+  udata = grub_malloc (usize);
+  if (!udata)
+    return -1;
+
+  ret = grub_lz4_decompress (inbuf, insize, udata, usize, 0);
+  if (ret < 0)
+    {
+      grub_free (udata);
+      return -1;
+    }
+  if (off > (grub_size_t) ret)
+    off = ret;
+  if (len > ret - off)
+    len = ret - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
 }
 
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t outsize,
+		 struct grub_squash_data *data __attribute__ ((unused)))
+{
+  return grub_zstd_decompress (inbuf, insize, off, outbuf, outsize);
+}
+
 static grub_ssize_t
 xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 	       char *outbuf, grub_size_t len, struct grub_squash_data *data)
@@ -439,6 +637,12 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -628,6 +832,8 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 static void
 squash_unmount (struct grub_squash_data *data)
 {
+  grub_dprintf ("squash4", "block cache: %lu hits, %lu misses\n",
+		squash_cache_hits, squash_cache_misses);
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
@@ -831,32 +1037,19 @@ direct_read (struct grub_squash_data *data,
       else if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
-	  grub_size_t csize;
+	  const char *block;
+	  grub_size_t csize, usize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
+	  block = squash_get_block (data, ino->cumulated_block_sizes[i] + a,
+				    csize, data->blksz, &usize);
 	  if (!block)
 	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
-	    {
-	      grub_free (block);
-	      return -1;
-	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
-	      != (grub_ssize_t) curread)
+	  if (boff + curread > usize)
 	    {
-	      grub_free (block);
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	      return -1;
 	    }
-	  grub_free (block);
+	  grub_memcpy (buf, block + boff, curread);
 	}
       else
 	err = grub_disk_read (data->disk, 
@@ -935,32 +1128,23 @@ grub_squash_read (grub_file_t file, char *buf, grub_size_t len)
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
+      const char *block;
+      grub_size_t usize;
+
+      /* Many files share a fragment block, so it is likely to be in the
+	 cache already.  */
+      block = squash_get_block (data, a, grub_le_to_cpu32 (frag.size),
+				data->blksz, &usize);
       if (!block)
 	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
+      if (b + len > usize)
 	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
+      grub_memcpy (buf, block + b, len);
     }
   else
     {
@@ -1010,10 +1194,13 @@ static struct grub_fs grub_squash_fs =
 GRUB_MOD_INIT(squash4)
 {
   grub_fs_register (&grub_squash_fs);
+  grub_disk_cache_hook_register (&squash_cache_hook);
 }
 
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  grub_disk_cache_hook_unregister (&squash_cache_hook);
+  squash_cache_flush ();
 }
 
@@ -451,7 +451,8 @@ grub_udf_read_icb (struct grub_udf_data *data,
 }
 
 static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
 {
   char *buf = NULL;
   char *ptr;
@@ -517,6 +518,8 @@ grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	  if (filebytes < adlen)
 	    {
 	      grub_uint32_t ad_pos = ad->position;
+	      *count = ((adlen - filebytes + U32 (node->data->lvd.bsize) - 1)
+			>> (GRUB_DISK_SECTOR_BITS + node->data->lbshift));
 	      grub_free (buf);
 	      return ((U32 (ad_pos) & GRUB_UDF_EXT_MASK) ? 0 :
 		      (grub_udf_get_block (node->data, node->part_ref, ad_pos)
@@ -571,6 +574,8 @@ grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	    {
 	      grub_uint32_t ad_block_num = ad->block.block_num;
 	      grub_uint32_t ad_part_ref = ad->block.part_ref;
+	      *count = ((adlen - filebytes + U32 (node->data->lvd.bsize) - 1)
+			>> (GRUB_DISK_SECTOR_BITS + node->data->lbshift));
 	      grub_free (buf);
 	      return ((U32 (ad_block_num) & GRUB_UDF_EXT_MASK) ?  0 :
 		      (grub_udf_get_block (node->data, ad_part_ref,
@@ -618,11 +623,11 @@ grub_udf_read_file (grub_fshelp_node_t node,
       return 0;
     }
 
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_udf_read_block,
-				U64 (node->block.fe.file_size),
-				node->data->lbshift, 0);
+  return grub_fshelp_read_file_extent (node->data->disk, node,
+				       read_hook, read_hook_data,
+				       pos, len, buf, grub_udf_read_block,
+				       U64 (node->block.fe.file_size),
+				       node->data->lbshift, 0);
 }
 
 static unsigned sblocklist[] = { 256, 512, 0 };
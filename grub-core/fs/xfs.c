@@ -45,6 +45,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define	XFS_SB_VERSION_SECTORBIT	0x0800
 #define	XFS_SB_VERSION_EXTFLGBIT	0x1000
 #define	XFS_SB_VERSION_DIRV2BIT		0x2000
+#define	XFS_SB_VERSION_BORGBIT		0x4000	/* ASCII only case-insens. */
 #define XFS_SB_VERSION_MOREBITSBIT	0x8000
 #define XFS_SB_VERSION_BITS_SUPPORTED \
 	(XFS_SB_VERSION_NUMBITS | \
@@ -210,6 +211,43 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } GRUB_PACKED;
 
+/* Start of the leaf blocks in the address space of a directory.  */
+#define XFS_DIR2_LEAF_OFFSET	(1ULL << 35)
+
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DIR3_LEAF1_MAGIC	0x3df1
+#define XFS_DIR3_LEAFN_MAGIC	0x3dff
+#define XFS_DA3_NODE_MAGIC	0x3ebe
+
+#define XFS_DA_NODE_MAXDEPTH	5
+
+/* Header of directory leaf and node blocks.  In V5 here follow crc,
+   uuid, etc, then count and level (stale for leaves) and the entries.  */
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} GRUB_PACKED;
+
+struct grub_xfs_da_hdr
+{
+  grub_uint16_t count;
+  grub_uint16_t level;
+} GRUB_PACKED;
+
+/* Entry of the hash index, in leaves and nodes alike.  Its value is the
+   address of the name in 8-byte units in a leaf and the block of the
+   child in a node.  */
+struct grub_xfs_da_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t value;
+} GRUB_PACKED;
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -427,6 +465,29 @@ grub_xfs_inline_de_inopos(struct grub_xfs_data *data,
   return ((grub_uint8_t *)(de + 1)) + de->len - 1 + (data->hasftype ? 1 : 0);
 }
 
+static grub_uint64_t
+grub_xfs_inline_de_ino (struct grub_xfs_data *data,
+			struct grub_xfs_dir_header *head,
+			struct grub_xfs_dir_entry *de)
+{
+  grub_uint8_t *inopos = grub_xfs_inline_de_inopos (data, de);
+
+  /* inopos might be unaligned.  */
+  if (!head->largeino)
+    return (((grub_uint32_t) inopos[0]) << 24)
+      | (((grub_uint32_t) inopos[1]) << 16)
+      | (((grub_uint32_t) inopos[2]) << 8)
+      | (((grub_uint32_t) inopos[3]) << 0);
+  return (((grub_uint64_t) inopos[0]) << 56)
+    | (((grub_uint64_t) inopos[1]) << 48)
+    | (((grub_uint64_t) inopos[2]) << 40)
+    | (((grub_uint64_t) inopos[3]) << 32)
+    | (((grub_uint64_t) inopos[4]) << 24)
+    | (((grub_uint64_t) inopos[5]) << 16)
+    | (((grub_uint64_t) inopos[6]) << 8)
+    | (((grub_uint64_t) inopos[7]) << 0);
+}
+
 static struct grub_xfs_dir_entry *
 grub_xfs_inline_next_de(struct grub_xfs_data *data,
 			struct grub_xfs_dir_header *head,
@@ -510,7 +571,8 @@ get_fsb (const void *keys, int idx)
 }
 
 static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
 {
   struct grub_xfs_btree_node *leaf = 0;
   int ex, nrec;
@@ -600,10 +662,16 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       /* Sparse block.  */
       if (fileblock < offset)
-        break;
+        {
+          *count = offset - fileblock;
+          break;
+        }
       else if (fileblock < offset + size)
         {
           ret = (fileblock - offset + start);
+          /* Extents don't cross allocation groups, so they are
+             contiguous on disk.  */
+          *count = offset + size - fileblock;
           break;
         }
     }
@@ -621,12 +689,12 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extent (node->data->disk, node,
+				       read_hook, read_hook_data,
+				       pos, len, buf, grub_xfs_read_block,
+				       grub_be_to_cpu64 (node->inode.size) + header_size,
+				       node->data->sblock.log2_bsize
+				       - GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -766,26 +834,9 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 
 	for (i = 0; i < head->count; i++)
 	  {
-	    grub_uint64_t ino;
-	    grub_uint8_t *inopos = grub_xfs_inline_de_inopos(dir->data, de);
+	    grub_uint64_t ino = grub_xfs_inline_de_ino (dir->data, head, de);
 	    grub_uint8_t c;
 
-	    /* inopos might be unaligned.  */
-	    if (smallino)
-	      ino = (((grub_uint32_t) inopos[0]) << 24)
-		| (((grub_uint32_t) inopos[1]) << 16)
-		| (((grub_uint32_t) inopos[2]) << 8)
-		| (((grub_uint32_t) inopos[3]) << 0);
-	    else
-	      ino = (((grub_uint64_t) inopos[0]) << 56)
-		| (((grub_uint64_t) inopos[1]) << 48)
-		| (((grub_uint64_t) inopos[2]) << 40)
-		| (((grub_uint64_t) inopos[3]) << 32)
-		| (((grub_uint64_t) inopos[4]) << 24)
-		| (((grub_uint64_t) inopos[5]) << 16)
-		| (((grub_uint64_t) inopos[6]) << 8)
-		| (((grub_uint64_t) inopos[7]) << 0);
-
 	    c = de->name[de->len];
 	    de->name[de->len] = '\0';
 	    if (iterate_dir_call_hook (ino, de->name, &ctx))
@@ -895,6 +946,411 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 }
 
 
+/* Read the directory block at byte OFFSET of the address space of DIR.
+   Unlike grub_xfs_read_file this reaches the leaf blocks, which lie
+   beyond the size of the directory.  */
+static int
+grub_xfs_read_dirblock (grub_fshelp_node_t dir, grub_uint64_t offset,
+			char *buf)
+{
+  struct grub_xfs_data *data = dir->data;
+  grub_disk_addr_t fileblock = offset >> data->sblock.log2_bsize;
+  grub_disk_addr_t left = 1 << data->sblock.log2_dirblk;
+
+  while (left)
+    {
+      grub_disk_addr_t blk, count = 1;
+
+      blk = grub_xfs_read_block (dir, fileblock, &count);
+      if (grub_errno || !blk)
+	return 0;
+      if (count > left)
+	count = left;
+      if (grub_disk_read (data->disk,
+			  blk << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+			  0, count << data->sblock.log2_bsize, buf))
+	return 0;
+      buf += count << data->sblock.log2_bsize;
+      fileblock += count;
+      left -= count;
+    }
+  return 1;
+}
+
+/* The name hash of the directory index, xfs_da_hashname in Linux.  */
+static grub_uint32_t
+grub_xfs_hashname (const grub_uint8_t *name, grub_size_t namelen)
+{
+  grub_uint32_t hash = 0;
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+  for (; namelen >= 4; namelen -= 4, name += 4)
+    hash = ((grub_uint32_t) name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7)
+      ^ name[3] ^ ROL32 (hash, 7 * 4);
+
+  switch (namelen)
+    {
+    case 3:
+      return ((grub_uint32_t) name[0] << 14) ^ (name[1] << 7) ^ name[2]
+	^ ROL32 (hash, 7 * 3);
+    case 2:
+      return ((grub_uint32_t) name[0] << 7) ^ name[1] ^ ROL32 (hash, 7 * 2);
+    case 1:
+      return name[0] ^ ROL32 (hash, 7);
+    }
+#undef ROL32
+  return hash;
+}
+
+/* Context for grub_xfs_hash_find.  */
+struct grub_xfs_lookup_ctx
+{
+  grub_fshelp_node_t dir;
+  const char *name;
+  grub_size_t namelen;
+  grub_uint32_t hash;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+  int dirblk_size;
+  /* The data block last read, at byte DATAOFF of the directory.  In a
+     block directory it holds the index as well and must stay.  */
+  char *datablock;
+  grub_uint64_t dataoff;
+  int single;
+  char *leafblock;
+};
+
+/* Helpers for grub_xfs_hash_find return 1 if they found the name, 0 if
+   it isn't there and -1 if the index can't be used.  */
+
+static int
+grub_xfs_lookup_found (struct grub_xfs_lookup_ctx *ctx, grub_uint64_t ino)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_malloc (grub_xfs_fshelp_size (ctx->dir->data) + 1);
+  if (!fdiro)
+    return -1;
+
+  fdiro->ino = ino;
+  fdiro->inode_read = 1;
+  fdiro->data = ctx->dir->data;
+  if (grub_xfs_read_inode (ctx->dir->data, ino, &fdiro->inode))
+    {
+      grub_free (fdiro);
+      return -1;
+    }
+
+  *ctx->foundnode = fdiro;
+  *ctx->foundtype = grub_xfs_mode_to_filetype (fdiro->inode.mode);
+  return 1;
+}
+
+/* Check whether the entry at ADDRESS, in 8-byte units, has our name.  */
+static int
+grub_xfs_lookup_check (struct grub_xfs_lookup_ctx *ctx, grub_uint32_t address)
+{
+  grub_uint64_t off = (grub_uint64_t) address << 3;
+  grub_uint64_t blkoff = off & ~(grub_uint64_t) (ctx->dirblk_size - 1);
+  int inblk = off & (ctx->dirblk_size - 1);
+  struct grub_xfs_dir2_entry *de;
+
+  if (blkoff != ctx->dataoff)
+    {
+      if (ctx->single || blkoff >= XFS_DIR2_LEAF_OFFSET)
+	return -1;
+      ctx->dataoff = ~(grub_uint64_t) 0;
+      if (!grub_xfs_read_dirblock (ctx->dir, blkoff, ctx->datablock))
+	return -1;
+      ctx->dataoff = blkoff;
+    }
+
+  de = (struct grub_xfs_dir2_entry *) (ctx->datablock + inblk);
+  if (inblk + sizeof (*de) + de->len > (grub_size_t) ctx->dirblk_size)
+    return -1;
+  if (de->len != ctx->namelen
+      || grub_memcmp (de + 1, ctx->name, ctx->namelen) != 0)
+    return 0;
+
+  return grub_xfs_lookup_found (ctx, grub_be_to_cpu64 (de->inode));
+}
+
+/* Look for our hash among the COUNT sorted entries ENTS.  Set AT_END if
+   entries with that hash may continue in the next leaf.  */
+static int
+grub_xfs_lookup_leaf (struct grub_xfs_lookup_ctx *ctx,
+		      const struct grub_xfs_da_entry *ents, unsigned count,
+		      int *at_end)
+{
+  unsigned lo = 0, hi = count;
+  int ret;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      if (grub_be_to_cpu32 (ents[mid].hashval) < ctx->hash)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (; lo < count && grub_be_to_cpu32 (ents[lo].hashval) == ctx->hash; lo++)
+    {
+      /* Stale entries have a null address.  */
+      if (!ents[lo].value)
+	continue;
+      ret = grub_xfs_lookup_check (ctx, grub_be_to_cpu32 (ents[lo].value));
+      if (ret)
+	return ret;
+    }
+
+  *at_end = (lo == count);
+  return 0;
+}
+
+/* Find the entries of the leaf or node block in CTX->leafblock.  Return
+   the magic of the block, 0 if it is malformed.  */
+static grub_uint16_t
+grub_xfs_da_entries (struct grub_xfs_lookup_ctx *ctx,
+		     struct grub_xfs_da_entry **ents, unsigned *count)
+{
+  struct grub_xfs_data *data = ctx->dir->data;
+  struct grub_xfs_da_blkinfo *info;
+  struct grub_xfs_da_hdr *hdr;
+  int entoff = data->hascrc ? 64 : 16;
+
+  info = (struct grub_xfs_da_blkinfo *) ctx->leafblock;
+  hdr = (struct grub_xfs_da_hdr *) (ctx->leafblock
+				    + (data->hascrc ? 56 : sizeof (*info)));
+  *ents = (struct grub_xfs_da_entry *) (ctx->leafblock + entoff);
+  *count = grub_be_to_cpu16 (hdr->count);
+  if (*count > (ctx->dirblk_size - entoff) / sizeof (**ents))
+    return 0;
+  return grub_be_to_cpu16 (info->magic);
+}
+
+/* Walk the index of a leaf or node directory down to the leaf which can
+   hold our hash, then follow the leaves while their entries keep it.  */
+static int
+grub_xfs_lookup_index (struct grub_xfs_lookup_ctx *ctx)
+{
+  struct grub_xfs_data *data = ctx->dir->data;
+  grub_uint16_t node_magic = data->hascrc ? XFS_DA3_NODE_MAGIC
+					  : XFS_DA_NODE_MAGIC;
+  grub_uint16_t leaf1_magic = data->hascrc ? XFS_DIR3_LEAF1_MAGIC
+					   : XFS_DIR2_LEAF1_MAGIC;
+  grub_uint16_t leafn_magic = data->hascrc ? XFS_DIR3_LEAFN_MAGIC
+					   : XFS_DIR2_LEAFN_MAGIC;
+  struct grub_xfs_da_entry *ents;
+  grub_uint64_t off = XFS_DIR2_LEAF_OFFSET;
+  grub_uint16_t magic;
+  grub_uint32_t forw;
+  unsigned count;
+  int depth, at_end, ret;
+
+  for (depth = 0; ; depth++)
+    {
+      unsigned lo = 0, hi;
+
+      if (!grub_xfs_read_dirblock (ctx->dir, off, ctx->leafblock))
+	return -1;
+      magic = grub_xfs_da_entries (ctx, &ents, &count);
+      if (magic == leaf1_magic || magic == leafn_magic)
+	break;
+      if (magic != node_magic || depth == XFS_DA_NODE_MAXDEPTH)
+	return -1;
+
+      /* Each entry holds the highest hash of its child, so the first
+	 entry not below ours leads to the first leaf with it.  */
+      hi = count;
+      while (lo < hi)
+	{
+	  unsigned mid = (lo + hi) / 2;
+	  if (grub_be_to_cpu32 (ents[mid].hashval) < ctx->hash)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      if (lo == count)
+	return 0;
+      off = (grub_uint64_t) grub_be_to_cpu32 (ents[lo].value)
+	<< data->sblock.log2_bsize;
+      if (off < XFS_DIR2_LEAF_OFFSET)
+	return -1;
+    }
+
+  for (depth = 0; ; depth++)
+    {
+      ret = grub_xfs_lookup_leaf (ctx, ents, count, &at_end);
+      if (ret || !at_end)
+	return ret;
+
+      forw = grub_be_to_cpu32 (((struct grub_xfs_da_blkinfo *)
+				ctx->leafblock)->forw);
+      if (!forw)
+	return 0;
+      /* Don't go round in circles on a corrupted chain.  */
+      if (depth == 1024)
+	return -1;
+      off = (grub_uint64_t) forw << data->sblock.log2_bsize;
+      if (off < XFS_DIR2_LEAF_OFFSET
+	  || !grub_xfs_read_dirblock (ctx->dir, off, ctx->leafblock)
+	  || grub_xfs_da_entries (ctx, &ents, &count) != leafn_magic)
+	return -1;
+    }
+}
+
+/* Find NAME in the directory DIR without reading the inodes of other
+   entries.  Block, leaf and node directories are searched through their
+   hash index.  */
+static int
+grub_xfs_hash_find (struct grub_fshelp_node *dir, const char *name,
+		    grub_fshelp_node_t *foundnode,
+		    enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_data *data = dir->data;
+  struct grub_xfs_lookup_ctx ctx = {
+    .dir = dir,
+    .name = name,
+    .namelen = grub_strlen (name),
+    .foundnode = foundnode,
+    .foundtype = foundtype,
+    .dataoff = ~(grub_uint64_t) 0
+  };
+  int dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk;
+  int ret = -1;
+
+  if (ctx.namelen == 0 || ctx.namelen > 255)
+    return -1;
+  ctx.hash = grub_xfs_hashname ((const grub_uint8_t *) name, ctx.namelen);
+
+  if (dir->inode.format == XFS_INODE_FORMAT_INO)
+    {
+      struct grub_xfs_dir_header *head =
+	(struct grub_xfs_dir_header *) grub_xfs_inode_data (&dir->inode);
+      struct grub_xfs_dir_entry *de = grub_xfs_inline_de (head);
+      char *end = (char *) &dir->inode + grub_xfs_inode_size (data);
+      int i;
+
+      for (i = 0; i < head->count; i++)
+	{
+	  if ((char *) grub_xfs_inline_next_de (data, head, de) > end)
+	    return -1;
+	  if (de->len == ctx.namelen
+	      && grub_memcmp (de->name, name, ctx.namelen) == 0)
+	    return grub_xfs_lookup_found (&ctx,
+					  grub_xfs_inline_de_ino (data, head,
+								  de));
+	  de = grub_xfs_inline_next_de (data, head, de);
+	}
+      return 0;
+    }
+
+  /* Case-insensitive filesystems hash the names folded to lower case.  */
+  if ((dir->inode.format != XFS_INODE_FORMAT_EXT
+       && dir->inode.format != XFS_INODE_FORMAT_BTREE)
+      || (data->sblock.version
+	  & grub_cpu_to_be16_compile_time (XFS_SB_VERSION_BORGBIT)))
+    return -1;
+
+  ctx.dirblk_size = 1 << dirblk_log2;
+  ctx.datablock = grub_malloc (2 * ctx.dirblk_size);
+  if (!ctx.datablock)
+    return 0;
+  ctx.leafblock = ctx.datablock + ctx.dirblk_size;
+
+  /* A directory of a single block may have its index in that block.  */
+  if (grub_be_to_cpu64 (dir->inode.size) == (grub_uint64_t) ctx.dirblk_size)
+    {
+      if (!grub_xfs_read_dirblock (dir, 0, ctx.datablock))
+	goto fail;
+      ctx.dataoff = 0;
+      if (grub_memcmp (ctx.datablock, data->hascrc ? "XDB3" : "XD2B", 4) == 0)
+	{
+	  struct grub_xfs_dirblock_tail *tail =
+	    grub_xfs_dir_tail (data, ctx.datablock);
+	  grub_uint32_t count = grub_be_to_cpu32 (tail->leaf_count);
+	  int at_end;
+
+	  if (count > (ctx.dirblk_size - sizeof (*tail)
+		       - ((char *) grub_xfs_first_de (data, ctx.datablock)
+			  - ctx.datablock)) / sizeof (struct grub_xfs_da_entry))
+	    goto fail;
+	  ctx.single = 1;
+	  ret = grub_xfs_lookup_leaf (&ctx,
+				      (struct grub_xfs_da_entry *) tail - count,
+				      count, &at_end);
+	  goto fail;
+	}
+    }
+
+  ret = grub_xfs_lookup_index (&ctx);
+
+ fail:
+  if (ret < 0 && grub_errno == GRUB_ERR_NONE)
+    grub_dprintf ("xfs", "not using the index of directory inode %"
+		  PRIuGRUB_UINT64_T "\n", dir->ino);
+  grub_free (ctx.datablock);
+  if (grub_errno)
+    return 0;
+  return ret;
+}
+
+/* Context for grub_xfs_lookup_file.  */
+struct grub_xfs_find_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_xfs_lookup_file.  */
+static int
+grub_xfs_find_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		    grub_fshelp_node_t node, void *data)
+{
+  struct grub_xfs_find_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN || grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in the directory DIR, through its hash index if it has
+   one.  */
+static grub_err_t
+grub_xfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_find_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (!dir->inode_read)
+    {
+      grub_xfs_read_inode (dir->data, dir->ino, &dir->inode);
+      if (grub_errno)
+	return grub_errno;
+      dir->inode_read = 1;
+    }
+
+  if (grub_xfs_hash_find (dir, name, foundnode, foundtype) >= 0)
+    return grub_errno;
+
+  grub_xfs_iterate_dir (dir, grub_xfs_find_iter, &ctx);
+  return grub_errno;
+}
+
+
 static struct grub_xfs_data *
 grub_xfs_mount (grub_disk_t disk)
 {
@@ -974,6 +1430,25 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+static grub_size_t
+grub_xfs_node_size (grub_fshelp_node_t node)
+{
+  return grub_xfs_fshelp_size (node->data);
+}
+
+static void
+grub_xfs_node_attach (grub_fshelp_node_t node, void *mount)
+{
+  node->data = mount;
+}
+
+static const struct grub_fshelp_node_desc grub_xfs_node_desc =
+  {
+    .name = "xfs",
+    .node_size = grub_xfs_node_size,
+    .attach = grub_xfs_node_attach
+  };
+
 static grub_err_t
 grub_xfs_dir (grub_device_t device, const char *path,
 	      grub_fs_dir_hook_t hook, void *hook_data)
@@ -988,8 +1463,10 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				NULL, grub_xfs_lookup_file, grub_xfs_read_symlink,
+				GRUB_FSHELP_DIR, device->disk,
+				&grub_xfs_node_desc, data);
   if (grub_errno)
     goto fail;
 
@@ -1021,8 +1498,10 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				NULL, grub_xfs_lookup_file, grub_xfs_read_symlink,
+				GRUB_FSHELP_REG, file->device->disk,
+				&grub_xfs_node_desc, data);
   if (grub_errno)
     goto fail;
 
@@ -53,8 +53,10 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <grub/crypto.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -159,8 +161,6 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
-extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
-
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
 typedef struct decomp_entry
@@ -169,12 +169,6 @@ typedef struct decomp_entry
   zfs_decomp_func_t *decomp_func;
 } decomp_entry_t;
 
-/*
- * Signature for checksum functions.
- */
-typedef void zio_checksum_t(const void *data, grub_uint64_t size, 
-			    grub_zfs_endian_t endian, zio_cksum_t *zcp);
-
 /*
  * Information about each checksum function.
  */
@@ -339,6 +333,23 @@ zle_decompress (void *s, void *d,
   return GRUB_ERR_NONE;
 }
 
+/* ZFS stores the size of the LZ4 block in the 4 bytes before it.  */
+static grub_err_t
+lz4_decompress (void *s, void *d, grub_size_t slen, grub_size_t dlen)
+{
+  grub_uint32_t bufsiz;
+
+  if (slen < 4)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+  bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (s));
+  if (bufsiz > slen - 4)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+
+  if (grub_lz4_decompress ((char *) s + 4, bufsiz, d, dlen, 0) < 0)
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
 static decomp_entry_t decomp_table[ZIO_COMPRESS_FUNCTIONS] = {
   {"inherit", NULL},		/* ZIO_COMPRESS_INHERIT */
   {"on", lzjb_decompress},	/* ZIO_COMPRESS_ON */
@@ -1838,6 +1849,182 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
   return GRUB_ERR_NONE;
 }
 
+/* Verified and decompressed metadata blocks are kept across mounts, so
+   that walking the MOS, ZAPs and indirect blocks doesn't read, checksum
+   and decompress the same blocks again.  Blocks are never overwritten in
+   place, so a block pointer names the same contents for as long as it
+   is reachable.  Like the disk cache, the blocks are dropped when unused
+   for this many seconds.  */
+#define GRUB_ZFS_CACHE_TIMEOUT 2
+#define GRUB_ZFS_CACHE_SIZE (8 << 20)
+#define GRUB_ZFS_CACHE_SLOTS 512
+
+struct grub_zfs_cached_block
+{
+  struct grub_zfs_cached_block *hash_next;
+  struct grub_zfs_cached_block *lru_prev;
+  struct grub_zfs_cached_block *lru_next;
+  grub_uint64_t guid;
+  dva_t dva[SPA_DVAS_PER_BP];
+  grub_uint64_t birth;
+  zio_cksum_t cksum;
+  grub_size_t size;
+  /* The contents follow.  */
+};
+
+static struct grub_zfs_cached_block *zfs_cache_slots[GRUB_ZFS_CACHE_SLOTS];
+/* Most recently used first.  */
+static struct grub_zfs_cached_block *zfs_cache_lru_head;
+static struct grub_zfs_cached_block *zfs_cache_lru_tail;
+static grub_size_t zfs_cache_bytes;
+static grub_uint64_t zfs_cache_time;
+static unsigned long zfs_cache_hits;
+static unsigned long zfs_cache_misses;
+
+static struct grub_zfs_cached_block **
+zfs_cache_slot (grub_uint64_t guid, const dva_t *dva, grub_uint64_t birth,
+		const zio_cksum_t *cksum)
+{
+  grub_uint64_t h;
+
+  h = guid ^ dva[0].dva_word[1] ^ birth ^ cksum->zc_word[0];
+  h ^= h >> 32;
+  h ^= h >> 16;
+  return &zfs_cache_slots[h & (GRUB_ZFS_CACHE_SLOTS - 1)];
+}
+
+static void
+zfs_cache_unlink (struct grub_zfs_cached_block *block)
+{
+  if (block->lru_prev)
+    block->lru_prev->lru_next = block->lru_next;
+  else
+    zfs_cache_lru_head = block->lru_next;
+  if (block->lru_next)
+    block->lru_next->lru_prev = block->lru_prev;
+  else
+    zfs_cache_lru_tail = block->lru_prev;
+}
+
+static void
+zfs_cache_push (struct grub_zfs_cached_block *block)
+{
+  block->lru_prev = NULL;
+  block->lru_next = zfs_cache_lru_head;
+  if (zfs_cache_lru_head)
+    zfs_cache_lru_head->lru_prev = block;
+  else
+    zfs_cache_lru_tail = block;
+  zfs_cache_lru_head = block;
+}
+
+static void
+zfs_cache_flush (void)
+{
+  struct grub_zfs_cached_block *block, *next;
+
+  for (block = zfs_cache_lru_head; block; block = next)
+    {
+      next = block->lru_next;
+      grub_free (block);
+    }
+  grub_memset (zfs_cache_slots, 0, sizeof (zfs_cache_slots));
+  zfs_cache_lru_head = zfs_cache_lru_tail = NULL;
+  zfs_cache_bytes = 0;
+}
+
+/* Drop the blocks if unused for too long.  */
+static void
+zfs_cache_check_time (void)
+{
+  grub_uint64_t now = grub_get_time_ms ();
+
+  if (now > zfs_cache_time + GRUB_ZFS_CACHE_TIMEOUT * 1000)
+    zfs_cache_flush ();
+  zfs_cache_time = now;
+}
+
+/* Whether the block of BP is worth keeping.  File contents are read
+   once and kept in file_buf, encrypted blocks must be decrypted with the
+   keys of each mount.  */
+static int
+zfs_cache_wanted (const blkptr_t *bp, grub_zfs_endian_t endian,
+		  grub_size_t lsize)
+{
+  grub_uint64_t prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
+
+  if (BP_IS_EMBEDDED (bp) || BP_IS_HOLE (bp) || ((prop >> 60) & 3)
+      || lsize > GRUB_ZFS_CACHE_SIZE / 8)
+    return 0;
+  return ((prop >> 56) & 0x1f) != 0
+    || ((prop >> 48) & 0xff) != DMU_OT_PLAIN_FILE_CONTENTS;
+}
+
+static struct grub_zfs_cached_block *
+zfs_cache_find (struct grub_zfs_data *data, const blkptr_t *bp)
+{
+  struct grub_zfs_cached_block *block;
+
+  zfs_cache_check_time ();
+  for (block = *zfs_cache_slot (data->guid, bp->blk_dva, bp->blk_birth,
+				&bp->blk_cksum); block;
+       block = block->hash_next)
+    if (block->guid == data->guid && block->birth == bp->blk_birth
+	&& grub_memcmp (block->dva, bp->blk_dva, sizeof (block->dva)) == 0
+	&& ZIO_CHECKSUM_EQUAL (block->cksum, bp->blk_cksum))
+      {
+	zfs_cache_unlink (block);
+	zfs_cache_push (block);
+	zfs_cache_hits++;
+	return block;
+      }
+  zfs_cache_misses++;
+  return NULL;
+}
+
+/* Keep a copy of BUF, the SIZE bytes of the block of BP, dropping the
+   least recently used blocks to make room.  */
+static void
+zfs_cache_add (struct grub_zfs_data *data, const blkptr_t *bp,
+	       const void *buf, grub_size_t size)
+{
+  struct grub_zfs_cached_block *block, **slot;
+
+  while (zfs_cache_lru_tail
+	 && zfs_cache_bytes + size > GRUB_ZFS_CACHE_SIZE)
+    {
+      struct grub_zfs_cached_block *victim = zfs_cache_lru_tail;
+
+      for (slot = zfs_cache_slot (victim->guid, victim->dva, victim->birth,
+				  &victim->cksum);
+	   *slot != victim; slot = &(*slot)->hash_next);
+      *slot = victim->hash_next;
+      zfs_cache_unlink (victim);
+      zfs_cache_bytes -= victim->size;
+      grub_free (victim);
+    }
+
+  block = grub_malloc (sizeof (*block) + size);
+  if (!block)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  block->guid = data->guid;
+  grub_memcpy (block->dva, bp->blk_dva, sizeof (block->dva));
+  block->birth = bp->blk_birth;
+  block->cksum = bp->blk_cksum;
+  block->size = size;
+  grub_memcpy (block + 1, buf, size);
+
+  slot = zfs_cache_slot (data->guid, bp->blk_dva, bp->blk_birth,
+			 &bp->blk_cksum);
+  block->hash_next = *slot;
+  *slot = block;
+  zfs_cache_push (block);
+  zfs_cache_bytes += size;
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1852,6 +2039,7 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   grub_err_t err;
   zio_cksum_t zc = bp->blk_cksum;
   grub_uint32_t checksum;
+  int cache;
 
   *buf = NULL;
 
@@ -1880,6 +2068,21 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   if (size)
     *size = lsize;
 
+  cache = zfs_cache_wanted (bp, endian, lsize);
+  if (cache)
+    {
+      struct grub_zfs_cached_block *block = zfs_cache_find (data, bp);
+
+      if (block)
+	{
+	  *buf = grub_malloc (lsize);
+	  if (!*buf)
+	    return grub_errno;
+	  grub_memcpy (*buf, block + 1, lsize);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
   if (comp >= ZIO_COMPRESS_FUNCTIONS)
     return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		       "compression algorithm %u not supported\n", (unsigned int) comp);
@@ -1992,6 +2195,9 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	}
     }
 
+  if (cache)
+    zfs_cache_add (data, bp, *buf, lsize);
+
   return GRUB_ERR_NONE;
 }
 
@@ -3591,6 +3797,10 @@ static void
 zfs_unmount (struct grub_zfs_data *data)
 {
   unsigned i;
+
+  grub_dprintf ("zfs", "block cache: %lu hits, %lu misses, %"
+		PRIuGRUB_SIZE " bytes\n",
+		zfs_cache_hits, zfs_cache_misses, zfs_cache_bytes);
   for (i = 0; i < data->n_devices_attached; i++)
     unmount_device (&data->devices_attached[i]);
   grub_free (data->devices_attached);
@@ -4375,4 +4585,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zfs_cache_flush ();
 }
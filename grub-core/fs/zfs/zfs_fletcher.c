@@ -60,9 +60,9 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
-void
-fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
-	    zio_cksum_t *zcp)
+static void
+fletcher_4_scalar (const void *buf, grub_uint64_t size,
+		   grub_zfs_endian_t endian, zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
@@ -82,3 +82,273 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
 }
 
+#ifdef ZFS_VECTOR_CLOBBERS
+
+/*
+ * The vector versions run FLETCHER_4_LANES independent sums, lane i
+ * taking words i, i + FLETCHER_4_LANES, ..., and then fold them into
+ * the sums of the loop above.  With n words per lane and N lanes the
+ * word k of lane i is word N * k + i of the buffer, and its weights in
+ * b, c and d are binomials in N * (n - k) - i.  Written in terms of the
+ * weights of the lane sums these give the coefficients below.
+ */
+#define FLETCHER_4_LANES	4
+
+struct fletcher_4_lanes
+{
+  grub_uint64_t a[FLETCHER_4_LANES];
+  grub_uint64_t b[FLETCHER_4_LANES];
+  grub_uint64_t c[FLETCHER_4_LANES];
+  grub_uint64_t d[FLETCHER_4_LANES];
+};
+
+/* Fold the lanes and sum the words the vector loop left over.  */
+static void
+fletcher_4_finish (const struct fletcher_4_lanes *l, const void *buf,
+		   grub_uint64_t size, grub_zfs_endian_t endian,
+		   zio_cksum_t *zcp)
+{
+  const grub_uint32_t *ip, *ipend;
+  grub_uint64_t a = 0, b = 0, c = 0, d = 0;
+  grub_uint64_t i;
+
+  for (i = 0; i < FLETCHER_4_LANES; i++)
+    {
+      a += l->a[i];
+      b += 4 * l->b[i] - i * l->a[i];
+      c += 16 * l->c[i] - 2 * (2 * i + 3) * l->b[i]
+	+ i * (i - 1) / 2 * l->a[i];
+      d += 64 * l->d[i] - 16 * (i + 3) * l->c[i]
+	+ (2 * i * i + 4 * i + 4) * l->b[i]
+	- i * (i - 1) * (i - 2) / 6 * l->a[i];
+    }
+
+  ip = (const grub_uint32_t *) ((const grub_uint8_t *) buf
+				+ (size & ~(grub_uint64_t) 15));
+  ipend = (const grub_uint32_t *) buf + (size / sizeof (grub_uint32_t));
+  for (; ip < ipend; ip++)
+    {
+      a += grub_zfs_to_cpu32 (ip[0], endian);
+      b += a;
+      c += b;
+      d += c;
+    }
+
+  zcp->zc_word[0] = grub_cpu_to_zfs64 (a, endian);
+  zcp->zc_word[1] = grub_cpu_to_zfs64 (b, endian);
+  zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
+  zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
+}
+
+#endif
+
+#if defined (__x86_64__)
+
+/* Bytes to swap words of the other endianness with vpshufb.  */
+static const grub_uint8_t fletcher_4_bswap[16] =
+  { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+
+/*
+ * Each 64-bit sum takes half of a register, so a, b, c and d are
+ * %xmm0-%xmm7 with lanes 0 and 1 in the even and lanes 2 and 3 in the
+ * odd registers.  Swapping the bytes takes shifts and shuffles as
+ * pshufb may be missing.
+ */
+static void
+fletcher_4_sse2 (const void *buf, grub_uint64_t size,
+		 grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  struct fletcher_4_lanes l;
+  const grub_uint8_t *ip = buf;
+  const grub_uint8_t *ipend = ip + (size & ~(grub_uint64_t) 15);
+  int swap = (endian == GRUB_ZFS_BIG_ENDIAN);
+
+  asm volatile ("pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		"pxor %%xmm6, %%xmm6\n\t"
+		"pxor %%xmm7, %%xmm7\n\t"
+		"pxor %%xmm15, %%xmm15\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jae 3f\n"
+		"1:\n\t"
+		"movdqu (%[ip]), %%xmm8\n\t"
+		"testl %[swap], %[swap]\n\t"
+		"jz 2f\n\t"
+		"movdqa %%xmm8, %%xmm9\n\t"
+		"psllw $8, %%xmm8\n\t"
+		"psrlw $8, %%xmm9\n\t"
+		"por %%xmm9, %%xmm8\n\t"
+		"pshuflw $0xb1, %%xmm8, %%xmm8\n\t"
+		"pshufhw $0xb1, %%xmm8, %%xmm8\n"
+		"2:\n\t"
+		"movdqa %%xmm8, %%xmm9\n\t"
+		"punpckldq %%xmm15, %%xmm8\n\t"
+		"punpckhdq %%xmm15, %%xmm9\n\t"
+		"paddq %%xmm8, %%xmm0\n\t"
+		"paddq %%xmm9, %%xmm1\n\t"
+		"paddq %%xmm0, %%xmm2\n\t"
+		"paddq %%xmm1, %%xmm3\n\t"
+		"paddq %%xmm2, %%xmm4\n\t"
+		"paddq %%xmm3, %%xmm5\n\t"
+		"paddq %%xmm4, %%xmm6\n\t"
+		"paddq %%xmm5, %%xmm7\n\t"
+		"addq $16, %[ip]\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jb 1b\n"
+		"3:\n\t"
+		"movdqu %%xmm0, 0(%[l])\n\t"
+		"movdqu %%xmm1, 16(%[l])\n\t"
+		"movdqu %%xmm2, 32(%[l])\n\t"
+		"movdqu %%xmm3, 48(%[l])\n\t"
+		"movdqu %%xmm4, 64(%[l])\n\t"
+		"movdqu %%xmm5, 80(%[l])\n\t"
+		"movdqu %%xmm6, 96(%[l])\n\t"
+		"movdqu %%xmm7, 112(%[l])"
+		: [ip] "+r" (ip)
+		: [ipend] "r" (ipend), [swap] "r" (swap), [l] "r" (&l)
+		: ZFS_VECTOR_CLOBBERS "memory", "cc");
+
+  fletcher_4_finish (&l, buf, size, endian, zcp);
+}
+
+static int
+fletcher_4_avx2_available (void)
+{
+  return !!(zfs_cpu_features () & ZFS_CPU_AVX2);
+}
+
+/* Each of a, b, c and d is a single register, %ymm0-%ymm3.  */
+static void
+fletcher_4_avx2 (const void *buf, grub_uint64_t size,
+		 grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  struct fletcher_4_lanes l;
+  const grub_uint8_t *ip = buf;
+  const grub_uint8_t *ipend = ip + (size & ~(grub_uint64_t) 15);
+  int swap = (endian == GRUB_ZFS_BIG_ENDIAN);
+
+  asm volatile ("vpxor %%ymm0, %%ymm0, %%ymm0\n\t"
+		"vpxor %%ymm1, %%ymm1, %%ymm1\n\t"
+		"vpxor %%ymm2, %%ymm2, %%ymm2\n\t"
+		"vpxor %%ymm3, %%ymm3, %%ymm3\n\t"
+		"vmovdqu (%[bswap]), %%xmm5\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jae 3f\n"
+		"1:\n\t"
+		"testl %[swap], %[swap]\n\t"
+		"jnz 2f\n\t"
+		"vpmovzxdq (%[ip]), %%ymm4\n\t"
+		"jmp 4f\n"
+		"2:\n\t"
+		"vmovdqu (%[ip]), %%xmm4\n\t"
+		"vpshufb %%xmm5, %%xmm4, %%xmm4\n\t"
+		"vpmovzxdq %%xmm4, %%ymm4\n"
+		"4:\n\t"
+		"vpaddq %%ymm4, %%ymm0, %%ymm0\n\t"
+		"vpaddq %%ymm0, %%ymm1, %%ymm1\n\t"
+		"vpaddq %%ymm1, %%ymm2, %%ymm2\n\t"
+		"vpaddq %%ymm2, %%ymm3, %%ymm3\n\t"
+		"addq $16, %[ip]\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jb 1b\n"
+		"3:\n\t"
+		"vmovdqu %%ymm0, 0(%[l])\n\t"
+		"vmovdqu %%ymm1, 32(%[l])\n\t"
+		"vmovdqu %%ymm2, 64(%[l])\n\t"
+		"vmovdqu %%ymm3, 96(%[l])\n\t"
+		"vzeroupper"
+		: [ip] "+r" (ip)
+		: [ipend] "r" (ipend), [swap] "r" (swap), [l] "r" (&l),
+		  [bswap] "r" (fletcher_4_bswap)
+		: ZFS_VECTOR_CLOBBERS "memory", "cc");
+
+  fletcher_4_finish (&l, buf, size, endian, zcp);
+}
+
+#elif defined (ZFS_VECTOR_CLOBBERS)
+
+static int
+fletcher_4_neon_available (void)
+{
+  return !!(zfs_cpu_features () & ZFS_CPU_NEON);
+}
+
+/*
+ * As with SSE2 a, b, c and d are v0-v7, lanes 0 and 1 in the even and
+ * lanes 2 and 3 in the odd registers.
+ */
+static void
+fletcher_4_neon (const void *buf, grub_uint64_t size,
+		 grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  struct fletcher_4_lanes l;
+  const grub_uint8_t *ip = buf;
+  const grub_uint8_t *ipend = ip + (size & ~(grub_uint64_t) 15);
+  grub_uint64_t swap = (endian == GRUB_ZFS_BIG_ENDIAN);
+  grub_uint64_t *out = l.a;
+
+  asm volatile (".arch armv8-a+simd\n\t"
+		"movi v0.2d, #0\n\t"
+		"movi v1.2d, #0\n\t"
+		"movi v2.2d, #0\n\t"
+		"movi v3.2d, #0\n\t"
+		"movi v4.2d, #0\n\t"
+		"movi v5.2d, #0\n\t"
+		"movi v6.2d, #0\n\t"
+		"movi v7.2d, #0\n\t"
+		"cmp %[ip], %[ipend]\n\t"
+		"b.hs 3f\n"
+		"1:\n\t"
+		"ld1 {v16.4s}, [%[ip]], #16\n\t"
+		"cbz %[swap], 2f\n\t"
+		"rev32 v16.16b, v16.16b\n"
+		"2:\n\t"
+		"uxtl v17.2d, v16.2s\n\t"
+		"uxtl2 v18.2d, v16.4s\n\t"
+		"add v0.2d, v0.2d, v17.2d\n\t"
+		"add v1.2d, v1.2d, v18.2d\n\t"
+		"add v2.2d, v2.2d, v0.2d\n\t"
+		"add v3.2d, v3.2d, v1.2d\n\t"
+		"add v4.2d, v4.2d, v2.2d\n\t"
+		"add v5.2d, v5.2d, v3.2d\n\t"
+		"add v6.2d, v6.2d, v4.2d\n\t"
+		"add v7.2d, v7.2d, v5.2d\n\t"
+		"cmp %[ip], %[ipend]\n\t"
+		"b.lo 1b\n"
+		"3:\n\t"
+		"st1 {v0.2d, v1.2d, v2.2d, v3.2d}, [%[out]], #64\n\t"
+		"st1 {v4.2d, v5.2d, v6.2d, v7.2d}, [%[out]]"
+		: [ip] "+r" (ip), [out] "+r" (out)
+		: [ipend] "r" (ipend), [swap] "r" (swap)
+		: ZFS_VECTOR_CLOBBERS "memory", "cc");
+
+  fletcher_4_finish (&l, buf, size, endian, zcp);
+}
+
+#endif
+
+const zio_checksum_impl_t fletcher_4_impls[] = {
+  {"scalar", NULL, fletcher_4_scalar},
+#if defined (__x86_64__)
+  {"sse2", NULL, fletcher_4_sse2},
+  {"avx2", fletcher_4_avx2_available, fletcher_4_avx2},
+#elif defined (ZFS_VECTOR_CLOBBERS)
+  {"neon", fletcher_4_neon_available, fletcher_4_neon},
+#endif
+  {NULL, NULL, NULL}
+};
+
+void
+fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
+	    zio_cksum_t *zcp)
+{
+  static zio_checksum_t *func;
+
+  if (!func)
+    func = zio_checksum_impl_select (fletcher_4_impls);
+  func (buf, size, endian, zcp);
+}
@@ -107,9 +107,174 @@ SHA256Transform(grub_uint32_t *H, const grub_uint8_t *cp)
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
-void
-zio_checksum_SHA256(const void *buf, grub_uint64_t size,
-		    grub_zfs_endian_t endian, zio_cksum_t *zcp)
+static void
+SHA256Blocks(grub_uint32_t *H, const grub_uint8_t *cp, grub_uint64_t n)
+{
+	for (; n; n--, cp += 64)
+		SHA256Transform(H, cp);
+}
+
+#if defined (__x86_64__)
+
+static const grub_uint8_t SHA256_BSWAP[16] = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static int
+SHA256BlocksSHANI_available(void)
+{
+	unsigned need = ZFS_CPU_SHA | ZFS_CPU_SSSE3 | ZFS_CPU_SSE4_1;
+
+	return (zfs_cpu_features() & need) == need;
+}
+
+/*
+ * Sixteen rounds, with W[t] .. W[t + 3] in MSG, the next twelve words
+ * in the other three registers and the constants at KOFF(%[k]).
+ * The four words after the sixteen are computed into MSG.
+ */
+#define	SHANI_ROUNDS(MSG, MSG1, MSG2, MSG3, KOFF)			\
+	"movdqu " #KOFF "(%[k]), %%xmm0\n\t"				\
+	"paddd %%xmm" #MSG ", %%xmm0\n\t"				\
+	"sha256rnds2 %%xmm1, %%xmm2\n\t"				\
+	"pshufd $0x0e, %%xmm0, %%xmm0\n\t"				\
+	"sha256rnds2 %%xmm2, %%xmm1\n\t"				\
+	"sha256msg1 %%xmm" #MSG1 ", %%xmm" #MSG "\n\t"			\
+	"movdqa %%xmm" #MSG3 ", %%xmm7\n\t"				\
+	"palignr $4, %%xmm" #MSG2 ", %%xmm7\n\t"			\
+	"paddd %%xmm7, %%xmm" #MSG "\n\t"				\
+	"sha256msg2 %%xmm" #MSG3 ", %%xmm" #MSG "\n\t"
+
+/*
+ * The SHA extensions keep the state as ABEF in %xmm1 and CDGH in %xmm2,
+ * and take the message plus constants in %xmm0.  The message is in
+ * %xmm3-%xmm6.  Each pass of the inner loop does sixteen rounds, the
+ * four words computed past W[63] in the last one are never used.
+ */
+static void
+SHA256BlocksSHANI(grub_uint32_t *H, const grub_uint8_t *cp, grub_uint64_t n)
+{
+	const grub_uint32_t *k;
+	grub_uint64_t passes;
+
+	if (!n)
+		return;
+
+	asm volatile (
+	    "movdqu 0(%[H]), %%xmm1\n\t"
+	    "movdqu 16(%[H]), %%xmm2\n\t"
+	    "movdqu (%[bswap]), %%xmm8\n\t"
+	    "pshufd $0xb1, %%xmm1, %%xmm1\n\t"
+	    "pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+	    "movdqa %%xmm1, %%xmm7\n\t"
+	    "palignr $8, %%xmm2, %%xmm1\n\t"
+	    "pblendw $0xf0, %%xmm7, %%xmm2\n"
+	    "1:\n\t"
+	    "movdqa %%xmm1, %%xmm9\n\t"
+	    "movdqa %%xmm2, %%xmm10\n\t"
+	    "movdqu 0(%[cp]), %%xmm3\n\t"
+	    "movdqu 16(%[cp]), %%xmm4\n\t"
+	    "movdqu 32(%[cp]), %%xmm5\n\t"
+	    "movdqu 48(%[cp]), %%xmm6\n\t"
+	    "pshufb %%xmm8, %%xmm3\n\t"
+	    "pshufb %%xmm8, %%xmm4\n\t"
+	    "pshufb %%xmm8, %%xmm5\n\t"
+	    "pshufb %%xmm8, %%xmm6\n\t"
+	    "movq %[K], %[k]\n\t"
+	    "movl $4, %k[passes]\n"
+	    "2:\n\t"
+	    SHANI_ROUNDS(3, 4, 5, 6, 0)
+	    SHANI_ROUNDS(4, 5, 6, 3, 16)
+	    SHANI_ROUNDS(5, 6, 3, 4, 32)
+	    SHANI_ROUNDS(6, 3, 4, 5, 48)
+	    "addq $64, %[k]\n\t"
+	    "decl %k[passes]\n\t"
+	    "jnz 2b\n\t"
+	    "paddd %%xmm9, %%xmm1\n\t"
+	    "paddd %%xmm10, %%xmm2\n\t"
+	    "addq $64, %[cp]\n\t"
+	    "decq %[n]\n\t"
+	    "jnz 1b\n\t"
+	    "pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+	    "pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+	    "movdqa %%xmm1, %%xmm7\n\t"
+	    "pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+	    "palignr $8, %%xmm7, %%xmm2\n\t"
+	    "movdqu %%xmm1, 0(%[H])\n\t"
+	    "movdqu %%xmm2, 16(%[H])"
+	    : [cp] "+r" (cp), [n] "+r" (n), [k] "=&r" (k),
+	      [passes] "=&r" (passes)
+	    : [H] "r" (H), [K] "r" (SHA256_K), [bswap] "r" (SHA256_BSWAP)
+	    : ZFS_VECTOR_CLOBBERS "memory", "cc");
+}
+
+#elif defined (ZFS_VECTOR_CLOBBERS)
+
+static int
+SHA256BlocksCE_available(void)
+{
+	return !!(zfs_cpu_features() & ZFS_CPU_SHA2);
+}
+
+/*
+ * Sixteen rounds as above, with the state as ABCD in v0 and EFGH in v1,
+ * the message in v4-v7 and the constants in v20-v23.
+ */
+#define	CE_ROUNDS(MSG, MSG1, MSG2, MSG3, KREG)				\
+	"add v16.4s, v" #MSG ".4s, v" #KREG ".4s\n\t"			\
+	"mov v18.16b, v0.16b\n\t"					\
+	"sha256h q0, q1, v16.4s\n\t"					\
+	"sha256h2 q1, q18, v16.4s\n\t"					\
+	"sha256su0 v" #MSG ".4s, v" #MSG1 ".4s\n\t"			\
+	"sha256su1 v" #MSG ".4s, v" #MSG2 ".4s, v" #MSG3 ".4s\n\t"
+
+static void
+SHA256BlocksCE(grub_uint32_t *H, const grub_uint8_t *cp, grub_uint64_t n)
+{
+	const grub_uint32_t *k;
+	grub_uint64_t passes;
+
+	if (!n)
+		return;
+
+	asm volatile (
+	    ".arch armv8-a+crypto\n\t"
+	    "ld1 {v0.4s, v1.4s}, [%[H]]\n"
+	    "1:\n\t"
+	    "mov v2.16b, v0.16b\n\t"
+	    "mov v3.16b, v1.16b\n\t"
+	    "ld1 {v4.16b, v5.16b, v6.16b, v7.16b}, [%[cp]], #64\n\t"
+	    "rev32 v4.16b, v4.16b\n\t"
+	    "rev32 v5.16b, v5.16b\n\t"
+	    "rev32 v6.16b, v6.16b\n\t"
+	    "rev32 v7.16b, v7.16b\n\t"
+	    "mov %[k], %[K]\n\t"
+	    "mov %[passes], #4\n"
+	    "2:\n\t"
+	    "ld1 {v20.4s, v21.4s, v22.4s, v23.4s}, [%[k]], #64\n\t"
+	    CE_ROUNDS(4, 5, 6, 7, 20)
+	    CE_ROUNDS(5, 6, 7, 4, 21)
+	    CE_ROUNDS(6, 7, 4, 5, 22)
+	    CE_ROUNDS(7, 4, 5, 6, 23)
+	    "subs %[passes], %[passes], #1\n\t"
+	    "b.ne 2b\n\t"
+	    "add v0.4s, v0.4s, v2.4s\n\t"
+	    "add v1.4s, v1.4s, v3.4s\n\t"
+	    "subs %[n], %[n], #1\n\t"
+	    "b.ne 1b\n\t"
+	    "st1 {v0.4s, v1.4s}, [%[H]]"
+	    : [cp] "+r" (cp), [n] "+r" (n), [k] "=&r" (k),
+	      [passes] "=&r" (passes)
+	    : [H] "r" (H), [K] "r" (SHA256_K)
+	    : ZFS_VECTOR_CLOBBERS "memory", "cc");
+}
+
+#endif
+
+static void
+SHA256(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
+       zio_cksum_t *zcp,
+       void (*blocks)(grub_uint32_t *, const grub_uint8_t *, grub_uint64_t))
 {
   grub_uint32_t H[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
 			 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
@@ -117,11 +282,10 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   unsigned padsize = size & 63;
   unsigned i;
   
-  for (i = 0; i < size - padsize; i += 64)
-    SHA256Transform(H, (grub_uint8_t *)buf + i);
+  blocks(H, buf, size / 64);
   
   for (i = 0; i < padsize; i++)
-    pad[i] = ((grub_uint8_t *)buf)[i];
+    pad[i] = ((grub_uint8_t *)buf)[size - padsize + i];
   
   for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
     pad[padsize] = 0;
@@ -129,8 +293,7 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   for (i = 0; i < 8; i++)
     pad[padsize++] = (size << 3) >> (56 - 8 * i);
   
-  for (i = 0; i < padsize && i <= 64; i += 64)
-    SHA256Transform(H, pad + i);
+  blocks(H, pad, padsize / 64);
   
   zcp->zc_word[0] = grub_cpu_to_zfs64 ((grub_uint64_t)H[0] << 32 | H[1], 
 				       endian);
@@ -141,3 +304,47 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   zcp->zc_word[3] = grub_cpu_to_zfs64 ((grub_uint64_t)H[6] << 32 | H[7],
 				       endian);
 }
+
+static void
+zio_checksum_SHA256_scalar(const void *buf, grub_uint64_t size,
+			   grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  SHA256(buf, size, endian, zcp, SHA256Blocks);
+}
+
+#if defined (__x86_64__)
+static void
+zio_checksum_SHA256_shani(const void *buf, grub_uint64_t size,
+			  grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  SHA256(buf, size, endian, zcp, SHA256BlocksSHANI);
+}
+#elif defined (ZFS_VECTOR_CLOBBERS)
+static void
+zio_checksum_SHA256_ce(const void *buf, grub_uint64_t size,
+		       grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  SHA256(buf, size, endian, zcp, SHA256BlocksCE);
+}
+#endif
+
+const zio_checksum_impl_t zio_checksum_SHA256_impls[] = {
+  {"scalar", NULL, zio_checksum_SHA256_scalar},
+#if defined (__x86_64__)
+  {"shani", SHA256BlocksSHANI_available, zio_checksum_SHA256_shani},
+#elif defined (ZFS_VECTOR_CLOBBERS)
+  {"armv8-ce", SHA256BlocksCE_available, zio_checksum_SHA256_ce},
+#endif
+  {NULL, NULL, NULL}
+};
+
+void
+zio_checksum_SHA256(const void *buf, grub_uint64_t size,
+		    grub_zfs_endian_t endian, zio_cksum_t *zcp)
+{
+  static zio_checksum_t *func;
+
+  if (!func)
+    func = zio_checksum_impl_select (zio_checksum_SHA256_impls);
+  func (buf, size, endian, zcp);
+}
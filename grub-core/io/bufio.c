@@ -24,18 +24,42 @@
 #include <grub/fs.h>
 #include <grub/bufio.h>
 #include <grub/dl.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
 
+/* Number of blocks kept per buffered file.  A sequential reader gets the
+   whole ring refilled with one read of the underlying file, everything
+   else replaces the least recently used block.  */
+#define GRUB_BUFIO_SLOTS	2
+
+struct grub_bufio_slot
+{
+  grub_off_t at;
+  grub_size_t len;
+  grub_uint32_t last_use;
+};
+
 struct grub_bufio
 {
   grub_file_t file;
   grub_size_t block_size;
-  grub_size_t buffer_len;
-  grub_off_t buffer_at;
+  unsigned nslots;
+  grub_uint32_t use_counter;
+  /* Offset the next sequential refill is expected at.  */
+  grub_off_t next_fill;
+
+  /* Statistics, printed with debug=bufio on close.  */
+  grub_uint64_t opened_ms;
+  grub_uint64_t fetch_ms;
+  grub_uint64_t delivered;
+  grub_uint64_t fetched;
+  unsigned long fetches;
+
+  struct grub_bufio_slot slots[GRUB_BUFIO_SLOTS];
   char buffer[0];
 };
 typedef struct grub_bufio *grub_bufio_t;
@@ -47,6 +71,7 @@ grub_bufio_open (grub_file_t io, int size)
 {
   grub_file_t file;
   grub_bufio_t bufio = 0;
+  unsigned nslots = GRUB_BUFIO_SLOTS;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (! file)
@@ -68,7 +93,11 @@ grub_bufio_open (grub_file_t io, int size)
   while (size & (size - 1))
     size = (size | (size - 1)) + 1;
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  /* A file which fits in one block doesn't need a ring.  */
+  if ((unsigned) size >= io->size)
+    nslots = 1;
+
+  bufio = grub_zalloc (sizeof (struct grub_bufio) + nslots * size);
   if (! bufio)
     {
       grub_free (file);
@@ -77,6 +106,8 @@ grub_bufio_open (grub_file_t io, int size)
 
   bufio->file = io;
   bufio->block_size = size;
+  bufio->nslots = nslots;
+  bufio->opened_ms = grub_get_time_ms ();
 
   file->device = io->device;
   file->size = io->size;
@@ -106,86 +137,173 @@ grub_buffile_open (const char *name, int size)
   return file;
 }
 
+static inline char *
+grub_bufio_slot_data (grub_bufio_t bufio, struct grub_bufio_slot *slot)
+{
+  return bufio->buffer + (slot - bufio->slots) * bufio->block_size;
+}
+
+static struct grub_bufio_slot *
+grub_bufio_find (grub_bufio_t bufio, grub_off_t pos)
+{
+  unsigned i;
+
+  for (i = 0; i < bufio->nslots; i++)
+    if (pos >= bufio->slots[i].at
+	&& pos < bufio->slots[i].at + bufio->slots[i].len)
+      return &bufio->slots[i];
+  return 0;
+}
+
+static struct grub_bufio_slot *
+grub_bufio_victim (grub_bufio_t bufio)
+{
+  struct grub_bufio_slot *victim = &bufio->slots[0];
+  unsigned i;
+
+  for (i = 1; i < bufio->nslots; i++)
+    if (bufio->slots[i].last_use < victim->last_use)
+      victim = &bufio->slots[i];
+  return victim;
+}
+
+/* Read LEN bytes at POS from the underlying file.  */
+static grub_ssize_t
+grub_bufio_fetch (grub_file_t file, grub_off_t pos, char *buf,
+		  grub_size_t len)
+{
+  grub_bufio_t bufio = file->data;
+  grub_uint64_t start = grub_get_time_ms ();
+  grub_ssize_t really_read;
+
+  grub_file_seek (bufio->file, pos);
+  really_read = grub_file_read (bufio->file, buf, len);
+
+  bufio->fetch_ms += grub_get_time_ms () - start;
+  bufio->fetches++;
+  if (really_read > 0)
+    bufio->fetched += really_read;
+
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = bufio->file->size;
+
+  return really_read;
+}
+
 static grub_ssize_t
 grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_size_t res = 0;
-  grub_off_t next_buf;
   grub_bufio_t bufio = file->data;
-  grub_ssize_t really_read;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
-  /* First part: use whatever we already have in the buffer.  */
-  if ((file->offset >= bufio->buffer_at) &&
-      (file->offset < bufio->buffer_at + bufio->buffer_len))
+  while (len)
     {
+      grub_off_t pos = file->offset + res;
+      grub_off_t next_buf;
+      struct grub_bufio_slot *slot;
+      grub_ssize_t really_read;
       grub_size_t n;
-      grub_uint64_t pos;
-
-      pos = file->offset - bufio->buffer_at;
-      n = bufio->buffer_len - pos;
-      if (n > len)
-        n = len;
+      unsigned i;
 
-      grub_memcpy (buf, &bufio->buffer[pos], n);
-      len -= n;
-      res += n;
+      /* Use whatever we already have in the ring.  */
+      slot = grub_bufio_find (bufio, pos);
+      if (slot)
+	{
+	  n = slot->at + slot->len - pos;
+	  if (n > len)
+	    n = len;
+
+	  grub_memcpy (buf, grub_bufio_slot_data (bufio, slot)
+		       + (pos - slot->at), n);
+	  slot->last_use = ++bufio->use_counter;
+	  len -= n;
+	  res += n;
+	  buf += n;
+	  continue;
+	}
 
-      buf += n;
-    }
-  if (len == 0)
-    return res;
+      /* Read whole blocks up to the last one (or up to a block we already
+	 hold) directly into the caller's buffer.  */
+      next_buf = (pos + len - 1) & ~((grub_off_t) bufio->block_size - 1);
+      for (i = 0; i < bufio->nslots; i++)
+	if (bufio->slots[i].len && bufio->slots[i].at > pos
+	    && bufio->slots[i].at < next_buf)
+	  next_buf = bufio->slots[i].at;
 
-  /* Need to read some more.  */
-  next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
-  /* Now read between file->offset + res and bufio->buffer_at.  */
-  if (file->offset + res < next_buf)
-    {
-      grub_size_t read_now;
-      read_now = next_buf - (file->offset + res);
-      grub_file_seek (bufio->file, file->offset + res);
-      really_read = grub_file_read (bufio->file, buf, read_now);
-      if (really_read < 0)
-	return -1;
-      if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-	file->size = bufio->file->size;
-      len -= really_read;
-      buf += really_read;
-      res += really_read;
-
-      /* Partial read. File ended unexpectedly. Save the last chunk in buffer.
-       */
-      if (really_read != (grub_ssize_t) read_now)
+      if (pos < next_buf)
 	{
-	  bufio->buffer_len = really_read;
-	  if (bufio->buffer_len > bufio->block_size)
-	    bufio->buffer_len = bufio->block_size;
-	  bufio->buffer_at = file->offset + res - bufio->buffer_len;
-	  grub_memcpy (&bufio->buffer[0], buf - bufio->buffer_len,
-		       bufio->buffer_len);
-	  return res;
+	  grub_size_t read_now;
+
+	  read_now = next_buf - pos;
+	  really_read = grub_bufio_fetch (file, pos, buf, read_now);
+	  if (really_read < 0)
+	    return -1;
+	  len -= really_read;
+	  buf += really_read;
+	  res += really_read;
+
+	  /* Partial read. File ended unexpectedly. Save the last chunk in
+	     the ring.  */
+	  if (really_read != (grub_ssize_t) read_now)
+	    {
+	      slot = grub_bufio_victim (bufio);
+	      slot->len = really_read;
+	      if (slot->len > bufio->block_size)
+		slot->len = bufio->block_size;
+	      slot->at = pos + really_read - slot->len;
+	      slot->last_use = ++bufio->use_counter;
+	      grub_memcpy (grub_bufio_slot_data (bufio, slot),
+			   buf - slot->len, slot->len);
+	      break;
+	    }
+	  continue;
 	}
-    }
-
-  /* Read into buffer.  */
-  grub_file_seek (bufio->file, next_buf);
-  really_read = grub_file_read (bufio->file, bufio->buffer,
-				bufio->block_size);
-  if (really_read < 0)
-    return -1;
-  bufio->buffer_at = next_buf;
-  bufio->buffer_len = really_read;
 
-  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = bufio->file->size;
+      /* Refill.  A reader continuing where the last refill ended gets the
+	 whole ring, anybody else only the block they asked for.  */
+      if (bufio->nslots > 1 && next_buf == bufio->next_fill)
+	{
+	  really_read = grub_bufio_fetch (file, next_buf, bufio->buffer,
+					  bufio->nslots * bufio->block_size);
+	  if (really_read < 0)
+	    return -1;
+	  for (i = 0; i < bufio->nslots; i++)
+	    {
+	      grub_size_t off = i * bufio->block_size;
+
+	      bufio->slots[i].at = next_buf + off;
+	      bufio->slots[i].len = 0;
+	      if ((grub_size_t) really_read > off)
+		bufio->slots[i].len = really_read - off;
+	      if (bufio->slots[i].len > bufio->block_size)
+		bufio->slots[i].len = bufio->block_size;
+	      bufio->slots[i].last_use = ++bufio->use_counter;
+	    }
+	  bufio->next_fill = next_buf + bufio->nslots * bufio->block_size;
+	}
+      else
+	{
+	  slot = grub_bufio_victim (bufio);
+	  really_read = grub_bufio_fetch (file, next_buf,
+					  grub_bufio_slot_data (bufio, slot),
+					  bufio->block_size);
+	  if (really_read < 0)
+	    return -1;
+	  slot->at = next_buf;
+	  slot->len = really_read;
+	  slot->last_use = ++bufio->use_counter;
+	  bufio->next_fill = next_buf + bufio->block_size;
+	}
 
-  if (len > bufio->buffer_len)
-    len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
-  res += len;
+      /* End of file.  */
+      if (! grub_bufio_find (bufio, pos))
+	break;
+    }
 
+  bufio->delivered += res;
   return res;
 }
 
@@ -193,6 +311,23 @@ static grub_err_t
 grub_bufio_close (grub_file_t file)
 {
   grub_bufio_t bufio = file->data;
+  grub_uint64_t elapsed = grub_get_time_ms () - bufio->opened_ms;
+
+  grub_dprintf ("bufio", "%s: delivered %llu bytes in %llu ms"
+		" (%llu KiB/s), fetched %llu bytes in %lu reads"
+		" taking %llu ms (%llu KiB/s)\n",
+		bufio->file->fs ? bufio->file->fs->name : "?",
+		(unsigned long long) bufio->delivered,
+		(unsigned long long) elapsed,
+		(unsigned long long) (elapsed ? grub_divmod64 (bufio->delivered,
+							       elapsed, 0)
+				      * 1000 / 1024 : 0),
+		(unsigned long long) bufio->fetched, bufio->fetches,
+		(unsigned long long) bufio->fetch_ms,
+		(unsigned long long) (bufio->fetch_ms
+				      ? grub_divmod64 (bufio->fetched,
+						       bufio->fetch_ms, 0)
+				      * 1000 / 1024 : 0));
 
   grub_file_close (bufio->file);
   grub_free (bufio);
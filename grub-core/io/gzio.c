@@ -44,6 +44,7 @@
 #include <grub/deflate.h>
 #include <grub/i18n.h>
 #include <grub/crypto.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -58,6 +59,56 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* Default memory for the seek index of each file, see
+   decompress_index_size in the manual.  */
+#define GZIO_INDEX_DEFAULT_SIZE	(1 << 20)
+
+/* Initial distance between checkpoints in the uncompressed data.  It is
+   doubled each time the index fills up.  */
+#define GZIO_CHECKPOINT_SPAN	(1 << 20)
+
+/* Decoding table entry.  OP is INFLATE_OP_LITERAL for a literal in VAL,
+   INFLATE_OP_BASE plus the number of extra bits for a length or distance
+   base in VAL, INFLATE_OP_EOB for the end of block and INFLATE_OP_INVALID
+   for an unused code.  Any other OP links to a sub-table at offset VAL
+   which is indexed with the next OP bits.  BITS is the number of bits the
+   entry consumes.  */
+struct inflate_code
+{
+  grub_uint8_t op;
+  grub_uint8_t bits;
+  grub_uint16_t val;
+};
+
+#define INFLATE_OP_LITERAL	0
+#define INFLATE_OP_BASE		16
+#define INFLATE_OP_EOB		32
+#define INFLATE_OP_INVALID	64
+
+/* Sizes of the dynamic block tables.  zlib's "enough" gives at most 1332
+   entries for the 286 literal/length codes with LBITS and codes of up to
+   15 bits (1334 if all 288 were allowed), and at most 400 for the 30
+   distance codes with DBITS.  build_table () checks them anyway.  */
+#define LCODE_SIZE 2048
+#define DCODE_SIZE 1024
+
+/* The decoder state at a block boundary, from which decompression can
+   resume without going back to the start of the stream.  */
+struct gzio_checkpoint
+{
+  /* The offset of the next uncompressed byte.  */
+  grub_off_t out;
+  /* The offset of the input byte holding the next bit and the bit.  */
+  grub_off_t in;
+  unsigned in_bit;
+  /* The position in the window.  */
+  unsigned wp;
+  /* The window, holding the 32K of output before OUT.  */
+  grub_uint8_t slide[WSIZE];
+  /* The checksum context.  */
+  grub_uint8_t hcontext[0];
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -82,9 +133,10 @@ struct grub_gzio
   unsigned inflate_d;
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
-  int inbuf_d;
+  grub_size_t inbuf_d;
+  grub_size_t inbuf_len;
   /* The bit buffer.  */
-  unsigned long bb;
+  grub_uint64_t bb;
   /* The bits in the bit buffer.  */
   unsigned bk;
   /* The sliding window in uncompressed data.  */
@@ -92,9 +144,9 @@ struct grub_gzio
   /* Current position in the slide.  */
   unsigned wp;
   /* The literal/length code table.  */
-  struct huft *tl;
+  const struct inflate_code *lcode;
   /* The distance code table.  */
-  struct huft *td;
+  const struct inflate_code *dcode;
   /* The checksum algorithm */
   const gcry_md_spec_t *hdesc;
   /* The wanted checksum */
@@ -104,11 +156,21 @@ struct grub_gzio
   /* Context for checksum calculation */
   grub_uint8_t *hcontext;
   /* The lookup bits for the literal/length code table. */
-  int bl;
+  unsigned lbits;
   /* The lookup bits for the distance code table.  */
-  int bd;
+  unsigned dbits;
+  /* The tables of the current dynamic block.  */
+  struct inflate_code dyn_lcode[LCODE_SIZE];
+  struct inflate_code dyn_dcode[DCODE_SIZE];
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* The window position to resume at after restoring a checkpoint.  */
+  unsigned resume_wp;
+  /* The seek index, ordered by offset.  */
+  struct gzio_checkpoint **checkpoints;
+  unsigned num_checkpoints;
+  unsigned max_checkpoints;
+  grub_off_t checkpoint_span;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -117,6 +179,7 @@ static struct grub_fs grub_gzio_fs;
 
 /* Function prototypes */
 static void initialize_tables (grub_gzio_t);
+static void record_checkpoint (grub_gzio_t);
 
 /* Eat variable-length header fields.  */
 static int
@@ -175,7 +238,6 @@ eat_field (grub_file_t file, int len)
 
 typedef unsigned char uch;
 typedef unsigned short ush;
-typedef unsigned long ulg;
 
 static int
 test_gzip_header (grub_file_t file)
@@ -241,34 +303,10 @@ test_gzip_header (grub_file_t file)
 }
 
 
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft
-{
-  uch e;			/* number of extra bits or operation */
-  uch b;			/* number of bits in this code or subcode */
-  union
-    {
-      ush n;			/* literal, length base, or distance base */
-      struct huft *t;		/* pointer to next level of table */
-    }
-  v;
-};
-
-
 /* The inflate algorithm uses a sliding 32K byte window on the uncompressed
    stream to find repeated byte strings.  This is implemented here as a
    circular buffer.  The index is updated simply by incrementing and then
    and'ing with 0x7fff (32K-1). */
-/* It is left to other modules to supply the 32K area.  It is assumed
-   to be usable as if it were declared "uch slide[32768];" or as just
-   "uch *slide;" and then malloc'ed in the latter case.  The definition
-   must be in unzip.h, included above. */
 
 
 /* Tables for deflate from PKZIP's appnote.txt. */
@@ -279,7 +317,6 @@ static ush cplens[] =
 {				/* Copy lengths for literal codes 257..285 */
   3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
   35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0};
-	/* note: see note #13 above about the 258 in this list. */
 static ush cplext[] =
 {				/* Extra bits for literal codes 257..285 */
   0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
@@ -297,86 +334,47 @@ static ush cpdext[] =
 
 
 /*
-   Huffman code decoding is performed using a multi-level table lookup.
-   The fastest way to decode is to simply build a lookup table whose
-   size is determined by the longest code.  However, the time it takes
-   to build this table can also be a factor if the data being decoded
-   is not very long.  The most common codes are necessarily the
-   shortest codes, so those codes dominate the decoding time, and hence
-   the speed.  The idea is you can have a shorter table that decodes the
-   shorter, more probable codes, and then point to subsidiary tables for
-   the longer codes.  The time it costs to decode the longer codes is
-   then traded against the time it takes to make longer tables.
-
-   This results of this trade are in the variables lbits and dbits
-   below.  lbits is the number of bits the first level table for literal/
-   length codes can decode in one step, and dbits is the same thing for
-   the distance codes.  Subsequent tables are also less than or equal to
-   those sizes.  These values may be adjusted either when all of the
-   codes are shorter than that, in which case the longest code length in
-   bits is used, or when the shortest code is *longer* than the requested
-   table size, in which case the length of the shortest code in bits is
-   used.
-
-   There are two different values for the two tables, since they code a
-   different number of possibilities each.  The literal/length table
-   codes 286 possible values, or in a flat code, a little over eight
-   bits.  The distance table codes 30 possible values, or a little less
-   than five bits, flat.  The optimum values for speed end up being
-   about one bit more than those, so lbits is 8+1 and dbits is 5+1.
-   The optimum values may differ though from machine to machine, and
-   possibly even between compilers.  Your mileage may vary.
+   Huffman codes are decoded with a two-level table lookup.  The root
+   table is indexed with the next LBITS (DBITS for distances) bits of
+   input and decodes every code of at most that length in one step.
+   Longer codes find a link in the root table to a sub-table indexed with
+   the remaining bits of the code.  A deflate code is never longer than
+   15 bits, so two levels are always enough.
+
+   The root sizes trade table building time, which is paid for every
+   dynamic block, against decoding speed.  With 10 bits nearly all
+   literal/length codes of real data resolve in the root table.
  */
 
+#define LBITS 10
+#define DBITS 8
 
-static int lbits = 9;		/* bits in base literal/length lookup table */
-static int dbits = 6;		/* bits in base distance lookup table */
-
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16			/* maximum bit length of any code (16 for explode) */
+/* If BMAX needs to be larger than 16, then the counts in build_table ()
+   need to be wider.  */
+#define BMAX 16			/* maximum bit length of any code */
 #define N_MAX 288		/* maximum number of codes in any set */
 
+/* The fixed block tables, built on first use.  */
+static struct inflate_code fixed_lcode[1 << 9];
+static struct inflate_code fixed_dcode[1 << 5];
+static unsigned fixed_lbits, fixed_dbits;
+static int fixed_built;
 
-/* Macros for inflate() bit peeking and grabbing.
-   The usage is:
-
-        NEEDBITS(j)
-        x = b & mask_bits[j];
-        DUMPBITS(j)
-
-   where NEEDBITS makes sure that b has at least j bits in it, and
-   DUMPBITS removes the bits from b.  The macros use the variable k
-   for the number of bits in b.  Normally, b and k are register
-   variables for speed, and are initialized at the beginning of a
-   routine that uses these macros from a global bit buffer and count.
-
-   If we assume that EOB will be the longest code, then we will never
-   ask for bits with NEEDBITS that are beyond the end of the stream.
-   So, NEEDBITS should not read any more bytes than are needed to
-   meet the request.  Then no bytes need to be "returned" to the buffer
-   at the end of the last block.
-
-   However, this assumption is not true for fixed blocks--the EOB code
-   is 7 bits, but the other literal/length codes can be 8 or 9 bits.
-   (The EOB code is shorter than other codes because fixed blocks are
-   generally short.  So, while a block always has an EOB, many other
-   literal/length codes have a significantly lower probability of
-   showing up at all.)  However, by making the first table have a
-   lookup of seven bits, the EOB code will be found in that first
-   lookup, and so will not require that too many bits be pulled from
-   the stream.
- */
 
-static ush mask_bits[] =
-{
-  0x0000,
-  0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
-  0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
-};
+/* The bit buffer is kept in B with K valid bits, lowest bits first.  Bits
+   above K are always zero.  NEEDBITS (n) makes sure there are at least N
+   bits; the refill loads a whole 64-bit word when the input buffer has
+   eight bytes left and goes byte by byte otherwise, so a single refill
+   serves a complete length/distance pair.
+
+   This reads up to eight bytes beyond what the current code needs.  It
+   doesn't matter: the trailer is never read through the bit buffer, and
+   stored blocks take their first bytes out of the bit buffer before
+   going back to the input.  */
 
-#define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte(gzio))<<k;k+=8;}} while (0)
+#define NEEDBITS(n) do { if (k < (n)) fill_bits (gzio, &b, &k); } while (0)
 #define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
+#define BITS(n) ((unsigned) b & ((1U << (n)) - 1))
 
 static int
 get_byte (grub_gzio_t gzio)
@@ -388,17 +386,70 @@ get_byte (grub_gzio_t gzio)
       return 0;
     }
 
-  if (gzio->file && (grub_file_tell (gzio->file)
-		     == (grub_off_t) gzio->data_offset
-		     || gzio->inbuf_d == INBUFSIZ))
+  if (gzio->inbuf_d == gzio->inbuf_len)
     {
+      grub_ssize_t really_read;
+
       gzio->inbuf_d = 0;
-      grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+      really_read = grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+      gzio->inbuf_len = (really_read > 0) ? really_read : 0;
+      if (! gzio->inbuf_len)
+	return 0;
     }
 
   return gzio->inbuf[gzio->inbuf_d++];
 }
 
+/* Return the buffered input and its size.  */
+static inline const grub_uint8_t *
+input_avail (grub_gzio_t gzio, grub_size_t *avail)
+{
+  if (gzio->mem_input)
+    {
+      *avail = gzio->mem_input_size - gzio->mem_input_off;
+      return gzio->mem_input + gzio->mem_input_off;
+    }
+  *avail = gzio->inbuf_len - gzio->inbuf_d;
+  return gzio->inbuf + gzio->inbuf_d;
+}
+
+static inline void
+input_skip (grub_gzio_t gzio, grub_size_t n)
+{
+  if (gzio->mem_input)
+    gzio->mem_input_off += n;
+  else
+    gzio->inbuf_d += n;
+}
+
+static inline void
+fill_bits (grub_gzio_t gzio, grub_uint64_t *b, unsigned *k)
+{
+  const grub_uint8_t *in;
+  grub_size_t avail;
+  unsigned n;
+
+  if (*k > 56)
+    return;
+
+  in = input_avail (gzio, &avail);
+  if (avail < 8)
+    {
+      while (*k <= 56)
+	{
+	  *b |= ((grub_uint64_t) get_byte (gzio)) << *k;
+	  *k += 8;
+	}
+      return;
+    }
+
+  n = (63 - *k) >> 3;
+  *b |= grub_le_to_cpu64 (grub_get_unaligned64 (in)) << *k;
+  *k += n << 3;
+  *b &= (((grub_uint64_t) 1) << *k) - 1;
+  input_skip (gzio, n);
+}
+
 static void
 gzio_seek (grub_gzio_t gzio, grub_off_t off)
 {
@@ -414,228 +465,217 @@ gzio_seek (grub_gzio_t gzio, grub_off_t off)
     grub_file_seek (gzio->file, off);
 }
 
-/* more function prototypes */
-static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
-		       struct huft **, int *);
-static int huft_free (struct huft *);
-static int inflate_codes_in_window (grub_gzio_t);
 
-
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
+/* Build the decoding table for the N code lengths in LENS.  Symbols below
+   NPLAIN decode to themselves.  If EOB is set, symbol NPLAIN is the end
+   of block code.  The remaining symbols decode to BASE plus the number
+   of extra bits in EXTRA.  BITS holds the wanted root table size on
+   entry and the one used on return.  Return zero on success, one if the
+   code set is incomplete and INCOMPLETE_OK isn't set, and two if the
+   lengths are over-subscribed or don't fit in SIZE entries.  */
 
 static int
-huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
-	    unsigned n,		/* number of codes (assumed <= N_MAX) */
-	    unsigned s,		/* number of simple-valued codes (0..s-1) */
-	    ush * d,		/* list of base values for non-simple codes */
-	    ush * e,		/* list of extra bits for non-simple codes */
-	    struct huft **t,	/* result: starting table */
-	    int *m)		/* maximum lookup bits, returns actual */
+build_table (const unsigned *lens, unsigned n, unsigned nplain, int eob,
+	     const ush *base, const ush *extra,
+	     struct inflate_code *table, unsigned size, unsigned *bits,
+	     int incomplete_ok)
 {
-  unsigned a;			/* counter for codes of length k */
-  unsigned c[BMAX + 1];		/* bit length count table */
-  unsigned f;			/* i repeats in table every f entries */
-  int g;			/* maximum code length */
-  int h;			/* table level */
-  register unsigned i;		/* counter, current code */
-  register unsigned j;		/* counter */
-  register int k;		/* number of bits in current code */
-  int l;			/* bits per table (returned in m) */
-  register unsigned *p;		/* pointer into c[], b[], or v[] */
-  register struct huft *q;	/* points to current table */
-  struct huft r;		/* table entry for structure assignment */
-  struct huft *u[BMAX];		/* table stack */
-  unsigned v[N_MAX];		/* values in order of bit length */
-  register int w;		/* bits before this table == (l * h) */
-  unsigned x[BMAX + 1];		/* bit offsets, then code stack */
-  unsigned *xp;			/* pointer into x */
-  int y;			/* number of dummy codes added */
-  unsigned z;			/* number of entries in current table */
-
-  /* Generate counts for each bit length */
-  grub_memset ((char *) c, 0, sizeof (c));
-  p = b;
-  i = n;
-  do
-    {
-      c[*p]++;			/* assume all entries <= BMAX */
-      p++;			/* Can't combine with above line (Solaris bug) */
-    }
-  while (--i);
-  if (c[0] == n)		/* null input--all zero length codes */
+  unsigned count[BMAX + 1];	/* number of codes of each length */
+  unsigned offs[BMAX + 1];	/* offsets in WORK for each length */
+  ush work[N_MAX];		/* symbols sorted by code length */
+  unsigned first_base = nplain + (eob ? 1 : 0);
+  unsigned len, sym, min, max, root, curr, drop;
+  unsigned used, huff, incr, fill, low, mask, i;
+  int left;
+  struct inflate_code here, *next;
+
+  grub_memset (count, 0, sizeof (count));
+  for (sym = 0; sym < n; sym++)
+    count[lens[sym]]++;
+
+  for (max = BMAX; max >= 1; max--)
+    if (count[max])
+      break;
+
+  here.op = INFLATE_OP_INVALID;
+  here.bits = 1;
+  here.val = 0;
+
+  if (max == 0)
     {
-      *t = (struct huft *) NULL;
-      *m = 0;
+      /* No codes at all.  That's valid for the distance code of a block
+	 which only has literals; any lookup fails.  */
+      table[0] = here;
+      table[1] = here;
+      *bits = 1;
       return 0;
     }
 
-  /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
-      break;
-  k = j;			/* minimum code length */
-  if ((unsigned) l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
+  for (min = 1; min < max; min++)
+    if (count[min])
       break;
-  g = i;			/* maximum code length */
-  if ((unsigned) l > i)
-    l = i;
-  *m = l;
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;			/* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;
-  xp = x + 2;
-  while (--i)
-    {				/* note that i == g from above */
-      *xp++ = (j += *p++);
-    }
 
-  /* Make a table of values in order of bit lengths */
-  p = b;
-  i = 0;
-  do
+  root = *bits;
+  if (root > max)
+    root = max;
+  if (root < min)
+    root = min;
+
+  left = 1;
+  for (len = 1; len <= BMAX; len++)
     {
-      if ((j = *p++) != 0)
-	v[x[j]++] = i;
+      left <<= 1;
+      left -= count[len];
+      if (left < 0)
+	return 2;
     }
-  while (++i < n);
-
-  /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;			/* first Huffman code is zero */
-  p = v;			/* grab values in bit order */
-  h = -1;			/* no tables yet--level -1 */
-  w = -l;			/* bits decoded == (l * h) */
-  u[0] = (struct huft *) NULL;	/* just to keep compilers happy */
-  q = (struct huft *) NULL;	/* ditto */
-  z = 0;			/* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
+  /* A single one bit code is allowed to be incomplete.  */
+  if (left > 0 && ! incomplete_ok && max != 1)
+    return 1;
+
+  offs[1] = 0;
+  for (len = 1; len < BMAX; len++)
+    offs[len + 1] = offs[len] + count[len];
+  for (sym = 0; sym < n; sym++)
+    if (lens[sym])
+      work[offs[lens[sym]]++] = sym;
+
+  used = 1U << root;
+  if (used > size)
+    return 2;
+
+  /* Lookups of unused codes fail.  Incomplete sets here have no
+     sub-tables, so the root table covers them.  */
+  if (left > 0)
+    for (i = 0; i < used; i++)
+      table[i] = here;
+
+  /* Walk the codes in canonical order, incrementing HUFF in bit reversed
+     order as deflate sends codes starting with their highest bit.  */
+  huff = 0;
+  sym = 0;
+  len = min;
+  next = table;
+  curr = root;
+  drop = 0;
+  low = (unsigned) -1;
+  mask = used - 1;
+
+  for (;;)
     {
-      a = c[k];
-      while (a--)
+      unsigned s = work[sym];
+
+      here.bits = len - drop;
+      if (s < nplain)
 	{
-	  /* here i is the Huffman code of length k bits for value *p */
-	  /* make tables up to required level */
-	  while (k > w + l)
-	    {
-	      h++;
-	      w += l;		/* previous table always l bits */
-
-	      /* compute minimum size table less than or equal to l bits */
-	      z = (z = (unsigned) (g - w)) > (unsigned) l ? (unsigned) l : z;	/* upper limit on table size */
-	      if ((f = 1 << (j = k - w)) > a + 1)	/* try a k-w bit table */
-		{		/* too few codes for k-w bit table */
-		  f -= a + 1;	/* deduct codes from patterns left */
-		  xp = c + k;
-		  while (++j < z)	/* try smaller tables up to z bits */
-		    {
-		      if ((f <<= 1) <= *++xp)
-			break;	/* enough codes to use up j bits */
-		      f -= *xp;	/* else deduct codes from patterns */
-		    }
-		}
-	      z = 1 << j;	/* table entries for j-bit table */
+	  here.op = INFLATE_OP_LITERAL;
+	  here.val = s;
+	}
+      else if (s < first_base)
+	{
+	  here.op = INFLATE_OP_EOB;
+	  here.val = 0;
+	}
+      else if (extra[s - first_base] == 99)
+	{
+	  here.op = INFLATE_OP_INVALID;
+	  here.val = 0;
+	}
+      else
+	{
+	  here.op = INFLATE_OP_BASE | extra[s - first_base];
+	  here.val = base[s - first_base];
+	}
 
-	      /* allocate and link in new table */
-	      q = (struct huft *) grub_zalloc ((z + 1) * sizeof (struct huft));
-	      if (! q)
-		{
-		  if (h)
-		    huft_free (u[0]);
-		  return 3;
-		}
+      /* Replicate the entry for every index ending in this code.  */
+      incr = 1U << (len - drop);
+      fill = 1U << curr;
+      min = fill;
+      do
+	{
+	  fill -= incr;
+	  next[(huff >> drop) + fill] = here;
+	}
+      while (fill != 0);
 
-	      *t = q + 1;	/* link to list for huft_free() */
-	      *(t = &(q->v.t)) = (struct huft *) NULL;
-	      u[h] = ++q;	/* table starts after link */
+      incr = 1U << (len - 1);
+      while (huff & incr)
+	incr >>= 1;
+      if (incr != 0)
+	{
+	  huff &= incr - 1;
+	  huff += incr;
+	}
+      else
+	huff = 0;
 
-	      /* connect to last table, if there is one */
-	      if (h)
-		{
-		  x[h] = i;	/* save pattern for backing up */
-		  r.b = (uch) l;	/* bits to dump before this table */
-		  r.e = (uch) (16 + j);		/* bits in this table */
-		  r.v.t = q;	/* pointer to this table */
-		  j = i >> (w - l);	/* (get around Turbo C bug) */
-		  u[h - 1][j] = r;	/* connect to last table */
-		}
-	    }
+      sym++;
+      if (--count[len] == 0)
+	{
+	  if (len == max)
+	    break;
+	  len = lens[work[sym]];
+	}
 
-	  /* set up table entry in r */
-	  r.b = (uch) (k - w);
-	  if (p >= v + n)
-	    r.e = 99;		/* out of values--invalid code */
-	  else if (*p < s)
-	    {
-	      r.e = (uch) (*p < 256 ? 16 : 15);		/* 256 is end-of-block code */
-	      r.v.n = (ush) (*p);	/* simple code is just the value */
-	      p++;		/* one compiler does not like *p++ */
-	    }
-	  else
+      /* Start a new sub-table when the root bits of the code change.  */
+      if (len > root && (huff & mask) != low)
+	{
+	  if (drop == 0)
+	    drop = root;
+	  next += min;
+
+	  /* Make it big enough for the longest code it has to hold.  */
+	  curr = len - drop;
+	  left = (int) (1 << curr);
+	  while (curr + drop < max)
 	    {
-	      r.e = (uch) e[*p - s];	/* non-simple--look up in lists */
-	      r.v.n = d[*p++ - s];
+	      left -= count[curr + drop];
+	      if (left <= 0)
+		break;
+	      curr++;
+	      left <<= 1;
 	    }
 
-	  /* fill code-like entries with r */
-	  f = 1 << (k - w);
-	  for (j = i >> w; j < z; j += f)
-	    q[j] = r;
+	  used += 1U << curr;
+	  if (used > size)
+	    return 2;
 
-	  /* backwards increment the k-bit code i */
-	  for (j = 1 << (k - 1); i & j; j >>= 1)
-	    i ^= j;
-	  i ^= j;
-
-	  /* backup over finished tables */
-	  while ((i & ((1 << w) - 1)) != x[h])
-	    {
-	      h--;		/* don't need to update q */
-	      w -= l;
-	    }
+	  low = huff & mask;
+	  table[low].op = curr;
+	  table[low].bits = root;
+	  table[low].val = next - table;
 	}
     }
 
-  /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
+  *bits = root;
+  return 0;
 }
 
 
-/* Free the malloc'ed tables built by huft_build(), which makes a linked
-   list of the tables it made, with the links in a dummy first entry of
-   each table.  */
-static int
-huft_free (struct huft *t)
+/* Copy LEN bytes eight at a time.  Overlapping is fine as long as SRC
+   is ahead of OUT or at least eight bytes behind it.  */
+static inline void
+copy_words (grub_uint8_t *out, const grub_uint8_t *src, grub_size_t len)
 {
-  register struct huft *p, *q;
+  for (; len >= 8; len -= 8, out += 8, src += 8)
+    grub_set_unaligned64 (out, grub_get_unaligned64 (src));
 
+  while (len--)
+    *out++ = *src++;
+}
 
-  /* Go through linked list, freeing from the malloced (t[-1]) address. */
-  p = t;
-  while (p != (struct huft *) NULL)
-    {
-      q = (--p)->v.t;
-      grub_free ((char *) p);
-      p = q;
-    }
-  return 0;
+/* Copy LEN bytes from SRC to OUT as if a byte at a time, which replicates
+   the pattern when the match overlaps its own output.  */
+static inline void
+copy_match (grub_uint8_t *out, const grub_uint8_t *src, unsigned len)
+{
+  if (src > out || out - src >= 8)
+    copy_words (out, src, len);
+  else if (out - src == 1)
+    grub_memset (out, *src, len);
+  else
+    while (len--)
+      *out++ = *src++;
 }
 
 
@@ -647,13 +687,22 @@ huft_free (struct huft *t)
 static int
 inflate_codes_in_window (grub_gzio_t gzio)
 {
-  register unsigned e;		/* table entry flag/number of extra bits */
+  const struct inflate_code *here;	/* table entry */
+  unsigned op;			/* operation of the entry */
+  unsigned e;			/* bytes to copy in this step */
   unsigned n, d;		/* length and index for copy */
   unsigned w;			/* current window position */
-  struct huft *t;		/* pointer to table entry */
-  unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  int code_state;		/* in the middle of a copy */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
+  grub_uint8_t *slide = gzio->slide;
+  /* Local copies of the tables; stores to the window could alias the
+     fields of GZIO otherwise.  */
+  const struct inflate_code *lcode = gzio->lcode;
+  const struct inflate_code *dcode = gzio->dcode;
+  unsigned lmask = (1U << gzio->lbits) - 1;
+  unsigned dmask = (1U << gzio->dbits) - 1;
+  int eob = 0;
 
   /* make local copies of globals */
   d = gzio->inflate_d;
@@ -661,110 +710,103 @@ inflate_codes_in_window (grub_gzio_t gzio)
   b = gzio->bb;			/* initialize bit buffer */
   k = gzio->bk;
   w = gzio->wp;			/* initialize window position */
+  code_state = gzio->code_state;
 
-  /* inflate the coded data */
-  ml = mask_bits[gzio->bl];		/* precompute masks for speed */
-  md = mask_bits[gzio->bd];
   for (;;)			/* do until end of block */
     {
-      if (! gzio->code_state)
+      if (! code_state)
 	{
-	  NEEDBITS ((unsigned) gzio->bl);
-	  if ((e = (t = gzio->tl + ((unsigned) b & ml))->e) > 16)
-	    do
-	      {
-		if (e == 99)
-		  {
-		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				"an unused code found");
-		    return 1;
-		  }
-		DUMPBITS (t->b);
-		e -= 16;
-		NEEDBITS (e);
-	      }
-	    while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-	  DUMPBITS (t->b);
-
-	  if (e == 16)		/* then it's a literal */
+	  /* The longest literal/length code.  A refill brings in at least
+	     56 bits, so several literals are decoded per refill.  */
+	  NEEDBITS (15);
+
+	  here = lcode + (b & lmask);
+	  op = here->op;
+	  if (op != INFLATE_OP_LITERAL && op < INFLATE_OP_BASE)
 	    {
-	      gzio->slide[w++] = (uch) t->v.n;
+	      DUMPBITS (here->bits);
+	      here = lcode + here->val + BITS (op);
+	      op = here->op;
+	    }
+	  DUMPBITS (here->bits);
+
+	  if (op == INFLATE_OP_LITERAL)
+	    {
+	      slide[w++] = (uch) here->val;
 	      if (w == WSIZE)
 		break;
+	      continue;
 	    }
-	  else
-	    /* it's an EOB or a length */
-	    {
-	      /* exit if end of block */
-	      if (e == 15)
-		{
-		  gzio->block_len = 0;
-		  break;
-		}
 
-	      /* get length of block to copy */
-	      NEEDBITS (e);
-	      n = t->v.n + ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-
-	      /* decode distance of block to copy */
-	      NEEDBITS ((unsigned) gzio->bd);
-	      if ((e = (t = gzio->td + ((unsigned) b & md))->e) > 16)
-		do
-		  {
-		    if (e == 99)
-		      {
-			grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				    "an unused code found");
-			return 1;
-		      }
-		    DUMPBITS (t->b);
-		    e -= 16;
-		    NEEDBITS (e);
-		  }
-		while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e)
-		       > 16);
-	      DUMPBITS (t->b);
-	      NEEDBITS (e);
-	      d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-	      gzio->code_state++;
+	  if (op & INFLATE_OP_EOB)
+	    {
+	      eob = 1;
+	      break;
 	    }
-	}
 
-      if (gzio->code_state)
-	{
-	  /* do the copy */
-	  do
+	  if (op & INFLATE_OP_INVALID)
 	    {
-	      n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n
-		    : e);
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "an unused code found");
+	      return 1;
+	    }
 
-	      if (w - d >= e)
-		{
-		  grub_memmove (gzio->slide + w, gzio->slide + d, e);
-		  w += e;
-		  d += e;
-		}
-	      else
-		/* purposefully use the overlap for extra copies here!! */
-		{
-		  while (e--)
-		    gzio->slide[w++] = gzio->slide[d++];
-		}
+	  /* Length extra bits, distance code and distance extra bits.  */
+	  NEEDBITS (5 + 15 + 13);
 
-	      if (w == WSIZE)
-		break;
+	  /* get length of block to copy */
+	  op &= 15;
+	  n = here->val + BITS (op);
+	  DUMPBITS (op);
+
+	  /* decode distance of block to copy */
+	  here = dcode + (b & dmask);
+	  op = here->op;
+	  if (op != INFLATE_OP_LITERAL && op < INFLATE_OP_BASE)
+	    {
+	      DUMPBITS (here->bits);
+	      here = dcode + here->val + BITS (op);
+	      op = here->op;
+	    }
+	  DUMPBITS (here->bits);
+
+	  if (! (op & INFLATE_OP_BASE))
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "an unused code found");
+	      return 1;
 	    }
-	  while (n);
 
-	  if (! n)
-	    gzio->code_state--;
+	  op &= 15;
+	  d = w - here->val - BITS (op);
+	  DUMPBITS (op);
+	  code_state = 1;
+	}
+
+      /* do the copy */
+      do
+	{
+	  d &= WSIZE - 1;
+	  e = WSIZE - (d > w ? d : w);
+	  if (e > n)
+	    e = n;
+	  n -= e;
+
+	  copy_match (slide + w, slide + d, e);
+	  w += e;
+	  d += e;
 
-	  /* did we break from the loop too soon? */
 	  if (w == WSIZE)
 	    break;
 	}
+      while (n);
+
+      if (! n)
+	code_state = 0;
+
+      /* did we break from the loop too soon? */
+      if (w == WSIZE)
+	break;
     }
 
   /* restore the globals from the locals */
@@ -773,6 +815,9 @@ inflate_codes_in_window (grub_gzio_t gzio)
   gzio->wp = w;			/* restore global window pointer */
   gzio->bb = b;			/* restore global bit buffer */
   gzio->bk = k;
+  gzio->code_state = code_state;
+  if (eob)
+    gzio->block_len = 0;
 
   return ! gzio->block_len;
 }
@@ -783,8 +828,8 @@ inflate_codes_in_window (grub_gzio_t gzio)
 static void
 init_stored_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   b = gzio->bb;			/* initialize bit buffer */
@@ -794,10 +839,9 @@ init_stored_block (grub_gzio_t gzio)
   DUMPBITS (k & 7);
 
   /* get the length and its complement */
-  NEEDBITS (16);
-  gzio->block_len = ((unsigned) b & 0xffff);
+  NEEDBITS (32);
+  gzio->block_len = BITS (16);
   DUMPBITS (16);
-  NEEDBITS (16);
   if (gzio->block_len != (int) ((~b) & 0xffff))
     grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		"the length of a stored block does not match");
@@ -809,48 +853,55 @@ init_stored_block (grub_gzio_t gzio)
 }
 
 
-/* get header for an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
+/* get header for an inflated type 1 (fixed Huffman codes) block.  The
+   tables are the same for every fixed block, so they are built once.  */
 
 static void
 init_fixed_block (grub_gzio_t gzio)
 {
-  int i;			/* temporary variable */
-  unsigned l[288];		/* length list for huft_build */
-
-  /* set up literal table */
-  for (i = 0; i < 144; i++)
-    l[i] = 8;
-  for (; i < 256; i++)
-    l[i] = 9;
-  for (; i < 280; i++)
-    l[i] = 7;
-  for (; i < 288; i++)		/* make a complete, but wrong code set */
-    l[i] = 8;
-  gzio->bl = 7;
-  if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  if (! fixed_built)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      return;
-    }
+      int i;			/* temporary variable */
+      unsigned l[288];		/* length list for build_table */
+
+      /* set up literal table */
+      for (i = 0; i < 144; i++)
+	l[i] = 8;
+      for (; i < 256; i++)
+	l[i] = 9;
+      for (; i < 280; i++)
+	l[i] = 7;
+      for (; i < 288; i++)	/* make a complete, but wrong code set */
+	l[i] = 8;
+      fixed_lbits = 9;
+      if (build_table (l, 288, 256, 1, cplens, cplext, fixed_lcode,
+		       ARRAY_SIZE (fixed_lcode), &fixed_lbits, 0) != 0)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "failed in building a Huffman code table");
+	  return;
+	}
 
-  /* set up distance table */
-  for (i = 0; i < 30; i++)	/* make an incomplete code set */
-    l[i] = 5;
-  gzio->bd = 5;
-  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->td, &gzio->bd) > 1)
-    {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      huft_free (gzio->tl);
-      gzio->tl = 0;
-      return;
+      /* set up distance table */
+      for (i = 0; i < 30; i++)	/* make an incomplete code set */
+	l[i] = 5;
+      fixed_dbits = 5;
+      if (build_table (l, 30, 0, 0, cpdist, cpdext, fixed_dcode,
+		       ARRAY_SIZE (fixed_dcode), &fixed_dbits, 1) != 0)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "failed in building a Huffman code table");
+	  return;
+	}
+
+      fixed_built = 1;
     }
 
+  gzio->lcode = fixed_lcode;
+  gzio->lbits = fixed_lbits;
+  gzio->dcode = fixed_dcode;
+  gzio->dbits = fixed_dbits;
+
   /* indicate we're now working on a block */
   gzio->code_state = 0;
   gzio->block_len++;
@@ -871,22 +922,22 @@ init_dynamic_block (grub_gzio_t gzio)
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
   unsigned ll[286 + 30];	/* literal/length and distance code lengths */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  unsigned bits;		/* root bits of the bit length table */
+  const struct inflate_code *here;
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
   k = gzio->bk;
 
   /* read in table lengths */
-  NEEDBITS (5);
-  nl = 257 + ((unsigned) b & 0x1f);	/* number of literal/length codes */
+  NEEDBITS (14);
+  nl = 257 + BITS (5);		/* number of literal/length codes */
   DUMPBITS (5);
-  NEEDBITS (5);
-  nd = 1 + ((unsigned) b & 0x1f);	/* number of distance codes */
+  nd = 1 + BITS (5);		/* number of distance codes */
   DUMPBITS (5);
-  NEEDBITS (4);
-  nb = 4 + ((unsigned) b & 0xf);	/* number of bit length codes */
+  nb = 4 + BITS (4);		/* number of bit length codes */
   DUMPBITS (4);
   if (nl > 286 || nd > 30)
     {
@@ -898,15 +949,16 @@ init_dynamic_block (grub_gzio_t gzio)
   for (j = 0; j < nb; j++)
     {
       NEEDBITS (3);
-      ll[bitorder[j]] = (unsigned) b & 7;
+      ll[bitorder[j]] = BITS (3);
       DUMPBITS (3);
     }
   for (; j < 19; j++)
     ll[bitorder[j]] = 0;
 
   /* build decoding table for trees--single level, 7 bit lookup */
-  gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  bits = 7;
+  if (build_table (ll, 19, 19, 0, NULL, NULL, gzio->dyn_lcode,
+		   LCODE_SIZE, &bits, 0) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
@@ -915,20 +967,24 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* read in literal and distance code lengths */
   n = nl + nd;
-  m = mask_bits[gzio->bl];
+  m = (1U << bits) - 1;
   i = l = 0;
   while ((unsigned) i < n)
     {
-      NEEDBITS ((unsigned) gzio->bl);
-      j = (gzio->td = gzio->tl + ((unsigned) b & m))->b;
-      DUMPBITS (j);
-      j = gzio->td->v.n;
+      NEEDBITS (7 + 7);
+      here = gzio->dyn_lcode + (b & m);
+      if (here->op != INFLATE_OP_LITERAL)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+      DUMPBITS (here->bits);
+      j = here->val;
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
 	{
-	  NEEDBITS (2);
-	  j = 3 + ((unsigned) b & 3);
+	  j = 3 + BITS (2);
 	  DUMPBITS (2);
 	  if ((unsigned) i + j > n)
 	    {
@@ -940,8 +996,7 @@ init_dynamic_block (grub_gzio_t gzio)
 	}
       else if (j == 17)		/* 3 to 10 zero length codes */
 	{
-	  NEEDBITS (3);
-	  j = 3 + ((unsigned) b & 7);
+	  j = 3 + BITS (3);
 	  DUMPBITS (3);
 	  if ((unsigned) i + j > n)
 	    {
@@ -955,8 +1010,7 @@ init_dynamic_block (grub_gzio_t gzio)
       else
 	/* j == 18: 11 to 138 zero length codes */
 	{
-	  NEEDBITS (7);
-	  j = 11 + ((unsigned) b & 0x7f);
+	  j = 11 + BITS (7);
 	  DUMPBITS (7);
 	  if ((unsigned) i + j > n)
 	    {
@@ -969,32 +1023,29 @@ init_dynamic_block (grub_gzio_t gzio)
 	}
     }
 
-  /* free decoding table for trees */
-  huft_free (gzio->tl);
-  gzio->td = 0;
-  gzio->tl = 0;
-
   /* restore the global bit buffer */
   gzio->bb = b;
   gzio->bk = k;
 
   /* build the decoding tables for literal/length and distance codes */
-  gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  gzio->lbits = LBITS;
+  if (build_table (ll, nl, 256, 1, cplens, cplext, gzio->dyn_lcode,
+		   LCODE_SIZE, &gzio->lbits, 0) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
-  gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
+  gzio->dbits = DBITS;
+  if (build_table (ll + nl, nd, 0, 0, cpdist, cpdext, gzio->dyn_dcode,
+		   DCODE_SIZE, &gzio->dbits, 0) != 0)
     {
-      huft_free (gzio->tl);
-      gzio->tl = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
+  gzio->lcode = gzio->dyn_lcode;
+  gzio->dcode = gzio->dyn_dcode;
 
   /* indicate we're now working on a block */
   gzio->code_state = 0;
@@ -1005,21 +1056,20 @@ init_dynamic_block (grub_gzio_t gzio)
 static void
 get_new_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
   k = gzio->bk;
 
   /* read in last block bit */
-  NEEDBITS (1);
+  NEEDBITS (3);
   gzio->last_block = (int) b & 1;
   DUMPBITS (1);
 
   /* read in block type */
-  NEEDBITS (2);
-  gzio->block_type = (unsigned) b & 3;
+  gzio->block_type = BITS (2);
   DUMPBITS (2);
 
   /* restore the global bit buffer */
@@ -1047,7 +1097,8 @@ static void
 inflate_window (grub_gzio_t gzio)
 {
   /* initialize window */
-  gzio->wp = 0;
+  gzio->wp = gzio->resume_wp;
+  gzio->resume_wp = 0;
 
   /*
    *  Main decompression loop.
@@ -1060,6 +1111,7 @@ inflate_window (grub_gzio_t gzio)
 	  if (gzio->last_block)
 	    break;
 
+	  record_checkpoint (gzio);
 	  get_new_block (gzio);
 	}
 
@@ -1078,15 +1130,41 @@ inflate_window (grub_gzio_t gzio)
 	  int w = gzio->wp;
 
 	  /*
-	   *  This is basically a glorified pass-through
+	   *  This is basically a glorified pass-through.  The bytes still
+	   *  in the bit buffer come first, then whole runs of the input
+	   *  buffer.
 	   */
 
-	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	  while (gzio->block_len && w < WSIZE && gzio->bk >= 8)
 	    {
-	      gzio->slide[w++] = get_byte (gzio);
+	      gzio->slide[w++] = gzio->bb & 0xff;
+	      gzio->bb >>= 8;
+	      gzio->bk -= 8;
 	      gzio->block_len--;
 	    }
 
+	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
+	    {
+	      const grub_uint8_t *in;
+	      grub_size_t avail;
+
+	      in = input_avail (gzio, &avail);
+	      if (avail == 0)
+		{
+		  gzio->slide[w++] = get_byte (gzio);
+		  gzio->block_len--;
+		  continue;
+		}
+	      if (avail > (grub_size_t) gzio->block_len)
+		avail = gzio->block_len;
+	      if (avail > (grub_size_t) (WSIZE - w))
+		avail = WSIZE - w;
+	      grub_memcpy (gzio->slide + w, in, avail);
+	      input_skip (gzio, avail);
+	      w += avail;
+	      gzio->block_len -= avail;
+	    }
+
 	  gzio->wp = w;
 
 	  continue;
@@ -1096,13 +1174,7 @@ inflate_window (grub_gzio_t gzio)
        *  Expand other kind of block.
        */
 
-      if (inflate_codes_in_window (gzio))
-	{
-	  huft_free (gzio->tl);
-	  huft_free (gzio->td);
-	  gzio->tl = 0;
-	  gzio->td = 0;
-	}
+      inflate_codes_in_window (gzio);
     }
 
   gzio->saved_offset += gzio->wp;
@@ -1133,24 +1205,179 @@ initialize_tables (grub_gzio_t gzio)
   gzio->saved_offset = 0;
   gzio_seek (gzio, gzio->data_offset);
 
-  /* Initialize the bit buffer.  */
+  /* Initialize the input and the bit buffer.  */
+  gzio->inbuf_d = 0;
+  gzio->inbuf_len = 0;
   gzio->bk = 0;
   gzio->bb = 0;
 
   /* Reset partial decompression code.  */
   gzio->last_block = 0;
   gzio->block_len = 0;
+  gzio->resume_wp = 0;
 
-  /* Reset memory allocation stuff.  */
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
-  gzio->tl = NULL;
-  gzio->td = NULL;
+  gzio->lcode = NULL;
+  gzio->dcode = NULL;
 
   if (gzio->hcontext)
     gzio->hdesc->init(gzio->hcontext);
 }
 
+static void
+free_checkpoints (grub_gzio_t gzio)
+{
+  unsigned i;
+
+  for (i = 0; i < gzio->num_checkpoints; i++)
+    grub_free (gzio->checkpoints[i]);
+  grub_free (gzio->checkpoints);
+  gzio->checkpoints = NULL;
+  gzio->num_checkpoints = 0;
+}
+
+/* Set up the seek index within the memory allowed by
+   decompress_index_size.  */
+static void
+init_checkpoints (grub_gzio_t gzio)
+{
+  const char *val;
+  grub_size_t budget = GZIO_INDEX_DEFAULT_SIZE;
+  grub_size_t size;
+
+  val = grub_env_get ("decompress_index_size");
+  if (val)
+    {
+      budget = grub_strtoul (val, 0, 0) * 1024;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  size = sizeof (struct gzio_checkpoint)
+    + (gzio->hcontext ? gzio->hdesc->contextsize : 0);
+  gzio->max_checkpoints = budget / size;
+  gzio->checkpoint_span = GZIO_CHECKPOINT_SPAN;
+  if (gzio->max_checkpoints == 0)
+    return;
+
+  gzio->checkpoints = grub_zalloc (gzio->max_checkpoints
+				   * sizeof (gzio->checkpoints[0]));
+  if (! gzio->checkpoints)
+    {
+      gzio->max_checkpoints = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
+/* Called at each block boundary.  Save the state if we are far enough
+   past the last checkpoint.  When the index is full, every other
+   checkpoint is dropped and the distance between them doubles.  */
+static void
+record_checkpoint (grub_gzio_t gzio)
+{
+  struct gzio_checkpoint *cp;
+  grub_off_t out = gzio->saved_offset + gzio->wp;
+  grub_off_t last = 0;
+  grub_off_t bitpos;
+  grub_size_t ctxsize = gzio->hcontext ? gzio->hdesc->contextsize : 0;
+  unsigned i;
+
+  if (! gzio->max_checkpoints)
+    return;
+
+  if (gzio->num_checkpoints)
+    last = gzio->checkpoints[gzio->num_checkpoints - 1]->out;
+  if (out < last + gzio->checkpoint_span)
+    return;
+
+  if (gzio->num_checkpoints == gzio->max_checkpoints)
+    {
+      unsigned j = 0;
+
+      for (i = 0; i < gzio->num_checkpoints; i++)
+	if (i & 1)
+	  gzio->checkpoints[j++] = gzio->checkpoints[i];
+	else
+	  grub_free (gzio->checkpoints[i]);
+      gzio->num_checkpoints = j;
+      gzio->checkpoint_span *= 2;
+
+      last = j ? gzio->checkpoints[j - 1]->out : 0;
+      if (out < last + gzio->checkpoint_span)
+	return;
+    }
+
+  cp = grub_malloc (sizeof (*cp) + ctxsize);
+  if (! cp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  /* The bit buffer holds input which has been read but not used.  */
+  bitpos = (gzio->mem_input ? gzio->mem_input_off
+	    : grub_file_tell (gzio->file) - (gzio->inbuf_len - gzio->inbuf_d));
+  bitpos = bitpos * 8 - gzio->bk;
+
+  cp->out = out;
+  cp->in = bitpos >> 3;
+  cp->in_bit = bitpos & 7;
+  cp->wp = gzio->wp;
+  grub_memcpy (cp->slide, gzio->slide, WSIZE);
+  if (ctxsize)
+    grub_memcpy (cp->hcontext, gzio->hcontext, ctxsize);
+
+  gzio->checkpoints[gzio->num_checkpoints++] = cp;
+}
+
+/* Return the last checkpoint whose window covers OFFSET.  */
+static struct gzio_checkpoint *
+find_checkpoint (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->num_checkpoints;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      struct gzio_checkpoint *cp = gzio->checkpoints[mid];
+
+      if (cp->out - cp->wp <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo ? gzio->checkpoints[lo - 1] : NULL;
+}
+
+static void
+restore_checkpoint (grub_gzio_t gzio, struct gzio_checkpoint *cp)
+{
+  grub_memcpy (gzio->slide, cp->slide, WSIZE);
+  /* Window starts are multiples of WSIZE, as read_real () expects.  */
+  gzio->saved_offset = cp->out - cp->wp;
+  gzio->resume_wp = cp->wp;
+
+  gzio_seek (gzio, cp->in);
+  gzio->inbuf_d = 0;
+  gzio->inbuf_len = 0;
+  gzio->bb = 0;
+  gzio->bk = 0;
+  if (cp->in_bit)
+    {
+      fill_bits (gzio, &gzio->bb, &gzio->bk);
+      gzio->bb >>= cp->in_bit;
+      gzio->bk -= cp->in_bit;
+    }
+
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+  gzio->code_state = 0;
+  gzio->lcode = NULL;
+  gzio->dcode = NULL;
+
+  if (gzio->hcontext)
+    grub_memcpy (gzio->hcontext, cp->hcontext, gzio->hdesc->contextsize);
+}
+
 
 /* Open a new decompressing object on the top of IO. If TRANSPARENT is true,
    even if IO does not contain data compressed by gzip, return a valid file
@@ -1193,6 +1420,8 @@ grub_gzio_open (grub_file_t io, const char *name __attribute__ ((unused)))
       return io;
     }
 
+  init_checkpoints (gzio);
+
   return file;
 }
 
@@ -1254,9 +1483,25 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 {
   grub_ssize_t ret = 0;
 
-  /* Do we reset decompression to the beginning of the file?  */
+  /* Do we resume decompression from a checkpoint, or reset it to the
+     beginning of the file?  Going forward, a checkpoint is only worth it
+     when it lies beyond what we have decompressed.  */
   if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+    {
+      struct gzio_checkpoint *cp = find_checkpoint (gzio, offset);
+
+      if (cp)
+	restore_checkpoint (gzio, cp);
+      else
+	initialize_tables (gzio);
+    }
+  else if (offset > gzio->saved_offset)
+    {
+      struct gzio_checkpoint *cp = find_checkpoint (gzio, offset);
+
+      if (cp && cp->out > gzio->saved_offset)
+	restore_checkpoint (gzio, cp);
+    }
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1284,7 +1529,7 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
       if (size > len)
 	size = len;
 
-      grub_memmove (buf, srcaddr, size);
+      copy_words ((grub_uint8_t *) buf, (grub_uint8_t *) srcaddr, size);
 
       buf += size;
       len -= size;
@@ -1320,8 +1565,7 @@ grub_gzio_close (grub_file_t file)
   grub_gzio_t gzio = file->data;
 
   grub_file_close (gzio->file);
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  free_checkpoints (gzio);
   grub_free (gzio->hcontext);
   grub_free (gzio);
 
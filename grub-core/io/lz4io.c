@@ -0,0 +1,930 @@
+/* lz4io.c - decompression support for lz4 */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/env.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MAGIC		0x184d2204
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_SKIPPABLE_MAGIC	0x184d2a50
+#define LZ4_SKIPPABLE_MASK	0xfffffff0
+
+#define LZ4_FLG_VERSION_MASK	0xc0
+#define LZ4_FLG_VERSION		0x40
+#define LZ4_FLG_INDEPENDENT	0x20
+#define LZ4_FLG_BLOCK_CHECKSUM	0x10
+#define LZ4_FLG_CONTENT_SIZE	0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_RESERVED	0x02
+#define LZ4_FLG_DICT_ID		0x01
+#define LZ4_BD_RESERVED		0x8f
+
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000
+
+/* Blocks of the legacy format all hold this much, but the last.  */
+#define LZ4_LEGACY_BLOCK_SIZE	(8 << 20)
+#define LZ4_COMPRESS_BOUND(x)	((x) + (x) / 255 + 16)
+
+/* Farthest back a match reaches, kept when blocks depend on each other.  */
+#define LZ4_WINDOW_SIZE		(64 << 10)
+
+/* Default memory for the seek index of each file, see
+   decompress_index_size in the manual.  */
+#define LZ4IO_INDEX_DEFAULT_SIZE (1 << 20)
+
+#define PRIME32_1 0x9e3779b1U
+#define PRIME32_2 0x85ebca77U
+#define PRIME32_3 0xc2b2ae3dU
+#define PRIME32_4 0x27d4eb2fU
+#define PRIME32_5 0x165667b1U
+
+/* XXH32 state, for the checksums of the frame format.  */
+struct xxh32
+{
+  grub_uint32_t v[4];
+  grub_uint32_t total;
+  int large;
+  grub_uint8_t mem[16];
+  grub_size_t memsize;
+};
+
+/* Point to resume decompression at: the start of a frame or a block of
+   the legacy format.  */
+struct grub_lz4io_entry
+{
+  grub_off_t in_off;
+  grub_off_t out_off;
+  int legacy;
+};
+
+struct grub_lz4io
+{
+  grub_file_t file;
+  grub_off_t saved_offset;
+
+  /* The frame being decompressed.  */
+  int in_frame;
+  int legacy;
+  grub_uint8_t flags;
+  grub_size_t block_max;
+  struct xxh32 hash;
+
+  /* Compressed input and decompressed output of the current block.  The
+     output of the previous blocks is kept in front of it when blocks may
+     refer to it.  */
+  char *inbuf;
+  char *outbuf;
+  grub_size_t inbuf_size;
+  grub_size_t outbuf_size;
+  grub_size_t out_pos;
+  grub_size_t out_end;
+
+  /* NULL if the index didn't fit in the memory allowed.  */
+  struct grub_lz4io_entry *index;
+  grub_size_t num_index;
+};
+
+typedef struct grub_lz4io *grub_lz4io_t;
+static struct grub_fs grub_lz4io_fs;
+
+static inline grub_uint32_t
+rotl32 (grub_uint32_t x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline grub_uint32_t
+xxh32_round (grub_uint32_t acc, const grub_uint8_t *p)
+{
+  acc += grub_le_to_cpu32 (grub_get_unaligned32 (p)) * PRIME32_2;
+  return rotl32 (acc, 13) * PRIME32_1;
+}
+
+static void
+xxh32_init (struct xxh32 *h)
+{
+  h->v[0] = PRIME32_1 + PRIME32_2;
+  h->v[1] = PRIME32_2;
+  h->v[2] = 0;
+  h->v[3] = -PRIME32_1;
+  h->total = 0;
+  h->large = 0;
+  h->memsize = 0;
+}
+
+static void
+xxh32_update (struct xxh32 *h, const void *buf, grub_size_t len)
+{
+  const grub_uint8_t *p = buf;
+
+  h->total += len;
+  if (h->total >= 16 || len >= 16)
+    h->large = 1;
+
+  if (h->memsize + len < 16)
+    {
+      grub_memcpy (h->mem + h->memsize, p, len);
+      h->memsize += len;
+      return;
+    }
+
+  if (h->memsize)
+    {
+      grub_size_t n = 16 - h->memsize;
+
+      grub_memcpy (h->mem + h->memsize, p, n);
+      p += n;
+      len -= n;
+      h->v[0] = xxh32_round (h->v[0], h->mem);
+      h->v[1] = xxh32_round (h->v[1], h->mem + 4);
+      h->v[2] = xxh32_round (h->v[2], h->mem + 8);
+      h->v[3] = xxh32_round (h->v[3], h->mem + 12);
+      h->memsize = 0;
+    }
+
+  for (; len >= 16; p += 16, len -= 16)
+    {
+      h->v[0] = xxh32_round (h->v[0], p);
+      h->v[1] = xxh32_round (h->v[1], p + 4);
+      h->v[2] = xxh32_round (h->v[2], p + 8);
+      h->v[3] = xxh32_round (h->v[3], p + 12);
+    }
+
+  grub_memcpy (h->mem, p, len);
+  h->memsize = len;
+}
+
+static grub_uint32_t
+xxh32_final (struct xxh32 *h)
+{
+  const grub_uint8_t *p = h->mem;
+  grub_size_t len = h->memsize;
+  grub_uint32_t acc;
+
+  if (h->large)
+    acc = rotl32 (h->v[0], 1) + rotl32 (h->v[1], 7)
+      + rotl32 (h->v[2], 12) + rotl32 (h->v[3], 18);
+  else
+    acc = h->v[2] + PRIME32_5;
+  acc += h->total;
+
+  for (; len >= 4; p += 4, len -= 4)
+    acc = rotl32 (acc + grub_le_to_cpu32 (grub_get_unaligned32 (p))
+		  * PRIME32_3, 17) * PRIME32_4;
+  for (; len; p++, len--)
+    acc = rotl32 (acc + *p * PRIME32_5, 11) * PRIME32_1;
+
+  acc ^= acc >> 15;
+  acc *= PRIME32_2;
+  acc ^= acc >> 13;
+  acc *= PRIME32_3;
+  acc ^= acc >> 16;
+  return acc;
+}
+
+static grub_uint32_t
+xxh32 (const void *buf, grub_size_t len)
+{
+  struct xxh32 h;
+
+  xxh32_init (&h);
+  xxh32_update (&h, buf, len);
+  return xxh32_final (&h);
+}
+
+static grub_size_t
+index_budget (void)
+{
+  const char *val;
+  grub_size_t budget;
+
+  val = grub_env_get ("decompress_index_size");
+  if (! val)
+    return LZ4IO_INDEX_DEFAULT_SIZE;
+
+  budget = grub_strtoul (val, 0, 0) * 1024;
+  grub_errno = GRUB_ERR_NONE;
+  return budget;
+}
+
+/* Read exactly LEN bytes, failing at the end of the file.  */
+static grub_err_t
+read_exact (grub_file_t file, void *buf, grub_size_t len)
+{
+  grub_ssize_t ret;
+
+  ret = grub_file_read (file, buf, len);
+  if (ret < 0)
+    return grub_errno;
+  if ((grub_size_t) ret != len)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "premature end of compressed");
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_le32 (grub_file_t file, grub_uint32_t *val)
+{
+  grub_uint32_t v;
+
+  if (read_exact (file, &v, sizeof (v)))
+    return grub_errno;
+  *val = grub_le_to_cpu32 (v);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+skip (grub_file_t file, grub_off_t len)
+{
+  if (len > file->size - file->offset)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "premature end of compressed");
+  grub_file_seek (file, file->offset + len);
+  return GRUB_ERR_NONE;
+}
+
+/* Make the block buffers big enough for blocks of BLOCK_MAX bytes.  */
+static grub_err_t
+alloc_buffers (grub_lz4io_t lz4io, grub_size_t block_max)
+{
+  grub_size_t insize = LZ4_COMPRESS_BOUND (block_max);
+  grub_size_t outsize = LZ4_WINDOW_SIZE + block_max;
+
+  if (lz4io->inbuf_size < insize)
+    {
+      grub_free (lz4io->inbuf);
+      lz4io->inbuf_size = 0;
+      lz4io->inbuf = grub_malloc (insize);
+      if (!lz4io->inbuf)
+	return grub_errno;
+      lz4io->inbuf_size = insize;
+    }
+  if (lz4io->outbuf_size < outsize)
+    {
+      grub_free (lz4io->outbuf);
+      lz4io->outbuf_size = 0;
+      lz4io->out_pos = lz4io->out_end = 0;
+      lz4io->outbuf = grub_malloc (outsize);
+      if (!lz4io->outbuf)
+	return grub_errno;
+      lz4io->outbuf_size = outsize;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Read the frame descriptor following the magic number, and the content
+   size if present into CONTENT_SIZE.  */
+static grub_err_t
+read_frame_descriptor (grub_lz4io_t lz4io, grub_uint64_t *content_size)
+{
+  grub_uint8_t desc[2 + 8 + 1];
+  grub_size_t len = 2;
+
+  if (read_exact (lz4io->file, desc, 2))
+    return grub_errno;
+
+  if ((desc[0] & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION
+      || (desc[0] & LZ4_FLG_RESERVED)
+      || (desc[1] & LZ4_BD_RESERVED)
+      || (desc[1] >> 4) < 4)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "invalid lz4 frame descriptor");
+  if (desc[0] & LZ4_FLG_DICT_ID)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "lz4 dictionaries aren't supported");
+
+  if (desc[0] & LZ4_FLG_CONTENT_SIZE)
+    len += 8;
+  if (read_exact (lz4io->file, desc + 2, len - 2 + 1))
+    return grub_errno;
+  if (((xxh32 (desc, len) >> 8) & 0xff) != desc[len])
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "lz4 frame descriptor checksum mismatch");
+
+  lz4io->flags = desc[0];
+  lz4io->block_max = 1 << (2 * (desc[1] >> 4) + 8);
+  if (desc[0] & LZ4_FLG_CONTENT_SIZE)
+    *content_size = grub_le_to_cpu64 (grub_get_unaligned64 (desc + 2));
+  else
+    *content_size = GRUB_FILE_SIZE_UNKNOWN;
+  return GRUB_ERR_NONE;
+}
+
+enum
+  {
+    FRAME_END,
+    FRAME_LZ4,
+    FRAME_LEGACY
+  };
+
+/* Read the header of the next frame, skipping skippable frames.  Return
+   FRAME_END at the end of the input, or -1 on error.  */
+static int
+read_frame_header (grub_lz4io_t lz4io, grub_uint64_t *content_size)
+{
+  while (1)
+    {
+      grub_uint32_t magic, len;
+      grub_ssize_t ret;
+
+      ret = grub_file_read (lz4io->file, &magic, sizeof (magic));
+      if (ret < 0)
+	return -1;
+      if (ret == 0)
+	return FRAME_END;
+      if (ret != sizeof (magic))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "premature end of compressed");
+	  return -1;
+	}
+      magic = grub_le_to_cpu32 (magic);
+
+      if (magic == LZ4_MAGIC)
+	return read_frame_descriptor (lz4io, content_size) ? -1 : FRAME_LZ4;
+
+      if (magic == LZ4_LEGACY_MAGIC)
+	{
+	  lz4io->flags = LZ4_FLG_INDEPENDENT;
+	  lz4io->block_max = LZ4_LEGACY_BLOCK_SIZE;
+	  *content_size = GRUB_FILE_SIZE_UNKNOWN;
+	  return FRAME_LEGACY;
+	}
+
+      if ((magic & LZ4_SKIPPABLE_MASK) != LZ4_SKIPPABLE_MAGIC)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 magic");
+	  return -1;
+	}
+      if (read_le32 (lz4io->file, &len) || skip (lz4io->file, len))
+	return -1;
+    }
+}
+
+/* Read the size of the next legacy block.  Return 0 and rewind if the
+   frame has ended, at the end of the input or at the magic number of the
+   next frame.  */
+static int
+read_legacy_block_size (grub_lz4io_t lz4io, grub_uint32_t *size)
+{
+  grub_ssize_t ret;
+
+  ret = grub_file_read (lz4io->file, size, sizeof (*size));
+  if (ret < 0)
+    return -1;
+  if (ret == 0)
+    return 0;
+  if (ret != sizeof (*size))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "premature end of compressed");
+      return -1;
+    }
+  *size = grub_le_to_cpu32 (*size);
+  if (*size > LZ4_COMPRESS_BOUND (LZ4_LEGACY_BLOCK_SIZE))
+    {
+      grub_file_seek (lz4io->file, lz4io->file->offset - sizeof (*size));
+      return 0;
+    }
+  return 1;
+}
+
+/* Decompress the next block into the output buffer.  Return 0 at the
+   end of the input, or -1 on error.  */
+static int
+next_block (grub_lz4io_t lz4io)
+{
+  grub_uint32_t size;
+  grub_ssize_t ret;
+  grub_size_t start, prefix;
+  int compressed = 1;
+
+  while (1)
+    {
+      if (!lz4io->in_frame)
+	{
+	  grub_uint64_t content_size;
+	  int type;
+
+	  type = read_frame_header (lz4io, &content_size);
+	  if (type < 0)
+	    return -1;
+	  if (type == FRAME_END)
+	    return 0;
+	  if (alloc_buffers (lz4io, lz4io->block_max))
+	    return -1;
+	  lz4io->in_frame = 1;
+	  lz4io->legacy = (type == FRAME_LEGACY);
+	  lz4io->out_pos = lz4io->out_end = 0;
+	  xxh32_init (&lz4io->hash);
+	}
+
+      if (lz4io->legacy)
+	{
+	  ret = read_legacy_block_size (lz4io, &size);
+	  if (ret < 0)
+	    return -1;
+	  if (ret > 0)
+	    break;
+	  lz4io->in_frame = 0;
+	  continue;
+	}
+
+      if (read_le32 (lz4io->file, &size))
+	return -1;
+      if (size != 0)
+	break;
+
+      /* End of the frame.  */
+      if (lz4io->flags & LZ4_FLG_CONTENT_CHECKSUM)
+	{
+	  grub_uint32_t sum;
+
+	  if (read_le32 (lz4io->file, &sum))
+	    return -1;
+	  if (sum != xxh32_final (&lz4io->hash))
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "lz4 content checksum mismatch");
+	      return -1;
+	    }
+	}
+      lz4io->in_frame = 0;
+    }
+
+  if (!lz4io->legacy && (size & LZ4_BLOCK_UNCOMPRESSED))
+    {
+      size &= ~LZ4_BLOCK_UNCOMPRESSED;
+      compressed = 0;
+    }
+  if (size > (compressed ? LZ4_COMPRESS_BOUND (lz4io->block_max)
+	      : lz4io->block_max))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 block size");
+      return -1;
+    }
+
+  if (read_exact (lz4io->file, lz4io->inbuf, size))
+    return -1;
+  if (lz4io->flags & LZ4_FLG_BLOCK_CHECKSUM)
+    {
+      grub_uint32_t sum;
+
+      if (read_le32 (lz4io->file, &sum))
+	return -1;
+      if (sum != xxh32 (lz4io->inbuf, size))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "lz4 block checksum mismatch");
+	  return -1;
+	}
+    }
+
+  /* Keep the window the block may refer to in front of it.  */
+  if (lz4io->flags & LZ4_FLG_INDEPENDENT)
+    start = 0;
+  else if (lz4io->out_end + lz4io->block_max <= lz4io->outbuf_size)
+    start = lz4io->out_end;
+  else
+    {
+      start = LZ4_WINDOW_SIZE;
+      if (start > lz4io->out_end)
+	start = lz4io->out_end;
+      grub_memmove (lz4io->outbuf, lz4io->outbuf + lz4io->out_end - start,
+		    start);
+    }
+  prefix = (lz4io->flags & LZ4_FLG_INDEPENDENT) ? 0 : start;
+
+  if (compressed)
+    {
+      ret = grub_lz4_decompress (lz4io->inbuf, size, lz4io->outbuf + start,
+				 lz4io->block_max, prefix);
+      if (ret < 0)
+	return -1;
+    }
+  else
+    {
+      grub_memcpy (lz4io->outbuf + start, lz4io->inbuf, size);
+      ret = size;
+    }
+
+  if (lz4io->flags & LZ4_FLG_CONTENT_CHECKSUM)
+    xxh32_update (&lz4io->hash, lz4io->outbuf + start, ret);
+
+  lz4io->out_pos = start;
+  lz4io->out_end = start + ret;
+  return 1;
+}
+
+/* Decompress up to LEN bytes into BUF, or skip them if BUF is NULL.  */
+static grub_ssize_t
+decode (grub_lz4io_t lz4io, char *buf, grub_size_t len)
+{
+  grub_size_t done = 0;
+
+  while (done < len)
+    {
+      grub_size_t n = lz4io->out_end - lz4io->out_pos;
+
+      if (n == 0)
+	{
+	  int ret = next_block (lz4io);
+
+	  if (ret < 0)
+	    return -1;
+	  if (ret == 0)
+	    break;
+	  continue;
+	}
+
+      if (n > len - done)
+	n = len - done;
+      if (buf)
+	grub_memcpy (buf + done, lz4io->outbuf + lz4io->out_pos, n);
+      lz4io->out_pos += n;
+      done += n;
+    }
+
+  return done;
+}
+
+/* Start decompressing again at ENTRY, or at the start if it is NULL.  */
+static void
+resume (grub_lz4io_t lz4io, struct grub_lz4io_entry *entry)
+{
+  lz4io->out_pos = lz4io->out_end = 0;
+  if (entry && entry->legacy)
+    {
+      lz4io->in_frame = 1;
+      lz4io->legacy = 1;
+      lz4io->flags = LZ4_FLG_INDEPENDENT;
+      lz4io->block_max = LZ4_LEGACY_BLOCK_SIZE;
+    }
+  else
+    lz4io->in_frame = 0;
+
+  grub_file_seek (lz4io->file, entry ? entry->in_off : 0);
+  lz4io->saved_offset = entry ? entry->out_off : 0;
+}
+
+/* Add a resume point, unless the index is already over budget.  */
+static void
+add_entry (grub_lz4io_t lz4io, grub_size_t *alloc, grub_size_t max_entries,
+	   int *index, grub_off_t in_off, grub_off_t out_off, int legacy)
+{
+  if (!*index)
+    return;
+
+  if (lz4io->num_index == max_entries)
+    {
+      *index = 0;
+      return;
+    }
+
+  if (lz4io->num_index == *alloc)
+    {
+      struct grub_lz4io_entry *entries;
+
+      *alloc = *alloc ? 2 * *alloc : 16;
+      if (*alloc > max_entries)
+	*alloc = max_entries;
+      entries = grub_realloc (lz4io->index, *alloc * sizeof (entries[0]));
+      if (!entries)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  *index = 0;
+	  return;
+	}
+      lz4io->index = entries;
+    }
+
+  lz4io->index[lz4io->num_index].in_off = in_off;
+  lz4io->index[lz4io->num_index].out_off = out_off;
+  lz4io->index[lz4io->num_index].legacy = legacy;
+  lz4io->num_index++;
+}
+
+/* Size of the contents of the compressed block of SIZE bytes at the
+   current offset, whose contents are at most BLOCK_MAX bytes.  */
+static grub_ssize_t
+block_content_size (grub_lz4io_t lz4io, grub_size_t size,
+		    grub_size_t block_max)
+{
+  if (read_exact (lz4io->file, lz4io->inbuf, size))
+    return -1;
+  return grub_lz4_decompressed_size (lz4io->inbuf, size, block_max);
+}
+
+/* Walk the frames to find the size of the uncompressed data, keeping the
+   points decompression can resume at if they fit in the budget.  Blocks
+   are only looked into when their size isn't recorded otherwise: the
+   last of a legacy frame and those of a frame without a content size.  */
+static int
+scan_frames (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_size_t max_entries = index_budget () / sizeof (lz4io->index[0]);
+  grub_size_t alloc = 0;
+  grub_uint64_t total = 0;
+  int index = 1;
+
+  while (1)
+    {
+      grub_off_t in_off = lz4io->file->offset;
+      grub_uint64_t content_size;
+      grub_uint32_t size;
+      int type;
+
+      type = read_frame_header (lz4io, &content_size);
+      if (type < 0)
+	return 0;
+      if (type == FRAME_END)
+	break;
+      if (alloc_buffers (lz4io, lz4io->block_max))
+	return 0;
+
+      if (type == FRAME_LEGACY)
+	{
+	  grub_off_t last = 0;
+	  grub_uint32_t last_size = 0;
+	  int ret;
+
+	  while (1)
+	    {
+	      grub_off_t block_off = lz4io->file->offset;
+
+	      ret = read_legacy_block_size (lz4io, &size);
+	      if (ret < 0)
+		return 0;
+	      if (ret == 0)
+		break;
+	      if (last)
+		total += LZ4_LEGACY_BLOCK_SIZE;
+	      add_entry (lz4io, &alloc, max_entries, &index, block_off, total,
+			 1);
+	      last = lz4io->file->offset;
+	      last_size = size;
+	      if (skip (lz4io->file, size))
+		return 0;
+	    }
+
+	  if (last)
+	    {
+	      grub_off_t next = lz4io->file->offset;
+	      grub_ssize_t n;
+
+	      grub_file_seek (lz4io->file, last);
+	      n = block_content_size (lz4io, last_size,
+				      LZ4_LEGACY_BLOCK_SIZE);
+	      if (n < 0)
+		return 0;
+	      total += n;
+	      grub_file_seek (lz4io->file, next);
+	    }
+	  continue;
+	}
+
+      add_entry (lz4io, &alloc, max_entries, &index, in_off, total, 0);
+
+      while (1)
+	{
+	  if (read_le32 (lz4io->file, &size))
+	    return 0;
+	  if (size == 0)
+	    break;
+
+	  if (content_size != GRUB_FILE_SIZE_UNKNOWN)
+	    {
+	      if (skip (lz4io->file, size & ~LZ4_BLOCK_UNCOMPRESSED))
+		return 0;
+	    }
+	  else if (size & LZ4_BLOCK_UNCOMPRESSED)
+	    {
+	      total += size & ~LZ4_BLOCK_UNCOMPRESSED;
+	      if (skip (lz4io->file, size & ~LZ4_BLOCK_UNCOMPRESSED))
+		return 0;
+	    }
+	  else
+	    {
+	      grub_ssize_t n;
+
+	      if (size > LZ4_COMPRESS_BOUND (lz4io->block_max))
+		{
+		  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			      "invalid lz4 block size");
+		  return 0;
+		}
+	      n = block_content_size (lz4io, size, lz4io->block_max);
+	      if (n < 0)
+		return 0;
+	      total += n;
+	    }
+
+	  if ((lz4io->flags & LZ4_FLG_BLOCK_CHECKSUM)
+	      && skip (lz4io->file, 4))
+	    return 0;
+	}
+
+      if ((lz4io->flags & LZ4_FLG_CONTENT_CHECKSUM)
+	  && skip (lz4io->file, 4))
+	return 0;
+      if (content_size != GRUB_FILE_SIZE_UNKNOWN)
+	total += content_size;
+    }
+
+  /* A single entry or a partial index is of no use.  */
+  if (!index || lz4io->num_index < 2)
+    {
+      grub_free (lz4io->index);
+      lz4io->index = NULL;
+      lz4io->num_index = 0;
+    }
+
+  file->size = total;
+  return 1;
+}
+
+static grub_file_t
+grub_lz4io_open (grub_file_t io,
+		 const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_lz4io_t lz4io;
+  grub_uint32_t magic;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (magic != grub_cpu_to_le32_compile_time (LZ4_MAGIC)
+	  && magic != grub_cpu_to_le32_compile_time (LZ4_LEGACY_MAGIC)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  lz4io = grub_zalloc (sizeof (*lz4io));
+  if (!lz4io)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  lz4io->file = io;
+
+  file->device = io->device;
+  file->data = lz4io;
+  file->fs = &grub_lz4io_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  /* The scan seeks to every block and looks into some, which over the
+     network would fetch the file once more just to open it.  Decode such
+     files in one go instead, their size is known at the end.  */
+  grub_file_seek (io, 0);
+  if (!io->not_easily_seekable && !(io->device && io->device->net)
+      && !scan_frames (file))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_free (lz4io->index);
+      grub_free (lz4io->inbuf);
+      grub_free (lz4io->outbuf);
+      grub_free (lz4io);
+      grub_free (file);
+
+      return io;
+    }
+
+  resume (lz4io, NULL);
+  return file;
+}
+
+/* Return the last index entry at or before OFFSET.  */
+static struct grub_lz4io_entry *
+find_entry (grub_lz4io_t lz4io, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = lz4io->num_index;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (lz4io->index[mid].out_off <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return &lz4io->index[lo];
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_ssize_t ret;
+
+  /* Resume at the entry before the offset if that is behind us or ahead
+     of the point we are at.  */
+  if (lz4io->index)
+    {
+      struct grub_lz4io_entry *entry = find_entry (lz4io, file->offset);
+
+      if (file->offset < lz4io->saved_offset
+	  || entry->out_off > lz4io->saved_offset)
+	resume (lz4io, entry);
+    }
+  /* If seek backward need to reset decoder and start from beginning of file.  */
+  else if (file->offset < lz4io->saved_offset)
+    resume (lz4io, NULL);
+
+  if (file->offset > lz4io->saved_offset)
+    {
+      ret = decode (lz4io, NULL, file->offset - lz4io->saved_offset);
+      if (ret < 0)
+	return -1;
+      lz4io->saved_offset += ret;
+      if (lz4io->saved_offset < file->offset)
+	{
+	  file->size = lz4io->saved_offset;
+	  return 0;
+	}
+    }
+
+  ret = decode (lz4io, buf, len);
+  if (ret < 0)
+    return -1;
+  lz4io->saved_offset = file->offset + ret;
+  if ((grub_size_t) ret < len)
+    file->size = lz4io->saved_offset;
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+
+  grub_file_close (lz4io->file);
+  grub_free (lz4io->index);
+  grub_free (lz4io->inbuf);
+  grub_free (lz4io->outbuf);
+  grub_free (lz4io);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs = {
+  .name = "lz4io",
+  .dir = 0,
+  .open = 0,
+  .read = grub_lz4io_read,
+  .close = grub_lz4io_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lz4io)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZ4IO, grub_lz4io_open);
+}
+
+GRUB_MOD_FINI (lz4io)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZ4IO);
+}
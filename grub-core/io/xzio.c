@@ -23,6 +23,7 @@
 #include <grub/file.h>
 #include <grub/fs.h>
 #include <grub/dl.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -33,6 +34,21 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* Default memory for the block index of each file, see
+   decompress_index_size in the manual.  */
+#define XZIO_INDEX_DEFAULT_SIZE (1 << 20)
+
+/* A Block from the Stream Index.  */
+struct grub_xzio_block
+{
+  /* Offsets of the Block in the file and in the uncompressed data.  */
+  grub_off_t in_off;
+  grub_off_t out_off;
+  /* Sizes from the Index record.  */
+  grub_uint64_t unpadded;
+  grub_uint64_t uncompressed;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -41,6 +57,10 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  /* The Blocks of the Stream, to resume decoding at the one holding the
+     wanted offset.  NULL if the Index didn't fit in the memory allowed.  */
+  struct grub_xzio_block *blocks;
+  grub_size_t num_blocks;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -70,6 +90,21 @@ decode_vli (const grub_uint8_t buf[], grub_size_t size_max,
   return i;
 }
 
+static grub_size_t
+index_budget (void)
+{
+  const char *val;
+  grub_size_t budget;
+
+  val = grub_env_get ("decompress_index_size");
+  if (! val)
+    return XZIO_INDEX_DEFAULT_SIZE;
+
+  budget = grub_strtoul (val, 0, 0) * 1024;
+  grub_errno = GRUB_ERR_NONE;
+  return budget;
+}
+
 static grub_ssize_t
 read_vli (grub_file_t file, grub_uint64_t *num)
 {
@@ -122,7 +157,10 @@ test_footer (grub_file_t file)
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
   grub_uint64_t uncompressed_size;
+  grub_uint64_t unpadded_size;
   grub_uint64_t records;
+  grub_off_t in_off = STREAM_HEADER_SIZE;
+  grub_size_t i = 0;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -150,16 +188,42 @@ test_footer (grub_file_t file)
   if (read_vli (xzio->file, &records) <= 0)
     goto ERROR;
 
-  for (; records != 0; records--)
+  if (records > 1 && records <= index_budget () / sizeof (xzio->blocks[0]))
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      xzio->blocks = grub_malloc (records * sizeof (xzio->blocks[0]));
+      if (xzio->blocks)
+	xzio->num_blocks = records;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  for (; records != 0; records--, i++)
+    {
+      if (read_vli (xzio->file, &unpadded_size) <= 0)	/* Unpadded.  */
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      if (xzio->blocks)
+	{
+	  xzio->blocks[i].in_off = in_off;
+	  xzio->blocks[i].out_off = uncompressed_size_total;
+	  xzio->blocks[i].unpadded = unpadded_size;
+	  xzio->blocks[i].uncompressed = uncompressed_size;
+	}
+
+      in_off += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
 
+  /* The Blocks have to end where the Index starts.  Otherwise this isn't
+     a single Stream and the offsets are of no use.  */
+  if (in_off != xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize)
+    {
+      grub_free (xzio->blocks);
+      xzio->blocks = NULL;
+      xzio->num_blocks = 0;
+    }
+
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
@@ -217,6 +281,7 @@ grub_xzio_open (grub_file_t io,
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
       xz_dec_end (xzio->dec);
+      grub_free (xzio->blocks);
       grub_free (xzio);
       grub_free (file);
 
@@ -226,6 +291,55 @@ grub_xzio_open (grub_file_t io,
   return file;
 }
 
+/* Return the Block holding OFFSET.  */
+static grub_size_t
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->num_blocks;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (xzio->blocks[mid].out_off <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Restart the decoder at the beginning of Block B.  */
+static grub_err_t
+seek_block (grub_xzio_t xzio, grub_size_t b)
+{
+  grub_size_t i;
+
+  xz_dec_reset (xzio->dec);
+  xzio->buf.in_pos = 0;
+  xzio->buf.out_pos = 0;
+
+  grub_file_seek (xzio->file, 0);
+  xzio->buf.in_size = grub_file_read (xzio->file, xzio->inbuf,
+				      STREAM_HEADER_SIZE);
+  if (xzio->buf.in_size != STREAM_HEADER_SIZE
+      || xz_dec_run (xzio->dec, &xzio->buf) != XZ_OK)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("xz file corrupted or unsupported block options"));
+
+  for (i = 0; i < b; i++)
+    xz_dec_skip_block (xzio->dec, xzio->blocks[i].unpadded,
+		       xzio->blocks[i].uncompressed);
+
+  grub_file_seek (xzio->file, xzio->blocks[b].in_off);
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  xzio->saved_offset = xzio->blocks[b].out_off;
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_ssize_t
 grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 {
@@ -235,9 +349,19 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_xzio_t xzio = file->data;
   grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
+  /* Resume at the Block holding the offset if that is behind us or ahead
+     of the Block we are in.  */
+  if (xzio->blocks)
+    {
+      grub_size_t b = find_block (xzio, file->offset);
+
+      if ((file->offset < xzio->saved_offset
+	   || xzio->blocks[b].out_off > xzio->saved_offset)
+	  && seek_block (xzio, b))
+	return -1;
+    }
+  /* If seek backward need to reset decoder and start from beginning of file.  */
+  else if (file->offset < xzio->saved_offset)
     {
       xz_dec_reset (xzio->dec);
       xzio->saved_offset = 0;
@@ -315,6 +439,7 @@ grub_xzio_close (grub_file_t file)
   xz_dec_end (xzio->dec);
 
   grub_file_close (xzio->file);
+  grub_free (xzio->blocks);
   grub_free (xzio);
 
   /* Device must not be closed twice.  */
@@ -0,0 +1,336 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/env.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const grub_uint8_t ZSTD_MAGIC[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+/* Default memory for the frame index of each file, see
+   decompress_index_size in the manual.  */
+#define ZSTDIO_INDEX_DEFAULT_SIZE (1 << 20)
+
+/* A frame of the file.  */
+struct grub_zstdio_frame
+{
+  /* Offsets of the frame in the file and in the uncompressed data.  */
+  grub_off_t in_off;
+  grub_off_t out_off;
+};
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  struct grub_zstd_dec *dec;
+  grub_off_t saved_offset;
+  /* The frames of the file, to resume decoding at the one holding the
+     wanted offset.  NULL if they didn't fit in the memory allowed.  */
+  struct grub_zstdio_frame *frames;
+  grub_size_t num_frames;
+};
+
+typedef struct grub_zstdio *grub_zstdio_t;
+static struct grub_fs grub_zstdio_fs;
+
+static grub_size_t
+index_budget (void)
+{
+  const char *val;
+  grub_size_t budget;
+
+  val = grub_env_get ("decompress_index_size");
+  if (! val)
+    return ZSTDIO_INDEX_DEFAULT_SIZE;
+
+  budget = grub_strtoul (val, 0, 0) * 1024;
+  grub_errno = GRUB_ERR_NONE;
+  return budget;
+}
+
+/* Input of the decoder.  */
+static grub_ssize_t
+read_input (void *data, void *buf, grub_size_t len)
+{
+  grub_file_t file = data;
+
+  if (buf)
+    return grub_file_read (file, buf, len);
+
+  if (len > file->size - file->offset)
+    len = file->size - file->offset;
+  grub_file_seek (file, file->offset + len);
+  return len;
+}
+
+/* Walk the frames to find the size of the uncompressed data, keeping
+   their offsets if they fit in the budget.  */
+static int
+scan_frames (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+  grub_size_t max_frames = index_budget () / sizeof (zstdio->frames[0]);
+  grub_size_t alloc = 0;
+  grub_uint64_t total = 0;
+  int known = 1, index = 1;
+
+  while (1)
+    {
+      grub_off_t in_off = zstdio->file->offset;
+      grub_uint64_t compressed, content;
+
+      if (grub_zstd_frame_info (read_input, zstdio->file,
+				&compressed, &content))
+	return 0;
+      if (!compressed)
+	break;
+      if (content == GRUB_ZSTD_SIZE_UNKNOWN)
+	{
+	  known = 0;
+	  break;
+	}
+
+      /* Skippable frames have no content and needn't be indexed.  */
+      if (content && index)
+	{
+	  if (zstdio->num_frames == max_frames)
+	    index = 0;
+	  else if (zstdio->num_frames == alloc)
+	    {
+	      struct grub_zstdio_frame *frames;
+
+	      alloc = alloc ? 2 * alloc : 16;
+	      if (alloc > max_frames)
+		alloc = max_frames;
+	      frames = grub_realloc (zstdio->frames,
+				     alloc * sizeof (frames[0]));
+	      if (frames)
+		zstdio->frames = frames;
+	      else
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  index = 0;
+		}
+	    }
+	  if (index)
+	    {
+	      zstdio->frames[zstdio->num_frames].in_off = in_off;
+	      zstdio->frames[zstdio->num_frames].out_off = total;
+	      zstdio->num_frames++;
+	    }
+	}
+
+      total += content;
+    }
+
+  /* A single frame or a partial index is of no use.  */
+  if (!known || !index || zstdio->num_frames < 2)
+    {
+      grub_free (zstdio->frames);
+      zstdio->frames = NULL;
+      zstdio->num_frames = 0;
+    }
+
+  if (known)
+    file->size = total;
+  return 1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  grub_uint8_t magic[sizeof (ZSTD_MAGIC)];
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+
+  if (grub_file_read (io, magic, sizeof (magic)) != sizeof (magic)
+      || grub_memcmp (magic, ZSTD_MAGIC, sizeof (magic)) != 0)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  zstdio->dec = grub_zstd_dec_init (read_input, io);
+  if (!zstdio->dec)
+    {
+      grub_free (file);
+      grub_free (zstdio);
+      return 0;
+    }
+
+  /* Walking the frames takes a seek and a read per block, which over the
+     network means fetching the whole file or a request per block.  Such
+     files are decoded in one go, their size is known at the end.  */
+  grub_file_seek (io, 0);
+  if (!io->not_easily_seekable && !(io->device && io->device->net)
+      && !scan_frames (file))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_zstd_dec_end (zstdio->dec);
+      grub_free (zstdio->frames);
+      grub_free (zstdio);
+      grub_free (file);
+
+      return io;
+    }
+
+  grub_file_seek (io, 0);
+  return file;
+}
+
+/* Return the frame holding OFFSET.  */
+static grub_size_t
+find_frame (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = zstdio->num_frames;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (zstdio->frames[mid].out_off <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_zstdio_t zstdio = file->data;
+  grub_ssize_t ret;
+
+  /* Resume at the frame holding the offset if that is behind us or ahead
+     of the frame we are in.  */
+  if (zstdio->frames)
+    {
+      grub_size_t f = find_frame (zstdio, file->offset);
+
+      if (file->offset < zstdio->saved_offset
+	  || zstdio->frames[f].out_off > zstdio->saved_offset)
+	{
+	  grub_file_seek (zstdio->file, zstdio->frames[f].in_off);
+	  grub_zstd_dec_reset (zstdio->dec);
+	  zstdio->saved_offset = zstdio->frames[f].out_off;
+	}
+    }
+  /* If seek backward need to reset decoder and start from beginning of file.  */
+  else if (file->offset < zstdio->saved_offset)
+    {
+      grub_file_seek (zstdio->file, 0);
+      grub_zstd_dec_reset (zstdio->dec);
+      zstdio->saved_offset = 0;
+    }
+
+  if (file->offset > zstdio->saved_offset)
+    {
+      ret = grub_zstd_dec_read (zstdio->dec, NULL,
+				file->offset - zstdio->saved_offset);
+      if (ret < 0)
+	return -1;
+      zstdio->saved_offset += ret;
+      if (zstdio->saved_offset < file->offset)
+	{
+	  file->size = zstdio->saved_offset;
+	  return 0;
+	}
+    }
+
+  ret = grub_zstd_dec_read (zstdio->dec, buf, len);
+  if (ret < 0)
+    return -1;
+  zstdio->saved_offset = file->offset + ret;
+  if ((grub_size_t) ret < len)
+    file->size = zstdio->saved_offset;
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  grub_zstd_dec_end (zstdio->dec);
+
+  grub_file_close (zstdio->file);
+  grub_free (zstdio->frames);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_zstdio_read,
+  .close = grub_zstdio_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
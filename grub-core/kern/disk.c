@@ -28,10 +28,37 @@
 
 #define	GRUB_CACHE_TIMEOUT	2
 
+/* After running out of memory, the disk cache stays smaller for this
+   long.  */
+#define GRUB_DISK_CACHE_BACKOFF_MS	5000
+
+/* The size of the data of one set of the disk cache.  */
+#define GRUB_DISK_CACHE_SET_SIZE	(GRUB_DISK_CACHE_WAYS \
+					 * (GRUB_DISK_SECTOR_SIZE \
+					    << GRUB_DISK_CACHE_BITS))
+
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+/* The slab holding the cache entries followed by their data.  It is
+   allocated on first use, so that its size may be changed at runtime.
+   grub_disk_cache_sets is 0 while there is none.  */
+struct grub_disk_cache *grub_disk_cache_table;
+unsigned grub_disk_cache_sets;
+static char *grub_disk_cache_slab;
+static char *grub_disk_cache_data;
+static grub_uint32_t grub_disk_cache_clock;
+
+/* The number of sets asked for with grub_disk_cache_resize.  */
+static unsigned grub_disk_cache_want = GRUB_DISK_CACHE_AUTO;
+
+/* When memory runs out, the next slab gets at most half the sets of the
+   one that was released or didn't fit.  The cap doubles again for every
+   GRUB_DISK_CACHE_BACKOFF_MS after that.  If not even one set fits, no
+   slab is allocated before grub_disk_cache_retry.  */
+static unsigned grub_disk_cache_cap = GRUB_DISK_CACHE_MAX_SETS;
+static grub_uint64_t grub_disk_cache_shortage;
+static grub_uint64_t grub_disk_cache_retry;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
@@ -39,12 +66,15 @@ int grub_disk_firmware_is_tainted;
 #if DISK_CACHE_STATS
 static unsigned long grub_disk_cache_hits;
 static unsigned long grub_disk_cache_misses;
+static unsigned long grub_disk_cache_evictions;
 
 void
-grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
+grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses,
+				 unsigned long *evictions)
 {
   *hits = grub_disk_cache_hits;
   *misses = grub_disk_cache_misses;
+  *evictions = grub_disk_cache_evictions;
 }
 #endif
 
@@ -60,16 +90,155 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  if (! grub_disk_cache_table)
+    return;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
-      if (cache->data && ! cache->lock)
+      if (! cache->lock)
+	cache->data = 0;
+    }
+}
+
+/* Free the slab unless an entry of it is in use.  */
+static int
+grub_disk_cache_free (void)
+{
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return 0;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
+    if (grub_disk_cache_table[i].lock)
+      {
+	grub_disk_cache_invalidate_all ();
+	return 0;
+      }
+
+  grub_free (grub_disk_cache_slab);
+  grub_disk_cache_slab = 0;
+  grub_disk_cache_table = 0;
+  grub_disk_cache_sets = 0;
+  return 1;
+}
+
+/* Memory ran out with a slab of SETS sets.  */
+static void
+grub_disk_cache_shrink (unsigned sets)
+{
+  grub_disk_cache_cap = sets > 1 ? sets / 2 : 1;
+  grub_disk_cache_shortage = grub_get_time_ms ();
+}
+
+static struct grub_disk_cache_hook *grub_disk_cache_hooks;
+
+void
+grub_disk_cache_hook_register (struct grub_disk_cache_hook *hook)
+{
+  hook->next = grub_disk_cache_hooks;
+  grub_disk_cache_hooks = hook;
+}
+
+void
+grub_disk_cache_hook_unregister (struct grub_disk_cache_hook *hook)
+{
+  struct grub_disk_cache_hook **p;
+
+  for (p = &grub_disk_cache_hooks; *p; p = &(*p)->next)
+    if (*p == hook)
+      {
+	*p = hook->next;
+	break;
+      }
+}
+
+/* Give the memory of the cache, and of the caches of decoded data, back
+   to the heap.  */
+void
+grub_disk_cache_release (void)
+{
+  struct grub_disk_cache_hook *hook;
+  unsigned sets = grub_disk_cache_sets;
+
+  if (grub_disk_cache_free ())
+    grub_disk_cache_shrink (sets);
+
+  for (hook = grub_disk_cache_hooks; hook; hook = hook->next)
+    hook->release ();
+}
+
+void
+grub_disk_cache_resize (unsigned sets)
+{
+  if (sets > GRUB_DISK_CACHE_MAX_SETS && sets != GRUB_DISK_CACHE_AUTO)
+    sets = GRUB_DISK_CACHE_MAX_SETS;
+
+  grub_disk_cache_free ();
+  grub_disk_cache_want = sets;
+  grub_disk_cache_cap = GRUB_DISK_CACHE_MAX_SETS;
+  grub_disk_cache_retry = 0;
+}
+
+/* Allocate the slab, halving its size until it fits into memory.  */
+static void
+grub_disk_cache_alloc (void)
+{
+  grub_uint64_t now;
+  grub_size_t table_size, n;
+  unsigned sets;
+
+  if (grub_disk_cache_want == 0)
+    return;
+
+  now = grub_get_time_ms ();
+  if (now < grub_disk_cache_retry)
+    return;
+
+  while (grub_disk_cache_cap < GRUB_DISK_CACHE_MAX_SETS
+	 && now - grub_disk_cache_shortage >= GRUB_DISK_CACHE_BACKOFF_MS)
+    {
+      grub_disk_cache_cap <<= 1;
+      grub_disk_cache_shortage += GRUB_DISK_CACHE_BACKOFF_MS;
+    }
+
+  sets = grub_disk_cache_want;
+  if (sets == GRUB_DISK_CACHE_AUTO)
+    {
+      grub_size_t avail;
+
+      avail = (grub_mm_free_bytes () / GRUB_DISK_CACHE_HEAP_SHARE
+	       / GRUB_DISK_CACHE_SET_SIZE);
+      sets = avail < GRUB_DISK_CACHE_DEFAULT_SETS
+	? avail : GRUB_DISK_CACHE_DEFAULT_SETS;
+    }
+  if (sets > grub_disk_cache_cap)
+    sets = grub_disk_cache_cap;
+
+  /* SETS is at most GRUB_DISK_CACHE_MAX_SETS, so the sizes can't
+     overflow.  */
+  for (; sets; sets >>= 1)
+    {
+      n = sets * GRUB_DISK_CACHE_WAYS;
+      table_size = ALIGN_UP (n * sizeof (struct grub_disk_cache),
+			     GRUB_DISK_SECTOR_SIZE);
+      grub_disk_cache_slab = grub_zalloc (table_size
+					  + (n << (GRUB_DISK_CACHE_BITS
+						   + GRUB_DISK_SECTOR_BITS)));
+      if (grub_disk_cache_slab)
 	{
-	  grub_free (cache->data);
-	  cache->data = 0;
+	  grub_disk_cache_table = (struct grub_disk_cache *) grub_disk_cache_slab;
+	  grub_disk_cache_data = grub_disk_cache_slab + table_size;
+	  grub_disk_cache_sets = sets;
+	  return;
 	}
+      grub_errno = GRUB_ERR_NONE;
+      grub_disk_cache_shrink (sets);
     }
+
+  grub_disk_cache_retry = now + GRUB_DISK_CACHE_BACKOFF_MS;
 }
 
 static char *
@@ -77,15 +246,12 @@ grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->last_use = ++grub_disk_cache_clock;
 #if DISK_CACHE_STATS
       grub_disk_cache_hits++;
 #endif
@@ -104,13 +270,9 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
@@ -118,31 +280,61 @@ static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
-  struct grub_disk_cache *cache;
+  struct grub_disk_cache *set, *cache = 0;
+  unsigned i;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  if (! grub_disk_cache_table)
+    grub_disk_cache_alloc ();
+  if (! grub_disk_cache_table)
+    return GRUB_ERR_NONE;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  /* Reuse the entry already holding this sector if any, otherwise take
+     a free entry or evict the least recently used one.  */
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector);
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    {
+      if (set[i].lock)
+	continue;
+      if (! set[i].data)
+	{
+	  if (! cache || cache->data)
+	    cache = set + i;
+	  continue;
+	}
+      if (set[i].dev_id == dev_id && set[i].disk_id == disk_id
+	  && set[i].sector == sector)
+	{
+	  cache = set + i;
+	  break;
+	}
+      if (! cache || (cache->data && (grub_int32_t) (set[i].last_use
+						     - cache->last_use) < 0))
+	cache = set + i;
+    }
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! cache->data)
-    return grub_errno;
+  if (! cache)
+    return GRUB_ERR_NONE;
 
+#if DISK_CACHE_STATS
+  if (cache->data && (cache->dev_id != dev_id || cache->disk_id != disk_id
+		      || cache->sector != sector))
+    grub_disk_cache_evictions++;
+#endif
+
+  cache->data = grub_disk_cache_data
+    + ((grub_size_t) (cache - grub_disk_cache_table)
+       << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
   grub_memcpy (cache->data, data,
 	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->last_use = ++grub_disk_cache_clock;
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -310,6 +502,62 @@ grub_disk_close (grub_disk_t disk)
   grub_free (disk);
 }
 
+/* Track whether the reads of DISK are sequential and size the read-ahead
+   window accordingly.  SECTOR and OFFSET are already adjusted.  */
+static void
+grub_disk_read_ahead_update (grub_disk_t disk, grub_disk_addr_t sector,
+			     grub_off_t offset, grub_size_t size)
+{
+  if (sector >= disk->read_ahead_next
+      && sector < disk->read_ahead_next + GRUB_DISK_CACHE_SIZE)
+    {
+      if (! disk->read_ahead)
+	disk->read_ahead = 1;
+      else
+	disk->read_ahead <<= 1;
+      if (disk->read_ahead > GRUB_DISK_MAX_READ_AHEAD)
+	disk->read_ahead = GRUB_DISK_MAX_READ_AHEAD;
+      /* The whole read including the requested unit must fit in one
+	 device read.  */
+      if (disk->read_ahead >= disk->max_agglomerate)
+	disk->read_ahead = disk->max_agglomerate ? disk->max_agglomerate - 1 : 0;
+    }
+  else
+    disk->read_ahead = 0;
+
+  disk->read_ahead_next = sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+				    >> GRUB_DISK_SECTOR_BITS);
+}
+
+/* Return the number of cache units to read from SECTOR on a cache miss.  */
+static unsigned
+grub_disk_read_ahead_units (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  unsigned units;
+
+  /* Without a cache to keep them in, the following units would only be
+     read again.  */
+  if (! grub_disk_cache_table)
+    grub_disk_cache_alloc ();
+  if (! grub_disk_cache_table)
+    return 1;
+
+  for (units = 1; units <= disk->read_ahead; units++)
+    {
+      grub_disk_addr_t next = sector + (units << GRUB_DISK_CACHE_BITS);
+
+      if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN
+	  && next + GRUB_DISK_CACHE_SIZE
+	  >= (disk->total_sectors << (disk->log_sector_size
+				      - GRUB_DISK_SECTOR_BITS)))
+	break;
+      if (grub_disk_cache_lookup (disk->dev->id, disk->id, next))
+	break;
+    }
+
+  return units;
+}
+
 /* Small read (less than cache size and not pass across cache unit boundaries).
    sector is already adjusted and is divisible by cache unit size.
  */
@@ -330,33 +578,60 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       return GRUB_ERR_NONE;
     }
 
-  /* Allocate a temporary buffer.  */
-  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! tmp_buf)
-    return grub_errno;
-
   /* Otherwise read data from the disk actually.  */
   if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
       || sector + GRUB_DISK_CACHE_SIZE
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
+      unsigned units, i;
+
+      /* Read the following cache units along if the reads are sequential,
+	 up to the first one already cached.  */
+      units = grub_disk_read_ahead_units (disk, sector);
+
+      /* Allocate a temporary buffer.  */
+      tmp_buf = grub_malloc (units << (GRUB_DISK_CACHE_BITS
+				       + GRUB_DISK_SECTOR_BITS));
+      if (! tmp_buf && units > 1)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  units = 1;
+	  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+	}
+      if (! tmp_buf)
+	return grub_errno;
+
       err = (disk->dev->read) (disk, transform_sector (disk, sector),
-			       1U << (GRUB_DISK_CACHE_BITS
-				      + GRUB_DISK_SECTOR_BITS
-				      - disk->log_sector_size), tmp_buf);
+			       units << (GRUB_DISK_CACHE_BITS
+					 + GRUB_DISK_SECTOR_BITS
+					 - disk->log_sector_size), tmp_buf);
+      if (err && units > 1)
+	{
+	  /* Don't let the read-ahead fail the request.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  units = 1;
+	  err = (disk->dev->read) (disk, transform_sector (disk, sector),
+				   1U << (GRUB_DISK_CACHE_BITS
+					  + GRUB_DISK_SECTOR_BITS
+					  - disk->log_sector_size), tmp_buf);
+	}
       if (!err)
 	{
 	  /* Copy it and store it in the disk cache.  */
 	  grub_memcpy (buf, tmp_buf + offset, size);
-	  grub_disk_cache_store (disk->dev->id, disk->id,
-				 sector, tmp_buf);
+	  for (i = 0; i < units; i++)
+	    grub_disk_cache_store (disk->dev->id, disk->id,
+				   sector + (i << GRUB_DISK_CACHE_BITS),
+				   tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+						    + GRUB_DISK_SECTOR_BITS)));
 	  grub_free (tmp_buf);
 	  return GRUB_ERR_NONE;
 	}
+
+      grub_free (tmp_buf);
     }
 
-  grub_free (tmp_buf);
   grub_errno = GRUB_ERR_NONE;
 
   {
@@ -423,6 +698,8 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  grub_disk_read_ahead_update (disk, sector, offset, size);
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
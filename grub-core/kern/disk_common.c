@@ -55,11 +55,34 @@ transform_sector (grub_disk_t disk, grub_disk_addr_t sector)
   return sector >> (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
 }
 
-static unsigned
-grub_disk_cache_get_index (unsigned long dev_id, unsigned long disk_id,
-			   grub_disk_addr_t sector)
+/* Return the first entry of the set which may hold SECTOR.  */
+static struct grub_disk_cache *
+grub_disk_cache_get_set (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector)
 {
-  return ((dev_id * 524287UL + disk_id * 2606459UL
-	   + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
-	  % GRUB_DISK_CACHE_NUM);
+  unsigned set_index;
+
+  set_index = ((dev_id * 524287UL + disk_id * 2606459UL
+		+ ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
+	       % grub_disk_cache_sets);
+  return grub_disk_cache_table + set_index * GRUB_DISK_CACHE_WAYS;
+}
+
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *cache;
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return NULL;
+
+  cache = grub_disk_cache_get_set (dev_id, disk_id, sector);
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++, cache++)
+    if (cache->data && cache->dev_id == dev_id && cache->disk_id == disk_id
+	&& cache->sector == sector)
+      return cache;
+
+  return NULL;
 }
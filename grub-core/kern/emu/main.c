@@ -25,6 +25,7 @@
 #include <setjmp.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
 #include <sys/types.h>
 
 #include <grub/dl.h>
@@ -94,6 +95,7 @@ grub_machine_fini (int flags)
 
 
 #define OPT_MEMDISK 257
+#define OPT_MEM_STATS 258
 
 static struct argp_option options[] = {
   {"root",      'r', N_("DEVICE_NAME"), 0, N_("Set root device."), 2},
@@ -107,6 +109,10 @@ static struct argp_option options[] = {
    N_("use GRUB files in the directory DIR [default=%s]"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {"hold",     'H', N_("SECS"),      OPTION_ARG_OPTIONAL, N_("wait until a debugger will attach"), 0},
+#ifdef MM_DEBUG
+  {"mem-stats", OPT_MEM_STATS, N_("FILE"), 0,
+   N_("write the heap usage per allocation site to FILE on exit"), 0},
+#endif
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -132,6 +138,7 @@ struct arguments
 {
   const char *dev_map;
   const char *mem_disk;
+  const char *mem_stats;
   int hold;
 };
 
@@ -147,6 +154,9 @@ argp_parser (int key, char *arg, struct argp_state *state)
     case OPT_MEMDISK:
       arguments->mem_disk = arg;
       break;
+    case OPT_MEM_STATS:
+      arguments->mem_stats = arg;
+      break;
     case 'r':
       free (root_dev);
       root_dev = xstrdup (arg);
@@ -188,6 +198,17 @@ static struct argp argp = {
 
 
 
+#ifdef MM_DEBUG
+static int
+write_mem_stats (const struct grub_mm_site *site, void *data)
+{
+  fprintf (data, "%s,%d,%llu,%llu,%lu,%lu\n", site->file, site->line,
+	   (unsigned long long) site->live, (unsigned long long) site->peak,
+	   site->allocs, site->frees);
+  return 0;
+}
+#endif
+
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 
 int
@@ -198,6 +219,7 @@ main (int argc, char *argv[])
       .dev_map = DEFAULT_DEVICE_MAP,
       .hold = 0,
       .mem_disk = 0,
+      .mem_stats = 0,
     };
   volatile int hold = 0;
   size_t total_module_size = sizeof (struct grub_module_info), memdisk_size = 0;
@@ -280,6 +302,20 @@ main (int argc, char *argv[])
   grub_hostfs_fini ();
   grub_host_fini ();
 
+#ifdef MM_DEBUG
+  if (arguments.mem_stats)
+    {
+      FILE *f = grub_util_fopen (arguments.mem_stats, "w");
+
+      if (! f)
+	grub_util_error (_("cannot open `%s': %s"), arguments.mem_stats,
+			 strerror (errno));
+      fprintf (f, "file,line,live,peak,allocs,frees\n");
+      grub_mm_site_iterate (write_mem_stats, f);
+      fclose (f);
+    }
+#endif
+
   grub_machine_fini (GRUB_LOADER_FLAG_NORETURN);
 
   return 0;
@@ -24,6 +24,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <grub/i18n.h>
+#include <grub/misc.h>
+
+#if defined(MM_DEBUG) && !defined(GRUB_UTIL)
+# undef grub_malloc
+# undef grub_zalloc
+# undef grub_realloc
+# undef grub_free
+#endif
 
 void *
 grub_malloc (grub_size_t size)
@@ -62,3 +70,128 @@ grub_realloc (void *ptr, grub_size_t size)
     grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return ret;
 }
+
+grub_size_t
+grub_mm_free_bytes (void)
+{
+  return GRUB_SIZE_MAX;
+}
+
+#if defined(MM_DEBUG) && !defined(GRUB_UTIL)
+int grub_mm_debug = 0;
+
+#include "../mm_stats.c"
+
+/* The host allocator keeps no header we could use, so remember the site
+   and size of every tracked block in a hash of the block addresses.  */
+struct grub_mm_block
+{
+  void *ptr;
+  struct grub_mm_site *site;
+  grub_size_t size;
+  struct grub_mm_block *next;
+};
+
+#define GRUB_MM_BLOCK_HASH	4099
+
+static struct grub_mm_block *grub_mm_blocks[GRUB_MM_BLOCK_HASH];
+
+static void
+grub_mm_site_track (const char *file, int line, void *ptr, grub_size_t size)
+{
+  struct grub_mm_block *b;
+  struct grub_mm_site *site;
+
+  if (! ptr)
+    return;
+
+  b = malloc (sizeof (*b));
+  if (! b)
+    return;
+
+  site = grub_mm_site_get (file, line);
+  grub_mm_site_alloc (site, size);
+  b->ptr = ptr;
+  b->site = site;
+  b->size = size;
+  b->next = grub_mm_blocks[(grub_addr_t) ptr % GRUB_MM_BLOCK_HASH];
+  grub_mm_blocks[(grub_addr_t) ptr % GRUB_MM_BLOCK_HASH] = b;
+}
+
+static void
+grub_mm_site_untrack (void *ptr)
+{
+  struct grub_mm_block **p, *b;
+
+  if (! ptr)
+    return;
+
+  for (p = &grub_mm_blocks[(grub_addr_t) ptr % GRUB_MM_BLOCK_HASH]; *p;
+       p = &(*p)->next)
+    if ((*p)->ptr == ptr)
+      {
+	b = *p;
+	*p = b->next;
+	grub_mm_site_free (b->site, b->size);
+	free (b);
+	return;
+      }
+}
+
+void *
+grub_debug_malloc (const char *file, int line, grub_size_t size)
+{
+  void *ptr;
+
+  if (grub_mm_debug)
+    grub_printf ("%s:%d: malloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
+  ptr = grub_malloc (size);
+  if (grub_mm_debug)
+    grub_printf ("%p\n", ptr);
+  grub_mm_site_track (file, line, ptr, size);
+  return ptr;
+}
+
+void *
+grub_debug_zalloc (const char *file, int line, grub_size_t size)
+{
+  void *ptr;
+
+  if (grub_mm_debug)
+    grub_printf ("%s:%d: zalloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
+  ptr = grub_zalloc (size);
+  if (grub_mm_debug)
+    grub_printf ("%p\n", ptr);
+  grub_mm_site_track (file, line, ptr, size);
+  return ptr;
+}
+
+void
+grub_debug_free (const char *file, int line, void *ptr)
+{
+  if (grub_mm_debug)
+    grub_printf ("%s:%d: free (%p)\n", file, line, ptr);
+  grub_mm_site_untrack (ptr);
+  grub_free (ptr);
+}
+
+void *
+grub_debug_realloc (const char *file, int line, void *ptr, grub_size_t size)
+{
+  void *ret;
+
+  if (grub_mm_debug)
+    grub_printf ("%s:%d: realloc (%p, 0x%" PRIxGRUB_SIZE ") = ", file, line, ptr, size);
+  ret = grub_realloc (ptr, size);
+  if (grub_mm_debug)
+    grub_printf ("%p\n", ret);
+
+  /* On failure the old block is left untouched.  */
+  if (! ret && size)
+    return ret;
+
+  grub_mm_site_untrack (ptr);
+  grub_mm_site_track (file, line, ret, size);
+  return ret;
+}
+#endif
@@ -53,6 +53,14 @@
   a typical optimization against defragmentation, and makes the
   implementation a bit easier.
 
+  Small blocks are allocated and freed far more often than large ones, so
+  a freed block of up to GRUB_MM_NBINS cells is not put back into the
+  ring but pushed onto the bin for its size. An allocation of that size
+  without special alignment pops it again without walking the ring. The
+  bins stay allocated as far as the regions are concerned, so their total
+  size is bounded by GRUB_MM_BIN_LIMIT, and they are flushed back into the
+  rings before anything else when memory runs out.
+
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
@@ -80,6 +88,13 @@
 
 grub_mm_region_t grub_mm_base;
 
+/* The bins of free small blocks, indexed by size in cells minus one.  */
+static grub_mm_header_t grub_mm_bins[GRUB_MM_NBINS];
+static unsigned grub_mm_bin_count[GRUB_MM_NBINS];
+static grub_size_t grub_mm_binned;
+
+static void grub_real_free (grub_mm_header_t p, grub_mm_region_t r);
+
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
    be allocated.  */
@@ -98,7 +113,7 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
     grub_fatal ("out of range pointer %p", ptr);
 
   *p = (grub_mm_header_t) ptr - 1;
-  if ((*p)->magic == GRUB_MM_FREE_MAGIC)
+  if ((*p)->magic == GRUB_MM_FREE_MAGIC || (*p)->magic == GRUB_MM_BIN_MAGIC)
     grub_fatal ("double free at %p", *p);
   if ((*p)->magic != GRUB_MM_ALLOC_MAGIC)
     grub_fatal ("alloc magic is broken at %p: %lx", *p,
@@ -141,7 +156,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    r->size += h->size << GRUB_MM_ALIGN_LOG2;
 	    r->pre_size &= (GRUB_MM_ALIGN - 1);
 	    *p = r;
-	    grub_free (h + 1);
+	    grub_real_free (h, r);
 	  }
 	*p = r;
 	return;
@@ -314,6 +329,31 @@ grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
   return 0;
 }
 
+/* Return all the blocks kept in the bins to their regions.  */
+static void
+grub_mm_flush_bins (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_MM_NBINS; i++)
+    while (grub_mm_bins[i])
+      {
+	grub_mm_header_t p;
+	grub_mm_region_t r;
+
+	p = grub_mm_bins[i];
+	if (p->magic != GRUB_MM_BIN_MAGIC)
+	  grub_fatal ("bin magic is broken at %p: 0x%x", p, p->magic);
+	grub_mm_bins[i] = p->next;
+	p->magic = GRUB_MM_ALLOC_MAGIC;
+	get_header_from_pointer (p + 1, &p, &r);
+	grub_real_free (p, r);
+      }
+
+  grub_memset (grub_mm_bin_count, 0, sizeof (grub_mm_bin_count));
+  grub_mm_binned = 0;
+}
+
 /* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
 void *
 grub_memalign (grub_size_t align, grub_size_t size)
@@ -338,6 +378,21 @@ grub_memalign (grub_size_t align, grub_size_t size)
   if (align == 0)
     align = 1;
 
+  /* Cells are always aligned enough for an unaligned request.  */
+  if (align == 1 && n <= GRUB_MM_NBINS && grub_mm_bins[n - 1])
+    {
+      grub_mm_header_t p = grub_mm_bins[n - 1];
+
+      if (p->magic != GRUB_MM_BIN_MAGIC)
+	grub_fatal ("bin magic is broken at %p: 0x%x", p, p->magic);
+
+      grub_mm_bins[n - 1] = p->next;
+      grub_mm_bin_count[n - 1]--;
+      grub_mm_binned -= n << GRUB_MM_ALIGN_LOG2;
+      p->magic = GRUB_MM_ALLOC_MAGIC;
+      return p + 1;
+    }
+
  again:
 
   for (r = grub_mm_base; r; r = r->next)
@@ -353,13 +408,19 @@ grub_memalign (grub_size_t align, grub_size_t size)
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
-      grub_disk_cache_invalidate_all ();
+      /* Give the binned blocks back so that they can coalesce.  */
+      grub_mm_flush_bins ();
       count++;
       goto again;
 
-#if 0
     case 1:
+      /* Release disk caches.  */
+      grub_disk_cache_release ();
+      count++;
+      goto again;
+
+#if 0
+    case 2:
       /* Unload unneeded modules.  */
       grub_dl_unload_unneeded ();
       count++;
@@ -395,18 +456,10 @@ grub_zalloc (grub_size_t size)
   return ret;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+/* Put the allocated block P back into the ring of its region R.  */
+static void
+grub_real_free (grub_mm_header_t p, grub_mm_region_t r)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
-
-  if (! ptr)
-    return;
-
-  get_header_from_pointer (ptr, &p, &r);
-
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
@@ -465,6 +518,35 @@ grub_free (void *ptr)
     }
 }
 
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
+  if (! ptr)
+    return;
+
+  get_header_from_pointer (ptr, &p, &r);
+
+  /* When a region is full, its first points to an allocated block, and
+     the code which walks the ring relies on seeing the alloc magic there.
+     Such a block must go back into the ring.  */
+  if (p->size <= GRUB_MM_NBINS && p != r->first
+      && grub_mm_binned + (p->size << GRUB_MM_ALIGN_LOG2) <= GRUB_MM_BIN_LIMIT)
+    {
+      p->magic = GRUB_MM_BIN_MAGIC;
+      p->next = grub_mm_bins[p->size - 1];
+      grub_mm_bins[p->size - 1] = p;
+      grub_mm_bin_count[p->size - 1]++;
+      grub_mm_binned += p->size << GRUB_MM_ALIGN_LOG2;
+      return;
+    }
+
+  grub_real_free (p, r);
+}
+
 /* Reallocate SIZE bytes and return the pointer. The contents will be
    the same as that of PTR.  */
 void *
@@ -501,6 +583,36 @@ grub_realloc (void *ptr, grub_size_t size)
   return q;
 }
 
+/* Return the size of all free blocks.  The binned ones count, as they
+   are given back before an allocation fails.  */
+grub_size_t
+grub_mm_free_bytes (void)
+{
+  grub_mm_region_t r;
+  grub_size_t total = grub_mm_binned;
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p;
+
+      /* Everything in this region is allocated.  */
+      if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
+	continue;
+
+      p = r->first;
+      do
+	{
+	  if (p->magic != GRUB_MM_FREE_MAGIC)
+	    grub_fatal ("free magic is broken at %p: 0x%x", p, p->magic);
+	  total += p->size << GRUB_MM_ALIGN_LOG2;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  return total;
+}
+
 #ifdef MM_DEBUG
 int grub_mm_debug = 0;
 
@@ -534,6 +646,7 @@ void
 grub_mm_dump (unsigned lineno)
 {
   grub_mm_region_t r;
+  unsigned i;
 
   grub_printf ("called at line %u\n", lineno);
   for (r = grub_mm_base; r; r = r->next)
@@ -554,11 +667,76 @@ grub_mm_dump (unsigned lineno)
 	    case GRUB_MM_ALLOC_MAGIC:
 	      grub_printf ("A:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
 	      break;
+	    case GRUB_MM_BIN_MAGIC:
+	      grub_printf ("B:%p:%u:%p\n",
+			   p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2, p->next);
+	      break;
 	    }
 	}
     }
 
   grub_printf ("\n");
+
+  for (i = 0; i < GRUB_MM_NBINS; i++)
+    if (grub_mm_bin_count[i])
+      grub_printf ("bin %u: %u blocks of %u bytes\n", i,
+		   grub_mm_bin_count[i],
+		   (unsigned int) (i + 1) << GRUB_MM_ALIGN_LOG2);
+  grub_printf ("binned: %u bytes\n\n", (unsigned int) grub_mm_binned);
+}
+
+#include "mm_stats.c"
+
+/* Account the block at PTR to the site FILE:LINE.  The site is remembered
+   in the otherwise unused next field of the allocated block's header.  */
+static void
+grub_mm_site_track (const char *file, int line, void *ptr)
+{
+  grub_mm_header_t p;
+  struct grub_mm_site *site;
+
+  if (! ptr)
+    return;
+
+  p = (grub_mm_header_t) ptr - 1;
+  site = grub_mm_site_get (file, line);
+  grub_mm_site_alloc (site, p->size << GRUB_MM_ALIGN_LOG2);
+  p->next = (grub_mm_header_t) site;
+}
+
+/* Return whether SITE points to an entry of the table.  */
+static int
+grub_mm_site_valid (const struct grub_mm_site *site)
+{
+  grub_addr_t off = (grub_addr_t) site - (grub_addr_t) grub_mm_sites;
+
+  if (site == &grub_mm_site_other)
+    return 1;
+  return (off < sizeof (grub_mm_sites)
+	  && off % sizeof (grub_mm_sites[0]) == 0);
+}
+
+/* Return the site the block at PTR was accounted to, if any.  */
+static struct grub_mm_site *
+grub_mm_site_of (void *ptr)
+{
+  grub_mm_header_t p;
+  struct grub_mm_site *site;
+
+  if (! ptr)
+    return NULL;
+
+  p = (grub_mm_header_t) ptr - 1;
+  site = (struct grub_mm_site *) p->next;
+  if (p->magic != GRUB_MM_ALLOC_MAGIC || ! grub_mm_site_valid (site))
+    return NULL;
+  return site;
+}
+
+static grub_size_t
+grub_mm_block_size (void *ptr)
+{
+  return ((grub_mm_header_t) ptr - 1)->size << GRUB_MM_ALIGN_LOG2;
 }
 
 void *
@@ -571,6 +749,7 @@ grub_debug_malloc (const char *file, int line, grub_size_t size)
   ptr = grub_malloc (size);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
+  grub_mm_site_track (file, line, ptr);
   return ptr;
 }
 
@@ -584,26 +763,48 @@ grub_debug_zalloc (const char *file, int line, grub_size_t size)
   ptr = grub_zalloc (size);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
+  grub_mm_site_track (file, line, ptr);
   return ptr;
 }
 
 void
 grub_debug_free (const char *file, int line, void *ptr)
 {
+  struct grub_mm_site *site;
+
   if (grub_mm_debug)
     grub_printf ("%s:%d: free (%p)\n", file, line, ptr);
+  site = grub_mm_site_of (ptr);
+  if (site)
+    grub_mm_site_free (site, grub_mm_block_size (ptr));
   grub_free (ptr);
 }
 
 void *
 grub_debug_realloc (const char *file, int line, void *ptr, grub_size_t size)
 {
+  struct grub_mm_site *site;
+  grub_size_t old_size = 0;
+  void *ret;
+
+  site = grub_mm_site_of (ptr);
+  if (site)
+    old_size = grub_mm_block_size (ptr);
+
   if (grub_mm_debug)
     grub_printf ("%s:%d: realloc (%p, 0x%" PRIxGRUB_SIZE ") = ", file, line, ptr, size);
-  ptr = grub_realloc (ptr, size);
+  ret = grub_realloc (ptr, size);
   if (grub_mm_debug)
-    grub_printf ("%p\n", ptr);
-  return ptr;
+    grub_printf ("%p\n", ret);
+
+  /* On failure the old block is left untouched.  */
+  if (! ret && size)
+    return ret;
+
+  if (site)
+    grub_mm_site_free (site, old_size);
+  grub_mm_site_track (file, line, ret);
+  return ret;
 }
 
 void *
@@ -618,6 +819,7 @@ grub_debug_memalign (const char *file, int line, grub_size_t align,
   ptr = grub_memalign (align, size);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
+  grub_mm_site_track (file, line, ptr);
   return ptr;
 }
 
@@ -0,0 +1,92 @@
+/* mm_stats.c - per call site statistics of the memory manager */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file is included by kern/mm.c and kern/emu/mm.c when MM_DEBUG is
+   enabled.  Sites are kept in a fixed open-addressed table so that the
+   accounting never allocates; once it is full, new sites are accounted
+   to a single catch-all entry.  */
+
+#define GRUB_MM_MAX_SITES	1024
+
+static struct grub_mm_site grub_mm_sites[GRUB_MM_MAX_SITES];
+static struct grub_mm_site grub_mm_site_other = { .file = "(other)" };
+
+static struct grub_mm_site *
+grub_mm_site_get (const char *file, int line)
+{
+  const char *c;
+  unsigned h = line;
+  unsigned i;
+
+  for (c = file; *c; c++)
+    h = h * 31 + *c;
+
+  for (i = 0; i < GRUB_MM_MAX_SITES; i++)
+    {
+      struct grub_mm_site *site;
+
+      site = &grub_mm_sites[(h + i) % GRUB_MM_MAX_SITES];
+      if (! site->file[0])
+	{
+	  /* Keep a copy, the name may belong to a module unloaded later.  */
+	  grub_strncpy (site->file, file, sizeof (site->file) - 1);
+	  site->line = line;
+	  return site;
+	}
+      if (site->line == line
+	  && grub_strncmp (site->file, file, sizeof (site->file) - 1) == 0)
+	return site;
+    }
+
+  return &grub_mm_site_other;
+}
+
+static void
+grub_mm_site_alloc (struct grub_mm_site *site, grub_size_t size)
+{
+  site->allocs++;
+  site->live += size;
+  if (site->live > site->peak)
+    site->peak = site->live;
+}
+
+static void
+grub_mm_site_free (struct grub_mm_site *site, grub_size_t size)
+{
+  site->frees++;
+  if (site->live < size)
+    site->live = 0;
+  else
+    site->live -= size;
+}
+
+int
+grub_mm_site_iterate (grub_mm_site_hook_t hook, void *data)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_MM_MAX_SITES; i++)
+    if (grub_mm_sites[i].file[0] && hook (&grub_mm_sites[i], data))
+      return 1;
+
+  if (grub_mm_site_other.allocs)
+    return hook (&grub_mm_site_other, data);
+
+  return 0;
+}
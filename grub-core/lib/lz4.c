@@ -0,0 +1,276 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ * Decompressor
+ * Copyright (C) 2011-2013, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ */
+
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+#include <grub/lz4.h>
+#include <grub/dl.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/*
+ * Compiler Options
+ */
+
+#define	GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
+
+#if (GCC_VERSION >= 302) || (defined (__INTEL_COMPILER) && __INTEL_COMPILER >= 800) || defined(__clang__)
+#define	expect(expr, value)    (__builtin_expect((expr), (value)))
+#else
+#define	expect(expr, value)    (expr)
+#endif
+
+#define	likely(expr)	expect((expr) != 0, 1)
+#define	unlikely(expr)	expect((expr) != 0, 0)
+
+/* Basic types */
+#define	BYTE	grub_uint8_t
+#define	U64	grub_uint64_t
+
+typedef struct _U64_S {
+	U64 v;
+} GRUB_PACKED U64_S;
+
+#define	A64(x)	(((U64_S *)(x))->v)
+
+/*
+ * Constants
+ */
+#define	MINMATCH 4
+
+#define	ML_BITS 4
+#define	ML_MASK ((1U<<ML_BITS)-1)
+#define	RUN_BITS (8-ML_BITS)
+#define	RUN_MASK ((1U<<RUN_BITS)-1)
+
+/*
+ * Literals and matches are copied in steps of WILDCOPY bytes, which may
+ * write up to WILDCOPY - 1 bytes past their end.  This is only done while
+ * both buffers have FASTMARGIN bytes left after the copy, the last bytes
+ * of a block are copied exactly.
+ */
+#define	WILDCOPY 16
+#define	FASTMARGIN (2 * WILDCOPY)
+
+static inline void
+LZ4_copy16(BYTE *d, const BYTE *s)
+{
+	U64 a = A64(s);
+	U64 b = A64(s + 8);
+
+	A64(d) = a;
+	A64(d + 8) = b;
+}
+
+/* Copy from S to D until D reaches E, S must be at least WILDCOPY behind. */
+static inline void
+LZ4_wildcopy(BYTE *d, const BYTE *s, BYTE *e)
+{
+	do {
+		LZ4_copy16(d, s);
+		d += WILDCOPY;
+		s += WILDCOPY;
+	} while (d < e);
+}
+
+/*
+ * Add the extra bytes of a literal run or match length at *IP to LENGTH.
+ * Return 0 if they run past IEND or make LENGTH exceed LIMIT.
+ */
+static inline int
+LZ4_read_length(const BYTE **ip, const BYTE *iend, grub_size_t *length,
+    grub_size_t limit)
+{
+	BYTE s;
+
+	do {
+		if (*ip >= iend)
+			return 0;
+		s = *(*ip)++;
+		*length += s;
+		if (*length > limit)
+			return 0;
+	} while (s == 255);
+	return 1;
+}
+
+grub_ssize_t
+grub_lz4_decompress(const char *src, grub_size_t srclen, char *dst,
+    grub_size_t dstlen, grub_size_t prefix)
+{
+	const BYTE *ip = (const BYTE *) src;
+	const BYTE *const iend = ip + srclen;
+	BYTE *op = (BYTE *) dst;
+	BYTE *const oend = op + dstlen;
+	const BYTE *const lowest = op - prefix;
+
+	while (1) {
+		const BYTE *ref;
+		grub_size_t length, offset;
+		BYTE token;
+
+		if (unlikely(ip >= iend))
+			goto _output_error;
+		token = *ip++;
+
+		/* copy literals */
+		length = token >> ML_BITS;
+		if (length == RUN_MASK &&
+		    !LZ4_read_length(&ip, iend, &length, dstlen))
+			goto _output_error;
+		if (likely((grub_size_t) (iend - ip) >= length + FASTMARGIN &&
+		    (grub_size_t) (oend - op) >= length + FASTMARGIN)) {
+			LZ4_wildcopy(op, ip, op + length);
+			op += length;
+			ip += length;
+		} else {
+			if (length > (grub_size_t) (iend - ip) ||
+			    length > (grub_size_t) (oend - op))
+				goto _output_error;
+			grub_memcpy(op, ip, length);
+			op += length;
+			ip += length;
+			/* The last sequence of a block has no match. */
+			if (ip == iend)
+				break;
+		}
+
+		/* get offset */
+		if (unlikely(iend - ip < 2))
+			goto _output_error;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (unlikely(offset == 0 ||
+		    offset > (grub_size_t) (op - lowest)))
+			/* reference outside of the output */
+			goto _output_error;
+		ref = op - offset;
+
+		/* get matchlength */
+		length = token & ML_MASK;
+		if (length == ML_MASK &&
+		    !LZ4_read_length(&ip, iend, &length, dstlen))
+			goto _output_error;
+		length += MINMATCH;
+		if (unlikely(length > (grub_size_t) (oend - op)))
+			goto _output_error;
+
+		/* copy repeated sequence */
+		if (likely((grub_size_t) (oend - op) >= length + FASTMARGIN)) {
+			if (likely(offset >= WILDCOPY)) {
+				LZ4_wildcopy(op, ref, op + length);
+			} else {
+				/*
+				 * The match overlaps its own output and
+				 * repeats with a period of OFFSET.  Lay out
+				 * the first WILDCOPY bytes one by one, the
+				 * rest can then be copied from a multiple of
+				 * the period at least WILDCOPY back.
+				 */
+				grub_size_t i, period = offset;
+
+				for (i = 0; i < WILDCOPY; i++)
+					op[i] = ref[i];
+				while (period < WILDCOPY)
+					period += offset;
+				if (length > WILDCOPY)
+					LZ4_wildcopy(op + WILDCOPY,
+					    op + WILDCOPY - period,
+					    op + length);
+			}
+			op += length;
+		} else {
+			while (length--)
+				*op++ = *ref++;
+		}
+	}
+
+	/* end of decoding */
+	return op - (BYTE *) dst;
+
+	/* corrupted input detected */
+	_output_error:
+	grub_error(GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 block");
+	return -1;
+}
+
+grub_ssize_t
+grub_lz4_decompressed_size(const char *src, grub_size_t srclen,
+    grub_size_t dstlen)
+{
+	const BYTE *ip = (const BYTE *) src;
+	const BYTE *const iend = ip + srclen;
+	grub_size_t size = 0;
+
+	while (1) {
+		grub_size_t length;
+		BYTE token;
+
+		if (ip >= iend)
+			goto _output_error;
+		token = *ip++;
+
+		length = token >> ML_BITS;
+		if (length == RUN_MASK &&
+		    !LZ4_read_length(&ip, iend, &length, dstlen))
+			goto _output_error;
+		if (length > (grub_size_t) (iend - ip) ||
+		    length > dstlen - size)
+			goto _output_error;
+		ip += length;
+		size += length;
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2 || (ip[0] | (ip[1] << 8)) == 0)
+			goto _output_error;
+		ip += 2;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK &&
+		    !LZ4_read_length(&ip, iend, &length, dstlen))
+			goto _output_error;
+		length += MINMATCH;
+		if (length > dstlen - size)
+			goto _output_error;
+		size += length;
+	}
+
+	return size;
+
+	_output_error:
+	grub_error(GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 block");
+	return -1;
+}
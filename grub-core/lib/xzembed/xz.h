@@ -177,6 +177,20 @@ enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b);
  */
 void xz_dec_reset(struct xz_dec *s);
 
+/**
+ * xz_dec_skip_block() - Account for a Block which isn't decoded
+ * @s:            Decoder state allocated using xz_dec_init()
+ * @unpadded:     Unpadded Size of the Block from the Index
+ * @uncompressed: Uncompressed Size of the Block from the Index
+ *
+ * To start decoding in the middle of a Stream, decode its Stream Header,
+ * call this for every Block before the wanted one in order and then
+ * continue with the input at the start of the wanted Block. The Index is
+ * still validated at the end of the Stream.
+ */
+void xz_dec_skip_block(struct xz_dec *s, uint64_t unpadded,
+		       uint64_t uncompressed);
+
 /**
  * xz_dec_end() - Free the memory allocated for the decoder state
  * @s:          Decoder state allocated using xz_dec_init(). If s is NULL,
@@ -488,6 +488,19 @@ static enum xz_ret dec_stream_header(struct xz_dec *s)
 
 	s->hash_id = s->temp.buf[HEADER_MAGIC_SIZE + 1];
 
+	/*
+	 * The Stream Header is decoded again after every reset, so free
+	 * the contexts of the previous run.
+	 */
+	kfree(s->crc32_context);
+	kfree(s->hash_context);
+	kfree(s->index.hash.hash_context);
+	kfree(s->block.hash.hash_context);
+	s->crc32_context = NULL;
+	s->hash_context = NULL;
+	s->index.hash.hash_context = NULL;
+	s->block.hash.hash_context = NULL;
+
 	if (s->crc32)
 	{
 		s->crc32_context = kmalloc(s->crc32->contextsize, GFP_KERNEL);
@@ -507,29 +520,15 @@ static enum xz_ret dec_stream_header(struct xz_dec *s)
 			if (s->hash->mdlen != s->hash_size)
 				return XZ_OPTIONS_ERROR;
 			s->hash_context = kmalloc(s->hash->contextsize, GFP_KERNEL);
-			if (s->hash_context == NULL)
-			{
-				kfree(s->crc32_context);
-				return XZ_MEMLIMIT_ERROR;
-			}
-			
 			s->index.hash.hash_context = kmalloc(s->hash->contextsize,
 							     GFP_KERNEL);
-			if (s->index.hash.hash_context == NULL)
-			{
-				kfree(s->hash_context);
-				kfree(s->crc32_context);
-				return XZ_MEMLIMIT_ERROR;
-			}
-			
 			s->block.hash.hash_context = kmalloc(s->hash->contextsize, GFP_KERNEL);
-			if (s->block.hash.hash_context == NULL)
-			{
-				kfree(s->index.hash.hash_context);
-				kfree(s->hash_context);
-				kfree(s->crc32_context);
+			/* Anything allocated is freed by the next reset or
+			   by xz_dec_end().  */
+			if (s->hash_context == NULL
+			    || s->index.hash.hash_context == NULL
+			    || s->block.hash.hash_context == NULL)
 				return XZ_MEMLIMIT_ERROR;
-			}
 
 			s->hash->init(s->hash_context);
 			s->hash->init(s->index.hash.hash_context);
@@ -1022,6 +1021,22 @@ void xz_dec_reset(struct xz_dec *s)
 	s->have_hash_value = 0;
 }
 
+void xz_dec_skip_block(struct xz_dec *s, uint64_t unpadded,
+		       uint64_t uncompressed)
+{
+	s->block.hash.unpadded += unpadded;
+	s->block.hash.uncompressed += uncompressed;
+
+#ifndef GRUB_EMBED_DECOMPRESSOR
+	if (s->hash)
+		s->hash->write(s->block.hash.hash_context,
+			       (const uint8_t *)&s->block.hash,
+			       2 * sizeof(vli_type));
+#endif
+
+	++s->block.count;
+}
+
 void xz_dec_end(struct xz_dec *s)
 {
 	if (s != NULL) {
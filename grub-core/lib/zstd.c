@@ -0,0 +1,1505 @@
+/* zstd.c - decompressor for the Zstandard format (RFC 8878)  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_MAGIC		0xfd2fb528
+#define ZSTD_SKIPPABLE_MAGIC	0x184d2a50
+#define ZSTD_SKIPPABLE_MASK	0xfffffff0
+
+#define ZSTD_BLOCK_MAX		(128 << 10)
+/* The largest window accepted, that of level 20.  The reference decoder
+   takes up to 128 MiB by default, too much to hold in the heap.  */
+#define ZSTD_WINDOW_MAX		(1 << 25)
+
+enum
+  {
+    BLOCK_RAW,
+    BLOCK_RLE,
+    BLOCK_COMPRESSED,
+    BLOCK_RESERVED
+  };
+
+enum
+  {
+    LITERALS_RAW,
+    LITERALS_RLE,
+    LITERALS_COMPRESSED,
+    LITERALS_TREELESS
+  };
+
+enum
+  {
+    MODE_PREDEFINED,
+    MODE_RLE,
+    MODE_FSE,
+    MODE_REPEAT
+  };
+
+#define HUF_MAX_BITS		11
+#define HUF_MAX_WEIGHT_LOG	6
+
+#define FSE_MAX_LOG		9
+#define LL_MAX_LOG		9
+#define ML_MAX_LOG		9
+#define OF_MAX_LOG		8
+#define LL_MAX_SYMBOL		35
+#define ML_MAX_SYMBOL		52
+#define OF_MAX_SYMBOL		31
+
+struct fse_entry
+{
+  grub_uint16_t base;
+  grub_uint8_t symbol;
+  grub_uint8_t bits;
+};
+
+struct fse_table
+{
+  unsigned log;
+  struct fse_entry e[1 << FSE_MAX_LOG];
+};
+
+struct huf_entry
+{
+  grub_uint8_t symbol;
+  grub_uint8_t bits;
+};
+
+struct xxh64
+{
+  grub_uint64_t v[4];
+  grub_uint8_t buf[32];
+  grub_size_t buffered;
+  grub_uint64_t total;
+};
+
+struct grub_zstd_dec
+{
+  grub_zstd_read_t read;
+  void *read_data;
+
+  /* Stop after the first frame.  */
+  int single_frame;
+  int frames_done;
+  int at_end;
+
+  /* The frame being decoded.  */
+  int in_frame;
+  int last_block;
+  int checksum;
+  grub_uint64_t content_size;
+  grub_uint64_t frame_out;
+  grub_size_t window_size;
+  grub_size_t block_max;
+  struct xxh64 xxh;
+
+  /* Decompressed data, including the part of the window needed by the
+     next block.  The bytes from POS to LEN haven't been returned yet.  */
+  char *win;
+  grub_size_t win_alloc;
+  grub_size_t win_len;
+  grub_size_t win_pos;
+
+  grub_uint8_t *in;
+  grub_size_t in_alloc;
+  grub_uint8_t *litbuf;
+  grub_size_t litbuf_alloc;
+
+  /* State kept from one block to the next.  */
+  grub_uint32_t rep[3];
+  int have_huf;
+  unsigned huf_bits;
+  struct huf_entry huf[1 << HUF_MAX_BITS];
+  int have_ll, have_of, have_ml;
+  struct fse_table ll, of, ml;
+};
+
+static const grub_int16_t ll_default[LL_MAX_SYMBOL + 1] =
+  {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+  };
+
+static const grub_int16_t ml_default[ML_MAX_SYMBOL + 1] =
+  {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+  };
+
+static const grub_int16_t of_default[28 + 1] =
+  {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+  };
+
+static const grub_uint32_t ll_base[LL_MAX_SYMBOL + 1] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+  };
+
+static const grub_uint8_t ll_bits[LL_MAX_SYMBOL + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+  };
+
+static const grub_uint32_t ml_base[ML_MAX_SYMBOL + 1] =
+  {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+  };
+
+static const grub_uint8_t ml_bits[ML_MAX_SYMBOL + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+  };
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+}
+
+/* Index of the highest set bit of V, which mustn't be 0.  */
+static inline unsigned
+highbit32 (grub_uint32_t v)
+{
+  unsigned r = 0;
+
+  while (v >>= 1)
+    r++;
+  return r;
+}
+
+/* XXH64 of the frame contents, of which the low 32 bits are stored as the
+   optional checksum.  */
+
+#define XXH_PRIME1	11400714785074694791ULL
+#define XXH_PRIME2	14029467366897019727ULL
+#define XXH_PRIME3	1609587929392839161ULL
+#define XXH_PRIME4	9650029242287828579ULL
+#define XXH_PRIME5	2870177450012600261ULL
+
+static inline grub_uint64_t
+xxh_rotl (grub_uint64_t v, int r)
+{
+  return (v << r) | (v >> (64 - r));
+}
+
+static inline grub_uint64_t
+xxh_round (grub_uint64_t acc, grub_uint64_t input)
+{
+  acc += input * XXH_PRIME2;
+  acc = xxh_rotl (acc, 31);
+  return acc * XXH_PRIME1;
+}
+
+static inline grub_uint64_t
+xxh_merge (grub_uint64_t acc, grub_uint64_t v)
+{
+  acc ^= xxh_round (0, v);
+  return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void
+xxh64_init (struct xxh64 *x)
+{
+  x->v[0] = XXH_PRIME1 + XXH_PRIME2;
+  x->v[1] = XXH_PRIME2;
+  x->v[2] = 0;
+  x->v[3] = -XXH_PRIME1;
+  x->buffered = 0;
+  x->total = 0;
+}
+
+static void
+xxh64_stripe (struct xxh64 *x, const grub_uint8_t *p)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    x->v[i] = xxh_round (x->v[i],
+			 grub_le_to_cpu64 (grub_get_unaligned64 (p + 8 * i)));
+}
+
+static void
+xxh64_update (struct xxh64 *x, const grub_uint8_t *p, grub_size_t len)
+{
+  x->total += len;
+
+  if (x->buffered)
+    {
+      grub_size_t n = 32 - x->buffered;
+
+      if (n > len)
+	n = len;
+      grub_memcpy (x->buf + x->buffered, p, n);
+      x->buffered += n;
+      p += n;
+      len -= n;
+      if (x->buffered < 32)
+	return;
+      xxh64_stripe (x, x->buf);
+      x->buffered = 0;
+    }
+
+  for (; len >= 32; p += 32, len -= 32)
+    xxh64_stripe (x, p);
+
+  grub_memcpy (x->buf, p, len);
+  x->buffered = len;
+}
+
+static grub_uint64_t
+xxh64_digest (const struct xxh64 *x)
+{
+  const grub_uint8_t *p = x->buf;
+  grub_size_t len = x->buffered;
+  grub_uint64_t h;
+
+  if (x->total >= 32)
+    {
+      h = xxh_rotl (x->v[0], 1) + xxh_rotl (x->v[1], 7)
+	+ xxh_rotl (x->v[2], 12) + xxh_rotl (x->v[3], 18);
+      h = xxh_merge (h, x->v[0]);
+      h = xxh_merge (h, x->v[1]);
+      h = xxh_merge (h, x->v[2]);
+      h = xxh_merge (h, x->v[3]);
+    }
+  else
+    h = XXH_PRIME5;
+
+  h += x->total;
+
+  for (; len >= 8; p += 8, len -= 8)
+    {
+      h ^= xxh_round (0, grub_le_to_cpu64 (grub_get_unaligned64 (p)));
+      h = xxh_rotl (h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+  if (len >= 4)
+    {
+      h ^= (grub_uint64_t) grub_le_to_cpu32 (grub_get_unaligned32 (p))
+	* XXH_PRIME1;
+      h = xxh_rotl (h, 23) * XXH_PRIME2 + XXH_PRIME3;
+      p += 4;
+      len -= 4;
+    }
+  for (; len; p++, len--)
+    {
+      h ^= *p * XXH_PRIME5;
+      h = xxh_rotl (h, 11) * XXH_PRIME1;
+    }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME2;
+  h ^= h >> 29;
+  h *= XXH_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* Bit streams of Huffman and FSE coded data are read backwards, starting
+   at the highest set bit of the last byte.  POS counts the bits left;
+   reading past the start yields zeros and makes it negative.  */
+struct bits
+{
+  const grub_uint8_t *p;
+  grub_size_t len;
+  grub_ssize_t pos;
+};
+
+static grub_err_t
+bits_init (struct bits *b, const grub_uint8_t *p, grub_size_t len)
+{
+  if (len == 0 || p[len - 1] == 0)
+    return corrupted ();
+  b->p = p;
+  b->len = len;
+  b->pos = (len - 1) * 8 + highbit32 (p[len - 1]);
+  return GRUB_ERR_NONE;
+}
+
+/* Return the N <= 32 bits below POS without consuming them.  */
+static inline grub_uint32_t
+bits_peek (const struct bits *b, unsigned n)
+{
+  grub_ssize_t start = b->pos - n;
+  grub_size_t byte;
+  grub_uint64_t v = 0;
+  unsigned shift = 0;
+
+  if (n == 0)
+    return 0;
+  if (start < 0)
+    {
+      if (b->pos <= 0)
+	return 0;
+      shift = -start;
+      n = b->pos;
+      start = 0;
+    }
+
+  byte = start >> 3;
+  if (byte + 8 <= b->len)
+    v = grub_le_to_cpu64 (grub_get_unaligned64 (b->p + byte));
+  else
+    {
+      unsigned i;
+
+      for (i = 0; byte + i < b->len; i++)
+	v |= (grub_uint64_t) b->p[byte + i] << (8 * i);
+    }
+  v >>= start & 7;
+  return (grub_uint32_t) ((v & ((1ULL << n) - 1)) << shift);
+}
+
+static inline grub_uint32_t
+bits_read (struct bits *b, unsigned n)
+{
+  grub_uint32_t v = bits_peek (b, n);
+
+  b->pos -= n;
+  return v;
+}
+
+/* Read a FSE table description of at most LEN bytes from P into NORM.
+   Return the number of bytes used or -1.  */
+static grub_ssize_t
+fse_read_description (const grub_uint8_t *p, grub_size_t len,
+		      grub_int16_t *norm, unsigned *max_symbol,
+		      unsigned *log, unsigned max_log)
+{
+  grub_size_t bitpos = 0;
+  grub_int32_t remaining, threshold;
+  unsigned nbits, symbol = 0;
+  int previous0 = 0;
+
+#define GET_BITS(n)							\
+  ({									\
+    grub_uint32_t v_ = 0;						\
+    unsigned i_;							\
+    for (i_ = 0; i_ < (n); i_++)					\
+      if (((bitpos + i_) >> 3) < len)					\
+	v_ |= ((p[(bitpos + i_) >> 3] >> ((bitpos + i_) & 7)) & 1) << i_; \
+    v_;									\
+  })
+
+  if (len < 1)
+    goto fail;
+
+  *log = (p[0] & 0xf) + 5;
+  bitpos = 4;
+  if (*log > max_log)
+    goto fail;
+
+  remaining = (1 << *log) + 1;
+  threshold = 1 << *log;
+  nbits = *log + 1;
+
+  while (remaining > 1 && symbol <= *max_symbol)
+    {
+      grub_int32_t max, count;
+
+      if (previous0)
+	{
+	  unsigned repeat;
+
+	  /* Runs of symbols with probability 0 are given in 2-bit steps,
+	     with 3 meaning another step follows.  */
+	  do
+	    {
+	      unsigned j;
+
+	      repeat = GET_BITS (2);
+	      bitpos += 2;
+	      for (j = 0; j < repeat; j++)
+		{
+		  if (symbol > *max_symbol)
+		    goto fail;
+		  norm[symbol++] = 0;
+		}
+	    }
+	  while (repeat == 3);
+	  if (symbol > *max_symbol)
+	    goto fail;
+	}
+
+      max = (2 * threshold - 1) - remaining;
+      count = GET_BITS (nbits);
+      if ((count & (threshold - 1)) < max)
+	{
+	  count &= threshold - 1;
+	  bitpos += nbits - 1;
+	}
+      else
+	{
+	  count &= 2 * threshold - 1;
+	  if (count >= threshold)
+	    count -= max;
+	  bitpos += nbits;
+	}
+      count--;
+      remaining -= count < 0 ? -count : count;
+      norm[symbol++] = count;
+      previous0 = !count;
+      while (remaining < threshold)
+	{
+	  nbits--;
+	  threshold >>= 1;
+	}
+    }
+#undef GET_BITS
+
+  if (remaining != 1 || ((bitpos + 7) >> 3) > len)
+    goto fail;
+
+  *max_symbol = symbol - 1;
+  return (bitpos + 7) >> 3;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+static grub_err_t
+fse_build (struct fse_table *t, const grub_int16_t *norm,
+	   unsigned max_symbol, unsigned log)
+{
+  grub_uint16_t next[256];
+  grub_uint32_t size = 1 << log, high = size - 1;
+  grub_uint32_t step = (size >> 1) + (size >> 3) + 3;
+  grub_uint32_t pos = 0, u;
+  unsigned s;
+  int i;
+
+  t->log = log;
+
+  for (s = 0; s <= max_symbol; s++)
+    if (norm[s] == -1)
+      {
+	t->e[high--].symbol = s;
+	next[s] = 1;
+      }
+    else
+      next[s] = norm[s];
+
+  for (s = 0; s <= max_symbol; s++)
+    for (i = 0; i < norm[s]; i++)
+      {
+	t->e[pos].symbol = s;
+	do
+	  pos = (pos + step) & (size - 1);
+	while (pos > high);
+      }
+  if (pos != 0)
+    return corrupted ();
+
+  for (u = 0; u < size; u++)
+    {
+      grub_uint16_t n = next[t->e[u].symbol]++;
+
+      t->e[u].bits = log - highbit32 (n);
+      t->e[u].base = (n << t->e[u].bits) - size;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static inline grub_uint8_t
+fse_decode (const struct fse_table *t, grub_uint32_t *state, struct bits *b)
+{
+  const struct fse_entry *e = &t->e[*state];
+
+  *state = e->base + bits_read (b, e->bits);
+  return e->symbol;
+}
+
+/* Read the Huffman tree description for the literals.  Return the number
+   of bytes used or -1.  */
+static grub_ssize_t
+huf_read_tree (struct grub_zstd_dec *dec, const grub_uint8_t *p,
+	       grub_size_t len)
+{
+  grub_uint8_t weights[256];
+  unsigned n = 0, i, w, max_bits;
+  grub_uint32_t total = 0, rest, pos;
+  grub_size_t used;
+
+  if (len < 1)
+    goto fail;
+
+  if (p[0] >= 128)
+    {
+      n = p[0] - 127;
+      used = 1 + (n + 1) / 2;
+      if (used > len)
+	goto fail;
+      for (i = 0; i < n; i++)
+	weights[i] = (i & 1) ? (p[1 + i / 2] & 0xf) : (p[1 + i / 2] >> 4);
+    }
+  else
+    {
+      grub_int16_t norm[HUF_MAX_BITS + 2];
+      unsigned max_symbol = HUF_MAX_BITS + 1, log;
+      struct fse_table table, *t = &table;
+      grub_uint32_t s1, s2;
+      grub_ssize_t desc;
+      struct bits b;
+
+      used = 1 + p[0];
+      if (used > len)
+	goto fail;
+      desc = fse_read_description (p + 1, p[0], norm, &max_symbol, &log,
+				   HUF_MAX_WEIGHT_LOG);
+      if (desc < 0)
+	return -1;
+      if (fse_build (t, norm, max_symbol, log)
+	  || bits_init (&b, p + 1 + desc, p[0] - desc))
+	return -1;
+
+      s1 = bits_read (&b, log);
+      s2 = bits_read (&b, log);
+      while (1)
+	{
+	  if (n > 253)
+	    goto fail;
+	  weights[n++] = fse_decode (t, &s1, &b);
+	  if (b.pos < 0)
+	    {
+	      weights[n++] = t->e[s2].symbol;
+	      break;
+	    }
+	  weights[n++] = fse_decode (t, &s2, &b);
+	  if (b.pos < 0)
+	    {
+	      weights[n++] = t->e[s1].symbol;
+	      break;
+	    }
+	}
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (weights[i] > HUF_MAX_BITS)
+	goto fail;
+      if (weights[i])
+	total += 1 << (weights[i] - 1);
+    }
+  if (total == 0)
+    goto fail;
+
+  /* The weight of the last symbol is implied by the others making up a
+     power of two.  */
+  max_bits = highbit32 (total) + 1;
+  rest = (1 << max_bits) - total;
+  if (max_bits > HUF_MAX_BITS || (rest & (rest - 1)))
+    goto fail;
+  weights[n++] = highbit32 (rest) + 1;
+
+  /* Codes are assigned in order of increasing weight.  */
+  pos = 0;
+  for (w = 1; w <= max_bits; w++)
+    for (i = 0; i < n; i++)
+      if (weights[i] == w)
+	{
+	  grub_uint32_t j, span = 1 << (w - 1);
+
+	  for (j = 0; j < span; j++)
+	    {
+	      dec->huf[pos + j].symbol = i;
+	      dec->huf[pos + j].bits = max_bits + 1 - w;
+	    }
+	  pos += span;
+	}
+  if (pos != (1U << max_bits))
+    goto fail;
+
+  dec->huf_bits = max_bits;
+  dec->have_huf = 1;
+  return used;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+static grub_err_t
+huf_decode_stream (struct grub_zstd_dec *dec, const grub_uint8_t *p,
+		   grub_size_t len, grub_uint8_t *out, grub_size_t n)
+{
+  unsigned max_bits = dec->huf_bits;
+  struct bits b;
+
+  if (bits_init (&b, p, len))
+    return grub_errno;
+
+  for (; n; n--)
+    {
+      const struct huf_entry *e = &dec->huf[bits_peek (&b, max_bits)];
+
+      *out++ = e->symbol;
+      b.pos -= e->bits;
+    }
+
+  if (b.pos != 0)
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the literals section at P into LITS and NLITS.  Return the
+   number of bytes used or -1.  */
+static grub_ssize_t
+decode_literals (struct grub_zstd_dec *dec, const grub_uint8_t *p,
+		 grub_size_t len, const grub_uint8_t **lits,
+		 grub_size_t *nlits)
+{
+  unsigned type, format;
+  grub_size_t hsize, regen, csize;
+
+  if (len < 1)
+    goto fail;
+
+  type = p[0] & 3;
+  format = (p[0] >> 2) & 3;
+
+  if (type == LITERALS_RAW || type == LITERALS_RLE)
+    {
+      switch (format)
+	{
+	case 1:
+	  hsize = 2;
+	  if (len < hsize)
+	    goto fail;
+	  regen = (p[0] >> 4) | (p[1] << 4);
+	  break;
+	case 3:
+	  hsize = 3;
+	  if (len < hsize)
+	    goto fail;
+	  regen = (p[0] >> 4) | (p[1] << 4) | (p[2] << 12);
+	  break;
+	default:
+	  hsize = 1;
+	  regen = p[0] >> 3;
+	  break;
+	}
+      if (regen > dec->block_max)
+	goto fail;
+
+      if (type == LITERALS_RAW)
+	{
+	  if (hsize + regen > len)
+	    goto fail;
+	  *lits = p + hsize;
+	  *nlits = regen;
+	  return hsize + regen;
+	}
+
+      if (hsize + 1 > len)
+	goto fail;
+      grub_memset (dec->litbuf, p[hsize], regen);
+      *lits = dec->litbuf;
+      *nlits = regen;
+      return hsize + 1;
+    }
+  else
+    {
+      grub_uint64_t h;
+      int streams = format != 0;
+      const grub_uint8_t *s;
+
+      hsize = format < 2 ? 3 : format + 2;
+      if (len < hsize)
+	goto fail;
+      h = p[0] | (p[1] << 8) | ((grub_uint64_t) p[2] << 16);
+      if (hsize > 3)
+	h |= (grub_uint64_t) p[3] << 24;
+      if (hsize > 4)
+	h |= (grub_uint64_t) p[4] << 32;
+      switch (format)
+	{
+	case 0:
+	case 1:
+	  regen = (h >> 4) & 0x3ff;
+	  csize = (h >> 14) & 0x3ff;
+	  break;
+	case 2:
+	  regen = (h >> 4) & 0x3fff;
+	  csize = (h >> 18) & 0x3fff;
+	  break;
+	default:
+	  regen = (h >> 4) & 0x3ffff;
+	  csize = (h >> 22) & 0x3ffff;
+	  break;
+	}
+      if (regen > dec->block_max || hsize + csize > len)
+	goto fail;
+
+      s = p + hsize;
+      if (type == LITERALS_COMPRESSED)
+	{
+	  grub_ssize_t tree = huf_read_tree (dec, s, csize);
+
+	  if (tree < 0)
+	    return -1;
+	  s += tree;
+	}
+      else if (!dec->have_huf)
+	goto fail;
+
+      if (!streams)
+	{
+	  if (huf_decode_stream (dec, s, p + hsize + csize - s, dec->litbuf,
+				 regen))
+	    return -1;
+	}
+      else
+	{
+	  grub_size_t sizes[4], part = (regen + 3) / 4;
+	  grub_uint8_t *out = dec->litbuf;
+	  int i;
+
+	  grub_size_t left = p + hsize + csize - s;
+
+	  if (left < 6 || regen < 3 * part)
+	    goto fail;
+	  sizes[0] = s[0] | (s[1] << 8);
+	  sizes[1] = s[2] | (s[3] << 8);
+	  sizes[2] = s[4] | (s[5] << 8);
+	  if (sizes[0] + sizes[1] + sizes[2] > left - 6)
+	    goto fail;
+	  sizes[3] = left - 6 - sizes[0] - sizes[1] - sizes[2];
+	  s += 6;
+	  for (i = 0; i < 4; i++)
+	    {
+	      grub_size_t n = i < 3 ? part : regen - 3 * part;
+
+	      if (huf_decode_stream (dec, s, sizes[i], out, n))
+		return -1;
+	      s += sizes[i];
+	      out += n;
+	    }
+	}
+      *lits = dec->litbuf;
+      *nlits = regen;
+      return hsize + csize;
+    }
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+/* Set up table T for one of the sequence codes.  Return the number of
+   bytes used or -1.  */
+static grub_ssize_t
+read_sequence_table (struct fse_table *t, int *have, unsigned mode,
+		     const grub_uint8_t *p, grub_size_t len,
+		     unsigned max_log, unsigned max_symbol,
+		     const grub_int16_t *def, unsigned def_max_symbol,
+		     unsigned def_log)
+{
+  grub_int16_t norm[ML_MAX_SYMBOL + 1];
+  grub_ssize_t used;
+  unsigned log;
+
+  switch (mode)
+    {
+    case MODE_PREDEFINED:
+      if (fse_build (t, def, def_max_symbol, def_log))
+	return -1;
+      used = 0;
+      break;
+    case MODE_RLE:
+      if (len < 1 || p[0] > max_symbol)
+	goto fail;
+      t->log = 0;
+      t->e[0].symbol = p[0];
+      t->e[0].bits = 0;
+      t->e[0].base = 0;
+      used = 1;
+      break;
+    case MODE_FSE:
+      used = fse_read_description (p, len, norm, &max_symbol, &log, max_log);
+      if (used < 0 || fse_build (t, norm, max_symbol, log))
+	return -1;
+      break;
+    default:
+      if (!*have)
+	goto fail;
+      return 0;
+    }
+  *have = 1;
+  return used;
+
+ fail:
+  corrupted ();
+  return -1;
+}
+
+/* Decode the compressed block at P to OUT, which has room for up to
+   OUT_MAX bytes and is preceded by the window.  */
+static grub_err_t
+decode_block (struct grub_zstd_dec *dec, const grub_uint8_t *p,
+	      grub_size_t len, grub_uint8_t *out, grub_size_t out_max,
+	      grub_size_t *written)
+{
+  const grub_uint8_t *lits, *end = p + len;
+  grub_uint8_t *op = out, *oend = out + out_max;
+  grub_size_t nlits, nseq, i;
+  grub_uint32_t ll_state, of_state, ml_state;
+  grub_ssize_t used;
+  struct bits b;
+  unsigned modes;
+
+  used = decode_literals (dec, p, len, &lits, &nlits);
+  if (used < 0)
+    return grub_errno;
+  p += used;
+
+  if (p >= end)
+    return corrupted ();
+  if (p[0] < 128)
+    nseq = *p++;
+  else if (p[0] < 255)
+    {
+      if (end - p < 2)
+	return corrupted ();
+      nseq = ((p[0] - 128) << 8) | p[1];
+      p += 2;
+    }
+  else
+    {
+      if (end - p < 3)
+	return corrupted ();
+      nseq = (p[1] | (p[2] << 8)) + 0x7f00;
+      p += 3;
+    }
+
+  if (nseq == 0)
+    goto copy_literals;
+
+  if (p >= end)
+    return corrupted ();
+  modes = *p++;
+  if (modes & 3)
+    return corrupted ();
+
+  used = read_sequence_table (&dec->ll, &dec->have_ll, modes >> 6, p, end - p,
+			      LL_MAX_LOG, LL_MAX_SYMBOL, ll_default,
+			      LL_MAX_SYMBOL, 6);
+  if (used < 0)
+    return grub_errno;
+  p += used;
+  used = read_sequence_table (&dec->of, &dec->have_of, (modes >> 4) & 3, p,
+			      end - p, OF_MAX_LOG, OF_MAX_SYMBOL, of_default,
+			      28, 5);
+  if (used < 0)
+    return grub_errno;
+  p += used;
+  used = read_sequence_table (&dec->ml, &dec->have_ml, (modes >> 2) & 3, p,
+			      end - p, ML_MAX_LOG, ML_MAX_SYMBOL, ml_default,
+			      ML_MAX_SYMBOL, 6);
+  if (used < 0)
+    return grub_errno;
+  p += used;
+
+  if (bits_init (&b, p, end - p))
+    return grub_errno;
+  ll_state = bits_read (&b, dec->ll.log);
+  of_state = bits_read (&b, dec->of.log);
+  ml_state = bits_read (&b, dec->ml.log);
+
+  for (i = 0; i < nseq; i++)
+    {
+      unsigned ll_code = dec->ll.e[ll_state].symbol;
+      unsigned of_code = dec->of.e[of_state].symbol;
+      unsigned ml_code = dec->ml.e[ml_state].symbol;
+      grub_uint32_t offset, ll, ml;
+
+      if (of_code > OF_MAX_SYMBOL)
+	return corrupted ();
+      offset = (1U << of_code) + bits_read (&b, of_code);
+      ml = ml_base[ml_code] + bits_read (&b, ml_bits[ml_code]);
+      ll = ll_base[ll_code] + bits_read (&b, ll_bits[ll_code]);
+
+      if (offset > 3)
+	{
+	  offset -= 3;
+	  dec->rep[2] = dec->rep[1];
+	  dec->rep[1] = dec->rep[0];
+	  dec->rep[0] = offset;
+	}
+      else
+	{
+	  /* Repeated offsets are shifted by one after an empty run of
+	     literals, with the last one replaced by the first one minus
+	     one.  */
+	  unsigned idx = offset - 1 + (ll == 0);
+
+	  if (idx == 3)
+	    offset = dec->rep[0] - 1;
+	  else
+	    offset = dec->rep[idx];
+	  /* Like the reference decoder, turn an invalid 0 into 1.  */
+	  if (offset == 0)
+	    offset = 1;
+	  if (idx >= 2)
+	    dec->rep[2] = dec->rep[1];
+	  if (idx >= 1)
+	    {
+	      dec->rep[1] = dec->rep[0];
+	      dec->rep[0] = offset;
+	    }
+	}
+
+      if (i + 1 < nseq)
+	{
+	  fse_decode (&dec->ll, &ll_state, &b);
+	  fse_decode (&dec->ml, &ml_state, &b);
+	  fse_decode (&dec->of, &of_state, &b);
+	}
+
+      if (ll > nlits || (grub_size_t) (oend - op) < (grub_size_t) ll + ml)
+	return corrupted ();
+      grub_memcpy (op, lits, ll);
+      op += ll;
+      lits += ll;
+      nlits -= ll;
+
+      if (offset == 0 || offset > (grub_size_t) (op - (grub_uint8_t *) dec->win))
+	return corrupted ();
+      if (offset >= ml)
+	grub_memcpy (op, op - offset, ml);
+      else
+	{
+	  const grub_uint8_t *src = op - offset;
+	  grub_uint32_t j;
+
+	  for (j = 0; j < ml; j++)
+	    op[j] = src[j];
+	}
+      op += ml;
+    }
+
+  if (b.pos != 0)
+    return corrupted ();
+
+ copy_literals:
+  if ((grub_size_t) (oend - op) < nlits)
+    return corrupted ();
+  grub_memcpy (op, lits, nlits);
+  op += nlits;
+
+  *written = op - out;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_input (grub_zstd_read_t read, void *data, void *buf, grub_size_t len)
+{
+  grub_ssize_t n = read (data, buf, len);
+
+  if (n < 0)
+    return grub_errno;
+  if ((grub_size_t) n != len)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "premature end of zstd data");
+  return GRUB_ERR_NONE;
+}
+
+struct frame_header
+{
+  /* Skippable frames hold SKIP bytes of data of no concern to us.  */
+  int skippable;
+  grub_uint32_t skip;
+  int single_segment;
+  int checksum;
+  grub_uint64_t window_size;
+  grub_uint64_t content_size;
+  /* Bytes read.  */
+  grub_size_t size;
+};
+
+/* Read the header of the next frame.  Set END if there is none.  */
+static grub_err_t
+read_frame_header (grub_zstd_read_t read, void *data,
+		   struct frame_header *hdr, int *end)
+{
+  grub_uint8_t buf[14], desc, *p;
+  grub_uint32_t magic;
+  unsigned fcs_size, dict_size;
+  grub_ssize_t n;
+
+  grub_memset (hdr, 0, sizeof (*hdr));
+  *end = 0;
+
+  n = read (data, buf, 4);
+  if (n < 0)
+    return grub_errno;
+  if (n == 0)
+    {
+      *end = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (n != 4)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "premature end of zstd data");
+  magic = grub_le_to_cpu32 (grub_get_unaligned32 (buf));
+
+  if ((magic & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC)
+    {
+      if (read_input (read, data, buf, 4))
+	return grub_errno;
+      hdr->skippable = 1;
+      hdr->skip = grub_le_to_cpu32 (grub_get_unaligned32 (buf));
+      hdr->size = 8;
+      return GRUB_ERR_NONE;
+    }
+  if (magic != ZSTD_MAGIC)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "not zstd data");
+
+  if (read_input (read, data, &desc, 1))
+    return grub_errno;
+  if (desc & 0x08)
+    return corrupted ();
+
+  hdr->single_segment = (desc >> 5) & 1;
+  hdr->checksum = (desc >> 2) & 1;
+  dict_size = (desc & 3) == 3 ? 4 : (desc & 3);
+  fcs_size = desc >> 6;
+  fcs_size = fcs_size ? (1 << fcs_size) : hdr->single_segment;
+
+  n = !hdr->single_segment + dict_size + fcs_size;
+  if (read_input (read, data, buf, n))
+    return grub_errno;
+  hdr->size = 5 + n;
+  p = buf;
+
+  if (!hdr->single_segment)
+    {
+      unsigned exponent = p[0] >> 3, mantissa = p[0] & 7;
+      grub_uint64_t base = 1ULL << (10 + exponent);
+
+      hdr->window_size = base + (base / 8) * mantissa;
+      p++;
+    }
+
+  if (dict_size)
+    {
+      grub_uint32_t id = 0;
+      unsigned i;
+
+      for (i = 0; i < dict_size; i++)
+	id |= (grub_uint32_t) p[i] << (8 * i);
+      if (id)
+	return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			   "zstd dictionaries aren't supported");
+      p += dict_size;
+    }
+
+  switch (fcs_size)
+    {
+    case 0:
+      hdr->content_size = GRUB_ZSTD_SIZE_UNKNOWN;
+      break;
+    case 1:
+      hdr->content_size = p[0];
+      break;
+    case 2:
+      hdr->content_size = grub_le_to_cpu16 (grub_get_unaligned16 (p)) + 256;
+      break;
+    case 4:
+      hdr->content_size = grub_le_to_cpu32 (grub_get_unaligned32 (p));
+      break;
+    default:
+      hdr->content_size = grub_le_to_cpu64 (grub_get_unaligned64 (p));
+      break;
+    }
+
+  if (hdr->single_segment)
+    hdr->window_size = hdr->content_size;
+  if (hdr->window_size > ZSTD_WINDOW_MAX)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "zstd window of %llu bytes is too large",
+		       (unsigned long long) hdr->window_size);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+skip_input (grub_zstd_read_t read, void *data, grub_uint64_t len)
+{
+  while (len)
+    {
+      grub_size_t n = len > (1U << 30) ? (1U << 30) : len;
+
+      if (read_input (read, data, NULL, n))
+	return grub_errno;
+      len -= n;
+    }
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_zstd_frame_info (grub_zstd_read_t read, void *read_data,
+		      grub_uint64_t *compressed, grub_uint64_t *content)
+{
+  struct frame_header hdr;
+  grub_uint8_t bh[3];
+  int end, last = 0;
+
+  *compressed = 0;
+  *content = 0;
+  if (read_frame_header (read, read_data, &hdr, &end))
+    return grub_errno;
+  if (end)
+    return GRUB_ERR_NONE;
+
+  *compressed = hdr.size;
+  if (hdr.skippable)
+    {
+      *compressed += hdr.skip;
+      return skip_input (read, read_data, hdr.skip);
+    }
+
+  *content = hdr.content_size;
+  while (!last)
+    {
+      grub_uint32_t h, size;
+
+      if (read_input (read, read_data, bh, 3))
+	return grub_errno;
+      h = bh[0] | (bh[1] << 8) | (bh[2] << 16);
+      last = h & 1;
+      size = h >> 3;
+      if (((h >> 1) & 3) == BLOCK_RESERVED)
+	return corrupted ();
+      if (((h >> 1) & 3) == BLOCK_RLE)
+	size = 1;
+      if (skip_input (read, read_data, size))
+	return grub_errno;
+      *compressed += 3 + size;
+    }
+  if (hdr.checksum)
+    {
+      if (skip_input (read, read_data, 4))
+	return grub_errno;
+      *compressed += 4;
+    }
+  return GRUB_ERR_NONE;
+}
+
+struct grub_zstd_dec *
+grub_zstd_dec_init (grub_zstd_read_t read, void *read_data)
+{
+  struct grub_zstd_dec *dec;
+
+  dec = grub_zalloc (sizeof (*dec));
+  if (!dec)
+    return NULL;
+  dec->read = read;
+  dec->read_data = read_data;
+  return dec;
+}
+
+void
+grub_zstd_dec_reset (struct grub_zstd_dec *dec)
+{
+  dec->frames_done = 0;
+  dec->at_end = 0;
+  dec->in_frame = 0;
+  dec->win_len = 0;
+  dec->win_pos = 0;
+}
+
+void
+grub_zstd_dec_end (struct grub_zstd_dec *dec)
+{
+  if (!dec)
+    return;
+  grub_free (dec->win);
+  grub_free (dec->in);
+  grub_free (dec->litbuf);
+  grub_free (dec);
+}
+
+/* Return BUF if it holds at least SIZE bytes, else a new buffer.  */
+static void *
+ensure_buffer (void *buf, grub_size_t *alloc, grub_size_t size)
+{
+  if (buf && *alloc >= size)
+    return buf;
+  grub_free (buf);
+  *alloc = size;
+  buf = grub_malloc (size ? : 1);
+  if (!buf)
+    *alloc = 0;
+  return buf;
+}
+
+static grub_err_t
+start_frame (struct grub_zstd_dec *dec)
+{
+  struct frame_header hdr;
+  grub_size_t alloc;
+  int end;
+
+  if (read_frame_header (dec->read, dec->read_data, &hdr, &end))
+    return grub_errno;
+  if (end)
+    {
+      dec->at_end = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (hdr.skippable)
+    return skip_input (dec->read, dec->read_data, hdr.skip);
+
+  dec->window_size = hdr.window_size;
+  dec->block_max = hdr.window_size < ZSTD_BLOCK_MAX
+    ? hdr.window_size : ZSTD_BLOCK_MAX;
+  dec->content_size = hdr.content_size;
+  dec->checksum = hdr.checksum;
+  dec->frame_out = 0;
+  dec->last_block = 0;
+
+  /* A single segment frame is decoded in one piece.  Otherwise keep room
+     for the next block beyond the window.  */
+  alloc = hdr.window_size;
+  if (!hdr.single_segment)
+    alloc += dec->block_max;
+  dec->win = ensure_buffer (dec->win, &dec->win_alloc, alloc);
+  if (!dec->win)
+    return grub_errno;
+  dec->in = ensure_buffer (dec->in, &dec->in_alloc, dec->block_max);
+  if (!dec->in)
+    return grub_errno;
+  dec->litbuf = ensure_buffer (dec->litbuf, &dec->litbuf_alloc,
+			       dec->block_max);
+  if (!dec->litbuf)
+    return grub_errno;
+  dec->win_len = 0;
+  dec->win_pos = 0;
+
+  dec->rep[0] = 1;
+  dec->rep[1] = 4;
+  dec->rep[2] = 8;
+  dec->have_huf = 0;
+  dec->have_ll = dec->have_of = dec->have_ml = 0;
+  if (dec->checksum)
+    xxh64_init (&dec->xxh);
+
+  dec->in_frame = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+end_frame (struct grub_zstd_dec *dec)
+{
+  grub_uint8_t buf[4];
+
+  if (dec->content_size != GRUB_ZSTD_SIZE_UNKNOWN
+      && dec->frame_out != dec->content_size)
+    return corrupted ();
+
+  if (dec->checksum)
+    {
+      if (read_input (dec->read, dec->read_data, buf, 4))
+	return grub_errno;
+      if (grub_le_to_cpu32 (grub_get_unaligned32 (buf))
+	  != (grub_uint32_t) xxh64_digest (&dec->xxh))
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   "zstd checksum mismatch");
+    }
+
+  dec->in_frame = 0;
+  dec->frames_done++;
+  if (dec->single_frame)
+    dec->at_end = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+next_block (struct grub_zstd_dec *dec)
+{
+  grub_uint8_t bh[3];
+  grub_uint32_t h, size;
+  grub_size_t written = 0;
+  char *out;
+
+  if (read_input (dec->read, dec->read_data, bh, 3))
+    return grub_errno;
+  h = bh[0] | (bh[1] << 8) | (bh[2] << 16);
+  size = h >> 3;
+  dec->last_block = h & 1;
+
+  /* Everything before the window has been returned, drop it.  */
+  if (dec->win_alloc - dec->win_len < dec->block_max
+      && dec->win_len > dec->window_size)
+    {
+      grub_memmove (dec->win, dec->win + dec->win_len - dec->window_size,
+		    dec->window_size);
+      dec->win_len = dec->window_size;
+      dec->win_pos = dec->win_len;
+    }
+  out = dec->win + dec->win_len;
+
+  switch ((h >> 1) & 3)
+    {
+    case BLOCK_RAW:
+      if (size > dec->block_max || size > dec->win_alloc - dec->win_len)
+	return corrupted ();
+      if (read_input (dec->read, dec->read_data, out, size))
+	return grub_errno;
+      written = size;
+      break;
+    case BLOCK_RLE:
+      if (size > dec->block_max || size > dec->win_alloc - dec->win_len)
+	return corrupted ();
+      if (read_input (dec->read, dec->read_data, bh, 1))
+	return grub_errno;
+      grub_memset (out, bh[0], size);
+      written = size;
+      break;
+    case BLOCK_COMPRESSED:
+      if (size > dec->block_max)
+	return corrupted ();
+      if (read_input (dec->read, dec->read_data, dec->in, size)
+	  || decode_block (dec, dec->in, size, (grub_uint8_t *) out,
+			   dec->win_alloc - dec->win_len < dec->block_max
+			   ? dec->win_alloc - dec->win_len : dec->block_max,
+			   &written))
+	return grub_errno;
+      break;
+    default:
+      return corrupted ();
+    }
+
+  dec->win_len += written;
+  dec->frame_out += written;
+  if (dec->frame_out > dec->content_size)
+    return corrupted ();
+  if (dec->checksum)
+    xxh64_update (&dec->xxh, (grub_uint8_t *) out, written);
+  return GRUB_ERR_NONE;
+}
+
+grub_ssize_t
+grub_zstd_dec_read (struct grub_zstd_dec *dec, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+
+  while (len)
+    {
+      if (dec->win_pos < dec->win_len)
+	{
+	  grub_size_t n = dec->win_len - dec->win_pos;
+
+	  if (n > len)
+	    n = len;
+	  if (buf)
+	    {
+	      grub_memcpy (buf, dec->win + dec->win_pos, n);
+	      buf += n;
+	    }
+	  dec->win_pos += n;
+	  ret += n;
+	  len -= n;
+	  continue;
+	}
+
+      if (dec->at_end)
+	break;
+
+      if (!dec->in_frame)
+	{
+	  if (start_frame (dec))
+	    return -1;
+	}
+      else if (dec->last_block)
+	{
+	  if (end_frame (dec))
+	    return -1;
+	}
+      else if (next_block (dec))
+	return -1;
+    }
+
+  return ret;
+}
+
+struct mem_input
+{
+  const char *p;
+  grub_size_t left;
+};
+
+static grub_ssize_t
+mem_read (void *data, void *buf, grub_size_t len)
+{
+  struct mem_input *in = data;
+
+  if (len > in->left)
+    len = in->left;
+  if (buf)
+    grub_memcpy (buf, in->p, len);
+  in->p += len;
+  in->left -= len;
+  return len;
+}
+
+grub_ssize_t
+grub_zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		      char *outbuf, grub_size_t outsize)
+{
+  struct mem_input in = { inbuf, insize };
+  struct grub_zstd_dec *dec;
+  grub_ssize_t ret;
+
+  dec = grub_zstd_dec_init (mem_read, &in);
+  if (!dec)
+    return -1;
+  dec->single_frame = 1;
+
+  ret = grub_zstd_dec_read (dec, NULL, off);
+  if (ret >= 0 && (grub_off_t) ret == off)
+    ret = grub_zstd_dec_read (dec, outbuf, outsize);
+  else if (ret >= 0)
+    ret = 0;
+
+  grub_zstd_dec_end (dec);
+  return ret;
+}
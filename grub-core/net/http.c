@@ -26,6 +26,8 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
+#include <grub/loader.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -34,23 +36,89 @@ enum
     HTTP_PORT = 80
   };
 
+/* At most this many idle connections are kept open for later requests
+   to the same server (HTTP/1.1 persistent connections).  */
+#define HTTP_POOL_SIZE 4
 
-typedef struct http_data
+/* With http_parallel above 1 files are fetched as consecutive ranges of
+   this size, that many at a time over separate connections.  */
+#define HTTP_SEGMENT_SIZE (1 << 20)
+#define HTTP_PARALLEL_MAX 8
+/* Read up to this much of an unwanted response to keep its connection.  */
+#define HTTP_DRAIN_SIZE 131072
+
+struct http_req;
+
+struct http_conn
 {
+  struct http_conn *next;
+  char *server;
+  int port;
+  grub_net_tcp_socket_t sock;
+  /* Request whose response arrives here, NULL while in the pool.  */
+  struct http_req *req;
+  /* Taken from the pool rather than opened for this request.  */
+  int reused;
+  /* Closed by the server or after an error.  */
+  int dead;
+};
+
+/* One GET and the state of parsing its response.  */
+typedef struct http_req
+{
+  struct http_req *next;
+  grub_file_t file;
+  struct http_conn *conn;
+  /* Requested range, END is 0 for the rest of the file.  */
+  grub_off_t start;
+  grub_off_t end;
+  /* Body bytes of the response received so far.  */
+  grub_off_t received;
+  /* Body bytes before the requested range, for servers ignoring it.  */
+  grub_off_t skip;
+  /* Nobody wants the body any more.  */
+  int discard;
   char *current_line;
   grub_size_t current_line_len;
   int headers_recv;
   int first_line_recv;
-  int size_recv;
-  grub_net_tcp_socket_t sock;
-  char *filename;
+  int code;
   grub_err_t err;
   char *errmsg;
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  int keep_alive;
+  int have_length;
+  grub_uint64_t length;
+  /* File size from Content-Range, 0 if none.  */
+  grub_uint64_t range_total;
+  int done;
+  /* The connection went away before the response was complete.  */
+  int failed;
+  int retried;
+  /* Headers received, or no point in waiting for them any longer.  */
+  int answered;
+  /* Body received while earlier requests are still being read.  */
+  grub_net_packets_t packs;
+} *http_req_t;
+
+typedef struct http_data
+{
+  char *filename;
+  int size_recv;
+  /* Requests in file order.  The first one feeds the file's packet
+     list.  */
+  http_req_t reqs;
+  /* Start of the next range to request.  */
+  grub_off_t next_start;
+  unsigned parallel;
+  /* A request failed for good; don't go past it.  */
+  int truncated;
 } *http_data_t;
 
+static struct http_conn *http_pool;
+
 static grub_off_t
 have_ahead (struct grub_file *file)
 {
@@ -62,86 +130,367 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+static int
+http_pool_remove (struct http_conn *conn)
+{
+  struct http_conn **prev;
+
+  for (prev = &http_pool; *prev; prev = &(*prev)->next)
+    if (*prev == conn)
+      {
+	*prev = conn->next;
+	conn->next = NULL;
+	return 1;
+      }
+  return 0;
+}
+
+static void
+http_conn_free (struct http_conn *conn)
+{
+  if (!conn->dead)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+/* Detach the connection from REQ, keeping it for later if the response
+   ended cleanly.  */
+static void
+http_conn_release (http_req_t req)
+{
+  struct http_conn *conn = req->conn, *c;
+  unsigned n = 0;
+
+  if (!conn)
+    return;
+  req->conn = NULL;
+  conn->req = NULL;
+
+  for (c = http_pool; c; c = c->next)
+    n++;
+  if (!req->done || req->failed || !req->keep_alive || req->err
+      || conn->dead || n >= HTTP_POOL_SIZE)
+    {
+      http_conn_free (conn);
+      return;
+    }
+
+  grub_net_tcp_unstall (conn->sock);
+  conn->reused = 0;
+  conn->next = http_pool;
+  http_pool = conn;
+}
+
+static void
+http_req_reset (http_req_t req)
+{
+  http_conn_release (req);
+  grub_free (req->current_line);
+  grub_free (req->errmsg);
+  req->current_line = 0;
+  req->current_line_len = 0;
+  req->errmsg = 0;
+  req->headers_recv = 0;
+  req->first_line_recv = 0;
+  req->code = 0;
+  req->err = GRUB_ERR_NONE;
+  req->chunked = 0;
+  req->chunk_rem = 0;
+  req->in_chunk_len = 0;
+  req->keep_alive = 1;
+  req->have_length = 0;
+  req->length = 0;
+  req->range_total = 0;
+  req->received = 0;
+  req->skip = 0;
+  req->discard = 0;
+  req->done = 0;
+  req->failed = 0;
+  req->answered = 0;
+}
+
+static void
+http_req_free (http_req_t req)
+{
+  http_req_reset (req);
+  while (req->packs.first)
+    {
+      grub_netbuff_free (req->packs.first->nb);
+      grub_net_remove_packet (req->packs.first);
+    }
+  grub_free (req);
+}
+
+/* Read the rest of REQ's response if that's cheaper than opening a new
+   connection later.  */
+static void
+http_drain (http_req_t req)
+{
+  int i;
+
+  if (!req->conn || req->conn->dead || req->done || req->failed || req->err
+      || !req->headers_recv || !req->keep_alive || !req->have_length
+      || req->length - req->received > HTTP_DRAIN_SIZE)
+    return;
+
+  req->discard = 1;
+  grub_net_tcp_unstall (req->conn->sock);
+  for (i = 0; !req->done && !req->failed && i < 2; i++)
+    {
+      grub_net_tcp_retransmit ();
+      grub_net_poll_cards (GRUB_NET_INTERVAL, &req->done);
+    }
+}
+
+static void
+http_free_reqs (http_data_t data)
+{
+  http_req_t req, next;
+
+  for (req = data->reqs; req; req = next)
+    {
+      next = req->next;
+      http_drain (req);
+      http_req_free (req);
+    }
+  data->reqs = 0;
+}
+
+static http_req_t
+http_req_new (struct grub_file *file, grub_off_t start)
+{
+  http_data_t data = file->data;
+  http_req_t req;
+
+  req = grub_zalloc (sizeof (*req));
+  if (!req)
+    return NULL;
+  req->file = file;
+  req->start = start;
+  req->keep_alive = 1;
+  if (data->parallel > 1)
+    {
+      req->end = start + HTTP_SEGMENT_SIZE;
+      if (file->size != GRUB_FILE_SIZE_UNKNOWN && req->end > file->size)
+	req->end = file->size;
+      data->next_start = req->end;
+    }
+  return req;
+}
+
+/* REQ has all of its response.  */
+static void
+http_req_done (http_req_t req)
+{
+  grub_file_t file = req->file;
+  http_data_t data = file->data;
+
+  req->done = 1;
+  req->answered = 1;
+  if (req != data->reqs)
+    return;
+
+  /* Let the reader move on to the next request.  */
+  file->device->net->stall = 1;
+  if (!req->next && (data->truncated || !req->end || req->end >= file->size
+		     || req->received < req->end - req->start))
+    {
+      file->device->net->eof = 1;
+      if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+	file->size = have_ahead (file);
+    }
+}
+
+/* Queue body data NB of REQ for the reader.  */
+static void
+http_deliver (http_req_t req, struct grub_net_buff *nb)
+{
+  grub_file_t file = req->file;
+  http_data_t data = file->data;
+  grub_size_t len = nb->tail - nb->data;
+
+  if (req->have_length && len > req->length - req->received)
+    {
+      len = req->length - req->received;
+      grub_netbuff_unput (nb, nb->tail - nb->data - len);
+    }
+  req->received += len;
+
+  if (req->skip && len)
+    {
+      grub_size_t n = len;
+      if (n > req->skip)
+	n = req->skip;
+      grub_netbuff_pull (nb, n);
+      req->skip -= n;
+      len -= n;
+    }
+
+  if (!len || req->discard)
+    grub_netbuff_free (nb);
+  else if (req == data->reqs)
+    {
+      if (grub_net_put_packet (&file->device->net->packs, nb))
+	grub_netbuff_free (nb);
+      if (file->device->net->packs.count >= 20)
+	file->device->net->stall = 1;
+
+      if (file->device->net->packs.count >= 100)
+	grub_net_tcp_stall (req->conn->sock);
+    }
+  else if (grub_net_put_packet (&req->packs, nb))
+    grub_netbuff_free (nb);
+
+  if (req->have_length && req->received == req->length)
+    http_req_done (req);
+}
+
+/* REQ won't get the rest of its response.  */
+static void
+http_req_fail (http_req_t req)
+{
+  req->failed = 1;
+  req->answered = 1;
+  if (req == ((http_data_t) req->file->data)->reqs)
+    req->file->device->net->stall = 1;
+}
+
+static void
+http_headers_done (grub_file_t file, http_req_t req)
+{
+  http_data_t data = file->data;
+
+  req->answered = 1;
+  if (req->err)
+    return;
+
+  /* Whole file in one response.  Without range support, skip to where
+     we wanted to be.  */
+  if (req->code == 200)
+    {
+      req->skip = req->start;
+      req->start = 0;
+      req->end = 0;
+      data->parallel = 1;
+    }
+
+  if (!data->size_recv)
+    {
+      if (req->code == 206 && req->range_total)
+	{
+	  file->size = req->range_total;
+	  data->size_recv = 1;
+	}
+      else if (req->code == 200 && req->have_length)
+	{
+	  file->size = req->length;
+	  data->size_recv = 1;
+	}
+    }
+  if (req->end && file->size != GRUB_FILE_SIZE_UNKNOWN
+      && req->end > file->size)
+    req->end = data->next_start = file->size;
+
+  /* We don't parse chunk trailers and a body without length ends with
+     the connection: neither can be followed by another response.  */
+  if (req->chunked || !req->have_length)
+    req->keep_alive = 0;
+  if (req->have_length && !req->length)
+    http_req_done (req);
+}
+
 static grub_err_t
-parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
+parse_line (grub_file_t file, http_req_t req, char *ptr, grub_size_t len)
 {
   char *end = ptr + len;
   while (end > ptr && *(end - 1) == '\r')
     end--;
   *end = 0;
   /* Trailing CRLF.  */
-  if (data->in_chunk_len == 1)
+  if (req->in_chunk_len == 1)
     {
-      data->in_chunk_len = 2;
+      req->in_chunk_len = 2;
       return GRUB_ERR_NONE;
     }
-  if (data->in_chunk_len == 2)
+  if (req->in_chunk_len == 2)
     {
-      data->chunk_rem = grub_strtoul (ptr, 0, 16);
+      req->chunk_rem = grub_strtoul (ptr, 0, 16);
       grub_errno = GRUB_ERR_NONE;
-      if (data->chunk_rem == 0)
-	{
-	  file->device->net->eof = 1;
-	  file->device->net->stall = 1;
-	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-	    file->size = have_ahead (file);
-	}
-      data->in_chunk_len = 0;
+      if (req->chunk_rem == 0)
+	http_req_done (req);
+      req->in_chunk_len = 0;
       return GRUB_ERR_NONE;
     }
   if (ptr == end)
     {
-      data->headers_recv = 1;
-      if (data->chunked)
-	data->in_chunk_len = 2;
+      req->headers_recv = 1;
+      if (req->chunked)
+	req->in_chunk_len = 2;
+      http_headers_done (file, req);
       return GRUB_ERR_NONE;
     }
 
-  if (!data->first_line_recv)
+  if (!req->first_line_recv)
     {
-      int code;
+      req->first_line_recv = 1;
       if (grub_memcmp (ptr, "HTTP/1.1 ", sizeof ("HTTP/1.1 ") - 1) != 0)
 	{
-	  data->errmsg = grub_strdup (_("unsupported HTTP response"));
-	  data->first_line_recv = 1;
+	  req->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+	  req->errmsg = grub_strdup (_("unsupported HTTP response"));
 	  return GRUB_ERR_NONE;
 	}
       ptr += sizeof ("HTTP/1.1 ") - 1;
-      code = grub_strtoul (ptr, &ptr, 10);
+      req->code = grub_strtoul (ptr, &ptr, 10);
       if (grub_errno)
 	return grub_errno;
-      switch (code)
+      switch (req->code)
 	{
 	case 200:
 	case 206:
 	  break;
 	case 404:
-	  data->err = GRUB_ERR_FILE_NOT_FOUND;
-	  data->errmsg = grub_xasprintf (_("file `%s' not found"), data->filename);
+	  req->err = GRUB_ERR_FILE_NOT_FOUND;
+	  req->errmsg = grub_xasprintf (_("file `%s' not found"),
+					((http_data_t) file->data)->filename);
 	  return GRUB_ERR_NONE;
 	default:
-	  data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+	  req->err = GRUB_ERR_NET_UNKNOWN_ERROR;
 	  /* TRANSLATORS: GRUB HTTP code is pretty young. So even perfectly
 	     valid answers like 403 will trigger this very generic message.  */
-	  data->errmsg = grub_xasprintf (_("unsupported HTTP error %d: %s"),
-					 code, ptr);
+	  req->errmsg = grub_xasprintf (_("unsupported HTTP error %d: %s"),
+					req->code, ptr);
 	  return GRUB_ERR_NONE;
 	}
-      data->first_line_recv = 1;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, &ptr, 10);
-      data->size_recv = 1;
+      req->length = grub_strtoull (ptr, &ptr, 10);
+      req->have_length = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Content-Range: bytes ",
+		   sizeof ("Content-Range: bytes ") - 1) == 0)
+    {
+      ptr = grub_strchr (ptr, '/');
+      if (ptr && ptr[1] != '*')
+	req->range_total = grub_strtoull (ptr + 1, 0, 10);
+      grub_errno = GRUB_ERR_NONE;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
 		   sizeof ("Transfer-Encoding: chunked") - 1) == 0)
     {
-      data->chunked = 1;
+      req->chunked = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Connection: close",
+		   sizeof ("Connection: close") - 1) == 0)
+    {
+      req->keep_alive = 0;
       return GRUB_ERR_NONE;
     }
 
@@ -150,42 +499,65 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_req_t req = conn->req;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  data->sock = 0;
-  if (data->current_line)
-    grub_free (data->current_line);
-  data->current_line = 0;
-  file->device->net->eof = 1;
-  file->device->net->stall = 1;
-  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = have_ahead (file);
+  if (!conn->dead)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  conn->dead = 1;
+
+  /* Server closed an idle connection.  */
+  if (!req)
+    {
+      if (http_pool_remove (conn))
+	http_conn_free (conn);
+      return;
+    }
+
+  if (req->current_line)
+    grub_free (req->current_line);
+  req->current_line = 0;
+  req->current_line_len = 0;
+  if (req->done)
+    return;
+
+  /* Without a length the body ends with the connection.  */
+  if (req->headers_recv && !req->have_length && !req->chunked)
+    {
+      http_req_done (req);
+      return;
+    }
+  http_req_fail (req);
 }
 
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_req_t req = conn->req;
+  grub_file_t file;
   grub_err_t err;
 
-  if (!data->sock)
+  if (!req || req->done || req->failed)
     {
+      /* Nothing should arrive here; don't reuse the connection.  */
+      if (req)
+	req->keep_alive = 0;
+      else if (http_pool_remove (conn))
+	http_conn_free (conn);
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     }
+  file = req->file;
 
   while (1)
     {
       char *ptr = (char *) nb->data;
-      if ((!data->headers_recv || data->in_chunk_len) && data->current_line)
+      if ((!req->headers_recv || req->in_chunk_len) && req->current_line)
 	{
 	  int have_line = 1;
 	  char *t;
@@ -197,67 +569,78 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      have_line = 0;
 	      ptr = (char *) nb->tail;
 	    }
-	  t = grub_realloc (data->current_line,
-			    data->current_line_len + (ptr - (char *) nb->data));
+	  t = grub_realloc (req->current_line,
+			    req->current_line_len + (ptr - (char *) nb->data));
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      http_err (sock, conn);
 	      return grub_errno;
 	    }
 	      
-	  data->current_line = t;
-	  grub_memcpy (data->current_line + data->current_line_len,
+	  req->current_line = t;
+	  grub_memcpy (req->current_line + req->current_line_len,
 		       nb->data, ptr - (char *) nb->data);
-	  data->current_line_len += ptr - (char *) nb->data;
+	  req->current_line_len += ptr - (char *) nb->data;
 	  if (!have_line)
 	    {
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
 	    }
-	  err = parse_line (file, data, data->current_line,
-			    data->current_line_len);
-	  grub_free (data->current_line);
-	  data->current_line = 0;
-	  data->current_line_len = 0;
+	  err = parse_line (file, req, req->current_line,
+			    req->current_line_len);
+	  grub_free (req->current_line);
+	  req->current_line = 0;
+	  req->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
 	      grub_netbuff_free (nb);
+	      http_err (sock, conn);
 	      return err;
 	    }
 	}
 
-      while (ptr < (char *) nb->tail && (!data->headers_recv
-					 || data->in_chunk_len))
+      while (ptr < (char *) nb->tail && (!req->headers_recv
+					 || req->in_chunk_len))
 	{
 	  char *ptr2;
 	  ptr2 = grub_memchr (ptr, '\n', (char *) nb->tail - ptr);
 	  if (!ptr2)
 	    {
-	      data->current_line = grub_malloc ((char *) nb->tail - ptr);
-	      if (!data->current_line)
+	      req->current_line = grub_malloc ((char *) nb->tail - ptr);
+	      if (!req->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  http_err (sock, conn);
 		  return grub_errno;
 		}
-	      data->current_line_len = (char *) nb->tail - ptr;
-	      grub_memcpy (data->current_line, ptr, data->current_line_len);
+	      req->current_line_len = (char *) nb->tail - ptr;
+	      grub_memcpy (req->current_line, ptr, req->current_line_len);
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
 	    }
-	  err = parse_line (file, data, ptr, ptr2 - ptr);
+	  err = parse_line (file, req, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
 	      grub_netbuff_free (nb);
+	      http_err (sock, conn);
 	      return err;
 	    }
 	  ptr = ptr2 + 1;
 	}
 
-      if (((char *) nb->tail - ptr) <= 0)
+      /* The body of an error response is of no use to us.  */
+      if (req->err)
+	{
+	  grub_netbuff_free (nb);
+	  grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+	  conn->dead = 1;
+	  req->retried = 1;
+	  http_req_fail (req);
+	  return GRUB_ERR_NONE;
+	}
+
+      if (((char *) nb->tail - ptr) <= 0 || req->done)
 	{
 	  grub_netbuff_free (nb);
 	  return GRUB_ERR_NONE;
@@ -265,51 +648,102 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
 	  grub_netbuff_free (nb);
+	  http_err (sock, conn);
 	  return err;
 	}
-      if (!(data->chunked && (grub_ssize_t) data->chunk_rem
+      if (!(req->chunked && (grub_ssize_t) req->chunk_rem
 	    < nb->tail - nb->data))
 	{
-	  grub_net_put_packet (&file->device->net->packs, nb);
-	  if (file->device->net->packs.count >= 20)
-	    file->device->net->stall = 1;
-
-	  if (file->device->net->packs.count >= 100)
-	    grub_net_tcp_stall (data->sock);
-
-	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
+	  if (req->chunked)
+	    req->chunk_rem -= nb->tail - nb->data;
+	  http_deliver (req, nb);
 	  return GRUB_ERR_NONE;
 	}
-      if (data->chunk_rem)
+      if (req->chunk_rem)
 	{
 	  struct grub_net_buff *nb2;
-	  nb2 = grub_netbuff_alloc (data->chunk_rem);
+	  nb2 = grub_netbuff_alloc (req->chunk_rem);
 	  if (!nb2)
 	    return grub_errno;
-	  grub_netbuff_put (nb2, data->chunk_rem);
-	  grub_memcpy (nb2->data, nb->data, data->chunk_rem);
-	  if (file->device->net->packs.count >= 20)
-	    {
-	      file->device->net->stall = 1;
-	      grub_net_tcp_stall (data->sock);
-	    }
-
-	  grub_net_put_packet (&file->device->net->packs, nb2);
-	  grub_netbuff_pull (nb, data->chunk_rem);
+	  grub_netbuff_put (nb2, req->chunk_rem);
+	  grub_memcpy (nb2->data, nb->data, req->chunk_rem);
+	  http_deliver (req, nb2);
+	  grub_netbuff_pull (nb, req->chunk_rem);
 	}
-      data->in_chunk_len = 1;
+      req->in_chunk_len = 1;
     }
 }
 
+/* Return the interface a new connection to SERVER would go through, or
+   NULL if there is none.  */
+static struct grub_net_network_level_interface *
+http_route (const char *server)
+{
+  grub_net_network_level_address_t addr, gateway;
+  struct grub_net_network_level_interface *inf;
+
+  if (grub_net_resolve_address (server, &addr)
+      || grub_net_route_address (addr, &gateway, &inf))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  return inf;
+}
+
+static struct http_conn *
+http_conn_get (char *server, int port)
+{
+  struct http_conn *conn;
+  struct grub_net_network_level_interface *inf = NULL;
+  int routed = 0;
+
+  for (conn = http_pool; conn; conn = conn->next)
+    if (conn->port == port && grub_strcmp (conn->server, server) == 0)
+      {
+	/* The routes may have changed since it was opened.  */
+	if (!routed)
+	  {
+	    inf = http_route (server);
+	    routed = 1;
+	  }
+	if (grub_net_tcp_socket_interface (conn->sock) != inf)
+	  continue;
+	http_pool_remove (conn);
+	conn->reused = 1;
+	return conn;
+      }
+
+  conn = grub_zalloc (sizeof (*conn));
+  if (!conn)
+    return NULL;
+  conn->port = port;
+  conn->server = grub_strdup (server);
+  if (!conn->server)
+    {
+      grub_free (conn);
+      return NULL;
+    }
+
+  grub_dprintf ("http", "connecting to host %s TCP port %d\n",
+		server, port);
+  conn->sock = grub_net_tcp_open (conn->server, port, http_receive,
+				  http_err, http_err, conn);
+  if (!conn->sock)
+    {
+      grub_free (conn->server);
+      grub_free (conn);
+      return NULL;
+    }
+  return conn;
+}
+
 static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+http_send_request (struct grub_file *file, http_req_t req)
 {
   http_data_t data = file->data;
   grub_uint8_t *ptr;
-  int i;
   struct grub_net_buff *nb;
   grub_err_t err;
   char* server = file->device->net->server;
@@ -323,7 +757,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
 				     "\r\n") - 1
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
+				     "-XXXXXXXXXXXXXXXXXXXX\r\n\r\n"));
   if (!nb)
     return grub_errno;
 
@@ -374,6 +808,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 	  sizeof (":XXXXXXXXXX"),
 	  ":%d",
 	  port);
+      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
     }
 
   ptr = nb->tail;
@@ -387,14 +822,24 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
     }
   grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
 	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
+  if (req->end)
+    {
+      ptr = nb->tail;
+      grub_snprintf ((char *) ptr,
+		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			     "XXXXXXXXXXXXXXXXXXXX\r\n"),
+		     "Range: bytes=%" PRIuGRUB_UINT64_T "-%" PRIuGRUB_UINT64_T
+		     "\r\n", req->start, req->end - 1);
+      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
+    }
+  else if (req->start)
     {
       ptr = nb->tail;
       grub_snprintf ((char *) ptr,
 		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
 			     "\r\n"),
 		     "Range: bytes=%" PRIuGRUB_UINT64_T "-\r\n",
-		     offset);
+		     req->start);
       grub_netbuff_put (nb, grub_strlen ((char *) ptr));
     }
   ptr = nb->tail;
@@ -403,57 +848,189 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 
   grub_dprintf ("http", "opening path %s on host %s TCP port %d\n",
 		data->filename, server, port ? port : HTTP_PORT);
-  data->sock = grub_net_tcp_open (server,
-				  port ? port : HTTP_PORT, http_receive,
-				  http_err, http_err,
-				  file);
-  if (!data->sock)
+  req->conn = http_conn_get (server, port ? port : HTTP_PORT);
+  if (!req->conn)
     {
       grub_netbuff_free (nb);
       return grub_errno;
     }
+  req->conn->req = req;
 
-  //  grub_net_poll_cards (5000);
-
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
+  err = grub_net_send_tcp_packet (req->conn->sock, nb, 1);
   if (err)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      grub_netbuff_free (nb);
+      http_conn_release (req);
       return err;
     }
+  return GRUB_ERR_NONE;
+}
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
+/* Send REQ and wait for the response headers.  */
+static grub_err_t
+http_establish (struct grub_file *file, http_req_t req)
+{
+  grub_err_t err;
+  int i;
+
+  while (1)
     {
-      grub_net_tcp_retransmit ();
-      grub_net_poll_cards (300, &data->headers_recv);
+      err = http_send_request (file, req);
+      if (err)
+	return err;
+
+      for (i = 0; !req->answered && i < 100; i++)
+	{
+	  grub_net_tcp_retransmit ();
+	  grub_net_poll_cards (300, &req->answered);
+	}
+
+      /* The server closed the pooled connection before we used it.  */
+      if (req->failed && !req->headers_recv && req->conn->reused
+	  && !req->retried)
+	{
+	  http_req_reset (req);
+	  req->retried = 1;
+	  continue;
+	}
+      break;
+    }
+
+  if (req->err)
+    {
+      char *str = req->errmsg;
+      err = grub_error (req->err, "%s", str);
+      grub_free (str);
+      req->errmsg = 0;
+      return err;
     }
+  if (!req->headers_recv)
+    return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"),
+		       ((http_data_t) file->data)->filename);
+  return GRUB_ERR_NONE;
+}
+
+/* REQ can't be completed; the file ends where its data does.  */
+static void
+http_truncate (struct grub_file *file, http_req_t req)
+{
+  http_data_t data = file->data;
+  http_req_t next;
 
-  if (!data->headers_recv)
+  data->truncated = 1;
+  for (; req->next; req->next = next)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      if (data->err)
+      next = req->next->next;
+      http_req_free (req->next);
+    }
+  req->failed = 0;
+  http_req_done (req);
+}
+
+/* Start the next request once the first one has all of its data, retry
+   failed ones and keep up to DATA->PARALLEL requests going.  This may
+   open connections, so it's called from outside the receive path.  */
+static void
+http_advance (struct grub_file *file)
+{
+  http_data_t data = file->data;
+  http_req_t req, *last;
+  unsigned n, limit;
+
+  while ((req = data->reqs) && req->done && req->next)
+    {
+      data->reqs = req->next;
+      http_req_free (req);
+      req = data->reqs;
+      while (req->packs.first)
 	{
-	  char *str = data->errmsg;
-	  err = grub_error (data->err, "%s", str);
-	  grub_free (str);
-	  data->errmsg = 0;
-	  return data->err;
+	  struct grub_net_buff *nb = req->packs.first->nb;
+	  grub_net_remove_packet (req->packs.first);
+	  if (grub_net_put_packet (&file->device->net->packs, nb))
+	    grub_netbuff_free (nb);
 	}
-      return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
+      if (req->done)
+	http_req_done (req);
     }
-  return GRUB_ERR_NONE;
+
+  for (req = data->reqs; req; req = req->next)
+    {
+      if (!req->failed)
+	continue;
+      /* Give up on a request only once it stops making progress.  */
+      if (req->received && req->have_length)
+	req->retried = 0;
+      if (req->retried || (req->headers_recv && !req->have_length))
+	{
+	  http_truncate (file, req);
+	  break;
+	}
+      req->start += req->received;
+      http_req_reset (req);
+      req->retried = 1;
+      if (http_send_request (file, req))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  http_truncate (file, req);
+	  break;
+	}
+    }
+
+  if (data->parallel <= 1 || data->truncated || file->device->net->eof)
+    return;
+
+  /* Without the file size only ask for the next range once the current
+     one turned out to be complete.  */
+  limit = data->parallel;
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    limit = 1;
+  n = 0;
+  for (last = &data->reqs; *last; last = &(*last)->next)
+    if (limit > 1 || !(*last)->done)
+      n++;
+  while (n < limit && data->next_start < file->size)
+    {
+      req = http_req_new (file, data->next_start);
+      if (!req)
+	break;
+      if (http_send_request (file, req))
+	{
+	  data->next_start = req->start;
+	  http_req_free (req);
+	  break;
+	}
+      *last = req;
+      last = &req->next;
+      n++;
+    }
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static unsigned
+http_parallel (void)
+{
+  const char *val = grub_env_get ("http_parallel");
+  unsigned long n;
+
+  if (!val)
+    return 1;
+  n = grub_strtoul (val, 0, 0);
+  grub_errno = GRUB_ERR_NONE;
+  if (n < 1)
+    return 1;
+  if (n > HTTP_PARALLEL_MAX)
+    return HTTP_PARALLEL_MAX;
+  return n;
 }
 
 static grub_err_t
 http_seek (struct grub_file *file, grub_off_t off)
 {
-  struct http_data *old_data, *data;
+  http_data_t data = file->data;
   grub_err_t err;
-  old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+
+  /* Connections which have their whole response go back to the pool.  */
+  http_free_reqs (data);
 
   while (file->device->net->packs.first)
     {
@@ -464,28 +1041,16 @@ http_seek (struct grub_file *file, grub_off_t off)
   file->device->net->stall = 0;
   file->device->net->eof = 0;
   file->device->net->offset = off;
+  data->truncated = 0;
 
-  data = grub_zalloc (sizeof (*data));
-  if (!data)
+  data->reqs = http_req_new (file, off);
+  if (!data->reqs)
     return grub_errno;
 
-  data->size_recv = 1;
-  data->filename = old_data->filename;
-  if (!data->filename)
-    {
-      grub_free (data);
-      file->data = 0;
-      return grub_errno;
-    }
-  grub_free (old_data);
-
-  file->data = data;
-  err = http_establish (file, off, 0);
+  err = http_establish (file, data->reqs);
   if (err)
     {
-      grub_free (data->filename);
-      grub_free (data);
-      file->data = 0;
+      http_free_reqs (data);
       return err;
     }
   return GRUB_ERR_NONE;
@@ -508,13 +1073,19 @@ http_open (struct grub_file *file, const char *filename)
       grub_free (data);
       return grub_errno;
     }
+  data->parallel = http_parallel ();
 
   file->not_easily_seekable = 0;
   file->data = data;
 
-  err = http_establish (file, 0, 1);
+  data->reqs = http_req_new (file, 0);
+  if (!data->reqs)
+    err = grub_errno;
+  else
+    err = http_establish (file, data->reqs);
   if (err)
     {
+      http_free_reqs (data);
       grub_free (data->filename);
       grub_free (data);
       return err;
@@ -531,10 +1102,7 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  if (data->current_line)
-    grub_free (data->current_line);
+  http_free_reqs (data);
   grub_free (data->filename);
   grub_free (data);
   return GRUB_ERR_NONE;
@@ -545,13 +1113,18 @@ http_packets_pulled (struct grub_file *file)
 {
   http_data_t data = file->data;
 
+  if (!data)
+    return 0;
+
+  http_advance (file);
+
   if (file->device->net->packs.count >= 20)
     return 0;
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data && data->sock)
-    grub_net_tcp_unstall (data->sock);
+  if (data->reqs && data->reqs->conn && !data->reqs->conn->dead)
+    grub_net_tcp_unstall (data->reqs->conn->sock);
   return 0;
 }
 
@@ -564,12 +1137,45 @@ static struct grub_net_app_protocol grub_http_protocol =
     .packets_pulled = http_packets_pulled
   };
 
+static void
+http_pool_flush (void)
+{
+  struct http_conn *conn;
+
+  while ((conn = http_pool))
+    {
+      http_pool = conn->next;
+      http_conn_free (conn);
+    }
+}
+
+/* Don't leave idle connections open to the booted system.  */
+static grub_err_t
+http_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  http_pool_flush ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+http_restore_hw (void)
+{
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_preboot *fini_hnd;
+
 GRUB_MOD_INIT (http)
 {
   grub_net_app_level_register (&grub_http_protocol);
+  fini_hnd = grub_loader_register_preboot_hook (http_fini_hw,
+						http_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
 }
 
 GRUB_MOD_FINI (http)
 {
   grub_net_app_level_unregister (&grub_http_protocol);
+  http_pool_flush ();
+  grub_loader_unregister_preboot_hook (fini_hnd);
 }
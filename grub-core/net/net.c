@@ -1700,6 +1700,11 @@ grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
 	    {
 	      if (net->protocol->packets_pulled)
 		net->protocol->packets_pulled (file);
+	      /* Served from the queue without waiting.  Still let the cards
+		 take in and acknowledge what has arrived meanwhile, so that
+		 the sender doesn't stall while the reader above us (bufio,
+		 a decompressor) works through this data.  */
+	      grub_net_poll_cards_idle_real ();
 	      return total;
 	    }
 	}
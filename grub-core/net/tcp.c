@@ -28,6 +28,24 @@
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* The receive window takes at most 1/TCP_WINDOW_HEAP_SHARE of the free
+   heap, within these bounds.  */
+#define TCP_MIN_WINDOW 8192
+#define TCP_MAX_WINDOW (4 << 20)
+#define TCP_WINDOW_HEAP_SHARE 8
+#define TCP_MAX_WINDOW_SHIFT 14
+
+/* The segment size to assume without a usable MTU (RFC 1122).  */
+#define TCP_DEFAULT_MSS 536
+
+/* Full-sized segments are acknowledged every second one (RFC 1122), or
+   after this many milliseconds if no second one comes.  */
+#define TCP_DELAYED_ACK_SEGMENTS 2
+#define TCP_DELAYED_ACK_TIMEOUT 40
+
+/* MSS and window scale options sent with SYN, padded with NOPs.  */
+#define TCP_SYN_OPTIONS_SIZE 8
+
 struct unacked
 {
   struct unacked *next;
@@ -47,6 +65,14 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_EOL = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_MSS = 2,
+    TCP_OPT_WINDOW_SCALE = 3
+  };
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +91,15 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  grub_uint32_t my_window;
+  /* Shift applied to my_window in every segment but SYN (RFC 7323);
+     zero unless the peer has agreed to window scaling.  */
+  int my_window_shift;
+  int window_scaling;
+  grub_uint16_t mss;
+  /* Received segments not acknowledged yet and when we must do it.  */
+  unsigned ack_delayed;
+  grub_uint64_t ack_deadline;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -182,6 +216,111 @@ error (grub_net_tcp_socket_t sock)
   sock->unack_last = NULL;
 }
 
+/* Window to advertise: as much as we may take from the free heap.  */
+static grub_uint32_t
+tcp_receive_window (void)
+{
+  grub_size_t avail;
+
+  avail = grub_mm_free_bytes () / TCP_WINDOW_HEAP_SHARE;
+  if (avail < TCP_MIN_WINDOW)
+    return TCP_MIN_WINDOW;
+  if (avail > TCP_MAX_WINDOW)
+    return TCP_MAX_WINDOW;
+  return avail;
+}
+
+static void
+tcp_init_window (grub_net_tcp_socket_t sock)
+{
+  grub_size_t hdr;
+
+  sock->my_window = tcp_receive_window ();
+  sock->my_window_shift = 0;
+  while ((sock->my_window >> sock->my_window_shift) > 0xffff
+	 && sock->my_window_shift < TCP_MAX_WINDOW_SHIFT)
+    sock->my_window_shift++;
+
+  if (sock->out_nla.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    hdr = GRUB_NET_OUR_IPV4_HEADER_SIZE + sizeof (struct tcphdr);
+  else
+    hdr = GRUB_NET_OUR_IPV6_HEADER_SIZE + sizeof (struct tcphdr);
+
+  if (sock->inf->card->mtu < hdr + TCP_DEFAULT_MSS)
+    sock->mss = TCP_DEFAULT_MSS;
+  else
+    sock->mss = sock->inf->card->mtu - hdr;
+}
+
+/* Without the peer's consent the window can't be scaled and has to fit in
+   the 16-bit header field.  */
+static void
+tcp_disable_window_scaling (grub_net_tcp_socket_t sock)
+{
+  sock->window_scaling = 0;
+  sock->my_window_shift = 0;
+  if (sock->my_window > 0xffff)
+    sock->my_window = 0xffff;
+}
+
+static inline grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  if (sock->i_stall)
+    return 0;
+  return grub_cpu_to_be16 (sock->my_window >> sock->my_window_shift);
+}
+
+/* Window field of SYN segments, which is never scaled.  */
+static inline grub_uint16_t
+tcp_syn_window (grub_net_tcp_socket_t sock)
+{
+  return grub_cpu_to_be16 (sock->my_window > 0xffff ? 0xffff
+			   : sock->my_window);
+}
+
+static void
+tcp_put_syn_options (grub_net_tcp_socket_t sock, grub_uint8_t *opt)
+{
+  opt[0] = TCP_OPT_MSS;
+  opt[1] = 4;
+  opt[2] = sock->mss >> 8;
+  opt[3] = sock->mss & 0xff;
+  if (sock->window_scaling)
+    {
+      opt[4] = TCP_OPT_NOP;
+      opt[5] = TCP_OPT_WINDOW_SCALE;
+      opt[6] = 3;
+      opt[7] = sock->my_window_shift;
+    }
+  else
+    grub_memset (opt + 4, TCP_OPT_NOP, 4);
+}
+
+/* Whether the SYN segment NB carries the window scale option.  */
+static int
+tcp_syn_has_window_scale (struct grub_net_buff *nb)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+  grub_uint8_t *opt = (grub_uint8_t *) (tcph + 1);
+  grub_uint8_t *end = nb->data + (grub_be_to_cpu16 (tcph->flags) >> 12) * 4;
+
+  while (opt < end && *opt != TCP_OPT_EOL)
+    {
+      if (*opt == TCP_OPT_NOP)
+	{
+	  opt++;
+	  continue;
+	}
+      if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+	break;
+      if (opt[0] == TCP_OPT_WINDOW_SCALE && opt[1] == 3)
+	return 1;
+      opt += opt[1];
+    }
+  return 0;
+}
+
 static grub_err_t
 tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
 {
@@ -198,6 +337,9 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
   if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
     size++;
   socket->my_cur_seq += size;
+  /* Any ACK we send covers everything received so far.  */
+  if (grub_be_to_cpu16 (tcph->flags) & TCP_ACK)
+    socket->ack_delayed = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
   tcph->checksum = 0;
@@ -332,8 +474,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
       tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->window = tcp_window (sock);
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -368,6 +509,10 @@ grub_net_tcp_retransmit (void)
   FOR_TCP_SOCKETS (sock)
   {
     struct unacked *unack;
+
+    if (sock->ack_delayed && ctime >= sock->ack_deadline)
+      ack (sock);
+
     for (unack = sock->unack_first; unack; unack = unack->next)
       {
 	struct tcphdr *tcph;
@@ -410,6 +555,33 @@ grub_net_tcp_retransmit (void)
   }
 }
 
+/* INF is going away.  Fail the sockets using it and forget them, so that
+   nothing sends through it any more.  */
+void
+grub_net_tcp_drop_interface (struct grub_net_network_level_interface *inf)
+{
+  grub_net_tcp_socket_t sock, next;
+
+  for (sock = tcp_sockets; sock; sock = next)
+    {
+      next = sock->next;
+      if (sock->inf != inf)
+	continue;
+      sock->i_closed = 1;
+      sock->they_reseted = 1;
+      sock->ack_delayed = 0;
+      error (sock);
+      grub_list_remove (GRUB_AS_LIST (sock));
+      sock->inf = NULL;
+    }
+}
+
+struct grub_net_network_level_interface *
+grub_net_tcp_socket_interface (grub_net_tcp_socket_t sock)
+{
+  return sock->inf;
+}
+
 grub_uint16_t
 grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 				grub_uint16_t proto,
@@ -527,7 +699,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
       return err;
     }
 
-  err = grub_netbuff_put (nb_ack, sizeof (*tcph));
+  err = grub_netbuff_put (nb_ack, sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE);
   if (err)
     {
       grub_netbuff_free (nb_ack);
@@ -535,8 +707,9 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
     }
   tcph = (void *) nb_ack->data;
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  tcph->flags = grub_cpu_to_be16_compile_time ((7 << 12) | TCP_SYN | TCP_ACK);
+  tcph->window = tcp_syn_window (sock);
+  tcp_put_syn_options (sock, (grub_uint8_t *) (tcph + 1));
   tcph->urgent = 0;
   sock->established = 1;
   tcp_socket_register (sock);
@@ -604,7 +777,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE + 128);
   if (!nb)
     {
       grub_free (socket);
@@ -619,7 +792,7 @@ grub_net_tcp_open (char *server,
       return NULL;
     }
 
-  err = grub_netbuff_put (nb, sizeof (*tcph));
+  err = grub_netbuff_put (nb, sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE);
   if (err)
     {
       grub_free (socket);
@@ -637,12 +810,14 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
+  tcp_init_window (socket);
+  socket->window_scaling = 1;
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->flags = grub_cpu_to_be16_compile_time ((7 << 12) | TCP_SYN);
+  tcph->window = tcp_syn_window (socket);
   tcph->urgent = 0;
+  tcp_put_syn_options (socket, (grub_uint8_t *) (tcph + 1));
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
   tcph->checksum = 0;
@@ -727,8 +902,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = tcp_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -751,7 +925,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = tcp_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -823,6 +997,8 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->established = 1;
+	if (!tcp_syn_has_window_scale (nb))
+	  tcp_disable_window_scaling (sock);
       }
 
     if (grub_be_to_cpu16 (tcph->flags) & TCP_RST)
@@ -886,6 +1062,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
     {
       struct grub_net_buff **nb_top_p, *nb_top;
       int do_ack = 0;
+      int ack_now = 0;
       int just_closed = 0;
       while (1)
 	{
@@ -931,18 +1108,30 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	      just_closed = 1;
 	      sock->their_cur_seq++;
 	      do_ack = 1;
+	      ack_now = 1;
 	    }
 	  /* If there is data, puts packet in socket list. */
 	  if ((nb_top->tail - nb_top->data) > 0)
 	    {
+	      /* Short or pushed segments usually end what the peer had to
+		 send, so don't keep it waiting for their ACK.  */
+	      if ((grub_be_to_cpu16 (tcph->flags) & TCP_PUSH)
+		  || nb_top->tail - nb_top->data < sock->mss)
+		ack_now = 1;
 	      grub_net_put_packet (&sock->packs, nb_top);
+	      sock->ack_delayed++;
 	      do_ack = 1;
 	    }
 	  else
 	    grub_netbuff_free (nb_top);
 	}
       if (do_ack)
-	ack (sock);
+	{
+	  if (ack_now || sock->ack_delayed >= TCP_DELAYED_ACK_SEGMENTS)
+	    ack (sock);
+	  else
+	    sock->ack_deadline = grub_get_time_ms () + TCP_DELAYED_ACK_TIMEOUT;
+	}
       while (sock->packs.first)
 	{
 	  nb = sock->packs.first->nb;
@@ -979,7 +1168,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	tcp_init_window (sock);
+	sock->window_scaling = 1;
+	if (!tcp_syn_has_window_scale (nb))
+	  tcp_disable_window_scaling (sock);
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
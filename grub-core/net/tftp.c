@@ -42,6 +42,13 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    /* Largest block size allowed by RFC 2348.  */
+    TFTP_MAX_BLKSIZE = 65464,
+    TFTP_HEADER_SIZE = 4,
+    /* Number of blocks the server may send before waiting for an ACK
+       (RFC 7440).  Kept well below the 50 packets we queue before
+       stalling the transfer.  */
+    TFTP_WINDOWSIZE = 16
   };
 
 enum
@@ -102,7 +109,13 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
   grub_uint64_t ack_sent;
+  /* Block last acknowledged in answer to a retransmitted or out of order
+     packet, and the number of the packet which triggered it, so that a
+     resent window triggers one ACK each time it is resent.  */
+  grub_uint64_t dup_ack;
+  grub_uint16_t dup_recv;
   int have_oack;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
@@ -169,6 +182,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   tftp_data_t data = file->data;
   grub_err_t err;
   grub_uint8_t *ptr;
+  grub_uint16_t recv_block;
 
   if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
     {
@@ -181,6 +195,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
     {
     case TFTP_OACK:
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->window_size = 1;
       data->have_oack = 1; 
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
@@ -190,11 +205,18 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    data->window_size = grub_strtoul ((char *) ptr
+					      + sizeof ("windowsize\0") - 1,
+					      0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->window_size == 0)
+	data->window_size = 1;
       data->block = 0;
+      data->dup_ack = -1;
       grub_netbuff_free (nb);
       err = ack (data, 0);
       grub_error_save (&data->save_err);
@@ -207,6 +229,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
+      recv_block = grub_be_to_cpu16 (tftph->u.data.block);
       err = grub_priority_queue_push (data->pq, &nb);
       if (err)
 	return err;
@@ -222,17 +245,44 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    tftph = (struct tftphdr *) nb_top->data;
 	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
 	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
+	    /* Already received.  Either our ACK got lost or the server
+	       timed out; tell it where to continue, once per window.  The
+	       packet which triggered the last such ACK coming again means
+	       the window is being resent once more, so that ACK was lost
+	       too.  */
+	    if (data->window_size == 1 || data->dup_ack != data->block
+		|| data->dup_recv == grub_be_to_cpu16 (tftph->u.data.block))
+	      {
+		ack (data, data->block);
+		data->dup_ack = data->block;
+		data->dup_recv = grub_be_to_cpu16 (tftph->u.data.block);
+	      }
 	    grub_netbuff_free (nb_top);
 	    grub_priority_queue_pop (data->pq);
 	  }
+	/* A block is missing but the one ending the window has arrived: ask
+	   for a retransmission now instead of waiting for the server to time
+	   out.  */
+	if (data->window_size > 1
+	    && cmp_block (grub_be_to_cpu16 (tftph->u.data.block),
+			  data->block + 1) > 0
+	    && cmp_block (recv_block, data->ack_sent + data->window_size) >= 0
+	    && (data->dup_ack != data->block || data->dup_recv == recv_block))
+	  {
+	    ack (data, data->block);
+	    data->dup_ack = data->block;
+	    data->dup_recv = recv_block;
+	  }
 	while (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) == 0)
 	  {
 	    unsigned size;
 
 	    grub_priority_queue_pop (data->pq);
 
-	    if (file->device->net->packs.count < 50)
+	    /* ACK only the last block of each window.  */
+	    if (data->block + 1 - data->ack_sent < data->window_size)
+	      err = 0;
+	    else if (file->device->net->packs.count < 50)
 	      err = ack (data, data->block + 1);
 	    else
 	      {
@@ -300,6 +350,35 @@ destroy_pq (tftp_data_t data)
   grub_priority_queue_destroy (data->pq);
 }
 
+/* Largest block which fits in one frame on the interface ADDR is reached
+   through, so that data packets never need IP fragmentation.  */
+static unsigned
+tftp_blksize (grub_net_network_level_address_t addr)
+{
+  struct grub_net_network_level_interface *inf;
+  grub_net_network_level_address_t gateway;
+  grub_size_t hdr, size;
+
+  if (grub_net_route_address (addr, &gateway, &inf) || !inf->card->mtu)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1024;
+    }
+
+  if (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6)
+    hdr = GRUB_NET_OUR_IPV6_HEADER_SIZE;
+  else
+    hdr = GRUB_NET_OUR_IPV4_HEADER_SIZE;
+  hdr += GRUB_NET_UDP_HEADER_SIZE + TFTP_HEADER_SIZE;
+
+  if (inf->card->mtu < hdr + TFTP_DEFAULTSIZE_PACKET)
+    return TFTP_DEFAULTSIZE_PACKET;
+  size = inf->card->mtu - hdr;
+  if (size > TFTP_MAX_BLKSIZE)
+    size = TFTP_MAX_BLKSIZE;
+  return size;
+}
+
 static grub_err_t
 tftp_open (struct grub_file *file, const char *filename)
 {
@@ -315,11 +394,28 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_uint8_t *nbd;
   grub_net_network_level_address_t addr;
   int port = file->device->net->port;
+  char blksize[sizeof ("65464")];
+  char windowsize[sizeof ("65535")];
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
 
+  /* What a server which ignores our options uses.  */
+  data->block_size = TFTP_DEFAULTSIZE_PACKET;
+  data->window_size = 1;
+  data->dup_ack = -1;
+
+  err = grub_net_resolve_address (file->device->net->server, &addr);
+  if (err)
+    {
+      grub_free (data);
+      return err;
+    }
+
+  grub_snprintf (blksize, sizeof (blksize), "%u", tftp_blksize (addr));
+  grub_snprintf (windowsize, sizeof (windowsize), "%u", TFTP_WINDOWSIZE);
+
   nb.head = open_data;
   nb.end = open_data + sizeof (open_data);
   grub_netbuff_clear (&nb);
@@ -350,9 +446,17 @@ tftp_open (struct grub_file *file, const char *filename)
   rrqlen += grub_strlen ("blksize") + 1;
   rrq += grub_strlen ("blksize") + 1;
 
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
+  grub_strcpy (rrq, blksize);
+  rrqlen += grub_strlen (blksize) + 1;
+  rrq += grub_strlen (blksize) + 1;
+
+  grub_strcpy (rrq, "windowsize");
+  rrqlen += grub_strlen ("windowsize") + 1;
+  rrq += grub_strlen ("windowsize") + 1;
+
+  grub_strcpy (rrq, windowsize);
+  rrqlen += grub_strlen (windowsize) + 1;
+  rrq += grub_strlen (windowsize) + 1;
 
   grub_strcpy (rrq, "tsize");
   rrqlen += grub_strlen ("tsize") + 1;
@@ -380,17 +484,6 @@ tftp_open (struct grub_file *file, const char *filename)
       return grub_errno;
     }
 
-  err = grub_net_resolve_address (file->device->net->server, &addr);
-  if (err)
-    {
-      grub_dprintf ("tftp", "file_size is %llu, block_size is %llu\n",
-		    (unsigned long long)data->file_size,
-		    (unsigned long long)data->block_size);
-      destroy_pq (data);
-      grub_free (data);
-      return err;
-    }
-
   data->sock = grub_net_udp_open (addr,
 				  port ? port : TFTP_SERVER_PORT, tftp_receive,
 				  file);
@@ -433,6 +526,10 @@ tftp_open (struct grub_file *file, const char *filename)
     }
 
   file->size = data->file_size;
+  grub_dprintf ("tftp", "file_size is %llu, block_size is %u,"
+		" window_size is %u\n",
+		(unsigned long long) data->file_size,
+		data->block_size, data->window_size);
 
   return GRUB_ERR_NONE;
 }
@@ -484,7 +581,9 @@ tftp_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data->ack_sent >= data->block)
+  /* Only a window held back by the stall above is still unacknowledged
+     here; a partial one is ACKed when its last block arrives.  */
+  if (data->block - data->ack_sent < data->window_size)
     return 0;
   return ack (data, data->block);
 }
@@ -33,6 +33,7 @@
 #include <grub/charset.h>
 #include <grub/script_sh.h>
 #include <grub/bufio.h>
+#include <grub/disk.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -475,6 +476,38 @@ grub_env_write_pager (struct grub_env_var *var __attribute__ ((unused)),
   return grub_strdup (val);
 }
 
+/* The size of the disk cache in KiB, rounded down to a whole set.  */
+static char *
+grub_env_write_disk_cache_size (struct grub_env_var *var
+				__attribute__ ((unused)),
+				const char *val)
+{
+  unsigned long size, sets;
+  char *end;
+
+  if (! *val)
+    {
+      grub_disk_cache_resize (GRUB_DISK_CACHE_AUTO);
+      return grub_strdup (val);
+    }
+
+  size = grub_strtoul (val, &end, 0);
+  if (grub_errno != GRUB_ERR_NONE)
+    return NULL;
+  if (*end)
+    {
+      grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+      return NULL;
+    }
+
+  sets = size / ((GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS) / 1024
+		 * GRUB_DISK_CACHE_WAYS);
+  if (sets > GRUB_DISK_CACHE_MAX_SETS)
+    sets = GRUB_DISK_CACHE_MAX_SETS;
+  grub_disk_cache_resize (sets);
+  return grub_strdup (val);
+}
+
 /* clear */
 static grub_err_t
 grub_mini_cmd_clear (struct grub_command *cmd __attribute__ ((unused)),
@@ -526,6 +559,10 @@ GRUB_MOD_INIT(normal)
   grub_register_variable_hook ("pager", 0, grub_env_write_pager);
   grub_env_export ("pager");
 
+  grub_register_variable_hook ("disk_cache_size", 0,
+			       grub_env_write_disk_cache_size);
+  grub_env_export ("disk_cache_size");
+
   /* Register a command "normal" for the rescue mode.  */
   grub_register_command ("normal", grub_cmd_normal,
 			 0, N_("Enter normal mode."));
@@ -571,6 +608,7 @@ GRUB_MOD_FINI(normal)
 
   grub_set_history (0);
   grub_register_variable_hook ("pager", 0, 0);
+  grub_register_variable_hook ("disk_cache_size", 0, 0);
   grub_fs_autoload_hook = 0;
   grub_unregister_command (cmd_clear);
 }
@@ -0,0 +1,117 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/zfs/zfs.h>
+#include <grub/zfs/spa.h>
+#include <grub/zfs/zio_checksum.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define BUF_SIZE (8192 + 128)
+
+/* Sizes around the block and lane boundaries of the implementations.  */
+static grub_uint64_t sizes[] = {
+  0, 4, 12, 16, 20, 52, 56, 60, 64, 68, 100, 128, 512, 4096, 8192, 8252
+};
+
+/* The SHA-256 digest of "abc".  */
+static const grub_uint64_t sha256_abc[4] = {
+  0xba7816bf8f01cfeaULL, 0x414140de5dae2223ULL,
+  0xb00361a396177a9cULL, 0xb410ff61f20015adULL
+};
+
+static void
+test_impls (const char *what, const zio_checksum_impl_t *impls,
+	    const grub_uint8_t *buf)
+{
+  const zio_checksum_impl_t *impl;
+  grub_size_t i, off;
+  int e;
+
+  for (impl = impls + 1; impl->ci_name; impl++)
+    {
+      if (impl->ci_available && !impl->ci_available ())
+	continue;
+      for (e = 0; e < 2; e++)
+	for (off = 0; off <= 4; off += 4)
+	  for (i = 0; i < ARRAY_SIZE (sizes); i++)
+	    {
+	      grub_zfs_endian_t endian = e ? GRUB_ZFS_BIG_ENDIAN
+		: GRUB_ZFS_LITTLE_ENDIAN;
+	      zio_cksum_t expected, actual;
+
+	      impls->ci_func (buf + off, sizes[i], endian, &expected);
+	      impl->ci_func (buf + off, sizes[i], endian, &actual);
+	      grub_test_assert (grub_memcmp (&expected, &actual,
+					     sizeof (expected)) == 0,
+				"%s %s mismatch: size %llu offset %d endian %d",
+				what, impl->ci_name,
+				(unsigned long long) sizes[i], (int) off, e);
+	    }
+    }
+}
+
+static void
+zfs_checksum_test (void)
+{
+  const zio_checksum_impl_t *impl;
+  grub_uint8_t *buf;
+  grub_uint32_t x = 404;
+  grub_size_t i;
+
+  for (impl = zio_checksum_SHA256_impls; impl->ci_name; impl++)
+    {
+      zio_cksum_t zc;
+
+      if (impl->ci_available && !impl->ci_available ())
+	continue;
+      impl->ci_func ("abc", 3, GRUB_ZFS_BIG_ENDIAN, &zc);
+      for (i = 0; i < 4; i++)
+	grub_test_assert (zc.zc_word[i]
+			  == grub_cpu_to_zfs64 (sha256_abc[i],
+						GRUB_ZFS_BIG_ENDIAN),
+			  "SHA256 %s digest of \"abc\" is wrong",
+			  impl->ci_name);
+    }
+
+  buf = grub_malloc (BUF_SIZE);
+  grub_test_assert (buf != NULL, "couldn't allocate the buffer");
+  if (!buf)
+    return;
+
+  /* Random data, and all ones to overflow the sums as early as possible.  */
+  for (i = 0; i < BUF_SIZE; i++)
+    {
+      x = x * 1103515245 + 12345;
+      buf[i] = x >> 24;
+    }
+  test_impls ("fletcher4", fletcher_4_impls, buf);
+  test_impls ("SHA256", zio_checksum_SHA256_impls, buf);
+
+  grub_memset (buf, 0xff, BUF_SIZE);
+  test_impls ("fletcher4", fletcher_4_impls, buf);
+
+  grub_free (buf);
+}
+
+/* Register zfs_checksum_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (zfs_checksum_test, zfs_checksum_test);
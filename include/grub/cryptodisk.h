@@ -54,6 +54,18 @@ typedef enum
 #define GRUB_CRYPTODISK_GF_BYTES (1U << GRUB_CRYPTODISK_GF_LOG_BYTES)
 #define GRUB_CRYPTODISK_MAX_KEYLEN 128
 
+#define GRUB_CRYPTODISK_AES_MAX_ROUNDS 14
+
+/* Round keys for doing AES with the instructions of the CPU.  */
+struct grub_cryptodisk_aes
+{
+  grub_uint8_t enc[GRUB_CRYPTODISK_AES_MAX_ROUNDS + 1][16];
+  grub_uint8_t dec[GRUB_CRYPTODISK_AES_MAX_ROUNDS + 1][16];
+  /* The second key of XTS.  */
+  grub_uint8_t tweak[GRUB_CRYPTODISK_AES_MAX_ROUNDS + 1][16];
+  unsigned rounds;
+};
+
 struct grub_cryptodisk;
 
 typedef gcry_err_code_t
@@ -98,6 +110,9 @@ struct grub_cryptodisk
   grub_uint64_t last_rekey;
   int rekey_derived_size;
   grub_disk_addr_t partition_start;
+  /* Set if the CPU does AES for this disk, with the keys in aes.  */
+  int aes_hw;
+  struct grub_cryptodisk_aes aes;
 };
 typedef struct grub_cryptodisk *grub_cryptodisk_t;
 
@@ -140,6 +155,23 @@ grub_cryptodisk_decrypt (struct grub_cryptodisk *dev,
 grub_err_t
 grub_cryptodisk_insert (grub_cryptodisk_t newdev, const char *name,
 			grub_disk_t source);
+
+/* Return 1 if the CPU can do AES with a key of KEYSIZE bytes, after
+   setting up AES.  TWEAK_KEY is the second key of XTS, of the same size,
+   or NULL.  */
+int
+grub_cryptodisk_aes_setkey (struct grub_cryptodisk_aes *aes,
+			    const grub_uint8_t *key, grub_size_t keysize,
+			    const grub_uint8_t *tweak_key);
+/* En- or decrypt a sector of LEN bytes in place.  */
+void
+grub_cryptodisk_aes_xts (const struct grub_cryptodisk_aes *aes,
+			 grub_uint8_t *data, grub_size_t len,
+			 const grub_uint8_t *iv, int do_encrypt);
+void
+grub_cryptodisk_aes_cbc (const struct grub_cryptodisk_aes *aes,
+			 grub_uint8_t *data, grub_size_t len,
+			 const grub_uint8_t *iv, int do_encrypt);
 #ifdef GRUB_UTIL
 grub_err_t
 grub_cryptodisk_cheat_insert (grub_cryptodisk_t newdev, const char *name,
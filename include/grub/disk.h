@@ -129,6 +129,13 @@ struct grub_disk
   /* Maximum number of sectors read divided by GRUB_DISK_CACHE_SIZE.  */
   unsigned int max_agglomerate;
 
+  /* The sector following the last read, to detect sequential reads.  */
+  grub_disk_addr_t read_ahead_next;
+
+  /* Number of cache units read ahead on a cache miss, grows while the
+     reads stay sequential.  */
+  unsigned int read_ahead;
+
   /* The id used by the disk cache manager.  */
   unsigned long id;
 
@@ -160,8 +167,21 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The number of entries in each set of the disk cache.  */
+#define GRUB_DISK_CACHE_WAYS	4
+
+/* The most sets the disk cache gets unless asked for more, 32MiB.  */
+#define GRUB_DISK_CACHE_DEFAULT_SETS	256
+
+/* The most sets the disk cache may have at all, 1GiB.  */
+#define GRUB_DISK_CACHE_MAX_SETS	8192
+
+/* Unless its size was set, the disk cache takes at most this share of
+   the free heap.  */
+#define GRUB_DISK_CACHE_HEAP_SHARE	8
+
+/* Size the disk cache from the free heap.  */
+#define GRUB_DISK_CACHE_AUTO		((unsigned) -1)
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
@@ -170,12 +190,33 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
+/* The maximum read-ahead of sequential reads in cache units, 1MiB.  */
+#define GRUB_DISK_MAX_READ_AHEAD (1 << (20 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS))
+
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
-/* This is called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
 
+/* This is called from the memory manager.  */
+void grub_disk_cache_release (void);
+
+/* A cache of data decoded from disks, which gives its memory back along
+   with the disk cache when the heap runs out.  RELEASE must not
+   allocate.  */
+struct grub_disk_cache_hook
+{
+  struct grub_disk_cache_hook *next;
+  void (*release) (void);
+};
+
+void EXPORT_FUNC(grub_disk_cache_hook_register) (struct grub_disk_cache_hook *hook);
+void EXPORT_FUNC(grub_disk_cache_hook_unregister) (struct grub_disk_cache_hook *hook);
+
+/* Set the number of sets of the disk cache, at most GRUB_DISK_CACHE_MAX_SETS,
+   or GRUB_DISK_CACHE_AUTO. Takes effect lazily.  */
+void EXPORT_FUNC(grub_disk_cache_resize) (unsigned sets);
+
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
 static inline int
@@ -215,7 +256,8 @@ grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 
 #if DISK_CACHE_STATS
 void
-EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
+EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses,
+					      unsigned long *evictions);
 #endif
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
@@ -233,7 +275,8 @@ grub_stop_disk_firmware (void)
     }
 }
 
-/* Disk cache.  */
+/* Disk cache. The entries and their data live in a single slab which is
+   allocated on first use, sets are GRUB_DISK_CACHE_WAYS entries wide.  */
 struct grub_disk_cache
 {
   enum grub_disk_dev_id dev_id;
@@ -241,9 +284,11 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  grub_uint32_t last_use;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_sets);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
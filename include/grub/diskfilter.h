@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/list.h>
+#include <grub/mirror.h>
 
 enum
   {
@@ -72,6 +73,8 @@ struct grub_diskfilter_pv {
   struct grub_diskfilter_pv *next;
   /* Optional.  */
   grub_uint8_t *internal_id;
+  /* Speed of reads from mirrored segments.  */
+  struct grub_mirror_stats stats;
 #ifdef GRUB_UTIL
   char **partmaps;
 #endif
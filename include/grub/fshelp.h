@@ -73,6 +73,41 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Filesystems whose lookups can be cached describe their nodes with
+   this.  A cached node is a copy of the bytes of the node the lookup
+   returned, so it must not own any memory.  */
+struct grub_fshelp_node_desc
+{
+  const char *name;
+  /* Size of NODE in bytes.  */
+  grub_size_t (*node_size) (grub_fshelp_node_t node);
+  /* Make NODE, a copy taken from the cache, refer to the filesystem
+     mounted as MOUNT.  */
+  void (*attach) (grub_fshelp_node_t node, void *mount);
+};
+
+/* Like grub_fshelp_find_file or, if ITERATE_DIR is NULL,
+   grub_fshelp_find_file_lookup, but the result of looking up each path
+   component is kept across mounts of the filesystem on DISK.  DESC
+   describes its nodes and MOUNT is passed to DESC->attach for nodes
+   taken from the cache.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+								      const char *name,
+								      grub_fshelp_node_t *foundnode,
+								      enum grub_fshelp_filetype *foundtype),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_node_desc *desc,
+					   void *mount);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +123,20 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Like grub_fshelp_read_file, but GET_EXTENT maps a whole run of blocks
+   at once.  It returns the disk block the block BLOCK of NODE is stored
+   in, or 0 if that block isn't stored on disk, and sets COUNT to the
+   number of blocks starting with BLOCK which follow each other on disk,
+   or which aren't stored either.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extent) (grub_disk_t disk, grub_fshelp_node_t node,
+					   grub_disk_read_hook_t read_hook,
+					   void *read_hook_data,
+					   grub_off_t pos, grub_size_t len, char *buf,
+					   grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+									   grub_disk_addr_t block,
+									   grub_disk_addr_t *count),
+					   grub_off_t filesize, int log2blocksize,
+					   grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
@@ -0,0 +1,39 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_LZ4_HEADER
+#define GRUB_LZ4_HEADER 1
+
+#include <grub/types.h>
+
+/* Decompress the LZ4 block SRC of SRCLEN bytes into DST, which has room
+   for DSTLEN bytes.  Matches may reach back PREFIX bytes before DST, into
+   the output of earlier blocks of the same stream.  Return the size of
+   the output, or -1 if the block is corrupted or doesn't fit.  */
+grub_ssize_t
+grub_lz4_decompress (const char *src, grub_size_t srclen, char *dst,
+		     grub_size_t dstlen, grub_size_t prefix);
+
+/* Return the size the LZ4 block SRC of SRCLEN bytes decompresses to,
+   without decompressing it, or -1 if it is corrupted or exceeds
+   DSTLEN.  */
+grub_ssize_t
+grub_lz4_decompressed_size (const char *src, grub_size_t srclen,
+			    grub_size_t dstlen);
+
+#endif
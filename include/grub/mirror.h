@@ -0,0 +1,105 @@
+/* mirror.h - choosing which copy of mirrored data to read */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MIRROR_H
+#define GRUB_MIRROR_H	1
+
+#include <grub/types.h>
+#include <grub/time.h>
+
+/* Sectors read from a device before its speed is trusted.  Until then
+   the least measured copy is read first, so that all get measured.  */
+#define GRUB_MIRROR_SAMPLE_SECTORS	4096
+
+/* Milliseconds a device is read last after failing.  Each further error
+   doubles this, up to GRUB_MIRROR_MAX_ERRORS times.  */
+#define GRUB_MIRROR_ERROR_HOLDOFF	5000
+#define GRUB_MIRROR_MAX_ERRORS		6
+
+/* How fast reads from one device have been.  The totals are halved now
+   and then, so recent reads weigh more.  */
+struct grub_mirror_stats
+{
+  grub_uint64_t sectors;
+  grub_uint64_t ms;
+  /* Recent errors, halved by every read which succeeds.  */
+  unsigned errors;
+  /* Time until which the device is read last.  */
+  grub_uint64_t failed_until;
+};
+
+/* Statistics of a device which can't be read at all.  */
+#define GRUB_MIRROR_STATS_MISSING { .errors = 1, .failed_until = ~0ULL }
+
+/* Record a read of SECTORS sectors which took MS milliseconds, or
+   failed.  */
+static inline void
+grub_mirror_account (struct grub_mirror_stats *stats, grub_uint64_t sectors,
+		     grub_uint64_t ms, int failed)
+{
+  if (failed)
+    {
+      if (stats->errors < GRUB_MIRROR_MAX_ERRORS)
+	stats->errors++;
+      stats->failed_until = grub_get_time_ms ()
+	+ (GRUB_MIRROR_ERROR_HOLDOFF << (stats->errors - 1));
+      return;
+    }
+  stats->errors >>= 1;
+  stats->sectors += sectors;
+  stats->ms += ms;
+  if (stats->sectors > (1ULL << 30))
+    {
+      stats->sectors >>= 1;
+      stats->ms >>= 1;
+    }
+}
+
+/* Whether the copy on the device of A should be read before that on the
+   device of B.  Either may be NULL if its device isn't known yet.  */
+static inline int
+grub_mirror_prefer (const struct grub_mirror_stats *a,
+		    const struct grub_mirror_stats *b)
+{
+  static const struct grub_mirror_stats unknown;
+  int a_failed, b_failed;
+  grub_uint64_t now;
+
+  if (!a)
+    a = &unknown;
+  if (!b)
+    b = &unknown;
+
+  /* Devices which failed lately come last.  */
+  now = grub_get_time_ms ();
+  a_failed = a->failed_until > now;
+  b_failed = b->failed_until > now;
+  if (a_failed != b_failed)
+    return !a_failed;
+
+  if (a->sectors < GRUB_MIRROR_SAMPLE_SECTORS
+      || b->sectors < GRUB_MIRROR_SAMPLE_SECTORS)
+    return a->sectors < b->sectors;
+
+  /* Compare sectors per millisecond.  The times are coarse but add up
+     over many reads.  */
+  return a->sectors * (b->ms + 1) > b->sectors * (a->ms + 1);
+}
+
+#endif /* ! GRUB_MIRROR_H */
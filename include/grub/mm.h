@@ -37,16 +37,37 @@ void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
 #endif
 
+/* The number of bytes which could still be allocated, not necessarily in
+   one piece.  GRUB_SIZE_MAX when the host allocates the memory.  */
+grub_size_t EXPORT_FUNC(grub_mm_free_bytes) (void);
+
 void grub_mm_check_real (const char *file, int line);
 #define grub_mm_check() grub_mm_check_real (GRUB_FILE, __LINE__);
 
 /* For debugging.  */
-#if defined(MM_DEBUG) && !defined(GRUB_UTIL) && !defined (GRUB_MACHINE_EMU)
+#if defined(MM_DEBUG) && !defined(GRUB_UTIL)
 /* Set this variable to 1 when you want to trace all memory function calls.  */
 extern int EXPORT_VAR(grub_mm_debug);
 
+#ifndef GRUB_MACHINE_EMU
 void grub_mm_dump_free (void);
 void grub_mm_dump (unsigned lineno);
+#endif
+
+/* Heap usage of the allocations made at one place in the source.  */
+struct grub_mm_site
+{
+  char file[48];
+  int line;
+  grub_size_t live;
+  grub_size_t peak;
+  unsigned long allocs;
+  unsigned long frees;
+};
+
+typedef int (*grub_mm_site_hook_t) (const struct grub_mm_site *site,
+				    void *data);
+int EXPORT_FUNC(grub_mm_site_iterate) (grub_mm_site_hook_t hook, void *data);
 
 #define grub_malloc(size)	\
   grub_debug_malloc (GRUB_FILE, __LINE__, size)
@@ -57,8 +78,10 @@ void grub_mm_dump (unsigned lineno);
 #define grub_realloc(ptr,size)	\
   grub_debug_realloc (GRUB_FILE, __LINE__, ptr, size)
 
+#ifndef GRUB_MACHINE_EMU
 #define grub_memalign(align,size)	\
   grub_debug_memalign (GRUB_FILE, __LINE__, align, size)
+#endif
 
 #define grub_free(ptr)	\
   grub_debug_free (GRUB_FILE, __LINE__, ptr)
@@ -70,8 +93,10 @@ void *EXPORT_FUNC(grub_debug_zalloc) (const char *file, int line,
 void EXPORT_FUNC(grub_debug_free) (const char *file, int line, void *ptr);
 void *EXPORT_FUNC(grub_debug_realloc) (const char *file, int line, void *ptr,
 				       grub_size_t size);
+#ifndef GRUB_MACHINE_EMU
 void *EXPORT_FUNC(grub_debug_memalign) (const char *file, int line,
 					grub_size_t align, grub_size_t size);
+#endif
 #endif /* MM_DEBUG && ! GRUB_UTIL */
 
 #endif /* ! GRUB_MM_H */
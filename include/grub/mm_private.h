@@ -24,6 +24,7 @@
 /* Magic words.  */
 #define GRUB_MM_FREE_MAGIC	0x2d3c2808
 #define GRUB_MM_ALLOC_MAGIC	0x6db08fa4
+#define GRUB_MM_BIN_MAGIC	0x4b1c7e35
 
 typedef struct grub_mm_header
 {
@@ -48,6 +49,11 @@ typedef struct grub_mm_header
 
 #define GRUB_MM_ALIGN	(1 << GRUB_MM_ALIGN_LOG2)
 
+/* Freed blocks of up to GRUB_MM_NBINS cells are kept in per-size bins,
+   holding at most GRUB_MM_BIN_LIMIT bytes in total.  */
+#define GRUB_MM_NBINS		32
+#define GRUB_MM_BIN_LIMIT	0x40000
+
 typedef struct grub_mm_region
 {
   struct grub_mm_header *first;
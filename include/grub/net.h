@@ -591,6 +591,9 @@ void grub_bootp_fini (void);
 void grub_dns_init (void);
 void grub_dns_fini (void);
 
+void
+grub_net_tcp_drop_interface (struct grub_net_network_level_interface *inter);
+
 static inline void
 grub_net_network_level_interface_unregister (struct grub_net_network_level_interface *inter)
 {
@@ -600,6 +603,7 @@ grub_net_network_level_interface_unregister (struct grub_net_network_level_inter
     inter->next->prev = inter->prev;
   inter->next = 0;
   inter->prev = 0;
+  grub_net_tcp_drop_interface (inter);
 }
 
 void
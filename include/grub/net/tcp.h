@@ -82,4 +82,7 @@ grub_net_tcp_stall (grub_net_tcp_socket_t sock);
 void
 grub_net_tcp_unstall (grub_net_tcp_socket_t sock);
 
+struct grub_net_network_level_interface *
+grub_net_tcp_socket_interface (grub_net_tcp_socket_t sock);
+
 #endif
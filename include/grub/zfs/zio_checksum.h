@@ -23,6 +23,23 @@
 #ifndef _SYS_ZIO_CHECKSUM_H
 #define	_SYS_ZIO_CHECKSUM_H
 
+/*
+ * Signature for checksum functions.
+ */
+typedef void zio_checksum_t(const void *data, grub_uint64_t size,
+			    grub_zfs_endian_t endian, zio_cksum_t *zcp);
+
+/*
+ * One implementation of a checksum.  Lists of them end with a NULL name,
+ * start with the portable one and go from slower to faster, so that the
+ * last one the CPU supports is used.
+ */
+typedef struct zio_checksum_impl {
+  const char	*ci_name;
+  int		(*ci_available) (void);	/* NULL if always available */
+  zio_checksum_t	*ci_func;
+} zio_checksum_impl_t;
+
 extern void zio_checksum_SHA256 (const void *, grub_uint64_t,
 				 grub_zfs_endian_t endian, zio_cksum_t *);
 extern void fletcher_2 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
@@ -30,4 +47,105 @@ extern void fletcher_2 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 extern void fletcher_4 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 			zio_cksum_t *);
 
+extern const zio_checksum_impl_t zio_checksum_SHA256_impls[];
+extern const zio_checksum_impl_t fletcher_4_impls[];
+
+static inline zio_checksum_t *
+zio_checksum_impl_select (const zio_checksum_impl_t *impls)
+{
+  zio_checksum_t *func = impls->ci_func;
+
+  for (; impls->ci_name; impls++)
+    if (!impls->ci_available || impls->ci_available ())
+      func = impls->ci_func;
+  return func;
+}
+
+/*
+ * CPU features the checksum implementations need.  The vector registers
+ * are left alone by the compiler when it is told not to use them, and
+ * must not be named as clobbered then.
+ */
+#define	ZFS_CPU_SSSE3	(1 << 0)
+#define	ZFS_CPU_SSE4_1	(1 << 1)
+#define	ZFS_CPU_AVX2	(1 << 2)
+#define	ZFS_CPU_SHA	(1 << 3)
+#define	ZFS_CPU_NEON	(1 << 4)
+#define	ZFS_CPU_SHA2	(1 << 5)
+
+#if defined (__x86_64__)
+
+#ifdef __SSE__
+#define	ZFS_VECTOR_CLOBBERS "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", \
+	"xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12",	\
+	"xmm13", "xmm14", "xmm15",
+#else
+#define	ZFS_VECTOR_CLOBBERS
+#endif
+
+/* Unlike grub_cpuid this sets the subleaf, and keeps all of %rbx.  */
+static inline void
+zfs_cpuid (grub_uint32_t leaf, grub_uint32_t *a, grub_uint32_t *b,
+	   grub_uint32_t *c, grub_uint32_t *d)
+{
+  asm volatile ("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d)
+		: "0" (leaf), "2" (0));
+}
+
+static inline unsigned
+zfs_cpu_features (void)
+{
+  grub_uint32_t max, a, b, c, d, ecx1, xcr0_lo, xcr0_hi;
+  unsigned features = 0;
+
+  zfs_cpuid (0, &max, &b, &c, &d);
+  zfs_cpuid (1, &a, &b, &ecx1, &d);
+  if (ecx1 & (1 << 9))
+    features |= ZFS_CPU_SSSE3;
+  if (ecx1 & (1 << 19))
+    features |= ZFS_CPU_SSE4_1;
+  if (max < 7)
+    return features;
+
+  zfs_cpuid (7, &a, &b, &c, &d);
+  if (b & (1 << 29))
+    features |= ZFS_CPU_SHA;
+
+  /* AVX state must have been enabled by whoever set up the CPU.  */
+  if ((b & (1 << 5)) && (ecx1 & (1 << 27)) && (ecx1 & (1 << 28)))
+    {
+      asm volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+      if ((xcr0_lo & 6) == 6)
+	features |= ZFS_CPU_AVX2;
+    }
+  return features;
+}
+
+#elif defined (__aarch64__) && !defined (GRUB_MACHINE_EMU) \
+  && !defined (GRUB_UTIL)
+
+#ifdef __ARM_NEON
+#define	ZFS_VECTOR_CLOBBERS "v0", "v1", "v2", "v3", "v4", "v5", "v6",	\
+	"v7", "v16", "v17", "v18", "v20", "v21", "v22", "v23",
+#else
+#define	ZFS_VECTOR_CLOBBERS
+#endif
+
+static inline unsigned
+zfs_cpu_features (void)
+{
+  grub_uint64_t pfr0, isar0;
+  unsigned features = 0;
+
+  asm volatile ("mrs %0, id_aa64pfr0_el1" : "=r" (pfr0));
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  if (((pfr0 >> 20) & 0xf) != 0xf)
+    features |= ZFS_CPU_NEON;
+  if ((features & ZFS_CPU_NEON) && ((isar0 >> 12) & 0xf) >= 1)
+    features |= ZFS_CPU_SHA2;
+  return features;
+}
+
+#endif
+
 #endif	/* _SYS_ZIO_CHECKSUM_H */
@@ -0,0 +1,68 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_ZSTD_HEADER
+#define GRUB_ZSTD_HEADER 1
+
+#include <grub/types.h>
+#include <grub/err.h>
+
+/* Content size of a frame which doesn't record it.  */
+#define GRUB_ZSTD_SIZE_UNKNOWN	((grub_uint64_t) -1)
+
+/* Read LEN bytes of compressed input into BUF, or skip them if BUF is
+   NULL.  Return the number of bytes read or skipped, which is less than
+   LEN only at the end of the input, or -1 on error.  */
+typedef grub_ssize_t (*grub_zstd_read_t) (void *data, void *buf,
+					  grub_size_t len);
+
+struct grub_zstd_dec;
+
+/* Create a decoder reading its input through READ.  */
+struct grub_zstd_dec *
+grub_zstd_dec_init (grub_zstd_read_t read, void *read_data);
+
+/* Forget all state, so that decoding starts again with a new frame at
+   the position READ is at.  */
+void
+grub_zstd_dec_reset (struct grub_zstd_dec *dec);
+
+/* Decompress up to LEN bytes into BUF, or skip them if BUF is NULL.
+   Return the number of bytes, which is less than LEN only at the end of
+   the input, or -1 on error.  */
+grub_ssize_t
+grub_zstd_dec_read (struct grub_zstd_dec *dec, char *buf, grub_size_t len);
+
+void
+grub_zstd_dec_end (struct grub_zstd_dec *dec);
+
+/* Skip the next frame from READ without decompressing it.  Set COMPRESSED
+   to its size in the input, which is 0 at the end of the input, and
+   CONTENT to the size of its contents or GRUB_ZSTD_SIZE_UNKNOWN.  */
+grub_err_t
+grub_zstd_frame_info (grub_zstd_read_t read, void *read_data,
+		      grub_uint64_t *compressed, grub_uint64_t *content);
+
+/* Decompress the first frame in INBUF, skipping the first OFF bytes of
+   its contents, to at most OUTSIZE bytes in OUTBUF.  Anything after the
+   frame is ignored.  */
+grub_ssize_t
+grub_zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		      char *outbuf, grub_size_t outsize);
+
+#endif
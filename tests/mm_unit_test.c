@@ -0,0 +1,229 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2018 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The utilities allocate from the host, so build the heap allocator here
+   under other names and let it manage a private heap.  */
+#define grub_mm_base		test_mm_base
+#define grub_mm_init_region	test_mm_init_region
+#define grub_memalign		test_memalign
+#define grub_malloc		test_malloc
+#define grub_zalloc		test_zalloc
+#define grub_realloc		test_realloc
+#define grub_free		test_free
+#define grub_mm_free_bytes	test_mm_free_bytes
+#include "../grub-core/kern/mm.c"
+#undef grub_mm_base
+#undef grub_mm_init_region
+#undef grub_memalign
+#undef grub_malloc
+#undef grub_zalloc
+#undef grub_realloc
+#undef grub_free
+#undef grub_mm_free_bytes
+
+#include <grub/test.h>
+
+#define HEAP_SIZE	(64 * 1024)
+#define MAX_BLOCKS	(HEAP_SIZE / GRUB_MM_ALIGN)
+#define STRESS_ROUNDS	100000
+
+static char heap[HEAP_SIZE] __attribute__ ((aligned (GRUB_MM_ALIGN)));
+
+static struct
+{
+  grub_uint8_t *ptr;
+  grub_size_t size;
+} blocks[MAX_BLOCKS];
+
+static grub_uint32_t seed = 2018;
+
+static grub_uint32_t
+rnd (grub_uint32_t n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static void
+put (unsigned i, grub_uint8_t *ptr, grub_size_t size)
+{
+  blocks[i].ptr = ptr;
+  blocks[i].size = size;
+  if (ptr)
+    grub_memset (ptr, i, size);
+}
+
+/* Check that nobody wrote over the first SIZE bytes of block I.  */
+static void
+check (unsigned i, grub_size_t size)
+{
+  grub_size_t j;
+
+  for (j = 0; j < size; j++)
+    if (blocks[i].ptr[j] != (grub_uint8_t) i)
+      break;
+  grub_test_assert (j == size, "block %u of %u bytes overwritten",
+		    i, (unsigned) blocks[i].size);
+}
+
+static void
+drop (unsigned i)
+{
+  if (!blocks[i].ptr)
+    return;
+  check (i, blocks[i].size);
+  test_free (blocks[i].ptr);
+  blocks[i].ptr = NULL;
+}
+
+/* Allocate blocks of SIZE bytes until the heap is full.  */
+static unsigned
+fill (grub_size_t size)
+{
+  unsigned n;
+
+  for (n = 0; n < MAX_BLOCKS; n++)
+    {
+      put (n, test_malloc (size), size);
+      if (!blocks[n].ptr)
+	break;
+    }
+  grub_errno = GRUB_ERR_NONE;
+  return n;
+}
+
+static void
+drop_all (void)
+{
+  unsigned i;
+
+  for (i = 0; i < MAX_BLOCKS; i++)
+    drop (i);
+}
+
+/* The whole heap must be free again.  */
+static void
+check_empty (const char *what)
+{
+  void *p;
+
+  p = test_malloc (HEAP_SIZE - 2 * GRUB_MM_ALIGN
+		   - sizeof (struct grub_mm_region));
+  grub_errno = GRUB_ERR_NONE;
+  grub_test_assert (p != NULL, "heap didn't coalesce after %s", what);
+  test_free (p);
+}
+
+static void
+mm_test (void)
+{
+  grub_size_t free_bytes;
+  unsigned i, n;
+  void *p;
+
+  test_mm_init_region (heap, HEAP_SIZE);
+  check_empty ("init");
+  free_bytes = test_mm_free_bytes ();
+  grub_test_assert (free_bytes > HEAP_SIZE / 2 && free_bytes <= HEAP_SIZE,
+		    "%u bytes free in a heap of %u", (unsigned) free_bytes,
+		    HEAP_SIZE);
+
+  /* Fill the region with blocks small enough for the bins, so that its
+     first is left pointing to an allocated block, and free them in
+     either order into the bins.  Allocating anything else then has to
+     walk the ring of the full region.  */
+  for (i = 0; i < 4; i++)
+    {
+      grub_size_t size = i * 40;
+      unsigned j;
+
+      n = fill (size);
+      grub_test_assert (n > 0, "no block of %u bytes fits", (unsigned) size);
+      if (i & 1)
+	for (j = n; j > 0; j--)
+	  drop (j - 1);
+      else
+	drop_all ();
+
+      p = test_malloc (4096);
+      grub_errno = GRUB_ERR_NONE;
+      grub_test_assert (p != NULL,
+			"no room after freeing %u blocks of %u bytes",
+			n, (unsigned) size);
+      test_free (p);
+
+      n = fill (size);
+      grub_test_assert (n > 0, "no block of %u bytes fits again",
+			(unsigned) size);
+      drop_all ();
+      check_empty ("filling");
+    }
+
+  /* Random allocations, reallocations and frees of mixed sizes and
+     alignments, running out of memory now and then.  */
+  for (i = 0; i < STRESS_ROUNDS; i++)
+    {
+      unsigned j = rnd (MAX_BLOCKS / 8);
+      grub_size_t size;
+
+      if (blocks[j].ptr && rnd (4))
+	{
+	  drop (j);
+	  continue;
+	}
+
+      size = rnd (8) ? rnd (GRUB_MM_NBINS * GRUB_MM_ALIGN) : rnd (8192);
+      switch (rnd (4))
+	{
+	case 0:
+	  drop (j);
+	  put (j, test_memalign (GRUB_MM_ALIGN << rnd (4), size), size);
+	  break;
+	case 1:
+	  if (blocks[j].ptr)
+	    {
+	      grub_uint8_t *q;
+	      grub_size_t keep = size < blocks[j].size ? size : blocks[j].size;
+
+	      q = test_realloc (blocks[j].ptr, size ? : 1);
+	      if (q)
+		{
+		  blocks[j].ptr = q;
+		  check (j, keep);
+		  put (j, q, size);
+		}
+	      break;
+	    }
+	  /* Fallthrough.  */
+	default:
+	  drop (j);
+	  put (j, test_malloc (size), size);
+	  break;
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  drop_all ();
+  check_empty ("random allocations");
+  grub_test_assert (test_mm_free_bytes () == free_bytes,
+		    "%u bytes free after random allocations instead of %u",
+		    (unsigned) test_mm_free_bytes (), (unsigned) free_bytes);
+}
+
+/* Register mm_test method as a unit test.  */
+GRUB_UNIT_TEST ("mm_test", mm_test);